@@ -3,12 +3,275 @@
 //
 
 #include "Cube.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <random>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 
+/**
+ * @brief Get the axes of a cube face.
+ * @param face The face index.
+ * @param sc The direction of the u axis.
+ * @param tc The direction of the v axis.
+ * @param rc The direction the face is facing.
+ */
+void Cube::GetFaceBasis(EFace face, XZM::vec3& sc, XZM::vec3& tc, XZM::vec3& rc){
+
+    if (face == EFace::Right) {
+        sc = XZM::vec3(0.0f, 0.0f, -1.0f);
+        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
+        rc = XZM::vec3(1.0f, 0.0f, 0.0f);
+    }
+    else if (face == EFace::Left) {
+        sc = XZM::vec3(0.0f, 0.0f, 1.0f);
+        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
+        rc = XZM::vec3(-1.0f, 0.0f, 0.0f);
+    }
+    else if (face == EFace::Front) {
+        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
+        tc = XZM::vec3(0.0f, 0.0f, 1.0f);
+        rc = XZM::vec3(0.0f, 1.0f, 0.0f);
+    }
+    else if (face == EFace::Back) {
+        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
+        tc = XZM::vec3(0.0f, 0.0f, -1.0f);
+        rc = XZM::vec3(0.0f, -1.0f, 0.0f);
+    }
+    else if (face == EFace::Up) {
+        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
+        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
+        rc = XZM::vec3(0.0f, 0.0f, 1.0f);
+    }
+    else if (face == EFace::Down) {
+        sc = XZM::vec3(-1.0f, 0.0f, 0.0f);
+        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
+        rc = XZM::vec3(0.0f, 0.0f, -1.0f);
+    }
+}
+
+
+/**
+ * @brief Convert a float to a half float, clamped to the largest half. See the file formats in Cube.h.
+ * @param value The float value.
+ * @return The bits of the half float.
+ */
+uint16_t Cube::FloatToHalf(float value){
+    uint32_t f;
+    memcpy(&f, &value, sizeof(float));
+
+    uint32_t sign = (f >> 16) & 0x8000u;
+    f &= 0x7FFFFFFFu;
+
+    /* Larger than 65504 or NaN. */
+    if(f >= 0x477FF000u){
+        return (uint16_t)(sign | ((f > 0x7F800000u) ? 0x7E00u : 0x7BFFu));
+    }
+    /* Smaller than the smallest normal half, let the float adder do the rounding. */
+    if(f < 0x38800000u){
+        float magic = 0.5f;
+        float denorm;
+        memcpy(&denorm, &f, sizeof(float));
+        denorm += magic;
+        uint32_t bits;
+        memcpy(&bits, &denorm, sizeof(float));
+        return (uint16_t)(sign | (bits - 0x3F000000u));
+    }
+    /* Rebias the exponent and round to the nearest even. */
+    uint32_t mantissaOdd = (f >> 13) & 1u;
+    f += 0xC8000FFFu + mantissaOdd;
+    return (uint16_t)(sign | (f >> 13));
+}
+
+
+/**
+ * @brief Resample a square RGBA float face to a new size. See the file formats in Cube.h.
+ * Use the box filter when shrinking by an integer factor, otherwise use the bilinear filter.
+ * @param src The source face.
+ * @param srcSize The source width and height.
+ * @param dst The target face.
+ * @param dstSize The target width and height.
+ */
+static void ResampleFace(const float* src, uint32_t srcSize, float* dst, uint32_t dstSize){
+
+    if(srcSize >= dstSize && srcSize % dstSize == 0){
+        uint32_t factor = srcSize / dstSize;
+        float weight = 1.0f / (float)(factor * factor);
+        for(uint32_t y = 0; y < dstSize; y++){
+            for(uint32_t x = 0; x < dstSize; x++){
+                float sum[4] = {0,0,0,0};
+                for(uint32_t sy = y * factor; sy < (y + 1) * factor; sy++){
+                    for(uint32_t sx = x * factor; sx < (x + 1) * factor; sx++){
+                        for(int c = 0; c < 4; c++){
+                            sum[c] += src[((size_t)sy * srcSize + sx) * 4 + c];
+                        }
+                    }
+                }
+                for(int c = 0; c < 4; c++){
+                    dst[((size_t)y * dstSize + x) * 4 + c] = sum[c] * weight;
+                }
+            }
+        }
+        return;
+    }
+
+    float ratio = (float)srcSize / (float)dstSize;
+    for(uint32_t y = 0; y < dstSize; y++){
+        float fy = std::max(((float)y + 0.5f) * ratio - 0.5f, 0.0f);
+        uint32_t y0 = std::min((uint32_t)fy, srcSize - 1);
+        uint32_t y1 = std::min(y0 + 1, srcSize - 1);
+        float ty = fy - (float)y0;
+        for(uint32_t x = 0; x < dstSize; x++){
+            float fx = std::max(((float)x + 0.5f) * ratio - 0.5f, 0.0f);
+            uint32_t x0 = std::min((uint32_t)fx, srcSize - 1);
+            uint32_t x1 = std::min(x0 + 1, srcSize - 1);
+            float tx = fx - (float)x0;
+            for(int c = 0; c < 4; c++){
+                float top = src[((size_t)y0 * srcSize + x0) * 4 + c] * (1 - tx) + src[((size_t)y0 * srcSize + x1) * 4 + c] * tx;
+                float bottom = src[((size_t)y1 * srcSize + x0) * 4 + c] * (1 - tx) + src[((size_t)y1 * srcSize + x1) * 4 + c] * tx;
+                dst[((size_t)y * dstSize + x) * 4 + c] = top * (1 - ty) + bottom * ty;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Generate the Van Der Corput sequence
+ * @param bits The sample index.
+ * @return The sequence.
+ */
+float Cube::RadicalInverse_VdC(unsigned int bits){
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
+}
+
+
+/**
+ * @brief Generate the Hammersley sequence.
+ * @param i The current sample index.
+ * @param N The total number of samples/
+ * @return The sequence.
+ */
+std::pair<float,float> Cube::Hammersley(unsigned int i, unsigned int N){
+    return std::make_pair(float(i)/float(N),RadicalInverse_VdC(i));
+}
+
+
+/**
+ * @brief Allocate the six faces, filled with 0.
+ * @param newWidth The width of each face.
+ * @param newHeight The height of each face.
+ */
+void CubeImage::Allocate(uint32_t newWidth, uint32_t newHeight){
+    Free();
+    width = newWidth;
+    height = newHeight;
+
+    size_t size = sizeof(float) * 4 * 6 * (size_t)width * height;
+    /* Round up to the alignment. */
+    size = (size + alignment - 1) / alignment * alignment;
+    data = static_cast<float*>(::operator new[](size, std::align_val_t(alignment)));
+    Clear();
+}
+
+
+/**
+ * @brief Free the six faces.
+ */
+void CubeImage::Free(){
+    if(data != nullptr){
+        ::operator delete[](data, std::align_val_t(alignment));
+    }
+    data = nullptr;
+    width = 0;
+    height = 0;
+}
+
+
+/**
+ * @brief Set all the texels to 0.
+ */
+void CubeImage::Clear(){
+    if(data == nullptr) return;
+    std::memset(data, 0, sizeof(float) * 4 * 6 * (size_t)width * height);
+}
+
+
+/**
+ * @brief Check if the image is allocated.
+ * @return True if nothing is allocated.
+ */
+bool CubeImage::Empty() const{
+    return data == nullptr;
+}
+
+
+/**
+ * @brief Read a texel as a vec3.
+ * @param face The face index.
+ * @param u The column.
+ * @param v The row.
+ * @return The color of the texel.
+ */
+XZM::vec3 CubeImage::Get(uint32_t face, uint32_t u, uint32_t v) const{
+    const float* texel = Texel(face, u, v);
+    return {texel[0], texel[1], texel[2]};
+}
+
+
+/**
+ * @brief Write a texel from a vec3.
+ * @param face The face index.
+ * @param u The column.
+ * @param v The row.
+ * @param value The color to write.
+ */
+void CubeImage::Set(uint32_t face, uint32_t u, uint32_t v, const XZM::vec3& value){
+    float* texel = Texel(face, u, v);
+    texel[0] = value.data[0];
+    texel[1] = value.data[1];
+    texel[2] = value.data[2];
+}
+
+
+CubeImage::~CubeImage(){
+    Free();
+}
+
+
+/**
+ * @brief Add a sample direction with its weight and source mip level.
+ * @param dir The sample direction in tangent space.
+ * @param w The weight of the sample.
+ * @param l The source mip level, can be fractional.
+ */
+void SampleTable::Add(const XZM::vec3& dir, float w, float l){
+    x.push_back(dir.data[0]);
+    y.push_back(dir.data[1]);
+    z.push_back(dir.data[2]);
+    weight.push_back(w);
+    lod.push_back(l);
+    totalWeight += w;
+}
+
+
+/**
+ * @brief Get the number of samples.
+ * @return The number of samples.
+ */
+size_t SampleTable::Size() const{
+    return x.size();
+}
+
+
 /**
  * @brief Load a face data from a loaded RGBE image. Stored as a float images.
  * @param src The source RGBE image.
@@ -22,54 +285,71 @@ void Cube::LoadFace(const stbi_uc *src, EFace face, int width, int height) {
     int offSet = numPixel * 4 * face;
 
     for(int i = 0; i < height; i++){
+        float* row = cubeMap.Texel(face, 0, i);
         for(int j = 0; j < width; j++){
-            auto r = static_cast<float>(src[offSet + 4*i*width + 4*j]);
-            auto g = static_cast<float>(src[offSet + 4*i*width + 4*j+1]);
-            auto b = static_cast<float>(src[offSet + 4*i*width + 4*j+2]);
-            auto e = static_cast<int>(src[offSet + 4*i*width + 4*j+3]);
-
-            /* If it is 0. */
-            if(r == 0 && g == 0 && b == 0 && e == 0){
-                cubeMaps[face][i][j].data[0] = 0;
-                cubeMaps[face][i][j].data[1] = 0;
-                cubeMaps[face][i][j].data[2] = 0;
-                continue;
-            }
-
-            r = (r+0.5f)/256;
-            g = (g+0.5f)/256;
-            b = (b+0.5f)/256;
-            e = e - 128;
-
-            cubeMaps[face][i][j].data[0] = ldexp(r,e);
-            cubeMaps[face][i][j].data[1] = ldexp(g,e);
-            cubeMaps[face][i][j].data[2] = ldexp(b,e);
+            DecodeRGBE(src + offSet + 4*i*width + 4*j, row + 4*j);
         }
     }
 }
 
 
 /**
- * @brief Read a RGBE src image from a given path and name.
+ * @brief Free the packed source with stb_image, which allocated it.
+ * @param data The packed source.
+ */
+void Cube::PackedDeleter::operator()(unsigned char* data) const {
+    stbi_image_free(data);
+}
+
+
+/**
+ * @brief Read a RGBE src image from a given path and name, hash it and read its manifest.
+ * The pixels are only decoded by LoadSource, so nothing is decoded if all the outputs are up to date.
  * @param fileName The source file path and name.
  */
 void Cube::ReadFile(const std::string &fileName) {
 
     srcName = fileName;
 
-    stbi_uc* src = stbi_load(fileName.c_str(),&cubeMapWidth,&cubeMapHeight,&cubeMapChannel,0);
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot find input file.");
+    }
+    srcBytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    srcHash = Manifest::Hash(srcBytes.data(), srcBytes.size());
+
+    manifest.Load(srcName);
+    cubeMap.Free();
+    packedMap.reset();
+}
+
+
+/**
+ * @brief Decode the source file into the cube map, if it is not decoded yet.
+ * When packed is set, the RGBE image from stb_image is kept as it is, its faces are already in the cubeMap order.
+ * The file bytes are released once decoded.
+ */
+void Cube::LoadSource() {
+
+    if(!cubeMap.Empty() || packedMap != nullptr) return;
+
+    stbi_uc* src = stbi_load_from_memory(srcBytes.data(), (int)srcBytes.size(), &cubeMapWidth, &cubeMapHeight, &cubeMapChannel, 0);
 
     if(src == nullptr){
-        throw std::runtime_error("Cannot find input file.");
+        throw std::runtime_error("Cannot decode input file.");
     }
 
     cubeMapHeight /= 6;
+    std::vector<unsigned char>().swap(srcBytes);
 
+    if(packed){
+        packedMap.reset(src);
+        printf("Cube: Input cube map loaded, packed.\n");
+        return;
+    }
+
+    cubeMap.Allocate(cubeMapWidth, cubeMapHeight);
     for(int face = 0; face < 6; face++){
-        cubeMaps[face] = new XZM::vec3*[cubeMapHeight];
-        for(int row = 0; row < cubeMapHeight; row++){
-            cubeMaps[face][row] = new XZM::vec3[cubeMapWidth];
-        }
         LoadFace(src, static_cast<EFace>(face), cubeMapWidth, cubeMapHeight);
     }
 
@@ -79,68 +359,223 @@ void Cube::ReadFile(const std::string &fileName) {
 
 
 /**
- * @brief Collect the brightest directions.
+ * @brief Make the manifest key of an output. Outputs depending on the source start with its hash.
+ * @param settings The mode and the settings producing the output, e.g. "mode=GGX level=3 samples=7000".
+ * @return The key.
  */
-void Cube::ProcessBright(){
-    uint32_t bright = std::min< uint32_t >(cubeMapWidth*cubeMapHeight*6, 1000);
-
-    std::vector<std::pair<float, Pixel_Ref>> pixelList;
-    pixelList.resize(cubeMapWidth*cubeMapHeight*6);
-
-    for(size_t face = 0; face < 6; face++){
-        for(uint32_t v = 0; v < cubeMapHeight; v++){
-            for(uint32_t u = 0; u < cubeMapWidth; u++){
-                pixelList.emplace_back();
-                pixelList.back().first = std::max({cubeMaps[face][v][u].data[0],cubeMaps[face][v][u].data[1],cubeMaps[face][v][u].data[2]});
-                pixelList.back().second.face = static_cast<EFace>(face);
-                pixelList.back().second.v = v;
-                pixelList.back().second.u = u;
+std::string Cube::GetOutputKey(const std::string& settings) const {
+    return "hash=" + Manifest::HashToString(srcHash) + " " + settings;
+}
+
+
+/**
+ * @brief Check if an output file can be kept instead of being computed again.
+ * Only outputs that are saved can be skipped, the comparison mode always computes them.
+ * @param fileName The output file path and name.
+ * @param key The key of the current inputs.
+ * @return True if the output is up to date.
+ */
+bool Cube::IsOutputUpToDate(const std::string& fileName, const std::string& key) {
+    return saveOutput && !forced && manifest.IsUpToDate(fileName, key);
+}
+
+
+/**
+ * @brief Record a written output file in the manifest.
+ * @param fileName The output file path and name.
+ * @param key The key of the inputs that produced it.
+ */
+void Cube::RecordOutput(const std::string& fileName, const std::string& key) {
+    manifest.Record(fileName, key);
+}
+
+
+/**
+ * @brief Set the number of worker threads used for the sampling.
+ * @param newNThreads The number of threads, 0 means the hardware thread count.
+ */
+void Cube::SetThreadCount(uint32_t newNThreads) {
+    nThreads = newNThreads;
+}
+
+
+/**
+ * @brief Turn the filtered importance sampling on or off.
+ * @param newFiltered True to read each sample from the mip level matching its solid angle.
+ */
+void Cube::SetFiltered(bool newFiltered) {
+    filtered = newFiltered;
+}
+
+
+/**
+ * @brief Turn the output files on or off.
+ * @param newSaveOutput True to write the output files.
+ */
+void Cube::SetSaveOutput(bool newSaveOutput) {
+    saveOutput = newSaveOutput;
+}
+
+
+/**
+ * @brief Compute all the outputs even if the manifest says they are up to date.
+ * @param newForced True to ignore the manifest.
+ */
+void Cube::SetForced(bool newForced) {
+    forced = newForced;
+}
+
+
+/**
+ * @brief Keep the source as packed RGBE, 4 bytes per texel, and decode it on each lookup.
+ * The mip chain stays in floats, so the filtered sampling only decodes the samples reading level 0.
+ * Must be called before the source is decoded.
+ * @param newPacked True to keep the source packed.
+ */
+void Cube::SetPacked(bool newPacked) {
+    packed = newPacked;
+}
+
+
+/**
+ * @brief Build the mip chain of the source cube map with a 2x2 box filter, down to 1x1.
+ * Must be called after anything that changes cubeMap, such as ProcessBright.
+ */
+void Cube::BuildMipChain(){
+
+    cubeMips.clear();
+    mipData = {packed ? nullptr : cubeMap.Data()};
+    mipWidth = {cubeMapWidth};
+    mipHeight = {cubeMapHeight};
+
+    if(!filtered) return;
+
+    auto parentWidth = (uint32_t)cubeMapWidth;
+    auto parentHeight = (uint32_t)cubeMapHeight;
+    while(parentWidth > 1 || parentHeight > 1){
+        uint32_t width = std::max(1u, parentWidth / 2);
+        uint32_t height = std::max(1u, parentHeight / 2);
+        auto parentLevel = (uint32_t)mipData.size() - 1;
+
+        auto mip = std::make_unique<CubeImage>();
+        mip->Allocate(width, height);
+
+        for(uint32_t face = 0; face < 6; face++){
+            for(uint32_t v = 0; v < height; v++){
+                /* Clamp for the odd sizes. */
+                size_t v0 = ((size_t)face * parentHeight + std::min(2*v, parentHeight-1)) * parentWidth;
+                size_t v1 = ((size_t)face * parentHeight + std::min(2*v+1, parentHeight-1)) * parentWidth;
+                for(uint32_t u = 0; u < width; u++){
+                    uint32_t u0 = std::min(2*u, parentWidth-1);
+                    uint32_t u1 = std::min(2*u+1, parentWidth-1);
+
+                    float t00[3];
+                    float t01[3];
+                    float t10[3];
+                    float t11[3];
+                    GetMipTexel(parentLevel, v0 + u0, t00);
+                    GetMipTexel(parentLevel, v0 + u1, t01);
+                    GetMipTexel(parentLevel, v1 + u0, t10);
+                    GetMipTexel(parentLevel, v1 + u1, t11);
+
+                    float* dst = mip->Texel(face, u, v);
+                    for(int c = 0; c < 3; c++){
+                        dst[c] = 0.25f * (t00[c] + t01[c] + t10[c] + t11[c]);
+                    }
+                }
             }
         }
+
+        mipData.push_back(mip->Data());
+        mipWidth.push_back((int32_t)width);
+        mipHeight.push_back((int32_t)height);
+        parentWidth = width;
+        parentHeight = height;
+        cubeMips.push_back(std::move(mip));
     }
+}
 
-    /* Sort all the pixels with the brightness. */
-    std::stable_sort(pixelList.rbegin(),pixelList.rend());
+
+/**
+ * @brief Get the source mip level for a sample, so the texel covers about the solid angle of the sample.
+ * Reference: GPU-Based Importance Sampling, GPU Gems 3, chapter 20.
+ * @param pdf The pdf of the sample direction.
+ * @return The mip level, clamped to the chain.
+ */
+float Cube::GetSampleLod(float pdf) const{
+
+    if(!filtered || mipData.size() <= 1) return 0.0f;
+
+    /* The solid angle of a sample and of a texel in level 0. */
+    float sampleAngle = 1.0f / ((float)nSamples * pdf);
+    float texelAngle = 4.0f * (float)M_PI / (6.0f * (float)cubeMapWidth * (float)cubeMapHeight);
+
+    /* With a bias of 1, one level up, to smooth out the remaining noise. */
+    float lod = 0.5f * std::log2(sampleAngle / texelAngle) + 1.0f;
+    if(!(lod > 0.0f)) return 0.0f;
+    return std::min(lod, (float)(mipData.size() - 1));
+}
+
+
+/**
+ * @brief Compute the root mean square error between two cube images of the same size.
+ * @param a The first image.
+ * @param b The second image.
+ * @return The RMSE over all the channels of all the texels.
+ */
+float Cube::RMSE(const CubeImage& a, const CubeImage& b){
+
+    if(a.Width() != b.Width() || a.Height() != b.Height() || a.Empty() || b.Empty()){
+        throw std::runtime_error("Cannot compare cube images of different sizes.");
+    }
+
+    size_t nTexel = 6 * (size_t)a.Width() * a.Height();
+    double sum = 0;
+    for(size_t i = 0; i < nTexel; i++){
+        for(int c = 0; c < 3; c++){
+            double d = (double)a.Data()[4*i+c] - (double)b.Data()[4*i+c];
+            sum += d * d;
+        }
+    }
+    return (float)std::sqrt(sum / (double)(nTexel * 3));
+}
+
+
+/**
+ * @brief Collect the brightest directions.
+ */
+void Cube::ProcessBright(){
+    size_t nTexel = 6 * (size_t)cubeMapWidth * cubeMapHeight;
+    auto bright = (uint32_t)std::min< size_t >(nTexel, 1000);
+
+    /* Only the brightness and the texel index, 8 bytes per texel, so large sources stay affordable. */
+    std::vector<std::pair<float, uint32_t>> pixelList(nTexel);
+    for(size_t i = 0; i < nTexel; i++){
+        float texel[3];
+        GetSourceTexel(i, texel);
+        pixelList[i] = std::make_pair(std::max({texel[0],texel[1],texel[2]}), (uint32_t)i);
+    }
+
+    /* Only the brightest ones need to be in order. Ties go to the later face, then to the earlier texel in the face. */
+    auto faceSize = (uint32_t)(cubeMapWidth * cubeMapHeight);
+    std::partial_sort(pixelList.begin(), pixelList.begin() + bright, pixelList.end(),
+                      [faceSize](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b){
+                          if(a.first != b.first) return a.first > b.first;
+                          if(a.second / faceSize != b.second / faceSize) return a.second / faceSize > b.second / faceSize;
+                          return a.second < b.second;
+                      });
 
     for(auto i = 0; i < bright; i++){
         XZM::vec3 sc;
         XZM::vec3 tc;
         XZM::vec3 rc;
 
-        auto face = pixelList[i].second.face;
-        auto u = pixelList[i].second.u;
-        auto v = pixelList[i].second.v;
+        uint32_t index = pixelList[i].second;
+        auto face = static_cast<EFace>(index / faceSize);
+        auto u = index % cubeMapWidth;
+        auto v = index / cubeMapWidth % cubeMapHeight;
 
-        if (face == EFace::Right) {
-            sc = XZM::vec3(0.0f, 0.0f, -1.0f);
-            tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-            rc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        }
-        else if (face == EFace::Left) {
-            sc = XZM::vec3(0.0f, 0.0f, 1.0f);
-            tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-            rc = XZM::vec3(-1.0f, 0.0f, 0.0f);
-        }
-        else if (face == EFace::Front) {
-            sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-            tc = XZM::vec3(0.0f, 0.0f, 1.0f);
-            rc = XZM::vec3(0.0f, 1.0f, 0.0f);
-        }
-        else if (face == EFace::Back) {
-            sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-            tc = XZM::vec3(0.0f, 0.0f, -1.0f);
-            rc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        }
-        else if (face == EFace::Up) {
-            sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-            tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-            rc = XZM::vec3(0.0f, 0.0f, 1.0f);
-        }
-        else if (face == EFace::Down) {
-            sc = XZM::vec3(-1.0f, 0.0f, 0.0f);
-            tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-            rc = XZM::vec3(0.0f, 0.0f, -1.0f);
-        }
+        GetFaceBasis(face, sc, tc, rc);
 
         XZM::vec3 N = XZM::Normalize(rc + sc * (2.0f * ((float) u + 0.5f) / (float) cubeMapHeight - 1.0f) +
                                      tc * (2.0f * ((float) v + 0.5f) / (float) cubeMapWidth - 1.0f));
@@ -148,8 +583,15 @@ void Cube::ProcessBright(){
         brightDirections.emplace_back();
         brightDirections.back().dir = N;
         float solid_angle = 4.0f * (float)M_PI / float(6.0f * (float)cubeMapWidth * (float)cubeMapHeight); // approximate, since pixels on cube actually take up different amounts depending on position
-        brightDirections.back().light = cubeMaps[face][v][u] * solid_angle;
-        cubeMaps[face][v][u] = XZM::vec3(0,0,0);
+        float texel[3];
+        GetSourceTexel(index, texel);
+        brightDirections.back().light = XZM::vec3(texel[0], texel[1], texel[2]) * solid_angle;
+        if(packed){
+            std::memset(packedMap.get() + 4 * (size_t)index, 0, 4);
+        }
+        else{
+            cubeMap.Set(face, u, v, XZM::vec3(0,0,0));
+        }
     }
 }
 
@@ -168,52 +610,163 @@ XZM::vec3 Cube::SumBrightDirection(const XZM::vec3& dir){
 }
 
 
+/**
+ * @brief Find the texel a direction projects to. Written with selects instead of branches,
+ * so it can be vectorized when called over a block of directions.
+ * @param x The x of the direction.
+ * @param y The y of the direction.
+ * @param z The z of the direction.
+ * @param width The width of each face.
+ * @param height The height of each face.
+ * @return The index of the texel in a CubeImage.
+ */
+static inline uint32_t ProjectionIndex(float x, float y, float z, int32_t width, int32_t height){
+    float ax = std::abs(x);
+    float ay = std::abs(y);
+    float az = std::abs(z);
+
+    bool onX = ax >= ay && ax >= az;
+    bool onY = !onX && ay >= az;
+
+    float rc = onX ? ax : (onY ? ay : az);
+    float sc = onX ? (x >= 0 ? -z : z) : (onY ? x : (z >= 0 ? x : -x));
+    float tc = onX ? -y : (onY ? (y >= 0 ? z : -z) : -y);
+    int32_t face = onX ? (x >= 0 ? EFace::Right : EFace::Left) : (onY ? (y >= 0 ? EFace::Front : EFace::Back) : (z >= 0 ? EFace::Up : EFace::Down));
+
+    auto u = (int32_t)std::floor(0.5f * (sc / rc + 1.0f) * (float)width);
+    u = std::max(0, std::min(width-1, u));
+    auto v = (int32_t)std::floor(0.5f * (tc / rc + 1.0f) * (float)height);
+    v = std::max(0, std::min(height-1, v));
+
+    return (uint32_t)((face * height + v) * width + u);
+}
+
+
 /**
  * @brief Project a given direction to the cube map, retrieve its color info.
  * @param dir The input direction.
  * @return The light info of that projected pixel on the cube map.
  */
 XZM::vec3 Cube::Projection(const XZM::vec3 &dir) {
-    float sc, tc, rc;
-    uint32_t face;
-
-    if (std::abs(dir.data[0]) >= std::abs(dir.data[1]) && std::abs(dir.data[0]) >= std::abs(dir.data[2])) {
-        if (dir.data[0] >= 0) { sc = -dir.data[2]; tc = -dir.data[1]; rc = dir.data[0]; face = EFace::Right; }
-        else            { sc =  dir.data[2]; tc = -dir.data[1]; rc = dir.data[0]; face = EFace::Left; }
-    } else if (std::abs(dir.data[1]) >= std::abs(dir.data[2])) {
-        if (dir.data[1] >= 0) { sc =  dir.data[0]; tc =  dir.data[2]; rc = dir.data[1]; face = EFace::Front; }
-        else            { sc =  dir.data[0]; tc = -dir.data[2]; rc = dir.data[1]; face = EFace::Back; }
-    } else {
-        if (dir.data[2] >= 0) { sc =  dir.data[0]; tc = -dir.data[1]; rc = dir.data[2]; face = EFace::Up; }
-        else            { sc = -dir.data[0]; tc = -dir.data[1]; rc = dir.data[2]; face = EFace::Down; }
-    }
+    float texel[3];
+    GetSourceTexel(ProjectionIndex(dir.data[0], dir.data[1], dir.data[2], cubeMapWidth, cubeMapHeight), texel);
+    return {texel[0], texel[1], texel[2]};
+}
+
+
+/**
+ * @brief Rotate a sample table into a tangent frame and sum the weighted cube map lookups.
+ * The rotation and the projection run over blocks of samples as plain arrays, so the compiler can vectorize them,
+ * only the final texel gather is scalar. When the mip chain is built, each sample blends the two levels around its lod.
+ * @param table The samples in tangent space.
+ * @param N The normal, which is the z axis of the tangent frame.
+ * @param TX The x axis of the tangent frame.
+ * @param TY The y axis of the tangent frame.
+ * @return The weighted sum of the lookups.
+ */
+XZM::vec3 Cube::IntegrateTable(const SampleTable& table, const XZM::vec3& N, const XZM::vec3& TX, const XZM::vec3& TY){
+
+    constexpr size_t blockSize = 64;
+    float dx[blockSize];
+    float dy[blockSize];
+    float dz[blockSize];
+    uint32_t index[blockSize];
+
+    const float* x = table.x.data();
+    const float* y = table.y.data();
+    const float* z = table.z.data();
+    const float* w = table.weight.data();
+    const float* texels = cubeMap.Data();
+
+    float acc[3] = {0.0f, 0.0f, 0.0f};
+    size_t nSample = table.Size();
+
+    bool useMips = mipData.size() > 1;
+    auto maxLevel = (uint32_t)mipData.size() - 1;
+    uint32_t level[blockSize];
+    float blend[blockSize];
+    uint32_t nextIndex[blockSize];
+
+    for(size_t begin = 0; begin < nSample; begin += blockSize){
+        size_t count = std::min(blockSize, nSample - begin);
+
+        /* The frame is orthonormal, so the rotated direction stays normalized. */
+        for(size_t i = 0; i < count; i++){
+            dx[i] = TX.data[0] * x[begin+i] + TY.data[0] * y[begin+i] + N.data[0] * z[begin+i];
+            dy[i] = TX.data[1] * x[begin+i] + TY.data[1] * y[begin+i] + N.data[1] * z[begin+i];
+            dz[i] = TX.data[2] * x[begin+i] + TY.data[2] * y[begin+i] + N.data[2] * z[begin+i];
+        }
+
+        if(useMips){
+            /* Blend the two mip levels around the sample's lod. */
+            for(size_t i = 0; i < count; i++){
+                float lod = table.lod[begin+i];
+                level[i] = (uint32_t)lod;
+                blend[i] = lod - (float)level[i];
+                uint32_t next = std::min(level[i] + 1, maxLevel);
+                index[i] = ProjectionIndex(dx[i], dy[i], dz[i], mipWidth[level[i]], mipHeight[level[i]]);
+                nextIndex[i] = ProjectionIndex(dx[i], dy[i], dz[i], mipWidth[next], mipHeight[next]);
+            }
+
+            for(size_t i = 0; i < count; i++){
+                float texel[3];
+                float nextTexel[3];
+                GetMipTexel(level[i], index[i], texel);
+                GetMipTexel(std::min(level[i] + 1, maxLevel), nextIndex[i], nextTexel);
+                float w0 = w[begin+i] * (1.0f - blend[i]);
+                float w1 = w[begin+i] * blend[i];
+                acc[0] += texel[0] * w0 + nextTexel[0] * w1;
+                acc[1] += texel[1] * w0 + nextTexel[1] * w1;
+                acc[2] += texel[2] * w0 + nextTexel[2] * w1;
+            }
+            continue;
+        }
+
+        for(size_t i = 0; i < count; i++){
+            index[i] = ProjectionIndex(dx[i], dy[i], dz[i], cubeMapWidth, cubeMapHeight);
+        }
 
-    int32_t u = std::floor(0.5f * (sc / std::abs(rc) + 1.0f) * (float)cubeMapWidth);
-    u = std::max(0, std::min(int32_t(cubeMapWidth)-1, u));
-    int32_t v = std::floor(0.5f * (tc / std::abs(rc) + 1.0f) * (float)cubeMapHeight);
-    v = std::max(0, std::min(int32_t(cubeMapHeight)-1, v));
+        if(packed){
+            for(size_t i = 0; i < count; i++){
+                float texel[3];
+                DecodeRGBE(packedMap.get() + 4 * (size_t)index[i], texel);
+                acc[0] += texel[0] * w[begin+i];
+                acc[1] += texel[1] * w[begin+i];
+                acc[2] += texel[2] * w[begin+i];
+            }
+            continue;
+        }
 
-    return cubeMaps[face][v][u];
+        for(size_t i = 0; i < count; i++){
+            const float* texel = texels + 4 * (size_t)index[i];
+            acc[0] += texel[0] * w[begin+i];
+            acc[1] += texel[1] * w[begin+i];
+            acc[2] += texel[2] * w[begin+i];
+        }
+    }
+    return {acc[0], acc[1], acc[2]};
 }
 
 
 /**
  * @brief Read a face data to a RGBE image.
+ * @param image The cube image to read from.
  * @param dst The target image we want to store to.
  * @param face The face index.
  * @param width The output width.
  * @param height The output height.
  */
-void Cube::ReadFace(unsigned char*& dst, EFace face, uint32_t width, uint32_t height){
+void Cube::ReadFace(const CubeImage& image, unsigned char*& dst, EFace face, uint32_t width, uint32_t height){
 
     uint32_t numPixel = width * height;
     uint32_t offSet = numPixel * 4 * face;
 
     for(int i = 0; i < height; i++){
+        const float* row = image.Texel(face, 0, i);
         for(int j = 0; j < width; j++){
-            float r = outMaps[face][i][j].data[0];
-            float g = outMaps[face][i][j].data[1];
-            float b = outMaps[face][i][j].data[2];
+            float r = row[4*j];
+            float g = row[4*j+1];
+            float b = row[4*j+2];
 
             float d = std::max(r, std::max(g, b));
             if (d <= 1e-32f) {
@@ -244,37 +797,56 @@ void Cube::ReadFace(unsigned char*& dst, EFace face, uint32_t width, uint32_t he
 
 
 /**
- * @brief Reset the output data to 0.
+ * @brief Save cube images as one half float cube file (.xzcube), the mip level i is levels[i] resampled to baseSize >> i.
+ * The renderer copies the file into a staging buffer as it is, so the data is in the order of its copy regions.
+ * The layout is described with the other file formats in Cube.h.
+ * @param fileName The output file path and name.
+ * @param levels The cube image of each mip level, their faces must be square.
+ * @param baseSize The face size of the mip level 0.
  */
-void Cube::ClearOutput(){
+void Cube::SaveCubeFile(const std::string& fileName, const std::vector<const CubeImage*>& levels, uint32_t baseSize){
 
-    if(outMaps[0] == nullptr || outMaps[0][0] == nullptr) return;
+    std::ofstream file(fileName, std::ios::binary);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the cube output file.");
+    }
 
-    for(auto face = 0; face < 6; face++){
-        for(auto v = 0; v < outMapHeight; v++){
-            for(auto u = 0; u < outMapWidth; u++){
-                outMaps[face][v][u] = XZM::vec3();
+    const uint32_t header[3] = {baseSize, (uint32_t)levels.size(), 4};
+    file.write("XZCB", 4);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    std::vector<float> resampled;
+    std::vector<uint16_t> halfs;
+    for(size_t i = 0; i < levels.size(); i++){
+        uint32_t levelSize = std::max(1u, baseSize >> i);
+        resampled.resize((size_t)levelSize * levelSize * 4);
+        halfs.resize(resampled.size());
+
+        for(uint32_t face = 0; face < 6; face++){
+            ResampleFace(levels[i]->Texel(face, 0, 0), levels[i]->Width(), resampled.data(), levelSize);
+            for(size_t j = 0; j < resampled.size(); j += 4){
+                halfs[j] = FloatToHalf(resampled[j]);
+                halfs[j+1] = FloatToHalf(resampled[j+1]);
+                halfs[j+2] = FloatToHalf(resampled[j+2]);
+                /* The padding float becomes an alpha of 1. */
+                halfs[j+3] = 0x3C00u;
             }
+            file.write(reinterpret_cast<const char*>(halfs.data()), (std::streamsize)(halfs.size() * sizeof(uint16_t)));
         }
     }
 }
 
 
 /**
- * @brief Destruct all the allocated data.
+ * @brief Choose the output files, the half float cube files instead of the RGBE png files.
+ * @param newCubeFileOutput True to write the cube files.
  */
-Cube::~Cube() {
-    for(int face = 0; face < 6; face++){
-        /* Clear the cube map. */
-        for(int row = 0; row < cubeMapHeight; row++){
-            delete[] cubeMaps[face][row];
-        }
-        delete[] cubeMaps[face];
-
-        /* Clear the output map. */
-        for(int row = 0; row < outMapHeight; row++){
-            delete[] outMaps[face][row];
-        }
-        delete[] outMaps[face];
-    }
+void Cube::SetCubeFileOutput(bool newCubeFileOutput) {
+    cubeFileOutput = newCubeFileOutput;
 }
+
+
+/**
+ * @brief Destruct all the allocated data. The cube images free their own blocks.
+ */
+Cube::~Cube() = default;
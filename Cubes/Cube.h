@@ -13,12 +13,25 @@
 #include <array>
 #include <iostream>
 #include <vector>
-#include <thread>
 #include <algorithm>
 #include "XZMath.h"
+#include "ThreadPool.h"
+#include "Manifest.h"
 
 /* Reference: Inspired by https://github.com/ixchow/15-466-ibl/blob/master/cubes/blur_cube.cpp */
 
+/*
+ * The half float files read by the renderer. The renderer has its own copy of FloatToHalf and ResampleFace,
+ * for the png fallback, so a change here must be made there too.
+ *  - Cube file (.xzcube): "XZCB", uint32 face size, uint32 mip levels, uint32 channels (4),
+ *    then for each mip level and each face in the EFace order, the RGBA halfs row by row.
+ *    The mip level i is (std::max)(faceSize >> i, 1) wide and there are at most log2(faceSize) + 1 levels.
+ *    In the GGX cube, the mip level i of L levels holds the roughness i / L.
+ *  - BRDF LUT (.xzlut): "XZLT", uint32 width, uint32 height, uint32 channels (2), then width * height * 2 halfs, row by row.
+ *  - The halfs are rounded to the nearest even and clamped to the largest half instead of infinity.
+ *  - The faces are resampled with the box filter when shrinking by an integer factor, otherwise with the bilinear filter.
+ */
+
 /* Correspond to the order of the face. */
 enum EFace{
     Right,
@@ -30,25 +43,98 @@ enum EFace{
 };
 
 /**
- * @brief The data of a pixel in a image. Will have its face index, and its uv index.
+ * @brief Used to calculate the brightest direction.
  */
-struct Pixel_Ref{
-    EFace face = EFace::Right;
-    size_t u = 0;
-    size_t v = 0;
+struct BrightDirection{
+    XZM::vec3 dir = XZM::vec3();
+    XZM::vec3 light = XZM::vec3();
+};
 
-    bool operator < (const Pixel_Ref& obj) const {
-        return face < obj.face;
-    }
+
+/**
+ * @brief The six faces of a cube map in one contiguous, 64 bytes aligned block.
+ * Each texel is 4 floats (RGB and a padding) so it never straddles a cache line,
+ * the faces follow the EFace order and the rows of a face are packed one after another.
+ */
+class CubeImage{
+
+private:
+    float* data = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+public:
+    /* The alignment of the allocated block in bytes. */
+    static constexpr size_t alignment = 64;
+
+    CubeImage() = default;
+    CubeImage(const CubeImage&) = delete;
+    CubeImage& operator= (const CubeImage&) = delete;
+
+    /* Allocate the six faces, filled with 0. */
+    void Allocate(uint32_t newWidth, uint32_t newHeight);
+    /* Free the six faces. */
+    void Free();
+    /* Set all the texels to 0. */
+    void Clear();
+    /* Check if the image is allocated. */
+    [[nodiscard]] bool Empty() const;
+
+    /* Get the size of each face. */
+    [[nodiscard]] uint32_t Width() const { return width; }
+    [[nodiscard]] uint32_t Height() const { return height; }
+    /* Get the first float of all the texels. */
+    [[nodiscard]] const float* Data() const { return data; }
+    /* Get the first float of a texel. */
+    float* Texel(uint32_t face, uint32_t u, uint32_t v) { return data + 4 * (((size_t)face * height + v) * width + u); }
+    [[nodiscard]] const float* Texel(uint32_t face, uint32_t u, uint32_t v) const { return data + 4 * (((size_t)face * height + v) * width + u); }
+    /* Read a texel as a vec3. */
+    [[nodiscard]] XZM::vec3 Get(uint32_t face, uint32_t u, uint32_t v) const;
+    /* Write a texel from a vec3. */
+    void Set(uint32_t face, uint32_t u, uint32_t v, const XZM::vec3& value);
+
+    ~CubeImage();
 };
 
 
 /**
- * @brief Used to calculate the brightest direction.
+ * @brief Decode a RGBE texel, 0 stays 0.
+ * @param rgbe The 4 bytes of the texel.
+ * @param rgb The decoded color.
  */
-struct BrightDirection{
-    XZM::vec3 dir = XZM::vec3();
-    XZM::vec3 light = XZM::vec3();
+static inline void DecodeRGBE(const unsigned char* rgbe, float* rgb){
+    if(rgbe[0] == 0 && rgbe[1] == 0 && rgbe[2] == 0 && rgbe[3] == 0){
+        rgb[0] = 0;
+        rgb[1] = 0;
+        rgb[2] = 0;
+        return;
+    }
+    int e = (int)rgbe[3] - 128;
+    rgb[0] = std::ldexp(((float)rgbe[0] + 0.5f) / 256, e);
+    rgb[1] = std::ldexp(((float)rgbe[1] + 0.5f) / 256, e);
+    rgb[2] = std::ldexp(((float)rgbe[2] + 0.5f) / 256, e);
+}
+
+
+/**
+ * @brief A set of tangent space sample directions and their weights, stored as a structure of arrays.
+ * The set is the same for every texel, so it is built once and only rotated into each texel's tangent frame.
+ */
+struct SampleTable{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> weight;
+    /* The source mip level each sample reads from, 0 if the sampling is not filtered. */
+    std::vector<float> lod;
+
+    /* The sum of all the weights. */
+    float totalWeight = 0;
+
+    /* Add a sample direction with its weight and source mip level. */
+    void Add(const XZM::vec3& dir, float w, float l = 0.0f);
+    /* Get the number of samples. */
+    [[nodiscard]] size_t Size() const;
 };
 
 
@@ -57,8 +143,31 @@ class Cube {
 protected:
     std::string srcName;
 
+    /* The bytes of the source file, decoded by LoadSource when an output has to be computed. */
+    std::vector<unsigned char> srcBytes;
+
+    /* The hash of the source file, part of the key of every output depending on it. */
+    uint64_t srcHash = 0;
+
+    /* The outputs produced from the source and the keys of their inputs. */
+    Manifest manifest;
+
+    /* If the outputs are computed again even if the manifest says they are up to date. */
+    bool forced = false;
+
+    /* Frees the packed source, it is allocated by stb_image. */
+    struct PackedDeleter{
+        void operator()(unsigned char* data) const;
+    };
+
     /* Order: Right, Left, Front, Back, Up, Down */
-    std::array<XZM::vec3**,6> cubeMaps;
+    CubeImage cubeMap;
+
+    /* If the source is kept as packed RGBE, 4 bytes per texel instead of 16, and decoded on each lookup. */
+    bool packed = false;
+
+    /* The packed RGBE source in the same texel order as cubeMap, only used when packed is set. */
+    std::unique_ptr<unsigned char, PackedDeleter> packedMap;
     int cubeMapWidth = 0;
     int cubeMapHeight = 0;
     int cubeMapChannel = 0;
@@ -69,32 +178,111 @@ protected:
     /* Number of samples when doing the Monte-Carlo. */
     uint32_t nSamples = 0;
 
-    /* Used multi-threading to process each face. */
-    std::array<std::thread,6> threads;
+    /* Number of worker threads used for the sampling, 0 means the hardware thread count. */
+    uint32_t nThreads = 0;
+
+    /* If the samples read from the mip level matching their solid angle (filtered importance sampling). */
+    bool filtered = true;
+
+    /* If the result is written to the output files. */
+    bool saveOutput = true;
+
+    /* If the outputs are written as half float cube files (.xzcube) instead of RGBE png files. */
+    bool cubeFileOutput = false;
+
+    /* The mip levels of the source cube map after the first one. */
+    std::vector<std::unique_ptr<CubeImage>> cubeMips;
+
+    /* The data and the face size of every source mip level, level 0 is cubeMap (nullptr when packed). */
+    std::vector<const float*> mipData;
+    std::vector<int32_t> mipWidth;
+    std::vector<int32_t> mipHeight;
 
     /* The output of the cube map. */
-    std::array<XZM::vec3**,6> outMaps;
+    CubeImage outMap;
     uint32_t outMapWidth = 0;
     uint32_t outMapHeight = 0;
 
+    /* The Van Der Corput sequence which mirrors a decimal binary representation around its decimal point. */
+    static float RadicalInverse_VdC(unsigned int bits);
+    /* The Hammersley Sequence for the low discrepancy sequence. */
+    static std::pair<float,float> Hammersley(unsigned int i, unsigned int N);
+    /* Convert a float to a half float, clamped to the largest half. */
+    static uint16_t FloatToHalf(float value);
+    /* Get the axes of a cube face. */
+    static void GetFaceBasis(EFace face, XZM::vec3& sc, XZM::vec3& tc, XZM::vec3& rc);
+    /* Decode the source file into the cube map, if it is not decoded yet. */
+    void LoadSource();
     /* Load a face data. from a loaded RGBE image. */
     void LoadFace(const unsigned char* src, EFace face, int width, int height);
+    /* Read a texel of the source cube map by its index, from the packed or the float source. */
+    void GetSourceTexel(size_t index, float* rgb) const {
+        if(packed){
+            DecodeRGBE(packedMap.get() + 4 * index, rgb);
+            return;
+        }
+        const float* texel = cubeMap.Data() + 4 * index;
+        rgb[0] = texel[0];
+        rgb[1] = texel[1];
+        rgb[2] = texel[2];
+    }
+    /* Read a texel of a source mip level by its index. */
+    void GetMipTexel(uint32_t level, size_t index, float* rgb) const {
+        if(level == 0){
+            GetSourceTexel(index, rgb);
+            return;
+        }
+        const float* texel = mipData[level] + 4 * index;
+        rgb[0] = texel[0];
+        rgb[1] = texel[1];
+        rgb[2] = texel[2];
+    }
     /* Collect the brightest directions. */
     void ProcessBright();
+    /* Build the mip chain of the source cube map. */
+    void BuildMipChain();
+    /* Get the source mip level for a sample from its pdf. */
+    [[nodiscard]] float GetSampleLod(float pdf) const;
     /* Given a direction, sum its project with the brightest directions. */
     virtual XZM::vec3 SumBrightDirection(const XZM::vec3& dir);
     /* Project a given direction to the cube map, retrieve its color info. */
     XZM::vec3 Projection(const XZM::vec3& dir);
+    /* Rotate a sample table into a tangent frame and sum the weighted cube map lookups. */
+    XZM::vec3 IntegrateTable(const SampleTable& table, const XZM::vec3& N, const XZM::vec3& TX, const XZM::vec3& TY);
     /* Read a face data to a RGBE image. */
-    void ReadFace(unsigned char*& dst, EFace face, uint32_t width, uint32_t height);
-    /* Reset the output data to 0. */
-    void ClearOutput();
+    void ReadFace(const CubeImage& image, unsigned char*& dst, EFace face, uint32_t width, uint32_t height);
+    /* Save cube images as the mip levels of a half float cube file. */
+    static void SaveCubeFile(const std::string& fileName, const std::vector<const CubeImage*>& levels, uint32_t baseSize);
+    /* Make the manifest key of an output from the source hash and its settings. */
+    [[nodiscard]] std::string GetOutputKey(const std::string& settings) const;
+    /* Check if an output file can be kept instead of being computed again. */
+    bool IsOutputUpToDate(const std::string& fileName, const std::string& key);
+    /* Record a written output file in the manifest. */
+    void RecordOutput(const std::string& fileName, const std::string& key);
 
 public:
-    /* Read a RGBE src image from a given path and name. */
+    /* Read a RGBE src image from a given path and name, and its manifest. */
     void ReadFile(const std::string& fileName);
+    /* Set the number of worker threads, 0 means the hardware thread count. */
+    void SetThreadCount(uint32_t newNThreads);
+    /* Turn the filtered importance sampling on or off. */
+    void SetFiltered(bool newFiltered);
+    /* Turn the output files on or off. */
+    void SetSaveOutput(bool newSaveOutput);
+    /* Compute all the outputs even if they are up to date. */
+    void SetForced(bool newForced);
+    /* Keep the source as packed RGBE to bound the memory of large sources. */
+    void SetPacked(bool newPacked);
+    /* Write the outputs as half float cube files instead of png files. */
+    void SetCubeFileOutput(bool newCubeFileOutput);
     /* Process the Monte-Carlo estimation. Will be inherited by child classes. */
     virtual void Processing(uint32_t nSamples, uint32_t outWidth, uint32_t outHeight) = 0;
+    /* Get the number of output cube maps. */
+    [[nodiscard]] virtual uint32_t GetOutputCount() const = 0;
+    /* Get an output cube map. */
+    [[nodiscard]] virtual const CubeImage& GetOutput(uint32_t index) const = 0;
+    /* Compute the root mean square error between two cube images of the same size. */
+    static float RMSE(const CubeImage& a, const CubeImage& b);
     /* Destruct all the allocated data. */
     virtual ~Cube();
 };
@@ -6,40 +6,17 @@
 
 #include "stb_image.h"
 #include "stb_image_write.h"
-
-
-/**
- * @brief Generate the Van Der Corput sequence
- * @param bits The sample index.
- * @return The sequence.
- */
-float GGX::RadicalInverse_VdC(unsigned int bits){
-    bits = (bits << 16u) | (bits >> 16u);
-    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
-    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
-    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
-    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-    return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
-}
-
-
-/**
- * @brief Generate the Hammersley sequence.
- * @param i The current sample index.
- * @param N The total number of samples/
- * @return The sequence.
- */
-std::pair<float,float> GGX::Hammersley(unsigned int i, unsigned int N){
-    return std::make_pair(float(i)/float(N),RadicalInverse_VdC(i));
-}
+#include <cstring>
+#include <fstream>
 
 
 /**
  * @brief Make a GGX sample based on the Hammersley Sequence.
  * @param Xi The Hammersley Sequence.
+ * @param roughness The roughness of the surface.
  * @return The sampled direction.
  */
-XZM::vec3 GGX::MakeSample(const std::pair<float,float>& Xi) const{
+XZM::vec3 GGX::MakeSample(const std::pair<float,float>& Xi, float roughness){
 
     float a = roughness * roughness;
     float Phi = 2 * (float)M_PI * Xi.first;
@@ -54,6 +31,37 @@ XZM::vec3 GGX::MakeSample(const std::pair<float,float>& Xi) const{
 }
 
 
+/**
+ * @brief Build the sample table of a roughness level. With V = N, the reflected L has NoL = 2 * z * z - 1,
+ * so it only depends on the sample and is stored as the sample's weight.
+ * @param level The roughness level, the roughness is level / numLevels.
+ */
+void GGX::BuildSampleTable(int level){
+
+    /* Roughness is [0.0,1.0). */
+    float roughness = (float)level / numLevels;
+
+    sampleTables[level] = SampleTable();
+    for (uint32_t i = 0; i < nSamples; ++i) {
+        XZM::vec3 sampleDir = MakeSample(Hammersley(i, nSamples), roughness);
+        float NoL = std::max(0.0f, std::min(1.0f, 2.0f * sampleDir.data[2] * sampleDir.data[2] - 1.0f));
+
+        if(NoL > 0){
+            /* The pdf of the half vector is D * NoH. A roughness of 0 is a delta, always level 0. */
+            float a = roughness * roughness;
+            float lod = 0.0f;
+            if(a > 0){
+                float NoH = sampleDir.data[2];
+                float d = NoH * NoH * (a * a - 1.0f) + 1.0f;
+                float D = (a * a) / ((float)M_PI * d * d);
+                lod = GetSampleLod(D * NoH);
+            }
+            sampleTables[level].Add(sampleDir, NoL, lod);
+        }
+    }
+}
+
+
 /**
  * @brief Importance sampling around the bright directions/
  * @param dir The direction of the surface normal.
@@ -78,6 +86,7 @@ XZM::vec3 GGX::SumBrightDirection(const XZM::vec3& dir){
 
 /**
  * @brief An override function for doing the GGX Monte-Carlo.
+ * The rows of all the faces and all the roughness levels are sampled by one thread pool, with no barrier between levels.
  * @param newNSamples The number of samples.
  * @param outWidth The output image width.
  * @param outHeight The output image height.
@@ -88,129 +97,142 @@ void GGX::Processing(uint32_t newNSamples, uint32_t outWidth, uint32_t outHeight
     outMapHeight = outHeight;
     nSamples = newNSamples;
 
-    ProcessBright();
-
-    for (int face = 0; face < 6; face++) {
-        outMaps[face] = new XZM::vec3 *[outMapHeight];
-        for (int row = 0; row < outMapHeight; row++) {
-            outMaps[face][row] = new XZM::vec3[outMapWidth];
+    /* Only the levels whose inputs changed since the last run are sampled again.
+     * A cube file holds all the levels, so they are all sampled again if it is out of date. */
+    std::vector<int> pendingLevels;
+    bool cubeFilePending = cubeFileOutput && !IsOutputUpToDate(GetCubeFileName(), GetCubeFileKey());
+    for(int level = 0; level < numLevels; level++){
+        if(cubeFileOutput ? !cubeFilePending : IsOutputUpToDate(GetLevelFileName(level), GetLevelKey(level))){
+            printf("GGX: %s is up to date, skipped.\n", cubeFileOutput ? GetCubeFileName().c_str() : GetLevelFileName(level).c_str());
+            continue;
         }
+        pendingLevels.push_back(level);
+    }
+    bool brdfPending = !IsOutputUpToDate(GetBRDFFileName(), GetBRDFKey());
+    if(pendingLevels.empty() && !brdfPending){
+        printf("GGX: All the outputs are up to date.\n");
+        return;
+    }
+
+    /* The LUT alone does not need the source. */
+    if(!pendingLevels.empty()){
+        LoadSource();
+        ProcessBright();
+        BuildMipChain();
     }
 
-    brdf = new XZM::vec3*[10];
-    for(auto i = 0; i < 10; i++){
-        brdf[i] = new XZM::vec3[10];
+    if(brdfPending){
+        brdfLUT.assign(2 * (size_t)brdfSize * brdfSize, 0.0f);
     }
 
-    /* Create different output based on the roughness values. */
-    for(int mip = 0; mip < 10; mip++) {
-        /* Roughness is [0.0,1.0). */
-        roughness = (float)mip / 10;
+    for(int level : pendingLevels){
+        levelMaps[level].Allocate(outMapWidth, outMapHeight);
+        BuildSampleTable(level);
+        levelRowsLeft[level] = 6 * outMapHeight;
+        levelWorkTime[level] = 0;
+    }
+
+    ThreadPool pool(nThreads);
+    printf("GGX: Sampling %zu roughness levels with %u threads... \n", pendingLevels.size(), pool.GetThreadCount());
+    startTime = std::chrono::high_resolution_clock::now();
+
+    /* Each row of each face of each level is a work item. */
+    for(int level : pendingLevels) {
         for (int face = 0; face < 6; face++) {
-            threads[face] = std::thread(&GGX::ProcessingFace, this, static_cast<EFace>(face));
+            for(uint32_t v = 0; v < outMapHeight; v++){
+                pool.Submit([this, level, face, v]{ ProcessingRow(level, static_cast<EFace>(face), v); });
+            }
         }
-
-        for (auto face = 0; face < 6; face++) {
-            threads[face].join();
+    }
+    /* The BRDF LUT does not depend on the cube, its rows run in the same pool. */
+    if(brdfPending){
+        for(uint32_t row = 0; row < brdfSize; row++){
+            pool.Submit([this, row]{ ProcessBRDF(row); });
         }
+    }
+    pool.Wait();
 
-        SaveOutput();
-        ClearOutput();
-        ProcessBRDF();
+    auto endTime = std::chrono::high_resolution_clock::now();
+    float elapsed = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+    float totalSamples = (float)nSamples * (float)outMapWidth * (float)outMapHeight * 6.0f * (float)pendingLevels.size();
+    printf("GGX: Sampling finished in %.2f ms, %.2f M samples/s.\n", elapsed, totalSamples / elapsed / 1000.0f);
+
+    if(saveOutput && cubeFilePending){
+        SaveCubeFile();
+        RecordOutput(GetCubeFileName(), GetCubeFileKey());
+    }
+    if(saveOutput && brdfPending){
+        SaveBRDF();
+        RecordOutput(GetBRDFFileName(), GetBRDFKey());
     }
-    SaveBRDF();
 }
 
 
 /**
- * @brief Process the Lambertian Monte-Carlo for a given output face.
+ * @brief Called when a row is finished. When it is the last row of a level, save that level and print its timing.
+ * @param level The roughness level of the row.
+ * @param workTime The time spent on the row in microseconds.
+ */
+void GGX::FinishRow(int level, int64_t workTime){
+
+    levelWorkTime[level] += workTime;
+    if(--levelRowsLeft[level] != 0) return;
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("GGX: Roughness level %d finished at %.2f ms, %.2f ms of work.\n", level,
+           std::chrono::duration<float, std::milli>(endTime - startTime).count(), (float)levelWorkTime[level] / 1000.0f);
+
+    /* The cube file is saved once all the levels are done. */
+    if(saveOutput && !cubeFileOutput){
+        SaveOutput(level);
+        RecordOutput(GetLevelFileName(level), GetLevelKey(level));
+    }
+}
+
+
+/**
+ * @brief Process the GGX Monte-Carlo for a row of a given output face and roughness level.
+ * @param level The roughness level, the roughness is level / numLevels.
  * @param face The face index.
+ * @param v The row index.
  */
-void GGX::ProcessingFace(EFace face) {
+void GGX::ProcessingRow(int level, EFace face, uint32_t v) {
+
+    auto rowStart = std::chrono::high_resolution_clock::now();
 
-    printf("GGX: Sampling face %d/6 and roughness %f ... \n", face,roughness);
     XZM::vec3 sc;
     XZM::vec3 tc;
     XZM::vec3 rc;
+    GetFaceBasis(face, sc, tc, rc);
 
-    if (face == EFace::Right) {
-        sc = XZM::vec3(0.0f, 0.0f, -1.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(1.0f, 0.0f, 0.0f);
-    }
-    else if (face == EFace::Left) {
-        sc = XZM::vec3(0.0f, 0.0f, 1.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(-1.0f, 0.0f, 0.0f);
-    }
-    else if (face == EFace::Front) {
-        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, 0.0f, 1.0f);
-        rc = XZM::vec3(0.0f, 1.0f, 0.0f);
-    }
-    else if (face == EFace::Back) {
-        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, 0.0f, -1.0f);
-        rc = XZM::vec3(0.0f, -1.0f, 0.0f);
-    }
-    else if (face == EFace::Up) {
-        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(0.0f, 0.0f, 1.0f);
-    }
-    else if (face == EFace::Down) {
-        sc = XZM::vec3(-1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(0.0f, 0.0f, -1.0f);
-    }
-
-    for (uint32_t v = 0; v < (uint32_t) outMapHeight; v++) {
-        for (uint32_t u = 0; u < (uint32_t) outMapWidth; u++) {
-            /* Find the Normal, Tangent, and BiTangent to the output pixel. */
-            XZM::vec3 N = XZM::Normalize(rc + sc * (2.0f * ((float) u + 0.5f) / (float) outMapHeight - 1.0f) +
-                                         tc * (2.0f * ((float) v + 0.5f) / (float) outMapWidth - 1.0f));
-            XZM::vec3 temp = (abs(N.data[2]) < 0.99f ? XZM::vec3(0.0f, 0.0f, 1.0f) : XZM::vec3(1.0f, 0.0f, 0.0f));
-            XZM::vec3 TX = XZM::Normalize(XZM::CrossProduct(temp, N));
-            XZM::vec3 TY = XZM::Normalize(XZM::CrossProduct(N, TX));
-
-            XZM::vec3 V = N;
-
-            XZM::vec3 acc = XZM::vec3(0.0f, 0.0f, 0.0f);
-            float totalWeight = 0;
-
-            for (uint32_t i = 0; i < uint32_t(nSamples); ++i) {
-                /* Generate a sample based on the Hammersley sequence. */
-                auto Xi = Hammersley(i, nSamples);
-                XZM::vec3 sampleDir = MakeSample(Xi);
-                sampleDir = XZM::Normalize(XZM::vec3(TX * sampleDir.data[0] + TY * sampleDir.data[1] + N * sampleDir.data[2]));
-
-                XZM::vec3 L = XZM::Normalize(sampleDir *2 * XZM::DotProduct( V, sampleDir ) - V);
-                float NoL = std::max(0.0f, std::min(1.0f, XZM::DotProduct(N,L)));
-
-                if(NoL > 0){
-                    /* Find its correspond cube map. */
-                    acc += Projection(sampleDir) * NoL;
-                    totalWeight += NoL;
-                }
-            }
-            /* Average the result. */
-            acc = acc * (1.0f / totalWeight);
-            acc += (SumBrightDirection(N));
-            outMaps[face][v][u] = acc;
+    for (uint32_t u = 0; u < (uint32_t) outMapWidth; u++) {
+        /* Find the Normal, Tangent, and BiTangent to the output pixel. */
+        XZM::vec3 N = XZM::Normalize(rc + sc * (2.0f * ((float) u + 0.5f) / (float) outMapHeight - 1.0f) +
+                                     tc * (2.0f * ((float) v + 0.5f) / (float) outMapWidth - 1.0f));
+        XZM::vec3 temp = (abs(N.data[2]) < 0.99f ? XZM::vec3(0.0f, 0.0f, 1.0f) : XZM::vec3(1.0f, 0.0f, 0.0f));
+        XZM::vec3 TX = XZM::Normalize(XZM::CrossProduct(temp, N));
+        XZM::vec3 TY = XZM::Normalize(XZM::CrossProduct(N, TX));
 
+        XZM::vec3 acc = IntegrateTable(sampleTables[level], N, TX, TY);
 
-        }
+        /* Average the result. */
+        acc = acc * (1.0f / sampleTables[level].totalWeight);
+        acc += (SumBrightDirection(N));
+        levelMaps[level].Set(face, u, v, acc);
     }
-    printf("GGX: Sampling face %d/6 and roughness %f Finished.\n",face+1,roughness);
+
+    auto rowEnd = std::chrono::high_resolution_clock::now();
+    FinishRow(level, std::chrono::duration_cast<std::chrono::microseconds>(rowEnd - rowStart).count());
 }
 
 
 /**
  * @brief Calculate the Schlick-GGX geometry function.
  * @param NoV Dot product of normal and view direction.
+ * @param roughness The roughness of the surface.
  * @return BRDF convolution.
  */
-float GGX::GeometrySchlickGGX(float NoV) const{
+float GGX::GeometrySchlickGGX(float NoV, float roughness){
     float a = roughness;
     float k = (a * a) / 2.0f;
 
@@ -226,24 +248,28 @@ float GGX::GeometrySchlickGGX(float NoV) const{
  * @param N The normal.
  * @param V The view direction.
  * @param L The light direction.
+ * @param roughness The roughness of the surface.
  * @return The G term.
  */
-float GGX::GeometrySmith(const XZM::vec3& N, const XZM::vec3& V, const XZM::vec3& L){
+float GGX::GeometrySmith(const XZM::vec3& N, const XZM::vec3& V, const XZM::vec3& L, float roughness){
     float NoV = std::max(XZM::DotProduct(N, V), 0.0f);
     float NoL = std::max(XZM::DotProduct(N, L), 0.0f);
-    float ggx2 = GeometrySchlickGGX(NoV);
-    float ggx1 = GeometrySchlickGGX(NoL);
+    float ggx2 = GeometrySchlickGGX(NoV, roughness);
+    float ggx1 = GeometrySchlickGGX(NoL, roughness);
     return ggx1 * ggx2;
 }
 
 
 /**
- * @brief Pre-compute the BRDF.
+ * @brief Pre-compute a row of the BRDF LUT. The texels are sampled at their centers, NoV on x and roughness on y.
+ * @param row The row of the LUT.
  */
-void GGX::ProcessBRDF(){
+void GGX::ProcessBRDF(uint32_t row){
+
+    float roughness = ((float)row + 0.5f) / (float)brdfSize;
 
-    for(int i = 0; i < 10; i++){
-        float NoV = (float)i / 10;
+    for(uint32_t i = 0; i < brdfSize; i++){
+        float NoV = ((float)i + 0.5f) / (float)brdfSize;
         XZM::vec3 V;
         V.data[0] = sqrt( 1.0f - NoV * NoV ); // sin
         V.data[1] = 0;
@@ -256,9 +282,9 @@ void GGX::ProcessBRDF(){
         XZM::vec3 TX = XZM::Normalize(XZM::CrossProduct(temp, N));
         XZM::vec3 TY = XZM::Normalize(XZM::CrossProduct(N, TX));
 
-        for(auto j = 0; j < nSamples; j++ ){
-            auto Xi = Hammersley( j, nSamples );
-            XZM::vec3 sampleDir = MakeSample(Xi);
+        for(uint32_t j = 0; j < brdfSamples; j++ ){
+            auto Xi = Hammersley( j, brdfSamples );
+            XZM::vec3 sampleDir = MakeSample(Xi, roughness);
             sampleDir = XZM::Normalize(XZM::vec3(TX * sampleDir.data[0] + TY * sampleDir.data[1] + N * sampleDir.data[2]));
             XZM::vec3 L = sampleDir * 2 * XZM::DotProduct( V, sampleDir ) - V;
             float NoL = std::max(0.0f, std::min(1.0f, L.data[2]));
@@ -266,34 +292,36 @@ void GGX::ProcessBRDF(){
             float VoH = std::max(0.0f, std::min(1.0f, XZM::DotProduct(V,sampleDir)));
 
             if( NoL > 0 ){
-                float G = GeometrySmith(N, V, L);
+                float G = GeometrySmith(N, V, L, roughness);
                 float G_Vis = (G * VoH) / (NoH * std::max(NoV,0.00001f));
                 float Fc = pow(1.0f - VoH, 5.0f);
                 A += (1.0f - Fc) * G_Vis;
                 B += Fc * G_Vis;
             }
         }
-        A /= float(nSamples);
-        B /= float(nSamples);
-        brdf[(size_t)(roughness*10)][i] = XZM::vec3(A,B,0);
+        A /= float(brdfSamples);
+        B /= float(brdfSamples);
+        brdfLUT[2 * ((size_t)row * brdfSize + i)] = A;
+        brdfLUT[2 * ((size_t)row * brdfSize + i) + 1] = B;
     }
 }
 
 
 /**
- * @brief Save the output as a png file.
+ * @brief Save the output of a roughness level as a png file.
+ * @param level The roughness level.
  */
-void GGX::SaveOutput() {
+void GGX::SaveOutput(int level) {
 
     auto* dst = new stbi_uc[outMapWidth*outMapHeight*4*6];
 
     /* Save each face. */
     for(int face = 0; face < 6; face++){
-        ReadFace(dst, static_cast<EFace>(face), outMapWidth, outMapHeight);
+        ReadFace(levelMaps[level], dst, static_cast<EFace>(face), outMapWidth, outMapHeight);
     }
 
     /* Save to png. */
-    std::string outFileName = srcName + "_ggx_" + std::to_string((int)(roughness*10)) + ".png";
+    std::string outFileName = GetLevelFileName(level);
     printf("GGX: Save Output to. %s ...\n",outFileName.c_str());
     stbi_write_png(outFileName.c_str(), (int)outMapWidth, (int)outMapHeight*6, 4, dst, (int)outMapWidth * 4);
 
@@ -302,34 +330,137 @@ void GGX::SaveOutput() {
 
 
 /**
- * @brief Save the pre-compute BRDF to a LUT.
+ * @brief Save the roughness levels as the mip levels of one half float cube file.
+ * The mip level 0 keeps the output size, so a small output has fewer mip levels than roughness levels.
+ * The mip level i of L levels takes the roughness level closest to i / L and is resampled to its mip size.
  */
-void GGX::SaveBRDF(){
-    auto* dst = new stbi_uc[10*10*3];
+void GGX::SaveCubeFile(){
 
-    for(auto i = 0; i < 10; i++){
-        for(auto j = 0; j < 10; j++){
-            dst[i*30 + j*3    ] =  (stbi_uc)(255*brdf[i][j].data[0]);
-            dst[i*30 + j*3 + 1] = (stbi_uc)(255*brdf[i][j].data[1]);
-            dst[i*30 + j*3 + 2] = (stbi_uc)(255*brdf[i][j].data[2]);
-        }
-    }
+    std::string outFileName = GetCubeFileName();
+    printf("GGX: Save Output to. %s ...\n",outFileName.c_str());
 
-    /* Save to png. */
-    std::string outFileName = srcName + "_ggx_brdf.png";
-    stbi_write_png(outFileName.c_str(), 10, 10, 3, dst, 30);
+    uint32_t mipLevels = 1;
+    while(mipLevels < (uint32_t)numLevels && (outMapWidth >> mipLevels) != 0){
+        mipLevels++;
+    }
 
-    delete[] dst;
+    std::vector<const CubeImage*> levels;
+    for(uint32_t i = 0; i < mipLevels; i++){
+        levels.push_back(&levelMaps[(i * numLevels + mipLevels / 2) / mipLevels]);
+    }
+    Cube::SaveCubeFile(outFileName, levels, outMapWidth);
 }
 
 
-GGX::~GGX() {
-    if(brdf == nullptr){
-        return;
+/**
+ * @brief Save the pre-compute BRDF LUT as a half float file (.xzlut), the layout is described in Cube.h.
+ */
+void GGX::SaveBRDF(){
+
+    std::string outFileName = GetBRDFFileName();
+    printf("GGX: Save BRDF LUT to. %s ...\n",outFileName.c_str());
+
+    std::ofstream file(outFileName, std::ios::binary);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the BRDF LUT output file.");
     }
 
-    for(auto i = 0; i < 10; i++){
-        delete[] brdf[i];
+    const uint32_t header[3] = {brdfSize, brdfSize, 2};
+    file.write("XZLT", 4);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    std::vector<uint16_t> halfs(brdfLUT.size());
+    for(size_t i = 0; i < brdfLUT.size(); i++){
+        halfs[i] = FloatToHalf(brdfLUT[i]);
     }
-    delete[] brdf;
+    file.write(reinterpret_cast<const char*>(halfs.data()), (std::streamsize)(halfs.size() * sizeof(uint16_t)));
+}
+
+
+/**
+ * @brief Get the output file path and name of a roughness level.
+ * @param level The roughness level.
+ * @return The png file next to the source.
+ */
+std::string GGX::GetLevelFileName(int level) const{
+    return srcName + "_ggx_" + std::to_string(level) + ".png";
+}
+
+
+/**
+ * @brief Get the manifest key of a roughness level, the source hash and all the settings changing the result.
+ * @param level The roughness level.
+ * @return The key.
+ */
+std::string GGX::GetLevelKey(int level) const{
+    return GetOutputKey("mode=GGX level=" + std::to_string(level) + " samples=" + std::to_string(nSamples) +
+                        " size=" + std::to_string(outMapWidth) + "x" + std::to_string(outMapHeight) +
+                        " filtered=" + (filtered ? "1" : "0"));
+}
+
+
+/**
+ * @brief Get the output file path and name of the cube file holding all the levels.
+ * @return The .xzcube file next to the source.
+ */
+std::string GGX::GetCubeFileName() const{
+    return srcName + "_ggx.xzcube";
+}
+
+
+/**
+ * @brief Get the manifest key of the cube file, the source hash and all the settings changing any level.
+ * @return The key.
+ */
+std::string GGX::GetCubeFileKey() const{
+    return GetOutputKey("mode=GGX levels=" + std::to_string(numLevels) + " samples=" + std::to_string(nSamples) +
+                        " size=" + std::to_string(outMapWidth) + "x" + std::to_string(outMapHeight) +
+                        " filtered=" + (filtered ? "1" : "0"));
+}
+
+
+/**
+ * @brief Get the output file path and name of the BRDF LUT.
+ * @return The .xzlut file next to the source.
+ */
+std::string GGX::GetBRDFFileName() const{
+    return srcName + "_ggx_brdf.xzlut";
 }
+
+
+/**
+ * @brief Get the manifest key of the BRDF LUT. It does not depend on the source, so there is no hash in it.
+ * @return The key.
+ */
+std::string GGX::GetBRDFKey() const{
+    return "mode=BRDF size=" + std::to_string(brdfSize) + " samples=" + std::to_string(brdfSamples);
+}
+
+
+/**
+ * @brief Set the size of the BRDF LUT.
+ * @param newBRDFSize The width and the height of the LUT.
+ */
+void GGX::SetBRDFSize(uint32_t newBRDFSize){
+    brdfSize = std::max(1u, newBRDFSize);
+}
+
+
+/**
+ * @brief Get the number of output cube maps.
+ * @return The number of roughness levels.
+ */
+uint32_t GGX::GetOutputCount() const{
+    return numLevels;
+}
+
+
+/**
+ * @brief Get an output cube map.
+ * @param index The roughness level.
+ * @return The pre-filtered cube of that level.
+ */
+const CubeImage& GGX::GetOutput(uint32_t index) const{
+    return levelMaps[index];
+}
+
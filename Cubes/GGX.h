@@ -6,6 +6,8 @@
 #define CUBES_GGX_H
 
 #include "Cube.h"
+#include <atomic>
+#include <chrono>
 
 /** Reference: Inspired by https://blog.selfshadow.com/publications/s2013-shading-course/karis/s2013_pbs_epic_notes_v2.pdf
  *  and https://learnopengl.com/PBR/IBL/Specular-IBL
@@ -17,38 +19,83 @@
  */
 class GGX : public Cube{
 
-    /* The roughness input of the GGX sampling. from 0.0 to 1.0 */
-    float roughness = 0.0f;
+    /* Number of roughness levels, roughness of level i is i / numLevels. */
+    static constexpr int numLevels = 10;
 
-    XZM::vec3** brdf = nullptr;
+    /* The number of samples for each texel of the BRDF LUT. It does not depend on the environment, so it is fixed. */
+    static constexpr uint32_t brdfSamples = 1024;
+
+    /* The size of the BRDF LUT, NoV on x and roughness on y. */
+    uint32_t brdfSize = 256;
+
+    /* The integrated BRDF LUT, the scale and the bias of F0 for each texel. */
+    std::vector<float> brdfLUT;
+
+    /* The output faces of each roughness level. */
+    std::array<CubeImage,numLevels> levelMaps;
+
+    /* Number of rows left to sample in each level. */
+    std::array<std::atomic<uint32_t>,numLevels> levelRowsLeft{};
+
+    /* Time spent on sampling each level, summed over all the threads. */
+    std::array<std::atomic<int64_t>,numLevels> levelWorkTime{};
+
+    /* The GGX samples of each roughness level, shared by all the texels. */
+    std::array<SampleTable,numLevels> sampleTables;
+
+    /* When the sampling starts. */
+    std::chrono::high_resolution_clock::time_point startTime;
 
-    /* The Van Der Corput sequence which mirrors a decimal binary representation around its decimal point. */
-    static float RadicalInverse_VdC(unsigned int bits);
-    /* The Hammersley Sequence for the low discrepancy sequence. */
-    static std::pair<float,float> Hammersley(unsigned int i, unsigned int N);
     /* Make a GGX sample based on the Hammersley Sequence. */
-    [[nodiscard]] XZM::vec3 MakeSample(const std::pair<float,float>& Xi) const;
+    [[nodiscard]] static XZM::vec3 MakeSample(const std::pair<float,float>& Xi, float roughness);
 
     /* Bright Importance Sampling. */
     XZM::vec3 SumBrightDirection(const XZM::vec3& dir) override;
 
     /* Compute the G-Term. */
-    float GeometrySchlickGGX(float NdotV) const;
-    float GeometrySmith(const XZM::vec3& N, const XZM::vec3& V, const XZM::vec3& L);
+    static float GeometrySchlickGGX(float NdotV, float roughness);
+    static float GeometrySmith(const XZM::vec3& N, const XZM::vec3& V, const XZM::vec3& L, float roughness);
+
+    /* Build the sample table of a roughness level. */
+    void BuildSampleTable(int level);
+
+    /* Called when a row is finished, save the level when all its rows are done. */
+    void FinishRow(int level, int64_t workTime);
+
+    /* Get the output file path and name of a roughness level. */
+    [[nodiscard]] std::string GetLevelFileName(int level) const;
+    /* Get the manifest key of a roughness level. */
+    [[nodiscard]] std::string GetLevelKey(int level) const;
+    /* Get the output file path and name of the cube file holding all the levels. */
+    [[nodiscard]] std::string GetCubeFileName() const;
+    /* Get the manifest key of the cube file. */
+    [[nodiscard]] std::string GetCubeFileKey() const;
+    /* Get the output file path and name of the BRDF LUT. */
+    [[nodiscard]] std::string GetBRDFFileName() const;
+    /* Get the manifest key of the BRDF LUT. */
+    [[nodiscard]] std::string GetBRDFKey() const;
 
 public:
     /* An override function for doing the GGX Monte-Carlo. */
     void Processing(uint32_t newNSamples, uint32_t outWidth, uint32_t outHeight) override;
-    /* Process the Lambertian Monte-Carlo for a given output face. */
-    void ProcessingFace(EFace face);
-    /* Pre-compute the BRDF. */
-    void ProcessBRDF();
-    /* Save the integrated BRDF to a LUT. */
+    /* Process the GGX Monte-Carlo for a row of a given output face and roughness level. */
+    void ProcessingRow(int level, EFace face, uint32_t v);
+    /* Pre-compute a row of the BRDF LUT. */
+    void ProcessBRDF(uint32_t row);
+    /* Save the integrated BRDF LUT as a half float file. */
     void SaveBRDF();
-    /* Save the output as a png file. */
-    void SaveOutput();
+    /* Set the size of the BRDF LUT. */
+    void SetBRDFSize(uint32_t newBRDFSize);
+    /* Save the output of a roughness level as a png file. */
+    void SaveOutput(int level);
+    /* Save all the roughness levels as the mip levels of one half float cube file. */
+    void SaveCubeFile();
+
+    /* Get the number of output cube maps. */
+    [[nodiscard]] uint32_t GetOutputCount() const override;
+    /* Get an output cube map. */
+    [[nodiscard]] const CubeImage& GetOutput(uint32_t index) const override;
 
-    ~GGX() override;
 };
 
 
@@ -3,6 +3,7 @@
 //
 
 #include "Lambertian.h"
+#include <chrono>
 
 #include "stb_image.h"
 
@@ -11,26 +12,43 @@
 
 
 /**
- * @brief Sample a direction. Since it's lambertian we uniformly pick a random direction.
+ * @brief Make a cosine-weighted sample based on the Hammersley Sequence.
+ * The sequence is the same for every texel and every run, so the output does not depend on the thread count.
+ * @param Xi The Hammersley Sequence.
  * @return The sampled direction.
  */
-XZM::vec3 Lambertian::MakeSample(){
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<> dis(0, 1);
-
-    /* Random around phi and r^2. */
-    XZM::vec3 rv((float)dis(gen), (float)dis(gen),1);
-    float phi = rv.data[0] * 2.0f * (float)M_PI;
-    float r = std::sqrt(rv.data[1]);
+XZM::vec3 Lambertian::MakeSample(const std::pair<float,float>& Xi){
+
+    /* Uniform around phi and r^2. */
+    float phi = Xi.first * 2.0f * (float)M_PI;
+    float r = std::sqrt(Xi.second);
     return {
             std::cos(phi) * r,
             std::sin(phi) * r,
-            std::sqrt(1.0f - rv.data[1])
+            std::sqrt(1.0f - Xi.second)
     };
 }
 
 
+/**
+ * @brief Build the sample table. With V = N, the reflected L has NoL = 2 * z * z - 1,
+ * so the samples that would be rejected can be dropped here once for all the texels.
+ */
+void Lambertian::BuildSampleTable(){
+
+    sampleTable = SampleTable();
+    for (uint32_t i = 0; i < nSamples; ++i) {
+        XZM::vec3 sampleDir = MakeSample(Hammersley(i, nSamples));
+        float NoL = std::max(0.0f, std::min(1.0f, 2.0f * sampleDir.data[2] * sampleDir.data[2] - 1.0f));
+
+        if(NoL > 0){
+            /* Cosine-weighted, pdf = cos / pi. */
+            sampleTable.Add(sampleDir, NoL, GetSampleLod(sampleDir.data[2] / (float)M_PI));
+        }
+    }
+}
+
+
 /**
  * @brief Importance sampling around the bright directions/
  * @param dir The direction of the surface normal.
@@ -63,122 +81,139 @@ void Lambertian::Processing(uint32_t newNSamples, uint32_t outWidth, uint32_t ou
     outMapHeight = outHeight;
     nSamples = newNSamples;
 
+    if(IsOutputUpToDate(GetOutputFileName(), GetKey())){
+        printf("Lambertian: %s is up to date, skipped.\n", GetOutputFileName().c_str());
+        return;
+    }
+    LoadSource();
+
     /* Collect the brightest part. */
     //ProcessBright();
 
+    outMap.Allocate(outMapWidth, outMapHeight);
+    BuildMipChain();
+    BuildSampleTable();
+
+    ThreadPool pool(nThreads);
+    printf("Lambertian: Sampling with %u threads... \n", pool.GetThreadCount());
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    /* Each row of each face is a work item. */
     for(int face = 0; face < 6; face++){
-        outMaps[face] = new XZM::vec3*[outMapHeight];
-        for(int row = 0; row < outMapHeight; row++){
-            outMaps[face][row] = new XZM::vec3[outMapWidth];
+        for(uint32_t v = 0; v < outMapHeight; v++){
+            pool.Submit([this, face, v]{ ProcessingRow(static_cast<EFace>(face), v); });
         }
-        /* Create a new thread to process each face. */
-        threads[face] = std::thread(&Lambertian::ProcessingFace,this,static_cast<EFace>(face));
     }
     /* Wait for all the works are done. */
-    for(auto face = 0; face < 6; face++){
-        threads[face].join();
-    }
+    pool.Wait();
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    float elapsed = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+    float totalSamples = (float)nSamples * (float)outMapWidth * (float)outMapHeight * 6.0f;
+    printf("Lambertian: Sampling finished in %.2f ms, %.2f M samples/s.\n", elapsed, totalSamples / elapsed / 1000.0f);
+
     /* Save the data. */
-    SaveOutput();
+    if(saveOutput){
+        SaveOutput();
+        RecordOutput(GetOutputFileName(), GetKey());
+    }
 }
 
 
 /**
- * @brief Process the Lambertian Monte-Carlo for a given output face.
+ * @brief Process the Lambertian Monte-Carlo for a row of a given output face.
  * @param face The face we want to process.
+ * @param v The row we want to process.
  */
-void Lambertian::ProcessingFace(EFace face) {
+void Lambertian::ProcessingRow(EFace face, uint32_t v) {
 
-    printf("Lambertian: Sampling face %d/6... \n", face);
     XZM::vec3 sc;
     XZM::vec3 tc;
     XZM::vec3 rc;
-
-    if (face == EFace::Right) {
-        sc = XZM::vec3(0.0f, 0.0f, -1.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(1.0f, 0.0f, 0.0f);
-    }
-    else if (face == EFace::Left) {
-        sc = XZM::vec3(0.0f, 0.0f, 1.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(-1.0f, 0.0f, 0.0f);
+    GetFaceBasis(face, sc, tc, rc);
+
+    for (uint32_t u = 0; u < (uint32_t) outMapWidth; u++) {
+        /* Find the Normal, Tangent, and BiTangent to the output pixel. */
+        XZM::vec3 N = XZM::Normalize(rc + sc * (2.0f * ((float) u + 0.5f) / (float) outMapHeight - 1.0f) +
+                                     tc * (2.0f * ((float) v + 0.5f) / (float) outMapWidth - 1.0f));
+        XZM::vec3 temp = (abs(N.data[2]) < 0.99f ? XZM::vec3(0.0f, 0.0f, 1.0f) : XZM::vec3(1.0f, 0.0f, 0.0f));
+        XZM::vec3 TX = XZM::Normalize(XZM::CrossProduct(N, temp));
+        XZM::vec3 TY = XZM::CrossProduct(N, TX);
+
+        XZM::vec3 acc = IntegrateTable(sampleTable, N, TX, TY);
+
+        /* Average the result. */
+        acc = acc * M_PI * (1.0f / (float)sampleTable.Size());
+       // acc += (SumBrightDirection(N));
+        outMap.Set(face, u, v, acc);
     }
-    else if (face == EFace::Front) {
-        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, 0.0f, 1.0f);
-        rc = XZM::vec3(0.0f, 1.0f, 0.0f);
-    }
-    else if (face == EFace::Back) {
-        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, 0.0f, -1.0f);
-        rc = XZM::vec3(0.0f, -1.0f, 0.0f);
-    }
-    else if (face == EFace::Up) {
-        sc = XZM::vec3(1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(0.0f, 0.0f, 1.0f);
-    }
-    else if (face == EFace::Down) {
-        sc = XZM::vec3(-1.0f, 0.0f, 0.0f);
-        tc = XZM::vec3(0.0f, -1.0f, 0.0f);
-        rc = XZM::vec3(0.0f, 0.0f, -1.0f);
-    }
-
-    for (uint32_t v = 0; v < (uint32_t) outMapHeight; v++) {
-        for (uint32_t u = 0; u < (uint32_t) outMapWidth; u++) {
-            /* Find the Normal, Tangent, and BiTangent to the output pixel. */
-            XZM::vec3 N = XZM::Normalize(rc + sc * (2.0f * ((float) u + 0.5f) / (float) outMapHeight - 1.0f) +
-                                         tc * (2.0f * ((float) v + 0.5f) / (float) outMapWidth - 1.0f));
-            XZM::vec3 temp = (abs(N.data[2]) < 0.99f ? XZM::vec3(0.0f, 0.0f, 1.0f) : XZM::vec3(1.0f, 0.0f, 0.0f));
-            XZM::vec3 TX = XZM::Normalize(XZM::CrossProduct(N, temp));
-            XZM::vec3 TY = XZM::CrossProduct(N, TX);
-
-            XZM::vec3 V = N;
-            XZM::vec3 acc = XZM::vec3(0.0f, 0.0f, 0.0f);
-            float totalWeight = 0;
-
-            for (uint32_t i = 0; i < uint32_t(nSamples); ++i) {
-                /* Randomly make a sample. */
-                XZM::vec3 sampleDir = MakeSample();
-                sampleDir = XZM::Normalize(XZM::vec3(TX * sampleDir.data[0] + TY * sampleDir.data[1] + N * sampleDir.data[2]));
-
-                XZM::vec3 L = XZM::Normalize(sampleDir *2 * XZM::DotProduct( V, sampleDir ) - V);
-                float NoL = std::max(0.0f, std::min(1.0f, XZM::DotProduct(N,L)));
-
-                if(NoL > 0){
-                    /* Find its correspond cube map. */
-                    acc += Projection(sampleDir) * NoL;
-                    totalWeight ++;
-                }
-            }
-            /* Average the result. */
-            acc = acc * M_PI * (1.0f / totalWeight);
-           // acc += (SumBrightDirection(N));
-            outMaps[face][v][u] = acc;
-        }
-    }
-    printf("Lambertian: Sampling face %d/6 Finished.\n",face+1);
 }
 
 
 /**
- * @brief Save the output as a png file.
+ * @brief Save the output as a png file, or as a half float cube file with its full mip chain.
  */
 void Lambertian::SaveOutput(){
 
+    std::string outFileName = GetOutputFileName();
+    printf("Lambertian: Save Output to. %s ...\n",outFileName.c_str());
+
+    if(cubeFileOutput){
+        /* The renderer samples the irradiance with mipmaps, so every level is made from the output here. */
+        auto mipLevels = (uint32_t)std::floor(std::log2(std::max(outMapWidth, 1u))) + 1;
+        SaveCubeFile(outFileName, std::vector<const CubeImage*>(mipLevels, &outMap), outMapWidth);
+        return;
+    }
+
     auto* dst = new stbi_uc[outMapWidth*outMapHeight*4*6];
 
     /* Save each face. */
     for(int face = 0; face < 6; face++){
-        ReadFace(dst, static_cast<EFace>(face), outMapWidth, outMapHeight);
+        ReadFace(outMap, dst, static_cast<EFace>(face), outMapWidth, outMapHeight);
     }
 
     /* Save to png. */
-    std::string outFileName = srcName + "_lam.png";
-    printf("Lambertian: Save Output to. %s ...\n",outFileName.c_str());
     stbi_write_png(outFileName.c_str(), (int)outMapWidth, (int)outMapHeight*6, 4, dst, (int)outMapWidth * 4);
 
     delete[] dst;
 }
 
+
+
+/**
+ * @brief Get the output file path and name.
+ * @return The png or the cube file next to the source.
+ */
+std::string Lambertian::GetOutputFileName() const{
+    return srcName + (cubeFileOutput ? "_lam.xzcube" : "_lam.png");
+}
+
+
+/**
+ * @brief Get the manifest key of the output, the source hash and all the settings changing the result.
+ * @return The key.
+ */
+std::string Lambertian::GetKey() const{
+    return GetOutputKey("mode=Lambertian samples=" + std::to_string(nSamples) +
+                        " size=" + std::to_string(outMapWidth) + "x" + std::to_string(outMapHeight) +
+                        " filtered=" + (filtered ? "1" : "0"));
+}
+
+
+/**
+ * @brief Get the number of output cube maps.
+ * @return 1, the irradiance cube.
+ */
+uint32_t Lambertian::GetOutputCount() const{
+    return 1;
+}
+
+
+/**
+ * @brief Get an output cube map.
+ * @param index The index of the output, must be 0.
+ * @return The irradiance cube.
+ */
+const CubeImage& Lambertian::GetOutput([[maybe_unused]] uint32_t index) const{
+    return outMap;
+}
\ No newline at end of file
@@ -6,7 +6,6 @@
 #define CUBES_LAMBERTIAN_H
 
 #include "Cube.h"
-#include <random>
 
 /* Reference: Inspired by https://github.com/ixchow/15-466-ibl/blob/master/cubes/blur_cube.cpp */
 
@@ -16,18 +15,31 @@
  */
 class Lambertian : public Cube{
 
-    /* Sample a direction. */
-    static XZM::vec3 MakeSample();
+    /* Make a cosine-weighted sample based on the Hammersley Sequence. */
+    static XZM::vec3 MakeSample(const std::pair<float,float>& Xi);
+    /* The cosine-weighted samples shared by all the texels. */
+    SampleTable sampleTable;
+
+    /* Build the sample table. */
+    void BuildSampleTable();
     /* Importance sampling toward the bright directions. */
     XZM::vec3 SumBrightDirection(const XZM::vec3& dir) override;
+    /* Get the output file path and name. */
+    [[nodiscard]] std::string GetOutputFileName() const;
+    /* Get the manifest key of the output. */
+    [[nodiscard]] std::string GetKey() const;
 
 public:
     /* An override function for doing the Lambertian Monte-Carlo. */
     void Processing(uint32_t nSamples, uint32_t outWidth, uint32_t outHeight) override;
-    /* Process the Lambertian Monte-Carlo for a given output face. */
-    void ProcessingFace(EFace face);
+    /* Process the Lambertian Monte-Carlo for a row of a given output face. */
+    void ProcessingRow(EFace face, uint32_t v);
     /* Save the output as a png file. */
     void SaveOutput();
+    /* Get the number of output cube maps. */
+    [[nodiscard]] uint32_t GetOutputCount() const override;
+    /* Get an output cube map. */
+    [[nodiscard]] const CubeImage& GetOutput(uint32_t index) const override;
 };
 
 
@@ -0,0 +1,126 @@
+//
+// Created by Xuan Zhai on 2024/4/24.
+//
+
+#include "Manifest.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+
+/**
+ * @brief Get the manifest file name of a source file.
+ * @param srcName The source cube map path and name.
+ * @return The manifest file path and name.
+ */
+std::string Manifest::GetManifestFileName(const std::string& srcName){
+    return srcName + ".xzman";
+}
+
+
+/**
+ * @brief Get the file name without its directory.
+ * @param fileName The file path and name.
+ * @return The file name.
+ */
+std::string Manifest::GetBaseName(const std::string& fileName){
+    size_t slash = fileName.find_last_of("/\\");
+    return slash == std::string::npos ? fileName : fileName.substr(slash + 1);
+}
+
+
+/**
+ * @brief Hash some bytes with the 64 bits FNV-1a. The renderer uses the same hash to check the manifest.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The hash.
+ */
+uint64_t Manifest::Hash(const unsigned char* data, size_t size){
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < size; i++){
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+
+/**
+ * @brief Format a hash as 16 hex digits.
+ * @param hash The hash.
+ * @return The hex string.
+ */
+std::string Manifest::HashToString(uint64_t hash){
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+    return buffer;
+}
+
+
+/**
+ * @brief Read the manifest of a source file. Lines that cannot be parsed are dropped.
+ * @param srcName The source cube map path and name.
+ */
+void Manifest::Load(const std::string& srcName){
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    path = GetManifestFileName(srcName);
+    entries.clear();
+
+    std::ifstream file(path);
+    std::string line;
+    while(std::getline(file, line)){
+        size_t tab = line.find('\t');
+        if(tab == std::string::npos) continue;
+        entries[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+}
+
+
+/**
+ * @brief Check if an output file exists and was produced with the same key.
+ * @param fileName The output file path and name.
+ * @param key The key of the current inputs.
+ * @return True if the output can be kept.
+ */
+bool Manifest::IsUpToDate(const std::string& fileName, const std::string& key){
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto entry = entries.find(GetBaseName(fileName));
+    if(entry == entries.end() || entry->second != key){
+        return false;
+    }
+    return std::ifstream(fileName, std::ios::binary).is_open();
+}
+
+
+/**
+ * @brief Record the key of an output file that was just written, and save the manifest.
+ * The manifest is saved after each output, so an interrupted run keeps the outputs it finished.
+ * @param fileName The output file path and name.
+ * @param key The key of the inputs that produced it.
+ */
+void Manifest::Record(const std::string& fileName, const std::string& key){
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    entries[GetBaseName(fileName)] = key;
+    Save();
+}
+
+
+/**
+ * @brief Write all the entries to the manifest file. The caller holds the lock.
+ */
+void Manifest::Save(){
+
+    std::ofstream file(path, std::ios::trunc);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the manifest file.");
+    }
+    for(const auto& entry : entries){
+        file << entry.first << '\t' << entry.second << '\n';
+    }
+}
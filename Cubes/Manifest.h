@@ -0,0 +1,59 @@
+//
+// Created by Xuan Zhai on 2024/4/24.
+//
+
+#ifndef CUBES_MANIFEST_H
+#define CUBES_MANIFEST_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+
+/**
+ * @brief The manifest of the pre-computed outputs of a source cube map, stored next to it as <src>.xzman.
+ * Each line is an output file name (without its directory), a tab, and the key of the inputs that produced it,
+ * e.g. "src.png_ggx_3.png\thash=... mode=GGX level=3 samples=7000 size=64 filtered=1".
+ * An output is only computed again when its key changes or the file is gone.
+ */
+class Manifest {
+
+private:
+    /* The path of the manifest file. */
+    std::string path;
+
+    /* The key of each output file. */
+    std::map<std::string,std::string> entries;
+
+    /* Outputs are recorded from the worker threads. */
+    std::mutex mutex;
+
+    /* Get the file name without its directory. */
+    static std::string GetBaseName(const std::string& fileName);
+
+    /* Write all the entries to the manifest file. */
+    void Save();
+
+public:
+    /* Get the manifest file name of a source file. */
+    static std::string GetManifestFileName(const std::string& srcName);
+
+    /* Hash some bytes with the 64 bits FNV-1a. */
+    static uint64_t Hash(const unsigned char* data, size_t size);
+
+    /* Format a hash as 16 hex digits. */
+    static std::string HashToString(uint64_t hash);
+
+    /* Read the manifest of a source file, it is empty if there is no manifest yet. */
+    void Load(const std::string& srcName);
+
+    /* Check if an output file exists and was produced with the same key. */
+    bool IsUpToDate(const std::string& fileName, const std::string& key);
+
+    /* Record the key of an output file that was just written, and save the manifest. */
+    void Record(const std::string& fileName, const std::string& key);
+};
+
+
+#endif //CUBES_MANIFEST_H
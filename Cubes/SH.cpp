@@ -0,0 +1,226 @@
+//
+// Created by Xuan Zhai on 2024/4/21.
+//
+
+#include "SH.h"
+#include <chrono>
+#include <fstream>
+
+
+/**
+ * @brief Evaluate the 9 real spherical harmonics basis functions at a direction.
+ * @param dir The normalized direction.
+ * @param basis The 9 output values.
+ */
+void SH::EvaluateBasis(const XZM::vec3& dir, float* basis){
+    float x = dir.data[0];
+    float y = dir.data[1];
+    float z = dir.data[2];
+
+    basis[0] = 0.282095f;
+    basis[1] = 0.488603f * y;
+    basis[2] = 0.488603f * z;
+    basis[3] = 0.488603f * x;
+    basis[4] = 1.092548f * x * y;
+    basis[5] = 1.092548f * y * z;
+    basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+    basis[7] = 1.092548f * x * z;
+    basis[8] = 0.546274f * (x * x - y * y);
+}
+
+
+/**
+ * @brief The solid angle of the texel between two corners on a face.
+ * Reference: https://www.rorydriscoll.com/2012/01/15/cubemap-texel-solid-angle/
+ * @param x0 The left of the texel in [-1,1].
+ * @param y0 The top of the texel in [-1,1].
+ * @param x1 The right of the texel in [-1,1].
+ * @param y1 The bottom of the texel in [-1,1].
+ * @return The solid angle.
+ */
+float SH::TexelSolidAngle(float x0, float y0, float x1, float y1){
+    auto AreaElement = [](float x, float y){
+        return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+    };
+    return AreaElement(x0, y0) - AreaElement(x0, y1) - AreaElement(x1, y0) + AreaElement(x1, y1);
+}
+
+
+/**
+ * @brief An override function for projecting the cube into the coefficients.
+ * Every source texel is visited once, one task per row, instead of Monte-Carlo sampling every output texel.
+ * @param newNSamples Not used.
+ * @param outWidth The width of the evaluated output cube.
+ * @param outHeight The height of the evaluated output cube.
+ */
+void SH::Processing(uint32_t newNSamples, uint32_t outWidth, uint32_t outHeight){
+    outMapWidth = outWidth;
+    outMapHeight = outHeight;
+    nSamples = newNSamples;
+
+    /* The coefficients only depend on the source, the sample count and the output size are not used. */
+    if(IsOutputUpToDate(GetOutputFileName(), GetOutputKey("mode=SH"))){
+        printf("SH: %s is up to date, skipped.\n", GetOutputFileName().c_str());
+        return;
+    }
+    LoadSource();
+
+    rowSums.assign(6 * cubeMapHeight, {});
+
+    ThreadPool pool(nThreads);
+    printf("SH: Projecting with %u threads... \n", pool.GetThreadCount());
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for(int face = 0; face < 6; face++){
+        for(uint32_t v = 0; v < (uint32_t)cubeMapHeight; v++){
+            pool.Submit([this, face, v]{ ProcessingRow(static_cast<EFace>(face), v); });
+        }
+    }
+    pool.Wait();
+
+    /* Sum the rows in a fixed order, so the result does not depend on the thread count. */
+    std::array<double,27> sum{};
+    for(const auto& row : rowSums){
+        for(size_t i = 0; i < 27; i++){
+            sum[i] += row[i];
+        }
+    }
+
+    /* Convolve with the cosine lobe and divide by pi: A0 = pi, A1 = 2pi/3, A2 = pi/4. */
+    const float band[9] = {1.0f, 2.0f/3.0f, 2.0f/3.0f, 2.0f/3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+    for(size_t i = 0; i < 9; i++){
+        coefficients[i] = XZM::vec3((float)sum[3*i], (float)sum[3*i+1], (float)sum[3*i+2]) * band[i];
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("SH: Projection finished in %.2f ms.\n", std::chrono::duration<float, std::milli>(endTime - startTime).count());
+
+    /* Evaluate at the output texels, used by the comparison mode. */
+    outMap.Allocate(outMapWidth, outMapHeight);
+    for(int face = 0; face < 6; face++){
+        XZM::vec3 sc;
+        XZM::vec3 tc;
+        XZM::vec3 rc;
+        GetFaceBasis(static_cast<EFace>(face), sc, tc, rc);
+
+        for(uint32_t v = 0; v < outMapHeight; v++){
+            for(uint32_t u = 0; u < outMapWidth; u++){
+                XZM::vec3 N = XZM::Normalize(rc + sc * (2.0f * ((float) u + 0.5f) / (float) outMapWidth - 1.0f) +
+                                             tc * (2.0f * ((float) v + 0.5f) / (float) outMapHeight - 1.0f));
+                outMap.Set(face, u, v, Evaluate(N));
+            }
+        }
+    }
+
+    if(saveOutput){
+        SaveOutput();
+        RecordOutput(GetOutputFileName(), GetOutputKey("mode=SH"));
+    }
+}
+
+
+/**
+ * @brief Project a row of a source face into the basis, weighted by the texel solid angles.
+ * @param face The face we want to process.
+ * @param v The row we want to process.
+ */
+void SH::ProcessingRow(EFace face, uint32_t v){
+
+    XZM::vec3 sc;
+    XZM::vec3 tc;
+    XZM::vec3 rc;
+    GetFaceBasis(face, sc, tc, rc);
+
+    auto& sum = rowSums[face * cubeMapHeight + v];
+    float basis[9];
+
+    float y0 = 2.0f * (float)v / (float)cubeMapHeight - 1.0f;
+    float y1 = 2.0f * (float)(v + 1) / (float)cubeMapHeight - 1.0f;
+
+    for(uint32_t u = 0; u < (uint32_t)cubeMapWidth; u++){
+        float x0 = 2.0f * (float)u / (float)cubeMapWidth - 1.0f;
+        float x1 = 2.0f * (float)(u + 1) / (float)cubeMapWidth - 1.0f;
+
+        XZM::vec3 dir = XZM::Normalize(rc + sc * (0.5f * (x0 + x1)) + tc * (0.5f * (y0 + y1)));
+        float solidAngle = TexelSolidAngle(x0, y0, x1, y1);
+        float texel[3];
+        GetSourceTexel(((size_t)face * cubeMapHeight + v) * cubeMapWidth + u, texel);
+
+        EvaluateBasis(dir, basis);
+        for(size_t i = 0; i < 9; i++){
+            float w = basis[i] * solidAngle;
+            sum[3*i]   += texel[0] * w;
+            sum[3*i+1] += texel[1] * w;
+            sum[3*i+2] += texel[2] * w;
+        }
+    }
+}
+
+
+/**
+ * @brief Evaluate the coefficients at a direction.
+ * @param dir The normalized direction.
+ * @return The irradiance divided by pi.
+ */
+XZM::vec3 SH::Evaluate(const XZM::vec3& dir) const{
+    float basis[9];
+    EvaluateBasis(dir, basis);
+
+    XZM::vec3 ret = XZM::vec3();
+    for(size_t i = 0; i < 9; i++){
+        ret += coefficients[i] * basis[i];
+    }
+    /* Ringing can push it below 0 around very bright lights. */
+    for(auto& c : ret.data){
+        c = std::max(0.0f, c);
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Save the coefficients as a text file, one "r g b" line per coefficient.
+ */
+void SH::SaveOutput(){
+
+    std::string outFileName = GetOutputFileName();
+    printf("SH: Save Output to. %s ...\n",outFileName.c_str());
+
+    std::ofstream file(outFileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the SH output file.");
+    }
+
+    file.precision(9);
+    for(const auto& c : coefficients){
+        file << c.data[0] << " " << c.data[1] << " " << c.data[2] << "\n";
+    }
+}
+
+
+/**
+ * @brief Get the output file path and name.
+ * @return The text file next to the source.
+ */
+std::string SH::GetOutputFileName() const{
+    return srcName + "_sh.txt";
+}
+
+
+/**
+ * @brief Get the number of output cube maps.
+ * @return 1, the evaluated irradiance cube.
+ */
+uint32_t SH::GetOutputCount() const{
+    return 1;
+}
+
+
+/**
+ * @brief Get an output cube map, the coefficients evaluated at each texel.
+ * @param index The index of the output, must be 0.
+ * @return The evaluated irradiance cube.
+ */
+const CubeImage& SH::GetOutput([[maybe_unused]] uint32_t index) const{
+    return outMap;
+}
@@ -0,0 +1,51 @@
+//
+// Created by Xuan Zhai on 2024/4/21.
+//
+
+#ifndef CUBES_SH_H
+#define CUBES_SH_H
+
+#include "Cube.h"
+
+/** Reference: An Efficient Representation for Irradiance Environment Maps, Ramamoorthi and Hanrahan 2001.
+ *  https://graphics.stanford.edu/papers/envmap/envmap.pdf
+ */
+
+
+/**
+ * @brief A child class of Cube. Project the source cube into 9 spherical harmonics coefficients of the irradiance.
+ * The coefficients are already convolved with the cosine lobe and divided by pi,
+ * so evaluating them at a normal gives the irradiance over pi, which is what the renderer multiplies with the albedo.
+ */
+class SH : public Cube{
+
+    /* The 9 coefficients, RGB each. Order: l=0, l=1 (m=-1,0,1), l=2 (m=-2,-1,0,1,2). */
+    std::array<XZM::vec3,9> coefficients;
+
+    /* The projection of each row of each face, summed up in order once all the rows are done. */
+    std::vector<std::array<double,27>> rowSums;
+
+    /* Evaluate the 9 basis functions at a direction. */
+    static void EvaluateBasis(const XZM::vec3& dir, float* basis);
+    /* The solid angle of the texel between two corners on a face, in [-1,1] face coordinates. */
+    static float TexelSolidAngle(float x0, float y0, float x1, float y1);
+    /* Get the output file path and name. */
+    [[nodiscard]] std::string GetOutputFileName() const;
+
+public:
+    /* An override function for projecting the cube into the coefficients. The number of samples is not used. */
+    void Processing(uint32_t newNSamples, uint32_t outWidth, uint32_t outHeight) override;
+    /* Project a row of a source face into the basis. */
+    void ProcessingRow(EFace face, uint32_t v);
+    /* Evaluate the coefficients at a direction. */
+    [[nodiscard]] XZM::vec3 Evaluate(const XZM::vec3& dir) const;
+    /* Save the coefficients as a text file. */
+    void SaveOutput();
+    /* Get the number of output cube maps. */
+    [[nodiscard]] uint32_t GetOutputCount() const override;
+    /* Get an output cube map, the coefficients evaluated at each texel. */
+    [[nodiscard]] const CubeImage& GetOutput(uint32_t index) const override;
+};
+
+
+#endif //CUBES_SH_H
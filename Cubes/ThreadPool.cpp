@@ -0,0 +1,149 @@
+//
+// Created by Xuan Zhai on 2024/4/20.
+//
+
+#include "ThreadPool.h"
+
+
+/**
+ * @brief Create the pool and start the workers.
+ * @param nThreads The number of workers, 0 means the hardware thread count.
+ */
+ThreadPool::ThreadPool(uint32_t nThreads) {
+
+    if(nThreads == 0){
+        nThreads = std::thread::hardware_concurrency();
+    }
+    /* hardware_concurrency() may return 0 if it is unknown. */
+    if(nThreads == 0){
+        nThreads = 1;
+    }
+
+    for(uint32_t i = 0; i < nThreads; i++){
+        queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+    for(uint32_t i = 0; i < nThreads; i++){
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+
+/**
+ * @brief Get the number of workers.
+ * @return The number of workers.
+ */
+uint32_t ThreadPool::GetThreadCount() const {
+    return (uint32_t)workers.size();
+}
+
+
+/**
+ * @brief Add a task to the pool. Tasks are spread over the workers' queues in a round-robin way.
+ * @param task The task to run.
+ */
+void ThreadPool::Submit(std::function<void()> task) {
+
+    pendingTasks++;
+
+    uint32_t index = nextQueue++ % (uint32_t)queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    queuedTasks++;
+
+    /* Take the lock so a worker going to sleep cannot miss this. */
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+    }
+    workCondition.notify_one();
+}
+
+
+/**
+ * @brief Take a task from the worker's own queue, or steal one from the others.
+ * @param index The index of the worker.
+ * @param task The task we got.
+ * @return True if a task is found.
+ */
+bool ThreadPool::PopTask(uint32_t index, std::function<void()>& task) {
+
+    /* Own queue first, from the front. */
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if(!queues[index]->tasks.empty()){
+            task = std::move(queues[index]->tasks.front());
+            queues[index]->tasks.pop_front();
+            return true;
+        }
+    }
+
+    /* Steal from the back of the others, starting from the next worker. */
+    auto nQueues = (uint32_t)queues.size();
+    for(uint32_t i = 1; i < nQueues; i++){
+        auto& victim = queues[(index + i) % nQueues];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if(!victim->tasks.empty()){
+            task = std::move(victim->tasks.back());
+            victim->tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief The main loop of each worker. Run tasks until the pool is destroyed.
+ * @param index The index of the worker.
+ */
+void ThreadPool::WorkerLoop(uint32_t index) {
+
+    std::function<void()> task;
+
+    while(true){
+        if(PopTask(index, task)){
+            queuedTasks--;
+            task();
+            task = nullptr;
+
+            /* The last task wakes up the waiting thread. */
+            if(--pendingTasks == 0){
+                std::lock_guard<std::mutex> lock(waitMutex);
+                waitCondition.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(workMutex);
+        workCondition.wait(lock, [this]{ return stop || queuedTasks > 0; });
+        if(stop && queuedTasks == 0){
+            return;
+        }
+    }
+}
+
+
+/**
+ * @brief Block until all the submitted tasks are finished.
+ */
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(waitMutex);
+    waitCondition.wait(lock, [this]{ return pendingTasks == 0; });
+}
+
+
+/**
+ * @brief Finish the remaining tasks, then stop and join all the workers.
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        stop = true;
+    }
+    workCondition.notify_all();
+
+    for(auto& worker : workers){
+        worker.join();
+    }
+}
@@ -0,0 +1,84 @@
+//
+// Created by Xuan Zhai on 2024/4/20.
+//
+
+#ifndef CUBES_THREADPOOL_H
+#define CUBES_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief A work-stealing thread pool.
+ * Each worker owns a queue and takes work from its front. When its own queue is empty,
+ * it steals from the back of the other workers' queues, so no core idles while work is left.
+ */
+class ThreadPool {
+
+private:
+    /**
+     * @brief The task queue owned by a worker.
+     */
+    struct WorkQueue{
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    /* One queue per worker. */
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    /* The worker threads. */
+    std::vector<std::thread> workers;
+
+    /* The queue the next submitted task goes to. */
+    std::atomic<uint32_t> nextQueue{0};
+
+    /* Number of tasks sitting in the queues. */
+    std::atomic<uint64_t> queuedTasks{0};
+
+    /* Number of tasks submitted but not finished yet. */
+    std::atomic<uint64_t> pendingTasks{0};
+
+    /* Used to put idle workers to sleep. */
+    std::mutex workMutex;
+    std::condition_variable workCondition;
+
+    /* Used to wake up the thread waiting for all the tasks. */
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+
+    /* Set when the pool is destroyed. */
+    bool stop = false;
+
+    /* Take a task from the worker's own queue, or steal one from the others. */
+    bool PopTask(uint32_t index, std::function<void()>& task);
+
+    /* The main loop of each worker. */
+    void WorkerLoop(uint32_t index);
+
+public:
+    /* Create a pool with nThreads workers, 0 means the hardware thread count. */
+    explicit ThreadPool(uint32_t nThreads = 0);
+
+    /* Get the number of workers. */
+    [[nodiscard]] uint32_t GetThreadCount() const;
+
+    /* Add a task to the pool. */
+    void Submit(std::function<void()> task);
+
+    /* Block until all the submitted tasks are finished. */
+    void Wait();
+
+    /* Stop and join all the workers. */
+    ~ThreadPool();
+};
+
+
+#endif //CUBES_THREADPOOL_H
@@ -1,17 +1,34 @@
 #include <iostream>
 #include <memory>
+#include <cstring>
+#include <chrono>
 #include "Cube.h"
 #include "Lambertian.h"
 #include "GGX.h"
+#include "SH.h"
 
 /* The source file path and name. */
 std::string src = "src.png";
-/* The mode of processing. Can be 'Lambertian' or 'GGX'. */
+/* The mode of processing. Can be 'Lambertian', 'GGX' or 'SH'. */
 std::string mode = "Lambertian";
 /* The number of sample we take when doing the Monte Carlo. */
 uint32_t numSample = 7000;
 /* The output images' pixel size for each face. */
 uint32_t outputSize = 64;
+/* The number of worker threads. 0 means the hardware thread count. */
+uint32_t numThreads = 0;
+/* The size of the BRDF LUT in the GGX mode. */
+uint32_t brdfSize = 256;
+/* If the samples read from the mip level matching their solid angle. */
+bool filtered = true;
+/* The number of samples of the reference in the comparison mode. 0 means no comparison. */
+uint32_t referenceSample = 0;
+/* If the outputs are computed again even if the manifest says they are up to date. */
+bool forced = false;
+/* If the source is kept as packed RGBE to bound the memory of large sources. */
+bool packed = false;
+/* If the outputs are half float cube files (.xzcube) instead of RGBE png files. */
+bool cubeFile = false;
 
 /**
  * @brief Read the arguments from the command line.
@@ -32,23 +49,118 @@ void ReadCMDArguments(int argc, char** argv){
         if(strcmp(argv[i],"--output") == 0){
             outputSize = strtoul(argv[i+1],nullptr,0);
         }
+        if(strcmp(argv[i],"--threads") == 0){
+            numThreads = strtoul(argv[i+1],nullptr,0);
+        }
+        if(strcmp(argv[i],"--brdf") == 0){
+            brdfSize = strtoul(argv[i+1],nullptr,0);
+        }
+        if(strcmp(argv[i],"--nofilter") == 0){
+            filtered = false;
+        }
+        if(strcmp(argv[i],"--reference") == 0){
+            referenceSample = strtoul(argv[i+1],nullptr,0);
+        }
+        if(strcmp(argv[i],"--force") == 0){
+            forced = true;
+        }
+        if(strcmp(argv[i],"--packed") == 0){
+            packed = true;
+        }
+        if(strcmp(argv[i],"--xzcube") == 0){
+            cubeFile = true;
+        }
     }
 }
 
 
-int main(int argc, char** argv) {
-
-    ReadCMDArguments(argc,argv);
-
+/**
+ * @brief Create a cube processor for a mode and load the source.
+ * @param cubeMode The mode of processing.
+ * @param isFiltered If the filtered importance sampling is used.
+ * @param isSaved If the output files are written.
+ * @return The processor.
+ */
+std::shared_ptr<Cube> CreateCube(const std::string& cubeMode, bool isFiltered, bool isSaved){
     std::shared_ptr<Cube> obj;
-    if(mode == "GGX"){
-        obj = std::make_shared<GGX>();
+    if(cubeMode == "GGX"){
+        auto ggx = std::make_shared<GGX>();
+        ggx->SetBRDFSize(brdfSize);
+        obj = ggx;
+    }
+    else if(cubeMode == "SH"){
+        obj = std::make_shared<SH>();
     }
     else{
         obj = std::make_shared<Lambertian>();
     }
 
+    obj->SetThreadCount(numThreads);
+    obj->SetFiltered(isFiltered);
+    obj->SetSaveOutput(isSaved);
+    obj->SetForced(forced);
+    obj->SetPacked(packed);
+    obj->SetCubeFileOutput(cubeFile);
     obj->ReadFile(src);
+    return obj;
+}
+
+
+/**
+ * @brief Run the processing and measure its time.
+ * @param obj The processor.
+ * @param nSample The number of samples.
+ * @return The time in milliseconds.
+ */
+float TimeProcessing(const std::shared_ptr<Cube>& obj, uint32_t nSample){
+    auto startTime = std::chrono::high_resolution_clock::now();
+    obj->Processing(nSample,outputSize,outputSize);
+    auto endTime = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
+
+
+/**
+ * @brief The comparison mode. Run an unfiltered reference with many samples,
+ * then the unfiltered and the filtered sampling with the given samples, and report their time and RMSE to the reference.
+ * The SH mode is compared to a Lambertian reference.
+ */
+void CompareQuality(){
+
+    std::string referenceMode = (mode == "SH") ? "Lambertian" : mode;
+    auto reference = CreateCube(referenceMode, false, false);
+    float referenceTime = TimeProcessing(reference, referenceSample);
+
+    auto unfiltered = CreateCube(mode, false, false);
+    float unfilteredTime = TimeProcessing(unfiltered, numSample);
+
+    /* The filtered one is the only one written out. */
+    auto filteredCube = CreateCube(mode, true, true);
+    /* The comparison needs the output in memory, so it cannot be skipped by the manifest. */
+    filteredCube->SetForced(true);
+    float filteredTime = TimeProcessing(filteredCube, numSample);
+
+    printf("\nCompare: reference %u samples %.2f ms, unfiltered %u samples %.2f ms, filtered %u samples %.2f ms.\n",
+           referenceSample, referenceTime, numSample, unfilteredTime, numSample, filteredTime);
+    printf("Compare: output | unfiltered RMSE | filtered RMSE\n");
+    for(uint32_t i = 0; i < reference->GetOutputCount(); i++){
+        printf("Compare: %6u | %15f | %13f\n", i,
+               Cube::RMSE(reference->GetOutput(i), unfiltered->GetOutput(i)),
+               Cube::RMSE(reference->GetOutput(i), filteredCube->GetOutput(i)));
+    }
+}
+
+
+int main(int argc, char** argv) {
+
+    ReadCMDArguments(argc,argv);
+
+    if(referenceSample > 0){
+        CompareQuality();
+        return 0;
+    }
+
+    auto obj = CreateCube(mode, filtered, true);
     obj->Processing(numSample,outputSize,outputSize);
 
     return 0;
@@ -0,0 +1,354 @@
+//
+// Created by Xuan Zhai on 2024/4/29.
+//
+
+#include "Benchmark.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+
+/**
+ * @brief Get the name of the case: the scene name and the culling mode.
+ * @return The name of the case.
+ */
+std::string BenchmarkCase::GetKey() const {
+    return scene.GetName() + "_" + culling;
+}
+
+
+/**
+ * @brief Get the matrix run when no matrix file is given.
+ * Each group of cases scales one part of the renderer and keeps the others small.
+ * @return The cases of the matrix.
+ */
+std::vector<BenchmarkCase> Benchmark::DefaultMatrix(){
+
+    std::vector<BenchmarkCase> matrix;
+    auto Add = [&matrix](const std::vector<std::string>& args, const std::string& culling){
+        BenchmarkCase newCase;
+        ReadSceneArguments(args, newCase.scene);
+        newCase.culling = culling;
+        matrix.emplace_back(newCase);
+    };
+
+    /* The draw loop and the culling. */
+    Add({"--instances", "100"}, "none");
+    Add({"--instances", "1000"}, "none");
+    Add({"--instances", "10000"}, "none");
+    Add({"--instances", "10000"}, "frustum");
+
+    /* The scene graph update. */
+    Add({"--instances", "1000", "--depth", "1"}, "none");
+    Add({"--instances", "1000", "--depth", "10"}, "none");
+    Add({"--instances", "1000", "--drivers", "64"}, "none");
+
+    /* The parser and the mesh loading. */
+    Add({"--instances", "256", "--meshes", "256", "--mesh-detail", "64"}, "none");
+
+    /* The materials and the lights. */
+    Add({"--instances", "1000", "--materials", "simple,environment,mirror,lambertian,pbr", "--meshes", "5"}, "none");
+    Add({"--instances", "1000", "--lights", "8", "--shadow", "512"}, "none");
+
+    return matrix;
+}
+
+
+/**
+ * @brief Read a matrix file. Each line holds the scene flags of a case and an optional "--culling" mode,
+ * the empty lines and the lines starting with '#' are skipped.
+ * @param fileName The matrix file path and name.
+ * @return The cases of the matrix.
+ */
+std::vector<BenchmarkCase> Benchmark::ReadMatrix(const std::string& fileName){
+
+    std::ifstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the matrix file: " + fileName);
+    }
+
+    std::vector<BenchmarkCase> matrix;
+    std::string line;
+    while(std::getline(file, line)){
+        std::istringstream stream(line);
+        std::vector<std::string> args;
+        std::string arg;
+        while(stream >> arg){
+            args.emplace_back(arg);
+        }
+        if(args.empty() || args[0][0] == '#'){
+            continue;
+        }
+
+        BenchmarkCase newCase;
+        ReadSceneArguments(args, newCase.scene);
+        for(size_t i = 0; i + 1 < args.size(); i++){
+            if(args[i] == "--culling"){
+                newCase.culling = args[i+1];
+            }
+        }
+        matrix.emplace_back(newCase);
+    }
+    return matrix;
+}
+
+
+/**
+ * @brief Set the scenes to run.
+ * @param newCases The cases.
+ */
+void Benchmark::SetCases(const std::vector<BenchmarkCase>& newCases){
+    cases = newCases;
+}
+
+
+/**
+ * @brief Set the renderer and the Cubes tool executables.
+ * @param newRendererPath The renderer executable.
+ * @param newIBLToolPath The Cubes tool, empty if the environment outputs are already there.
+ */
+void Benchmark::SetRenderer(const std::string& newRendererPath, const std::string& newIBLToolPath){
+    rendererPath = newRendererPath;
+    iblToolPath = newIBLToolPath;
+}
+
+
+/**
+ * @brief Set the output and the baseline directories, they are created if needed.
+ * @param newOutputDirectory The directory of the generated scenes and the results.
+ * @param newBaselineDirectory The directory of the baselines.
+ */
+void Benchmark::SetDirectories(const std::string& newOutputDirectory, const std::string& newBaselineDirectory){
+    outputDirectory = newOutputDirectory;
+    baselineDirectory = newBaselineDirectory;
+}
+
+
+/**
+ * @brief Set the tolerance, the frame count and if the baselines are updated.
+ * @param newTolerance The allowed slowdown of a stage, 0.15 means 15%.
+ * @param newFrameCount The number of frames of the performance test and of the replay.
+ * @param newUpdateBaseline Set if the results are written as the new baselines.
+ */
+void Benchmark::SetOptions(double newTolerance, uint32_t newFrameCount, bool newUpdateBaseline){
+    tolerance = newTolerance;
+    frameCount = newFrameCount;
+    updateBaseline = newUpdateBaseline;
+}
+
+
+/**
+ * @brief Run a command and measure its wall time.
+ * @param command The command line.
+ * @return The wall time in milliseconds.
+ */
+double Benchmark::RunCommand(const std::string& command){
+
+    std::cout << "Benchmark: " << command << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    int result = std::system(command.c_str());
+    auto end = std::chrono::steady_clock::now();
+
+    if(result != 0){
+        throw std::runtime_error("The command failed with " + std::to_string(result) + ": " + command);
+    }
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+/**
+ * @brief Write the text events of the headless replay: start the animation, then draw a frame every 1/60 second.
+ * @param fileName The event file path and name.
+ */
+void Benchmark::WriteReplayEvents(const std::string& fileName) const {
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the event file: " + fileName);
+    }
+
+    file << "0 PLAY 0 1\n";
+    for(uint32_t i = 1; i <= frameCount; i++){
+        file << (uint64_t)i * 1000000 / 60 << " AVAILABLE\n";
+    }
+}
+
+
+/**
+ * @brief Read the p50 of each stage from the renderer's stats JSON file.
+ * The file is written by FrameStats::SaveJSON, one stage per line, so a regular expression is enough.
+ * Only the "stages" object is read, the "counters" after it are counts and not milliseconds.
+ * @param fileName The stats file path and name.
+ * @return The p50 of each stage in milliseconds.
+ */
+std::map<std::string, double> Benchmark::ReadStatsFile(const std::string& fileName){
+
+    std::ifstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the stats file: " + fileName);
+    }
+
+    static const std::regex stagePattern("\"([^\"]+)\": \\{\"count\": [0-9]+,.*\"p50\": ([-0-9.eE+]+)");
+
+    std::map<std::string, double> results;
+    std::string line;
+    std::smatch match;
+    bool isInStages = false;
+    while(std::getline(file, line)){
+        if(line.find("\"stages\": {") != std::string::npos){
+            isInStages = true;
+            continue;
+        }
+        if(!isInStages){
+            continue;
+        }
+        if(line.find('}') == 0 || line.find("  }") == 0){
+            break;
+        }
+        if(std::regex_search(line, match, stagePattern)){
+            results[match[1].str()] = std::stod(match[2].str());
+        }
+    }
+
+    if(results.empty()){
+        throw std::runtime_error("No stage found in the stats file: " + fileName);
+    }
+    return results;
+}
+
+
+/**
+ * @brief Read a baseline file, one "stage milliseconds" pair per line.
+ * @param fileName The baseline file path and name.
+ * @return The baseline of each stage, empty if the file does not exist.
+ */
+std::map<std::string, double> Benchmark::ReadBaseline(const std::string& fileName){
+
+    std::map<std::string, double> baseline;
+    std::ifstream file(fileName);
+
+    std::string stage;
+    double milliseconds;
+    while(file >> stage >> milliseconds){
+        baseline[stage] = milliseconds;
+    }
+    return baseline;
+}
+
+
+/**
+ * @brief Write a baseline file, one "stage milliseconds" pair per line so it diffs well.
+ * @param fileName The baseline file path and name.
+ * @param results The result of each stage.
+ */
+void Benchmark::WriteBaseline(const std::string& fileName, const std::map<std::string, double>& results){
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the baseline file: " + fileName);
+    }
+
+    char line[256];
+    for(const auto& result : results){
+        snprintf(line, sizeof(line), "%s %.6f\n", result.first.c_str(), result.second);
+        file << line;
+    }
+}
+
+
+/**
+ * @brief Compare the results of a case with its baseline and print a line per stage.
+ * @param key The name of the case.
+ * @param results The result of each stage.
+ * @param baseline The baseline of each stage.
+ * @return The number of regressed stages.
+ */
+uint32_t Benchmark::Compare(const std::string& key, const std::map<std::string, double>& results, const std::map<std::string, double>& baseline) const {
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-28s %12s %12s %8s", key.c_str(), "base (ms)", "now (ms)", "ratio");
+    std::cout << line << std::endl;
+
+    uint32_t regressions = 0;
+    for(const auto& result : results){
+        auto iter = baseline.find(result.first);
+        if(iter == baseline.end()){
+            snprintf(line, sizeof(line), "  %-26s %12s %12.3f %8s", result.first.c_str(), "-", result.second, "new");
+            std::cout << line << std::endl;
+            continue;
+        }
+
+        double ratio = iter->second > 0 ? result.second / iter->second : 1.0;
+        bool isRegressed = result.second > iter->second * (1.0 + tolerance) && result.second - iter->second > marginMilliseconds;
+        regressions += isRegressed ? 1 : 0;
+
+        snprintf(line, sizeof(line), "  %-26s %12.3f %12.3f %7.2fx%s", result.first.c_str(), iter->second, result.second, ratio, isRegressed ? "  REGRESSED" : "");
+        std::cout << line << std::endl;
+    }
+    return regressions;
+}
+
+
+/**
+ * @brief Run all the cases. For each one, generate the scene, run the performance test and the headless replay
+ * on the virtual clock, then compare with the baseline or write it.
+ * The performance test gives the p50 of each frame stage, the process wall times cover the loading, so the parser is measured too.
+ * @return The number of regressions and failed runs, 0 if all passed.
+ */
+uint32_t Benchmark::Run(){
+
+    if(rendererPath.empty()){
+        throw std::runtime_error("No renderer executable is given.");
+    }
+
+    std::filesystem::create_directories(outputDirectory);
+    std::filesystem::create_directories(baselineDirectory);
+
+    std::string eventFileName = outputDirectory + "/replay.events";
+    WriteReplayEvents(eventFileName);
+
+    std::string iblArgument = iblToolPath.empty() ? "" : " --ibl-tool \"" + iblToolPath + "\"";
+
+    SceneGenerator generator;
+    uint32_t failures = 0;
+
+    for(const auto& benchmarkCase : cases){
+
+        std::string key = benchmarkCase.GetKey();
+        std::string sceneFileName = generator.Generate(benchmarkCase.scene, outputDirectory);
+        std::string statsFileName = outputDirectory + "/" + key + ".json";
+        std::string common = "\"" + rendererPath + "\" --scene \"" + sceneFileName + "\" --camera Camera --drawing-size 1280 720 --culling " +
+                             benchmarkCase.culling + iblArgument;
+
+        std::map<std::string, double> results;
+        try{
+            double testWall = RunCommand(common + " --performance-test " + std::to_string(frameCount) + " --stats-json \"" + statsFileName + "\"");
+            results = ReadStatsFile(statsFileName);
+            results["process_performance_test"] = testWall;
+            results["process_replay"] = RunCommand(common + " --headless \"" + eventFileName + "\" --virtual-clock");
+        }
+        catch(const std::exception& e){
+            std::cout << "Benchmark: " << key << " failed: " << e.what() << std::endl;
+            failures++;
+            continue;
+        }
+
+        std::string baselineFileName = baselineDirectory + "/" + key + ".txt";
+        if(updateBaseline){
+            WriteBaseline(baselineFileName, results);
+            std::cout << "Benchmark: wrote the baseline " << baselineFileName << std::endl;
+        }
+        else{
+            failures += Compare(key, results, ReadBaseline(baselineFileName));
+        }
+    }
+
+    return failures;
+}
@@ -0,0 +1,104 @@
+//
+// Created by Xuan Zhai on 2024/4/29.
+//
+
+#ifndef SCENEGEN_BENCHMARK_H
+#define SCENEGEN_BENCHMARK_H
+
+#include "SceneGenerator.h"
+#include <map>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief A scene of the benchmark matrix and the culling mode it is rendered with.
+ */
+struct BenchmarkCase{
+    SceneSettings scene;
+    std::string culling = "none";
+
+    /* Get the name of the case, used for its output and baseline files. */
+    [[nodiscard]] std::string GetKey() const;
+};
+
+
+/**
+ * @brief Generate each scene of a matrix, run the renderer's performance test and a headless replay on it,
+ * then compare the p50 of each stage against the stored baselines.
+ * A stage regresses if it is slower than the baseline by more than the tolerance and by more than a small absolute margin,
+ * so the stages that take a few microseconds do not fail on noise.
+ */
+class Benchmark {
+
+private:
+    /* The scenes to run. */
+    std::vector<BenchmarkCase> cases;
+
+    /* The renderer executable. */
+    std::string rendererPath;
+
+    /* The Cubes tool given to the renderer, empty if not used. */
+    std::string iblToolPath;
+
+    /* The directory of the generated scenes and the results. */
+    std::string outputDirectory = "scenegen_out";
+
+    /* The directory of the baselines, one file per case. */
+    std::string baselineDirectory = "baselines";
+
+    /* The allowed slowdown of a stage, 0.15 means 15%. */
+    double tolerance = 0.15;
+
+    /* The slowdown in milliseconds under which a stage never regresses. */
+    double marginMilliseconds = 0.05;
+
+    /* The number of frames of the performance test and of the replay. */
+    uint32_t frameCount = 300;
+
+    /* Set if the results are written as the new baselines instead of compared. */
+    bool updateBaseline = false;
+
+    /* Run a command and return the wall time it took in milliseconds, throw if it fails. */
+    static double RunCommand(const std::string& command);
+
+    /* Write the events of the headless replay, one frame every 1/60 second. */
+    void WriteReplayEvents(const std::string& fileName) const;
+
+    /* Read the p50 of each stage from the renderer's stats JSON file. */
+    static std::map<std::string, double> ReadStatsFile(const std::string& fileName);
+
+    /* Read a baseline file, empty if it does not exist. */
+    static std::map<std::string, double> ReadBaseline(const std::string& fileName);
+
+    /* Write a baseline file. */
+    static void WriteBaseline(const std::string& fileName, const std::map<std::string, double>& results);
+
+    /* Compare the results of a case with its baseline, return the number of regressed stages. */
+    uint32_t Compare(const std::string& key, const std::map<std::string, double>& results, const std::map<std::string, double>& baseline) const;
+
+public:
+    /* Get the matrix run when no matrix file is given. */
+    static std::vector<BenchmarkCase> DefaultMatrix();
+
+    /* Read a matrix file, each line holds the scene flags of a case. */
+    static std::vector<BenchmarkCase> ReadMatrix(const std::string& fileName);
+
+    /* Set the scenes to run. */
+    void SetCases(const std::vector<BenchmarkCase>& newCases);
+
+    /* Set the renderer and the Cubes tool executables. */
+    void SetRenderer(const std::string& newRendererPath, const std::string& newIBLToolPath);
+
+    /* Set the output and the baseline directories. */
+    void SetDirectories(const std::string& newOutputDirectory, const std::string& newBaselineDirectory);
+
+    /* Set the tolerance, the frame count and if the baselines are updated. */
+    void SetOptions(double newTolerance, uint32_t newFrameCount, bool newUpdateBaseline);
+
+    /* Run all the cases, return the number of regressions and failed runs. */
+    uint32_t Run();
+};
+
+
+#endif //SCENEGEN_BENCHMARK_H
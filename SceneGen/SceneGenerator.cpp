@@ -0,0 +1,429 @@
+//
+// Created by Xuan Zhai on 2024/4/29.
+//
+
+#include "SceneGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+/* The distance between two neighbour instances on the grid. */
+static const float GRID_SPACING = 3.0f;
+
+/* The size of a vertex in the pnTtc layout: position, normal, tangent, texcoord and color. */
+static const uint32_t VERTEX_STRIDE = 52;
+
+static const float PI = 3.14159265358979f;
+
+
+/**
+ * @brief Write a float with a fixed precision, so the output does not depend on the locale or the platform.
+ * @param value The float to write.
+ * @return The float as a string.
+ */
+static std::string ToString(float value){
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.5f", value);
+    return buffer;
+}
+
+
+/**
+ * @brief Write a list of floats as a JSON array.
+ * @param values The floats to write.
+ * @return The JSON array.
+ */
+static std::string ToArray(const std::vector<float>& values){
+    std::string result = "[";
+    for(size_t i = 0; i < values.size(); i++){
+        result += (i == 0 ? "" : ",") + ToString(values[i]);
+    }
+    return result + "]";
+}
+
+
+/**
+ * @brief Write a node object.
+ * @param name The node name.
+ * @param translation The local translation.
+ * @param rotation The local rotation as a quaternion (x,y,z,w).
+ * @param extra The extra members, like the children, the mesh or the light, each starting with a comma.
+ * @return The node object.
+ */
+static std::string MakeNode(const std::string& name, const std::vector<float>& translation, const std::vector<float>& rotation, const std::string& extra){
+    return "{\n\t\"type\":\"NODE\",\n\t\"name\":\"" + name + "\",\n\t\"translation\":" + ToArray(translation) +
+           ",\n\t\"rotation\":" + ToArray(rotation) + ",\n\t\"scale\":[1,1,1]" + extra + "\n}";
+}
+
+
+/**
+ * @brief Write a list of indices as a JSON array.
+ * @param indices The indices to write.
+ * @return The JSON array.
+ */
+static std::string ToIndexArray(const std::vector<size_t>& indices){
+    std::string result = "[";
+    for(size_t i = 0; i < indices.size(); i++){
+        result += (i == 0 ? "" : ",") + std::to_string(indices[i]);
+    }
+    return result + "]";
+}
+
+
+/**
+ * @brief Get a short name made of the settings, used as the scene file name.
+ * @return The name, e.g. "d3_i100_m4_s16_l1_sh0_dr0_lambertian".
+ */
+std::string SceneSettings::GetName() const {
+    std::string name = "d" + std::to_string(depth) + "_i" + std::to_string(instanceCount) + "_m" + std::to_string(meshCount) +
+                       "_s" + std::to_string(meshDetail) + "_l" + std::to_string(lightCount) + "_sh" + std::to_string(shadowSize) +
+                       "_dr" + std::to_string(driverCount);
+    for(const auto& material : materials){
+        name += "_" + material;
+    }
+    return name;
+}
+
+
+/**
+ * @brief Add an object to the s72 array.
+ * @param object The object as JSON text.
+ * @return The index of the object in the s72 array.
+ */
+size_t SceneGenerator::AddObject(const std::string& object){
+    objects.emplace_back(object);
+    return objects.size() - 1;
+}
+
+
+/**
+ * @brief Write a UV sphere as a non-indexed triangle list in the pnTtc layout.
+ * The meshes get slightly different radius, so they are distinct meshes for the renderer.
+ * @param fileName The b72 file path and name.
+ * @param meshIndex The index of the mesh.
+ */
+void SceneGenerator::WriteMeshFile(const std::string& fileName, uint32_t meshIndex) const {
+
+    std::ofstream file(fileName, std::ios::binary);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the mesh file: " + fileName);
+    }
+
+    uint32_t segments = (std::max)(settings.meshDetail, 3u);
+    uint32_t rings = (std::max)(segments / 2, 2u);
+    float radius = 0.8f + 0.4f * (float)(meshIndex % 4) / 4.0f;
+
+    /* Write the vertex at a given longitude and latitude step. */
+    auto WriteVertex = [&](uint32_t u, uint32_t v){
+        float phi = 2.0f * PI * (float)u / (float)segments;
+        float theta = PI * (float)v / (float)rings;
+        float normal[3] = {std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)};
+        float position[3] = {normal[0] * radius, normal[1] * radius, normal[2] * radius};
+        float tangent[4] = {-std::sin(phi), std::cos(phi), 0.0f, 1.0f};
+        float texcoord[2] = {(float)u / (float)segments, 1.0f - (float)v / (float)rings};
+        uint8_t color[4] = {255, 255, 255, 255};
+
+        file.write(reinterpret_cast<const char*>(position), sizeof(position));
+        file.write(reinterpret_cast<const char*>(normal), sizeof(normal));
+        file.write(reinterpret_cast<const char*>(tangent), sizeof(tangent));
+        file.write(reinterpret_cast<const char*>(texcoord), sizeof(texcoord));
+        file.write(reinterpret_cast<const char*>(color), sizeof(color));
+    };
+
+    /* Two counter-clockwise triangles per quad, seen from outside. */
+    for(uint32_t v = 0; v < rings; v++){
+        for(uint32_t u = 0; u < segments; u++){
+            WriteVertex(u, v);
+            WriteVertex(u, v + 1);
+            WriteVertex(u + 1, v + 1);
+
+            WriteVertex(u, v);
+            WriteVertex(u + 1, v + 1);
+            WriteVertex(u + 1, v);
+        }
+    }
+
+    if(!file){
+        throw std::runtime_error("Cannot write the mesh file: " + fileName);
+    }
+}
+
+
+/**
+ * @brief Add the meshes, their materials and write their b72 files.
+ * The material types are given to the meshes in turn.
+ * @param directory The output directory.
+ * @param name The scene name, the prefix of the b72 files.
+ */
+void SceneGenerator::AddMeshes(const std::string& directory, const std::string& name){
+
+    uint32_t segments = (std::max)(settings.meshDetail, 3u);
+    uint32_t rings = (std::max)(segments / 2, 2u);
+    uint32_t vertexCount = segments * rings * 6;
+
+    for(uint32_t i = 0; i < (std::max)(settings.meshCount, 1u); i++){
+
+        /* The material of the mesh. */
+        const std::string& type = settings.materials[i % settings.materials.size()];
+        std::string materialName = type + ": gen." + std::to_string(i);
+        std::vector<float> albedo = {0.3f + 0.7f * (float)((i * 3) % 7) / 6.0f, 0.3f + 0.7f * (float)((i * 5) % 7) / 6.0f, 0.3f + 0.7f * (float)((i * 2) % 7) / 6.0f};
+
+        std::string parameters;
+        if(type == "lambertian"){
+            parameters = "{\n\t\t\"albedo\":" + ToArray(albedo) + "\n\t}";
+        }
+        else if(type == "pbr"){
+            parameters = "{\n\t\t\"albedo\":" + ToArray(albedo) + ",\n\t\t\"roughness\":" + ToString(0.2f + 0.6f * (float)(i % 4) / 3.0f) +
+                         ",\n\t\t\"metalness\":" + ToString((float)(i % 2)) + "\n\t}";
+        }
+        else if(type == "simple" || type == "environment" || type == "mirror"){
+            parameters = "{}";
+        }
+        else{
+            throw std::runtime_error("Unknown material type: " + type);
+        }
+
+        size_t materialIndex = AddObject("{\n\t\"type\":\"MATERIAL\",\n\t\"name\":\"" + materialName + "\",\n\t\"" + type + "\":" + parameters + "\n}");
+
+        /* The mesh and its b72 file, all the attributes are in the same file. */
+        std::string meshName = "Sphere." + std::to_string(i);
+        std::string fileName = name + "." + meshName + ".b72";
+        WriteMeshFile(directory + "/" + fileName, i);
+
+        auto Attribute = [&fileName](const std::string& attribute, uint32_t offset, const std::string& format){
+            return "\t\t\"" + attribute + "\":{ \"src\":\"" + fileName + "\", \"offset\":" + std::to_string(offset) +
+                   ", \"stride\":" + std::to_string(VERTEX_STRIDE) + ", \"format\":\"" + format + "\" }";
+        };
+
+        meshIndices.emplace_back(AddObject("{\n\t\"type\":\"MESH\",\n\t\"name\":\"" + meshName + "\",\n\t\"topology\":\"TRIANGLE_LIST\",\n\t\"count\":" + std::to_string(vertexCount) +
+                                           ",\n\t\"attributes\":{\n" +
+                                           Attribute("POSITION", 0, "R32G32B32_SFLOAT") + ",\n" +
+                                           Attribute("NORMAL", 12, "R32G32B32_SFLOAT") + ",\n" +
+                                           Attribute("TANGENT", 24, "R32G32B32A32_SFLOAT") + ",\n" +
+                                           Attribute("TEXCOORD", 40, "R32G32_SFLOAT") + ",\n" +
+                                           Attribute("COLOR", 48, "R8G8B8A8_UNORM") +
+                                           "\n\t},\n\t\"material\":" + std::to_string(materialIndex) + "\n}"));
+    }
+}
+
+
+/**
+ * @brief Add a mesh instance node. The instances are placed on a square grid around the origin in creation order.
+ * @return The index of the node.
+ */
+size_t SceneGenerator::AddInstance(){
+
+    auto side = (uint32_t)std::ceil(std::sqrt((float)settings.instanceCount));
+    uint32_t index = instancesCreated++;
+    float offset = (float)(side - 1) * GRID_SPACING * 0.5f;
+
+    /* A random rotation around the up axis, so the instances are not all the same draw. */
+    std::uniform_real_distribution<float> angleDistribution(0.0f, PI);
+    float halfAngle = angleDistribution(random);
+
+    size_t mesh = meshIndices[index % meshIndices.size()];
+    size_t node = AddObject(MakeNode("Instance." + std::to_string(index),
+                                     {(float)(index % side) * GRID_SPACING - offset, (float)(index / side) * GRID_SPACING - offset, 0.0f},
+                                     {0.0f, 0.0f, std::sin(halfAngle), std::cos(halfAngle)},
+                                     ",\n\t\"mesh\":" + std::to_string(mesh)));
+    instanceIndices.emplace_back(node);
+    return node;
+}
+
+
+/**
+ * @brief Add a group node and its subtree. The groups at the last level hold the instances.
+ * The node is reserved first, so its children can refer to the indices after it.
+ * @param level The level of the group, from 1 to the depth.
+ * @param groupCount The number of groups created so far, used to name them.
+ * @return The index of the group node.
+ */
+size_t SceneGenerator::AddGroup(uint32_t level, uint32_t& groupCount){
+
+    size_t node = AddObject("");
+    std::string name = "Group." + std::to_string(groupCount++);
+    groupIndices.emplace_back(node);
+
+    std::vector<size_t> children;
+    for(uint32_t i = 0; i < branching && instancesCreated < settings.instanceCount; i++){
+        children.emplace_back(level == settings.depth ? AddInstance() : AddGroup(level + 1, groupCount));
+    }
+
+    objects[node] = MakeNode(name, {0, 0, 0}, {0, 0, 0, 1}, ",\n\t\"children\":" + ToIndexArray(children));
+    return node;
+}
+
+
+/**
+ * @brief Add the spot lights, placed on a circle above the grid and facing down.
+ * @return The indices of the light nodes.
+ */
+std::vector<size_t> SceneGenerator::AddLights(){
+
+    std::vector<size_t> nodes;
+    auto side = (float)std::ceil(std::sqrt((float)settings.instanceCount));
+    float radius = side * GRID_SPACING * 0.25f;
+
+    for(uint32_t i = 0; i < settings.lightCount; i++){
+        std::string name = "Spot." + std::to_string(i);
+        std::string shadow = settings.shadowSize > 0 ? ",\n\t\"shadow\":" + std::to_string(settings.shadowSize) : "";
+
+        size_t light = AddObject("{\n\t\"type\":\"LIGHT\",\n\t\"name\":\"" + name + "\",\n\t\"tint\":[1,1,1]" + shadow +
+                                 ",\n\t\"spot\":{\n\t\t\"radius\":0.5,\n\t\t\"power\":600.0,\n\t\t\"fov\":1.485,\n\t\t\"blend\":0.15,\n\t\t\"limit\":" +
+                                 ToString(side * GRID_SPACING * 2.0f) + "\n\t}\n}");
+
+        float angle = 2.0f * PI * (float)i / (float)settings.lightCount;
+        nodes.emplace_back(AddObject(MakeNode(name, {radius * std::cos(angle), radius * std::sin(angle), 8.0f}, {0, 0, 0, 1},
+                                              ",\n\t\"light\":" + std::to_string(light))));
+    }
+    return nodes;
+}
+
+
+/**
+ * @brief Add the drivers, each turns a node around the up axis over four seconds.
+ * The group nodes are animated first so a driver moves a whole subtree, then the instances.
+ */
+void SceneGenerator::AddDrivers(){
+
+    std::vector<size_t> candidates = groupIndices;
+    candidates.insert(candidates.end(), instanceIndices.begin(), instanceIndices.end());
+
+    const uint32_t keyCount = 9;
+    for(uint32_t i = 0; i < settings.driverCount && i < candidates.size(); i++){
+        std::vector<float> times;
+        std::vector<float> values;
+        for(uint32_t k = 0; k < keyCount; k++){
+            float halfAngle = PI * (float)k / (float)(keyCount - 1);
+            times.emplace_back(4.0f * (float)k / (float)(keyCount - 1));
+            values.insert(values.end(), {0.0f, 0.0f, std::sin(halfAngle), std::cos(halfAngle)});
+        }
+
+        AddObject("{\n\t\"type\":\"DRIVER\",\n\t\"name\":\"Driver." + std::to_string(i) + "\",\n\t\"node\":" + std::to_string(candidates[i]) +
+                  ",\n\t\"channel\":\"rotation\",\n\t\"times\":" + ToArray(times) + ",\n\t\"values\":" + ToArray(values) +
+                  ",\n\t\"interpolation\":\"SLERP\"\n}");
+    }
+}
+
+
+/**
+ * @brief Write a synthetic scene: a camera looking at the grid, the meshes and materials,
+ * the group tree with the instances, the lights, the environment and the drivers.
+ * @param newSettings The settings of the scene.
+ * @param directory The output directory, it should exist.
+ * @return The s72 file path and name.
+ */
+std::string SceneGenerator::Generate(const SceneSettings& newSettings, const std::string& directory){
+
+    settings = newSettings;
+    if(settings.materials.empty()){
+        settings.materials = {"simple"};
+    }
+
+    objects.clear();
+    meshIndices.clear();
+    groupIndices.clear();
+    instanceIndices.clear();
+    instancesCreated = 0;
+    random.seed(settings.seed);
+
+    /* The number of children per group, so the last level can hold all the instances. */
+    branching = 2;
+    if(settings.depth > 0){
+        branching = (std::max)((uint32_t)std::ceil(std::pow((double)settings.instanceCount, 1.0 / settings.depth) - 1e-9), 2u);
+    }
+
+    std::string name = settings.GetName();
+    std::vector<size_t> roots;
+
+    AddObject("\"s72-v1\"");
+
+    /* The camera sees the whole grid from above at 45 degrees. */
+    auto side = (float)std::ceil(std::sqrt((float)settings.instanceCount));
+    float distance = side * GRID_SPACING * 0.9f + 5.0f;
+    size_t camera = AddObject("{\n\t\"type\":\"CAMERA\",\n\t\"name\":\"Camera\",\n\t\"perspective\":{\n\t\t\"aspect\":1.77778,\n\t\t\"vfov\":1.0,\n\t\t\"near\":0.1,\n\t\t\"far\":" +
+                              ToString(distance * 4.0f) + "\n\t}\n}");
+    roots.emplace_back(AddObject(MakeNode("Camera", {0.0f, -distance, distance}, {std::sin(PI / 8.0f), 0.0f, 0.0f, std::cos(PI / 8.0f)},
+                                          ",\n\t\"camera\":" + std::to_string(camera))));
+
+    AddMeshes(directory, name);
+
+    uint32_t groupCount = 0;
+    while(instancesCreated < settings.instanceCount){
+        roots.emplace_back(settings.depth == 0 ? AddInstance() : AddGroup(1, groupCount));
+    }
+
+    std::vector<size_t> lights = AddLights();
+    roots.insert(roots.end(), lights.begin(), lights.end());
+
+    AddObject("{\n\t\"type\":\"ENVIRONMENT\",\n\t\"name\":\"sky\",\n\t\"radiance\": {\"src\":\"" + settings.environment + "\", \"type\":\"cube\", \"format\":\"rgbe\"}\n}");
+
+    AddDrivers();
+
+    AddObject("{\n\t\"type\":\"SCENE\",\n\t\"name\":\"" + name + "\",\n\t\"roots\":" + ToIndexArray(roots) + "\n}");
+
+    std::string fileName = directory + "/" + name + ".s72";
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the scene file: " + fileName);
+    }
+
+    file << "[";
+    for(size_t i = 0; i < objects.size(); i++){
+        file << (i == 0 ? "" : ",\n") << objects[i];
+    }
+    file << "]\n";
+
+    return fileName;
+}
+
+
+/**
+ * @brief Read the scene flags from a list of arguments, the flags not about the scene are skipped.
+ * @param args The arguments, e.g. {"--depth", "4", "--instances", "1000"}.
+ * @param settings The settings to update.
+ */
+void ReadSceneArguments(const std::vector<std::string>& args, SceneSettings& settings){
+
+    for(size_t i = 0; i + 1 < args.size(); i++){
+        const std::string& flag = args[i];
+        const std::string& value = args[i+1];
+
+        if(flag == "--depth"){
+            settings.depth = std::stoul(value);
+        }
+        else if(flag == "--instances"){
+            settings.instanceCount = std::stoul(value);
+        }
+        else if(flag == "--meshes"){
+            settings.meshCount = std::stoul(value);
+        }
+        else if(flag == "--mesh-detail"){
+            settings.meshDetail = std::stoul(value);
+        }
+        else if(flag == "--materials"){
+            settings.materials.clear();
+            size_t start = 0;
+            while(start <= value.size()){
+                size_t end = value.find(',', start);
+                if(end == std::string::npos) end = value.size();
+                if(end > start) settings.materials.emplace_back(value.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+        else if(flag == "--lights"){
+            settings.lightCount = std::stoul(value);
+        }
+        else if(flag == "--shadow"){
+            settings.shadowSize = std::stoul(value);
+        }
+        else if(flag == "--drivers"){
+            settings.driverCount = std::stoul(value);
+        }
+        else if(flag == "--seed"){
+            settings.seed = std::stoul(value);
+        }
+    }
+}
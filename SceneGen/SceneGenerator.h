@@ -0,0 +1,107 @@
+//
+// Created by Xuan Zhai on 2024/4/29.
+//
+
+#ifndef SCENEGEN_SCENEGENERATOR_H
+#define SCENEGEN_SCENEGENERATOR_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief The knobs of a generated benchmark scene.
+ */
+struct SceneSettings{
+    /* The number of group node levels above the mesh instances. */
+    uint32_t depth = 3;
+    /* The number of mesh instances. */
+    uint32_t instanceCount = 100;
+    /* The number of distinct meshes, the instances use them in turn. */
+    uint32_t meshCount = 4;
+    /* The number of segments around each sphere mesh, the triangle count grows with its square. */
+    uint32_t meshDetail = 16;
+    /* The material types given to the meshes in turn: simple, environment, mirror, lambertian or pbr. */
+    std::vector<std::string> materials = {"lambertian"};
+    /* The number of spot lights. */
+    uint32_t lightCount = 1;
+    /* The shadow map size of each light, 0 means no shadow map. */
+    uint32_t shadowSize = 0;
+    /* The number of animated group nodes. */
+    uint32_t driverCount = 0;
+    /* The seed of the random instance rotations. */
+    uint32_t seed = 1;
+    /* The environment cube map, referenced next to the scene file. */
+    std::string environment = "src.png";
+
+    /* Get a short name made of the settings, used as the scene file name. */
+    [[nodiscard]] std::string GetName() const;
+};
+
+
+/**
+ * @brief Write a synthetic s72 scene and its b72 meshes from a SceneSettings.
+ * The instances sit on a grid under a balanced tree of group nodes, so the parser, the scene graph update,
+ * the culling and the draw loop can each be scaled on their own.
+ */
+class SceneGenerator {
+
+private:
+    /* The s72 objects, the index in this list is the index in the s72 array. */
+    std::vector<std::string> objects;
+
+    /* The settings of the scene being generated. */
+    SceneSettings settings;
+
+    /* The random generator of the instance rotations. */
+    std::mt19937 random;
+
+    /* The s72 index of each mesh. */
+    std::vector<size_t> meshIndices;
+
+    /* The group nodes, the animated ones are picked from them first. */
+    std::vector<size_t> groupIndices;
+
+    /* The mesh instance nodes, animated once all the group nodes are. */
+    std::vector<size_t> instanceIndices;
+
+    /* The number of instances created so far. */
+    uint32_t instancesCreated = 0;
+
+    /* The number of children of each group node. */
+    uint32_t branching = 2;
+
+    /* Add an object to the s72 array and return its index. */
+    size_t AddObject(const std::string& object);
+
+    /* Write the sphere mesh of a given index to a b72 file. */
+    void WriteMeshFile(const std::string& fileName, uint32_t meshIndex) const;
+
+    /* Add the meshes and their materials. */
+    void AddMeshes(const std::string& directory, const std::string& name);
+
+    /* Add a group node and its subtree, return its index. */
+    size_t AddGroup(uint32_t level, uint32_t& groupCount);
+
+    /* Add a mesh instance node, return its index. */
+    size_t AddInstance();
+
+    /* Add the spot lights and return the indices of their nodes. */
+    std::vector<size_t> AddLights();
+
+    /* Add the drivers rotating the first group nodes. */
+    void AddDrivers();
+
+public:
+    /* Write <directory>/<name>.s72 and its b72 files, return the s72 path. */
+    std::string Generate(const SceneSettings& newSettings, const std::string& directory);
+};
+
+
+/* Read the scene flags (--depth, --instances, ...) from a list of arguments. Unknown ones are left for the caller. */
+void ReadSceneArguments(const std::vector<std::string>& args, SceneSettings& settings);
+
+
+#endif //SCENEGEN_SCENEGENERATOR_H
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <cstring>
+#include <filesystem>
+#include "SceneGenerator.h"
+#include "Benchmark.h"
+
+/* The directory the scenes are written to. */
+std::string outputDirectory = ".";
+/* The environment cube map copied next to the scenes, empty if it is already there. */
+std::string environmentPath;
+/* The settings of the generated scene, read from the scene flags. */
+SceneSettings sceneSettings;
+/* The renderer executable. Set to run the benchmark instead of writing a single scene. */
+std::string rendererPath;
+/* The Cubes tool the renderer uses to prepare the environment. */
+std::string iblToolPath;
+/* The matrix file of the benchmark, empty means the default matrix. */
+std::string matrixFileName;
+/* The directory of the benchmark baselines. */
+std::string baselineDirectory = "baselines";
+/* The allowed slowdown of a stage before it regresses, 0.15 means 15%. */
+double tolerance = 0.15;
+/* The number of frames of each benchmark run. */
+uint32_t frameCount = 300;
+/* If the benchmark results are written as the new baselines. */
+bool updateBaseline = false;
+
+/**
+ * @brief Read the arguments from the command line. The scene flags are read by ReadSceneArguments.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ */
+void ReadCMDArguments(int argc, char** argv){
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i],"--out") == 0){
+            outputDirectory = argv[i+1];
+        }
+        if(strcmp(argv[i],"--environment") == 0){
+            environmentPath = argv[i+1];
+        }
+        if(strcmp(argv[i],"--bench") == 0){
+            rendererPath = argv[i+1];
+        }
+        if(strcmp(argv[i],"--ibl-tool") == 0){
+            iblToolPath = argv[i+1];
+        }
+        if(strcmp(argv[i],"--matrix") == 0){
+            matrixFileName = argv[i+1];
+        }
+        if(strcmp(argv[i],"--baseline") == 0){
+            baselineDirectory = argv[i+1];
+        }
+        if(strcmp(argv[i],"--tolerance") == 0){
+            tolerance = strtod(argv[i+1],nullptr);
+        }
+        if(strcmp(argv[i],"--frames") == 0){
+            frameCount = strtoul(argv[i+1],nullptr,0);
+        }
+        if(strcmp(argv[i],"--update-baseline") == 0){
+            updateBaseline = true;
+        }
+    }
+
+    ReadSceneArguments(std::vector<std::string>(argv + 1, argv + argc), sceneSettings);
+}
+
+
+int main(int argc, char** argv) {
+
+    ReadCMDArguments(argc,argv);
+
+    std::filesystem::create_directories(outputDirectory);
+
+    /* The scenes refer to the environment by its file name, so it is copied next to them. */
+    if(!environmentPath.empty()){
+        std::filesystem::path source(environmentPath);
+        sceneSettings.environment = source.filename().string();
+        std::filesystem::copy_file(source, std::filesystem::path(outputDirectory) / source.filename(), std::filesystem::copy_options::overwrite_existing);
+    }
+
+    if(!rendererPath.empty()){
+        std::vector<BenchmarkCase> cases = matrixFileName.empty() ? Benchmark::DefaultMatrix() : Benchmark::ReadMatrix(matrixFileName);
+        for(auto& benchmarkCase : cases){
+            benchmarkCase.scene.environment = sceneSettings.environment;
+        }
+
+        Benchmark benchmark;
+        benchmark.SetCases(cases);
+        benchmark.SetRenderer(rendererPath, iblToolPath);
+        benchmark.SetDirectories(outputDirectory, baselineDirectory);
+        benchmark.SetOptions(tolerance, frameCount, updateBaseline);
+
+        uint32_t failures = benchmark.Run();
+        if(failures > 0){
+            std::cout << "Benchmark: " << failures << " regressions or failed runs." << std::endl;
+            return 1;
+        }
+        std::cout << "Benchmark: all cases passed." << std::endl;
+        return 0;
+    }
+
+    SceneGenerator generator;
+    std::cout << "Wrote " << generator.Generate(sceneSettings, outputDirectory) << std::endl;
+
+    return 0;
+}
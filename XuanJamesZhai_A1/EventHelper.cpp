@@ -3,66 +3,250 @@
 //
 
 #include "EventHelper.h"
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+/* The magic number and version of the binary event file. */
+static const char EVENT_MAGIC[4] = {'X','Z','E','V'};
+static const uint32_t EVENT_VERSION = 2;
+
+
+/**
+ * @brief Read a value of a plain type from a binary file.
+ * @param input The binary file.
+ * @param value The value read.
+ * @return False if the file ends.
+ */
+template<typename T>
+static bool ReadValue(std::ifstream& input, T& value){
+    return (bool)input.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+
+/**
+ * @brief Read a string stored as its length and its characters from a binary file.
+ * @param input The binary file.
+ * @param value The string read.
+ * @return False if the file ends.
+ */
+static bool ReadString(std::ifstream& input, std::string& value){
+    uint32_t length;
+    if(!ReadValue(input, length)) return false;
+    value.resize(length);
+    return length == 0 || (bool)input.read(value.data(), length);
+}
 
 
 /**
- * @brief Read and parse an event file.
+ * @brief Write a string as its length and its characters to a binary file.
+ * @param output The binary file.
+ * @param value The string to write.
+ */
+static void WriteString(std::ofstream& output, const std::string& value){
+    auto length = (uint32_t)value.size();
+    output.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    output.write(value.data(), length);
+}
+
+
+/**
+ * @brief Open an event file. It is binary if it starts with the magic number, otherwise it is read as text.
+ * The events are read in chunks when they are needed.
  * @param fileName The event file's path and name.
  */
 void EventHelper::ReadEventFile(const std::string& fileName){
-    std::ifstream input = std::ifstream(fileName, std::ios::binary);
+    input = std::ifstream(fileName, std::ios::binary);
 
     if(!input){
         throw std::runtime_error("Parse Event Error: Unable to open the input file.");
     }
 
-    float time;
+    char magic[4] = {};
+    uint32_t version = 0;
+    input.read(magic, 4);
+    isBinary = input.gcount() == 4 && memcmp(magic, EVENT_MAGIC, 4) == 0;
+
+    if(isBinary){
+        if(!ReadValue(input, version) || version != EVENT_VERSION){
+            throw std::runtime_error("Parse Event Error: Unsupported binary event file version.");
+        }
+    }
+    else{
+        input.clear();
+        input.seekg(0);
+    }
+
+    chunk.clear();
+    chunkIndex = 0;
+}
+
+
+/**
+ * @brief Read one event from a text event file. Empty lines are skipped.
+ * @param node The event read.
+ * @return False if the file ends.
+ */
+bool EventHelper::ReadTextEvent(EventNode& node){
+
+    std::string line;
     std::string type;
-    std::string data;
-    float data1;
-    int data2;
 
-    while(!input.eof()){
-        EventNode newNode;
-        input >> time >> type;
-        newNode.time = time;
+    while(std::getline(input, line)){
+        /* Drop the '\r' of the Windows line ending. */
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+
+        /* The text times can have a fraction, they are rounded to the microsecond. */
+        std::istringstream stream(line);
+        double time;
+        if(!(stream >> time >> type)){
+            continue;
+        }
+        if(time < 0){
+            throw std::runtime_error("Parse Event Error: Negative event time.");
+        }
+        node.time = (uint64_t)std::llround(time);
 
         if(type == "AVAILABLE"){
-            newNode.eventType = EventType::AVAILABLE;
+            node.eventType = EventType::AVAILABLE;
         }
         else if(type == "PLAY"){
-            newNode.eventType = EventType::PLAY;
-            input >> data1 >> data2;
-            newNode.data = std::make_pair(data1,data2);
+            node.eventType = EventType::PLAY;
+            std::pair<float,int> play;
+            stream >> play.first >> play.second;
+            node.data = play;
         }
-        else if(type == "SAVE"){
-            newNode.eventType = EventType::SAVE;
-            input >> data;
-            newNode.data = data;
+        else if(type == "SAVE" || type == "CAMERA"){
+            node.eventType = type == "SAVE" ? EventType::SAVE : EventType::CAMERA;
+            std::string name;
+            stream >> name;
+            node.data = name;
         }
         else if(type == "MARK"){
-            newNode.eventType = EventType::MARK;
-            input.ignore();
-            std::getline(input,data);
-            newNode.data = data;
+            node.eventType = EventType::MARK;
+            std::string text;
+            stream.ignore();
+            std::getline(stream, text);
+            node.data = text;
+        }
+        else if(type == "LOOK"){
+            node.eventType = EventType::LOOK;
+            std::array<float,6> look{};
+            for(float& value : look){
+                stream >> value;
+            }
+            node.data = look;
+        }
+        else if(type == "SET"){
+            node.eventType = EventType::SET;
+            std::pair<std::string,std::string> parameter;
+            stream >> parameter.first >> parameter.second;
+            node.data = parameter;
         }
         else{
             throw std::runtime_error("Parse Event Error: Unable to find the event type.");
         }
-        events.emplace_back(newNode);
+
+        if(stream.fail()){
+            throw std::runtime_error("Parse Event Error: Missing data for the event " + type + ".");
+        }
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * @brief Read one event from a binary event file.
+ * @param node The event read.
+ * @return False if the file ends.
+ */
+bool EventHelper::ReadBinaryEvent(EventNode& node){
+
+    uint8_t type;
+    if(!ReadValue(input, node.time)) return false;
+    if(!ReadValue(input, type) || type >= EventType::NO_EVENT){
+        throw std::runtime_error("Parse Event Error: Unable to find the event type.");
+    }
+    node.eventType = (EventType)type;
+
+    bool isValid = true;
+    switch(node.eventType){
+        case EventType::PLAY: {
+            std::pair<float,int> play;
+            int32_t rate;
+            isValid = ReadValue(input, play.first) && ReadValue(input, rate);
+            play.second = rate;
+            node.data = play;
+            break;
+        }
+        case EventType::SAVE:
+        case EventType::MARK:
+        case EventType::CAMERA: {
+            std::string name;
+            isValid = ReadString(input, name);
+            node.data = name;
+            break;
+        }
+        case EventType::LOOK: {
+            std::array<float,6> look{};
+            isValid = ReadValue(input, look);
+            node.data = look;
+            break;
+        }
+        case EventType::SET: {
+            std::pair<std::string,std::string> parameter;
+            isValid = ReadString(input, parameter.first) && ReadString(input, parameter.second);
+            node.data = parameter;
+            break;
+        }
+        default:
+            break;
+    }
+
+    if(!isValid){
+        throw std::runtime_error("Parse Event Error: The binary event file is truncated.");
+    }
+    return true;
+}
+
+
+/**
+ * @brief Read the next chunk of events, the chunk is empty if the file ends.
+ */
+void EventHelper::ReadChunk(){
+
+    chunk.clear();
+    chunkIndex = 0;
+
+    EventNode node;
+    while(chunk.size() < chunkSize && (isBinary ? ReadBinaryEvent(node) : ReadTextEvent(node))){
+        chunk.emplace_back(std::move(node));
+        node = EventNode();
     }
 }
 
 
 /**
- * @brief Given the current time step, set the sliding window to refers to the current events to act.
- * @param time The current time step.
+ * @brief Get the next event without removing it. The next chunk is read if the current one is done.
+ * @return The next event, nullptr if all the events are done.
  */
-void EventHelper::GetMatchedNode(float time){
+const EventNode* EventHelper::PeekEvent(){
+    if(chunkIndex == chunk.size()){
+        ReadChunk();
+    }
+    return chunkIndex < chunk.size() ? &chunk[chunkIndex] : nullptr;
+}
 
-    auto iter = std::lower_bound(events.begin(),events.end(),time, EventNode::compare);
 
-    endIndex = iter-events.begin();
+/**
+ * @brief Remove the next event once it is run.
+ */
+void EventHelper::PopEvent(){
+    if(PeekEvent() != nullptr){
+        chunkIndex++;
+    }
 }
 
 
@@ -70,6 +254,76 @@ void EventHelper::GetMatchedNode(float time){
  * @brief Check if all the events are done.
  * @return True if all are done.
  */
-bool EventHelper::EventAllFinished() const {
-    return startIndex == events.size();
+bool EventHelper::EventAllFinished() {
+    return PeekEvent() == nullptr;
+}
+
+
+/**
+ * @brief Write one event to a binary event file.
+ * @param output The binary file.
+ * @param node The event to write.
+ */
+void EventHelper::WriteBinaryEvent(std::ofstream& output, const EventNode& node){
+
+    auto type = (uint8_t)node.eventType;
+    output.write(reinterpret_cast<const char*>(&node.time), sizeof(node.time));
+    output.write(reinterpret_cast<const char*>(&type), sizeof(type));
+
+    switch(node.eventType){
+        case EventType::PLAY: {
+            const auto& play = std::get<std::pair<float,int>>(node.data);
+            auto rate = (int32_t)play.second;
+            output.write(reinterpret_cast<const char*>(&play.first), sizeof(play.first));
+            output.write(reinterpret_cast<const char*>(&rate), sizeof(rate));
+            break;
+        }
+        case EventType::SAVE:
+        case EventType::MARK:
+        case EventType::CAMERA:
+            WriteString(output, std::get<std::string>(node.data));
+            break;
+        case EventType::LOOK: {
+            const auto& look = std::get<std::array<float,6>>(node.data);
+            output.write(reinterpret_cast<const char*>(look.data()), sizeof(float) * look.size());
+            break;
+        }
+        case EventType::SET: {
+            const auto& parameter = std::get<std::pair<std::string,std::string>>(node.data);
+            WriteString(output, parameter.first);
+            WriteString(output, parameter.second);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+
+/**
+ * @brief Convert a text event file into the binary format. The events are streamed, so the file can be of any size.
+ * @param srcFileName The text event file's path and name.
+ * @param dstFileName The binary event file's path and name.
+ */
+void EventHelper::ConvertToBinary(const std::string& srcFileName, const std::string& dstFileName){
+
+    EventHelper source;
+    source.ReadEventFile(srcFileName);
+
+    std::ofstream output(dstFileName, std::ios::binary);
+    if(!output){
+        throw std::runtime_error("Parse Event Error: Unable to open the output file.");
+    }
+
+    output.write(EVENT_MAGIC, 4);
+    output.write(reinterpret_cast<const char*>(&EVENT_VERSION), sizeof(EVENT_VERSION));
+
+    for(const EventNode* node = source.PeekEvent(); node != nullptr; node = source.PeekEvent()){
+        WriteBinaryEvent(output, *node);
+        source.PopEvent();
+    }
+
+    if(!output){
+        throw std::runtime_error("Parse Event Error: Unable to write the output file.");
+    }
 }
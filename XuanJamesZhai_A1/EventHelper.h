@@ -8,17 +8,24 @@
 #include <variant>
 #include <string>
 #include <vector>
+#include <array>
 #include <fstream>
+#include <cstdint>
 
 
 /**
  * @brief A list of events that can do.
+ * CAMERA switches to a named camera, LOOK places the movable camera (position and direction),
+ * SET changes a render parameter by name.
  */
 enum EventType{
     AVAILABLE,
     PLAY,
     SAVE,
     MARK,
+    CAMERA,
+    LOOK,
+    SET,
     NO_EVENT
 };
 
@@ -28,39 +35,68 @@ enum EventType{
  */
 class EventNode{
 public:
-    /* The time the event is processing. */
-    float time = 0;
+    /* The time the event is processing, in microseconds. An integer so hours long scripts keep the microseconds. */
+    uint64_t time = 0;
     /* The type of the event. */
     EventType eventType = EventType::NO_EVENT;
-    /* The actual value of data in the event. */
-    std::variant<std::string, std::pair<float,int>> data = "";
-
-    static bool compare(const EventNode& a,float b) {
-        return a.time <= b;
-    }
+    /* The actual value of data in the event. A name for SAVE, MARK and CAMERA, (time, rate) for PLAY,
+     * (position, direction) for LOOK, (name, value) for SET. */
+    std::variant<std::string, std::pair<float,int>, std::array<float,6>, std::pair<std::string,std::string>> data = "";
 
     EventNode() = default;
 };
 
+
+/**
+ * @brief Read the events lazily from a text or a binary (.xzev) event file.
+ * Only a chunk of events is kept in memory, so long capture scripts do not need to fit in memory.
+ * The binary file starts with "XZEV" and a version, then each event is its time as uint64 microseconds, its type as a byte and its data.
+ */
 class EventHelper {
 
-public:
-    /* A list contains all the events. */
-    std::vector<EventNode> events;
+private:
+    /* The opened event file. */
+    std::ifstream input;
+
+    /* Set if the event file is in the binary format. */
+    bool isBinary = false;
+
+    /* The events read from the file but not run yet. */
+    std::vector<EventNode> chunk;
+
+    /* The next event to run in the chunk. */
+    size_t chunkIndex = 0;
 
-    /* The start of the sliding window which has all the current events. */
-    size_t startIndex = 0;
-    /* The end of the sliding window. */
-    size_t endIndex = 0;
+    /* The number of events read at once. */
+    const size_t chunkSize = 4096;
 
-    /* Read and parse the event file. */
+    /* Read one event from a text event file. */
+    bool ReadTextEvent(EventNode& node);
+
+    /* Read one event from a binary event file. */
+    bool ReadBinaryEvent(EventNode& node);
+
+    /* Read the next chunk of events. */
+    void ReadChunk();
+
+    /* Write one event to a binary event file. */
+    static void WriteBinaryEvent(std::ofstream& output, const EventNode& node);
+
+public:
+    /* Open the event file, the events are read when they are needed. */
     void ReadEventFile(const std::string& fileName);
 
-    /* Given the current time step, set the sliding window to refers to the current events to act. */
-    void GetMatchedNode(float time);
+    /* Get the next event without removing it, nullptr if all are done. */
+    const EventNode* PeekEvent();
+
+    /* Remove the next event once it is run. */
+    void PopEvent();
 
     /* Check if we reach to the end of the event lists. */
-    bool EventAllFinished() const;
+    bool EventAllFinished();
+
+    /* Convert a text event file into the binary format. */
+    static void ConvertToBinary(const std::string& srcFileName, const std::string& dstFileName);
 };
 
 
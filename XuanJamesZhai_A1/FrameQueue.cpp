@@ -0,0 +1,102 @@
+//
+// Created by Xuan Zhai on 2024/5/4.
+//
+
+#include "FrameQueue.h"
+#include <algorithm>
+
+
+/**
+ * @brief Create a frame queue.
+ * @param newDepth The max number of snapshots waiting to be drawn, at least 1.
+ */
+FrameQueue::FrameQueue(size_t newDepth) : depth((std::max)(newDepth, (size_t)1)) {
+}
+
+
+/**
+ * @brief Get a snapshot to capture into. A drawn snapshot is reused if there is one, otherwise a new one is made.
+ * @return The snapshot.
+ */
+std::shared_ptr<FrameSnapshot> FrameQueue::Acquire(){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(freeSnapshots.empty()){
+        return std::make_shared<FrameSnapshot>();
+    }
+
+    std::shared_ptr<FrameSnapshot> snapshot = freeSnapshots.back();
+    freeSnapshots.pop_back();
+    return snapshot;
+}
+
+
+/**
+ * @brief Hand a drawn snapshot back so a later frame can capture into it.
+ * @param snapshot The drawn snapshot.
+ */
+void FrameQueue::Recycle(const std::shared_ptr<FrameSnapshot>& snapshot){
+    std::lock_guard<std::mutex> lock(mutex);
+    freeSnapshots.emplace_back(snapshot);
+}
+
+
+/**
+ * @brief Wait until a snapshot can be pushed without blocking. The window loop uses it to keep polling the window events.
+ * @param timeout The max time to wait.
+ * @return True if there is space or the queue is closed, false on timeout.
+ */
+bool FrameQueue::WaitForSpace(std::chrono::milliseconds timeout){
+    std::unique_lock<std::mutex> lock(mutex);
+    return notFull.wait_for(lock, timeout, [this]{ return isClosed || snapshots.size() < depth; });
+}
+
+
+/**
+ * @brief Push a captured snapshot. Wait while the queue is full, so the simulation runs at most the queue depth ahead.
+ * @param snapshot The captured snapshot.
+ * @return False if the queue is closed and the snapshot is dropped.
+ */
+bool FrameQueue::Push(const std::shared_ptr<FrameSnapshot>& snapshot){
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this]{ return isClosed || snapshots.size() < depth; });
+    if(isClosed){
+        return false;
+    }
+
+    snapshots.emplace_back(snapshot);
+    lock.unlock();
+    notEmpty.notify_one();
+    return true;
+}
+
+
+/**
+ * @brief Pop the oldest snapshot. Wait while the queue is empty.
+ * @return The snapshot, or nullptr once the queue is closed and all its snapshots are popped.
+ */
+std::shared_ptr<FrameSnapshot> FrameQueue::Pop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this]{ return isClosed || !snapshots.empty(); });
+    if(snapshots.empty()){
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameSnapshot> snapshot = snapshots.front();
+    snapshots.pop_front();
+    lock.unlock();
+    notFull.notify_one();
+    return snapshot;
+}
+
+
+/**
+ * @brief Stop the queue. The snapshots already pushed can still be popped, the later pushes are dropped.
+ */
+void FrameQueue::Close(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isClosed = true;
+    }
+    notFull.notify_all();
+    notEmpty.notify_all();
+}
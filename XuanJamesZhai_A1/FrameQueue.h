@@ -0,0 +1,95 @@
+//
+// Created by Xuan Zhai on 2024/5/4.
+//
+
+#ifndef XUANJAMESZHAI_A1_FRAMEQUEUE_H
+#define XUANJAMESZHAI_A1_FRAMEQUEUE_H
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "S72Helper.h"
+
+
+/**
+ * @brief The scene state a frame is drawn from, captured by the simulation thread after the scene update.
+ * The render thread only reads the snapshot, so the simulation can move on to the next frame while it is drawn.
+ */
+struct FrameSnapshot{
+    /* The index of the frame, counted by the simulation thread. */
+    uint64_t frameIndex = 0;
+
+    /* The time the snapshot is captured, the frame latency counts from it. */
+    std::chrono::steady_clock::time_point captureTime;
+
+    /* The camera the frame is drawn from. */
+    std::shared_ptr<S72Object::Camera> camera = std::make_shared<S72Object::Camera>();
+
+    /* The camera the instances are culled with, the user camera when drawing from the debug camera. */
+    std::shared_ptr<S72Object::Camera> cullingCamera = std::make_shared<S72Object::Camera>();
+
+    /* The cameras of the multi-view mode, in the order of VulkanHelper::viewCameras. */
+    std::vector<std::shared_ptr<S72Object::Camera>> viewCameras;
+
+    /* The culling mode, 'none' or 'frustum'. */
+    std::string cullingMode;
+
+    /* The instances of each mesh, in the order of S72Helper::meshes. */
+    std::vector<std::vector<S72Object::MeshInstance>> meshInstances;
+
+    /* The lights, in the order of S72Helper::lights. */
+    std::vector<std::shared_ptr<S72Object::Light>> lights;
+};
+
+
+/**
+ * @brief A bounded queue of frame snapshots between the simulation thread and the render thread.
+ * Its depth is the number of frames the simulation can run ahead of the render thread.
+ * The drawn snapshots are handed back to be reused, so their vectors keep their memory from frame to frame.
+ */
+class FrameQueue {
+
+private:
+    /* The captured snapshots waiting to be drawn. */
+    std::deque<std::shared_ptr<FrameSnapshot>> snapshots;
+
+    /* The drawn snapshots that can be captured into again. */
+    std::vector<std::shared_ptr<FrameSnapshot>> freeSnapshots;
+
+    /* The max number of snapshots waiting to be drawn. */
+    size_t depth;
+
+    /* Set when no snapshot will be pushed anymore. */
+    bool isClosed = false;
+
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+public:
+    explicit FrameQueue(size_t newDepth);
+
+    /* Get a snapshot to capture into, a drawn one if there is any. */
+    std::shared_ptr<FrameSnapshot> Acquire();
+
+    /* Hand a drawn snapshot back to be reused. */
+    void Recycle(const std::shared_ptr<FrameSnapshot>& snapshot);
+
+    /* Wait until a snapshot can be pushed without blocking, or until the timeout. */
+    bool WaitForSpace(std::chrono::milliseconds timeout);
+
+    /* Push a captured snapshot, wait while the queue is full. */
+    bool Push(const std::shared_ptr<FrameSnapshot>& snapshot);
+
+    /* Pop the oldest snapshot, wait while the queue is empty. */
+    std::shared_ptr<FrameSnapshot> Pop();
+
+    /* Stop the queue, the waiting threads are woken up. */
+    void Close();
+};
+
+
+#endif //XUANJAMESZHAI_A1_FRAMEQUEUE_H
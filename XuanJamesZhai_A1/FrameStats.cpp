@@ -0,0 +1,179 @@
+//
+// Created by Xuan Zhai on 2024/4/28.
+//
+
+#include "FrameStats.h"
+#include "JSONHelper.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+
+
+/**
+ * @brief Add a sample of a stage.
+ * @param stage The stage name, e.g. "cpu_record" or "gpu_shadow".
+ * @param milliseconds The time spent in the stage.
+ */
+void FrameStats::AddSample(const std::string& stage, double milliseconds){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = samples.find(stage);
+    if(iter == samples.end()){
+        stageNames.emplace_back(stage);
+        iter = samples.emplace(stage, std::vector<double>()).first;
+    }
+    iter->second.emplace_back(milliseconds);
+}
+
+
+/**
+ * @brief Add a sample of a counter. The counters are reported apart from the stages since they are not times.
+ * @param counter The counter name, e.g. "fragment_invocations".
+ * @param value The count of the frame.
+ */
+void FrameStats::AddCounter(const std::string& counter, double value){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = counterSamples.find(counter);
+    if(iter == counterSamples.end()){
+        counterNames.emplace_back(counter);
+        iter = counterSamples.emplace(counter, std::vector<double>()).first;
+    }
+    iter->second.emplace_back(value);
+}
+
+
+/**
+ * @brief Add a value written with the results.
+ * @param key The name of the value.
+ * @param value The value.
+ */
+void FrameStats::AddMetadata(const std::string& key, const std::string& value){
+    std::lock_guard<std::mutex> lock(mutex);
+    metadata.emplace_back(key, value);
+}
+
+
+/**
+ * @brief Compute the statistics of a list of samples. The percentiles use the nearest rank.
+ * @param values The samples, taken by value since they are sorted.
+ * @return The statistics.
+ */
+FrameStats::Summary FrameStats::Summarize(std::vector<double> values){
+
+    Summary summary;
+    if(values.empty()){
+        return summary;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    auto Percentile = [&values](double p){
+        auto rank = (size_t)std::ceil(p / 100.0 * (double)values.size());
+        return values[(std::max)(rank, (size_t)1) - 1];
+    };
+
+    summary.count = values.size();
+    summary.min = values.front();
+    summary.max = values.back();
+    summary.mean = std::accumulate(values.begin(), values.end(), 0.0) / (double)values.size();
+    summary.p50 = Percentile(50);
+    summary.p95 = Percentile(95);
+    summary.p99 = Percentile(99);
+    return summary;
+}
+
+
+/**
+ * @brief Print a table of all the stages, in milliseconds, then a table of all the counters.
+ */
+void FrameStats::Print() const {
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-28s %8s %9s %9s %9s %9s %9s %9s", "stage (ms)", "count", "min", "mean", "p50", "p95", "p99", "max");
+    std::cout << line << std::endl;
+
+    for(const auto& name : stageNames){
+        Summary s = Summarize(samples.at(name));
+        snprintf(line, sizeof(line), "%-28s %8zu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f", name.c_str(), s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+        std::cout << line << std::endl;
+    }
+
+    if(counterNames.empty()){
+        return;
+    }
+
+    snprintf(line, sizeof(line), "%-28s %8s %12s %12s %12s %12s %12s %12s", "counter", "count", "min", "mean", "p50", "p95", "p99", "max");
+    std::cout << line << std::endl;
+
+    for(const auto& name : counterNames){
+        Summary s = Summarize(counterSamples.at(name));
+        snprintf(line, sizeof(line), "%-28s %8zu %12.0f %12.0f %12.0f %12.0f %12.0f %12.0f", name.c_str(), s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+        std::cout << line << std::endl;
+    }
+}
+
+
+/**
+ * @brief Write the statistics as a JSON file: the metadata, an object per stage in milliseconds, then an object per counter.
+ * @param fileName The JSON file path and name.
+ */
+void FrameStats::SaveJSON(const std::string& fileName) const {
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the stats file: " + fileName);
+    }
+
+    file << "{\n  \"metadata\": {";
+    for(size_t i = 0; i < metadata.size(); i++){
+        file << (i == 0 ? "\n" : ",\n") << "    \"" << JSONHelper::Escape(metadata[i].first) << "\": \"" << JSONHelper::Escape(metadata[i].second) << "\"";
+    }
+    file << "\n  },\n  \"stages\": {";
+
+    char values[256];
+    for(size_t i = 0; i < stageNames.size(); i++){
+        Summary s = Summarize(samples.at(stageNames[i]));
+        snprintf(values, sizeof(values), "\"count\": %zu, \"min\": %.6f, \"mean\": %.6f, \"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"max\": %.6f",
+                 s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+        file << (i == 0 ? "\n" : ",\n") << "    \"" << JSONHelper::Escape(stageNames[i]) << "\": {" << values << "}";
+    }
+    file << "\n  },\n  \"counters\": {";
+
+    for(size_t i = 0; i < counterNames.size(); i++){
+        Summary s = Summarize(counterSamples.at(counterNames[i]));
+        snprintf(values, sizeof(values), "\"count\": %zu, \"min\": %.0f, \"mean\": %.3f, \"p50\": %.0f, \"p95\": %.0f, \"p99\": %.0f, \"max\": %.0f",
+                 s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+        file << (i == 0 ? "\n" : ",\n") << "    \"" << JSONHelper::Escape(counterNames[i]) << "\": {" << values << "}";
+    }
+    file << "\n  }\n}\n";
+}
+
+
+/**
+ * @brief Write the statistics as a CSV file, one stage or counter per row. The unit column is "ms" for the stages and "count" for the counters.
+ * @param fileName The CSV file path and name.
+ */
+void FrameStats::SaveCSV(const std::string& fileName) const {
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the stats file: " + fileName);
+    }
+
+    file << "stage,unit,count,min,mean,p50,p95,p99,max\n";
+
+    char line[256];
+    for(const auto& name : stageNames){
+        Summary s = Summarize(samples.at(name));
+        snprintf(line, sizeof(line), "%s,ms,%zu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", name.c_str(), s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+        file << line;
+    }
+    for(const auto& name : counterNames){
+        Summary s = Summarize(counterSamples.at(name));
+        snprintf(line, sizeof(line), "%s,count,%zu,%.0f,%.3f,%.0f,%.0f,%.0f,%.0f\n", name.c_str(), s.count, s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+        file << line;
+    }
+}
@@ -0,0 +1,79 @@
+//
+// Created by Xuan Zhai on 2024/4/28.
+//
+
+#ifndef XUANJAMESZHAI_A1_FRAMESTATS_H
+#define XUANJAMESZHAI_A1_FRAMESTATS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <mutex>
+
+
+/**
+ * @brief Collect the time of each frame stage (CPU or GPU, in milliseconds) over a performance run,
+ * then report min/mean/p50/p95/p99 for each stage on the console, as JSON or as CSV.
+ * The per-frame counters, like the shaded fragments, are kept and reported apart from the times.
+ */
+class FrameStats {
+
+public:
+    /**
+     * @brief The statistics of a stage over the run.
+     */
+    struct Summary{
+        size_t count = 0;
+        double min = 0;
+        double mean = 0;
+        double p50 = 0;
+        double p95 = 0;
+        double p99 = 0;
+        double max = 0;
+    };
+
+private:
+    /* The stage names in the order they first appear. */
+    std::vector<std::string> stageNames;
+
+    /* The samples of each stage, in milliseconds. */
+    std::map<std::string, std::vector<double>> samples;
+
+    /* The counter names in the order they first appear. */
+    std::vector<std::string> counterNames;
+
+    /* The samples of each counter, plain counts. */
+    std::map<std::string, std::vector<double>> counterSamples;
+
+    /* Extra values written with the results, like the scene name or the frame count. */
+    std::vector<std::pair<std::string,std::string>> metadata;
+
+    /* The samples can be added from the simulation thread and the render thread. */
+    std::mutex mutex;
+
+public:
+    /* Add a sample of a stage, in milliseconds. */
+    void AddSample(const std::string& stage, double milliseconds);
+
+    /* Add a sample of a counter, a plain count like "fragment_invocations". */
+    void AddCounter(const std::string& counter, double value);
+
+    /* Add a value written with the results. */
+    void AddMetadata(const std::string& key, const std::string& value);
+
+    /* Compute the statistics of a list of samples. */
+    static Summary Summarize(std::vector<double> values);
+
+    /* Print a table of all the stages, then of all the counters. */
+    void Print() const;
+
+    /* Write the statistics as a JSON file. */
+    void SaveJSON(const std::string& fileName) const;
+
+    /* Write the statistics as a CSV file, one stage or counter per row with its unit. */
+    void SaveCSV(const std::string& fileName) const;
+};
+
+
+#endif //XUANJAMESZHAI_A1_FRAMESTATS_H
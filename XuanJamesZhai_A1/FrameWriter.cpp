@@ -0,0 +1,123 @@
+//
+// Created by Xuan Zhai on 2024/4/26.
+//
+
+#include "FrameWriter.h"
+#include "ImageWriter.h"
+#include <algorithm>
+
+
+/**
+ * @brief Start the workers. A few are enough to keep up with the saves, the rest of the cores are left to the renderer.
+ * @param[in] nThreads The number of workers, 0 means up to 4 depending on the hardware thread count.
+ */
+FrameWriter::FrameWriter(uint32_t nThreads) {
+
+    if(nThreads == 0){
+        nThreads = (std::min)(4u, std::thread::hardware_concurrency() / 2);
+    }
+    /* hardware_concurrency() may return 0 if it is unknown. */
+    if(nThreads == 0){
+        nThreads = 1;
+    }
+
+    for(uint32_t i = 0; i < nThreads; i++){
+        workers.emplace_back(&FrameWriter::WorkerLoop, this);
+    }
+}
+
+
+/**
+ * @brief Queue a frame to be written. Block if too many frames are already waiting.
+ * @param[in] filename The target file name, its extension picks the format.
+ * @param[in] width The width of the frame.
+ * @param[in] height The height of the frame.
+ * @param[in] pixels The RGBA8 pixels, moved into the queue.
+ */
+void FrameWriter::Push(const std::string& filename, uint32_t width, uint32_t height, std::vector<unsigned char>&& pixels) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this]{ return jobs.size() < maxPendingJobs; });
+
+    Job job;
+    job.filename = filename;
+    job.width = width;
+    job.height = height;
+    job.pixels = std::move(pixels);
+    jobs.push_back(std::move(job));
+
+    jobCondition.notify_one();
+}
+
+
+/**
+ * @brief Block until all the queued frames are written.
+ * Throw the first error met by the workers, if any.
+ */
+void FrameWriter::Flush() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this]{ return jobs.empty() && busyWorkers == 0; });
+
+    if(error){
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+
+/**
+ * @brief The main loop of each worker. Take the frames in order and write them until the writer is destroyed.
+ */
+void FrameWriter::WorkerLoop() {
+
+    while(true){
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobCondition.wait(lock, [this]{ return stop || !jobs.empty(); });
+            if(jobs.empty()){
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            busyWorkers++;
+        }
+        /* Wake up a Push waiting for a free slot. */
+        doneCondition.notify_all();
+
+        std::exception_ptr jobError = nullptr;
+        try{
+            ImageWriter::Save(job.filename, job.width, job.height, job.pixels.data());
+        }
+        catch(...){
+            jobError = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+            if(jobError && !error){
+                error = jobError;
+            }
+        }
+        doneCondition.notify_all();
+    }
+}
+
+
+/**
+ * @brief Write the remaining frames, then stop and join the workers.
+ */
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobCondition.notify_all();
+
+    for(auto& worker : workers){
+        worker.join();
+    }
+}
@@ -0,0 +1,80 @@
+//
+// Created by Xuan Zhai on 2024/4/26.
+//
+
+#ifndef XUANJAMESZHAI_A1_FRAMEWRITER_H
+#define XUANJAMESZHAI_A1_FRAMEWRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief Write the frames read back from the GPU to files on a few background threads,
+ * so the render loop does not wait for the encoding or the disk.
+ */
+class FrameWriter {
+
+private:
+    /**
+     * @brief A frame waiting to be written.
+     */
+    struct Job{
+        std::string filename;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        /* RGBA8 pixels, row by row. */
+        std::vector<unsigned char> pixels;
+    };
+
+    /* The frames waiting to be written, in the order they are pushed. */
+    std::deque<Job> jobs;
+
+    /* The max number of frames waiting, Push blocks beyond that so the queue cannot eat all the memory. */
+    const size_t maxPendingJobs = 8;
+
+    /* Number of workers encoding a frame right now. */
+    uint32_t busyWorkers = 0;
+
+    /* Set when the writer is destroyed. */
+    bool stop = false;
+
+    /* The first error met by the workers, thrown again by Flush. */
+    std::exception_ptr error = nullptr;
+
+    std::mutex mutex;
+
+    /* Wake up a worker when a job is pushed. */
+    std::condition_variable jobCondition;
+
+    /* Wake up the render thread when a job is done. */
+    std::condition_variable doneCondition;
+
+    /* The worker threads. */
+    std::vector<std::thread> workers;
+
+    /* The main loop of each worker. */
+    void WorkerLoop();
+
+public:
+    /* Start nThreads workers, 0 means a few depending on the hardware thread count. */
+    explicit FrameWriter(uint32_t nThreads = 0);
+
+    /* Queue a frame to be written. */
+    void Push(const std::string& filename, uint32_t width, uint32_t height, std::vector<unsigned char>&& pixels);
+
+    /* Block until all the queued frames are written. */
+    void Flush();
+
+    /* Write the remaining frames and join the workers. */
+    ~FrameWriter();
+};
+
+
+#endif //XUANJAMESZHAI_A1_FRAMEWRITER_H
@@ -0,0 +1,175 @@
+//
+// Created by Xuan Zhai on 2024/4/27.
+//
+
+#include "ImageWriter.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#endif
+
+
+/**
+ * @brief Get the format of a file from its extension.
+ * @param[in] filename The file name.
+ * @return The format, PPM if the extension is not known.
+ */
+EImageFormat ImageWriter::GetFormat(const std::string& filename){
+
+    size_t dot = filename.find_last_of('.');
+    if(dot == std::string::npos){
+        return EImageFormat::PPM;
+    }
+
+    std::string extension = filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){ return (char)std::tolower(c); });
+
+    if(extension == "png"){
+        return EImageFormat::PNG;
+    }
+    if(extension == "pfm"){
+        return EImageFormat::PFM;
+    }
+    return EImageFormat::PPM;
+}
+
+
+/**
+ * @brief Drop the alpha channel of RGBA8 pixels.
+ * With SSSE3 four pixels are shuffled at once, the plain loop is left for the compiler to vectorize.
+ * @param[in] rgba The source pixels, 4 bytes each.
+ * @param[out] rgb The destination, 3 bytes per pixel.
+ * @param[in] nPixels The number of pixels.
+ */
+void ImageWriter::SwizzleRGBAToRGB(const unsigned char* rgba, unsigned char* rgb, size_t nPixels){
+
+    size_t i = 0;
+
+#if defined(__SSSE3__) || defined(__AVX__)
+    /* Each store writes 16 bytes for 12 useful ones, stop early enough to stay in the destination. */
+    const __m128i mask = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+    for(; i + 6 <= nPixels; i += 4){
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + i * 3), _mm_shuffle_epi8(pixels, mask));
+    }
+#endif
+
+    for(; i < nPixels; i++){
+        rgb[i * 3 + 0] = rgba[i * 4 + 0];
+        rgb[i * 3 + 1] = rgba[i * 4 + 1];
+        rgb[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+}
+
+
+/**
+ * @brief Save a RGBA8 image to a PPM (P6) file. The alpha is dropped and the whole image is written at once.
+ * @param[in] filename The target file name.
+ * @param[in] width The width of the image.
+ * @param[in] height The height of the image.
+ * @param[in] rgba The pixels, row by row from the top.
+ */
+void ImageWriter::SaveToPPM(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba){
+
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+    std::vector<char> data(header.size() + (size_t)width * height * 3);
+    memcpy(data.data(), header.data(), header.size());
+    SwizzleRGBAToRGB(rgba, reinterpret_cast<unsigned char*>(data.data() + header.size()), (size_t)width * height);
+
+    std::ofstream ppmFile(filename, std::ios::binary);
+    if (!ppmFile.is_open()) {
+        throw std::runtime_error("Failed to open PPM file for writing.");
+    }
+    ppmFile.write(data.data(), (std::streamsize)data.size());
+    if(!ppmFile){
+        throw std::runtime_error("Failed to write the PPM file.");
+    }
+}
+
+
+/**
+ * @brief Save a RGBA8 image to a PNG file. The alpha is dropped.
+ * @param[in] filename The target file name.
+ * @param[in] width The width of the image.
+ * @param[in] height The height of the image.
+ * @param[in] rgba The pixels, row by row from the top.
+ */
+void ImageWriter::SaveToPNG(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba){
+
+    std::vector<unsigned char> rgb((size_t)width * height * 3);
+    SwizzleRGBAToRGB(rgba, rgb.data(), (size_t)width * height);
+
+    if(!stbi_write_png(filename.c_str(), (int)width, (int)height, 3, rgb.data(), (int)width * 3)){
+        throw std::runtime_error("Failed to write the PNG file.");
+    }
+}
+
+
+/**
+ * @brief Save a RGBA8 image to a PFM (PF) file, as little endian floats in [0,1].
+ * PFM stores the rows from the bottom, so they are flipped here.
+ * @param[in] filename The target file name.
+ * @param[in] width The width of the image.
+ * @param[in] height The height of the image.
+ * @param[in] rgba The pixels, row by row from the top.
+ */
+void ImageWriter::SaveToPFM(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba){
+
+    /* A negative scale means little endian. */
+    std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+
+    std::vector<float> values((size_t)width * height * 3);
+    for(uint32_t y = 0; y < height; y++){
+        const unsigned char* src = rgba + (size_t)(height - 1 - y) * width * 4;
+        float* dst = values.data() + (size_t)y * width * 3;
+        for(uint32_t x = 0; x < width; x++){
+            dst[x * 3 + 0] = (float)src[x * 4 + 0] / 255.0f;
+            dst[x * 3 + 1] = (float)src[x * 4 + 1] / 255.0f;
+            dst[x * 3 + 2] = (float)src[x * 4 + 2] / 255.0f;
+        }
+    }
+
+    std::ofstream pfmFile(filename, std::ios::binary);
+    if (!pfmFile.is_open()) {
+        throw std::runtime_error("Failed to open PFM file for writing.");
+    }
+    pfmFile.write(header.data(), (std::streamsize)header.size());
+    pfmFile.write(reinterpret_cast<const char*>(values.data()), (std::streamsize)(values.size() * sizeof(float)));
+    if(!pfmFile){
+        throw std::runtime_error("Failed to write the PFM file.");
+    }
+}
+
+
+/**
+ * @brief Save a RGBA8 image, the format is chosen by the file extension (.png, .pfm, PPM otherwise).
+ * @param[in] filename The target file name.
+ * @param[in] width The width of the image.
+ * @param[in] height The height of the image.
+ * @param[in] rgba The pixels, row by row from the top.
+ */
+void ImageWriter::Save(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba){
+
+    switch(GetFormat(filename)){
+        case EImageFormat::PNG:
+            SaveToPNG(filename, width, height, rgba);
+            break;
+        case EImageFormat::PFM:
+            SaveToPFM(filename, width, height, rgba);
+            break;
+        default:
+            SaveToPPM(filename, width, height, rgba);
+            break;
+    }
+}
@@ -0,0 +1,52 @@
+//
+// Created by Xuan Zhai on 2024/4/27.
+//
+
+#ifndef XUANJAMESZHAI_A1_IMAGEWRITER_H
+#define XUANJAMESZHAI_A1_IMAGEWRITER_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+
+/**
+ * @brief The file formats a rendered frame can be saved to.
+ * PFM stores 32-bit floats, it is used to debug the HDR values.
+ */
+enum class EImageFormat : uint32_t{
+    PPM = 0,
+    PNG = 1,
+    PFM = 2
+};
+
+
+/**
+ * @brief Encode a RGBA8 frame read back from the GPU and write it to a file.
+ * Each image is converted in a single pass and written with one call, instead of byte by byte.
+ */
+class ImageWriter {
+
+private:
+    /* Write a PPM (P6) file. */
+    static void SaveToPPM(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba);
+
+    /* Write a PNG file through stb_image_write. */
+    static void SaveToPNG(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba);
+
+    /* Write a PFM (PF) file with the 32-bit float RGB values. */
+    static void SaveToPFM(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba);
+
+public:
+    /* Get the format of a file from its extension, PPM if it is unknown. */
+    static EImageFormat GetFormat(const std::string& filename);
+
+    /* Drop the alpha channel of nPixels RGBA8 pixels. */
+    static void SwizzleRGBAToRGB(const unsigned char* rgba, unsigned char* rgb, size_t nPixels);
+
+    /* Save a RGBA8 image, the format is chosen by the file extension. */
+    static void Save(const std::string& filename, uint32_t width, uint32_t height, const unsigned char* rgba);
+};
+
+
+#endif //XUANJAMESZHAI_A1_IMAGEWRITER_H
@@ -0,0 +1,21 @@
+//
+// Created by Xuan Zhai on 2024/5/2.
+//
+
+#include "JSONHelper.h"
+
+
+/**
+ * @brief Escape a name written in a JSON string.
+ * The names are plain identifiers like the stage or zone names, only the quotes and backslashes need escaping.
+ * @param text The name.
+ * @return The escaped name.
+ */
+std::string JSONHelper::Escape(const std::string& text){
+    std::string result;
+    for(char c : text){
+        if(c == '"' || c == '\\') result += '\\';
+        result += c;
+    }
+    return result;
+}
@@ -0,0 +1,22 @@
+//
+// Created by Xuan Zhai on 2024/5/2.
+//
+
+#ifndef XUANJAMESZHAI_A1_JSONHELPER_H
+#define XUANJAMESZHAI_A1_JSONHELPER_H
+
+#include <string>
+
+
+/**
+ * @brief The helpers shared by the JSON files we write, the frame stats and the Chrome trace.
+ */
+class JSONHelper {
+
+public:
+    /* Escape a name written in a JSON string. */
+    static std::string Escape(const std::string& text);
+};
+
+
+#endif //XUANJAMESZHAI_A1_JSONHELPER_H
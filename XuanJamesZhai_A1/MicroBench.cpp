@@ -0,0 +1,74 @@
+//
+// Created by Xuan Zhai on 2024/4/30.
+//
+
+#include "MicroBench.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+
+/**
+ * @brief Set the batch time, the number of batches and the name filter.
+ * @param newMinBatchMilliseconds The time a batch should take at least.
+ * @param newRepetitions The number of batches timed for each benchmark.
+ * @param newFilter Only the benchmarks whose name contains it are run, empty means all.
+ */
+void MicroBench::SetOptions(double newMinBatchMilliseconds, uint32_t newRepetitions, const std::string& newFilter){
+    minBatchMilliseconds = newMinBatchMilliseconds;
+    repetitions = newRepetitions;
+    filter = newFilter;
+}
+
+
+/**
+ * @brief Check if a benchmark is selected by the filter.
+ * @param name The benchmark name.
+ * @return True if it should run.
+ */
+bool MicroBench::IsSelected(const std::string& name) const {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+
+/**
+ * @brief Print a table of all the results: the time per operation, the operations and the bytes per second.
+ */
+void MicroBench::Print() const {
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-36s %12s %12s %14s %12s", "benchmark", "iterations", "ns/op", "op/s", "MB/s");
+    std::cout << line << std::endl;
+
+    for(const auto& result : results){
+        char bytes[32] = "-";
+        if(result.bytesPerSecond > 0){
+            snprintf(bytes, sizeof(bytes), "%.1f", result.bytesPerSecond / 1e6);
+        }
+        snprintf(line, sizeof(line), "%-36s %12llu %12.2f %14.0f %12s", result.name.c_str(), (unsigned long long)result.iterations,
+                 result.nsPerOp, 1e9 / result.nsPerOp, bytes);
+        std::cout << line << std::endl;
+    }
+}
+
+
+/**
+ * @brief Write the results as a CSV file, one benchmark per row.
+ * @param fileName The CSV file path and name.
+ */
+void MicroBench::SaveCSV(const std::string& fileName) const {
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the benchmark file: " + fileName);
+    }
+
+    file << "benchmark,iterations,ns_per_op,bytes_per_second\n";
+
+    char line[256];
+    for(const auto& result : results){
+        snprintf(line, sizeof(line), "%s,%llu,%.3f,%.0f\n", result.name.c_str(), (unsigned long long)result.iterations, result.nsPerOp, result.bytesPerSecond);
+        file << line;
+    }
+}
@@ -0,0 +1,144 @@
+//
+// Created by Xuan Zhai on 2024/4/30.
+//
+
+#ifndef XUANJAMESZHAI_A1_MICROBENCH_H
+#define XUANJAMESZHAI_A1_MICROBENCH_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+
+/**
+ * @brief A small runner for the CPU microbenchmarks. Each benchmark is an operation called with its iteration index,
+ * it is run in batches long enough to hide the clock resolution, and the median batch gives the time per operation.
+ */
+class MicroBench {
+
+public:
+    /**
+     * @brief The result of a benchmark.
+     */
+    struct Result{
+        std::string name;
+        /* The number of operations in each batch. */
+        uint64_t iterations = 0;
+        /* The median time per operation. */
+        double nsPerOp = 0;
+        /* The bytes processed per second, 0 if the operation has no byte size. */
+        double bytesPerSecond = 0;
+    };
+
+private:
+    /* The results in the order the benchmarks are run. */
+    std::vector<Result> results;
+
+    /* The time a batch should take at least, in milliseconds. */
+    double minBatchMilliseconds = 20;
+
+    /* The number of batches timed for each benchmark. */
+    uint32_t repetitions = 5;
+
+    /* Only the benchmarks whose name contains it are run, empty means all. */
+    std::string filter;
+
+    /* Time a batch of operations, return the time in nanoseconds. */
+    template<typename F>
+    static double RunBatch(F& operation, uint64_t iterations);
+
+public:
+    /* Keep a value alive so the compiler does not remove the operation computing it. */
+    template<typename T>
+    static void KeepValue(const T& value);
+
+    /* Set the batch time, the number of batches and the name filter. */
+    void SetOptions(double newMinBatchMilliseconds, uint32_t newRepetitions, const std::string& newFilter);
+
+    /* Check if a benchmark is selected by the filter. */
+    [[nodiscard]] bool IsSelected(const std::string& name) const;
+
+    /* Run a benchmark and record its result. */
+    template<typename F>
+    void Run(const std::string& name, double bytesPerOp, F&& operation);
+
+    /* Print a table of all the results. */
+    void Print() const;
+
+    /* Write the results as a CSV file, one benchmark per row. */
+    void SaveCSV(const std::string& fileName) const;
+};
+
+
+/**
+ * @brief Keep a value alive so the compiler does not remove the operation computing it.
+ * @param value The result of the operation.
+ */
+template<typename T>
+void MicroBench::KeepValue(const T& value){
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<const volatile char*>(&value);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+
+/**
+ * @brief Time a batch of operations.
+ * @param operation The operation, called with the iteration index.
+ * @param iterations The number of operations.
+ * @return The time of the batch in nanoseconds.
+ */
+template<typename F>
+double MicroBench::RunBatch(F& operation, uint64_t iterations){
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < iterations; i++){
+        operation(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+
+/**
+ * @brief Run a benchmark: grow the batch until it lasts the minimum batch time, then time the batches and keep the median.
+ * @param name The benchmark name, e.g. "parse/wide".
+ * @param bytesPerOp The bytes processed by an operation, 0 if it has no byte size.
+ * @param operation The operation, called with the iteration index so it can walk through its inputs.
+ */
+template<typename F>
+void MicroBench::Run(const std::string& name, double bytesPerOp, F&& operation){
+
+    if(!IsSelected(name)){
+        return;
+    }
+
+    /* Double the batch until it is long enough, the first call also warms the caches. */
+    uint64_t iterations = 1;
+    double minBatchNanoseconds = minBatchMilliseconds * 1e6;
+    while(RunBatch(operation, iterations) < minBatchNanoseconds && iterations < (1ull << 40)){
+        iterations *= 2;
+    }
+
+    std::vector<double> batches;
+    for(uint32_t i = 0; i < (std::max)(repetitions, 1u); i++){
+        batches.emplace_back(RunBatch(operation, iterations) / (double)iterations);
+    }
+    std::sort(batches.begin(), batches.end());
+
+    Result result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = batches[batches.size() / 2];
+    result.bytesPerSecond = bytesPerOp > 0 ? bytesPerOp / result.nsPerOp * 1e9 : 0;
+    results.emplace_back(result);
+}
+
+
+#endif //XUANJAMESZHAI_A1_MICROBENCH_H
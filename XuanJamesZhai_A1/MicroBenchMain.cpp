@@ -0,0 +1,359 @@
+//
+// Created by Xuan Zhai on 2024/4/30.
+//
+
+/* The CPU microbenchmarks of the parser, the scene graph, the culling, the drivers and the math library.
+ * It is built without Vulkan or GLFW, so the hot paths can be measured on any machine. */
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <random>
+#include <functional>
+#include "MicroBench.h"
+#include "S72Helper.h"
+#include "FrustumCulling.h"
+#include "XZJParser.h"
+#include "XZMath.h"
+
+/* The stb image implementation is compiled here, the materials read their textures with it. */
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+/* The extra s72 files to parse and update, on top of the generated ones. */
+static std::vector<std::string> sceneFileNames;
+
+/* The directory the generated scenes are written to. */
+static std::string workDirectory = "microbench_scenes";
+
+/* The number of mesh instances in the generated scenes. */
+static uint32_t instanceCount = 4096;
+
+/* Only the benchmarks whose name contains it are run. */
+static std::string benchFilter;
+
+/* The time a batch should take at least, in milliseconds. */
+static double minBatchMilliseconds = 20;
+
+/* The number of batches timed for each benchmark. */
+static uint32_t repetitions = 5;
+
+/* The CSV file the results are written to, empty means the console only. */
+static std::string csvFileName;
+
+
+/**
+ * @brief Read the command line arguments and record their values.
+ * @param argc The number of arguments
+ * @param argv The char array of the arguments
+ */
+void ReadCMDArguments(int argc, char** argv){
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i],"--scene") == 0){
+            sceneFileNames.emplace_back(argv[i+1]);
+        }
+        else if(strcmp(argv[i],"--work-dir") == 0){
+            workDirectory = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--instances") == 0){
+            instanceCount = strtoul(argv[i+1],nullptr,0);
+        }
+        else if(strcmp(argv[i],"--filter") == 0){
+            benchFilter = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--min-time") == 0){
+            minBatchMilliseconds = strtod(argv[i+1],nullptr);
+        }
+        else if(strcmp(argv[i],"--repetitions") == 0){
+            repetitions = strtoul(argv[i+1],nullptr,0);
+        }
+        else if(strcmp(argv[i],"--csv") == 0){
+            csvFileName = argv[i+1];
+        }
+    }
+}
+
+
+/**
+ * @brief Write a scene made of a tree of nodes with a single triangle mesh at each leaf.
+ * Up to 64 group nodes, spread over the tree, are turned by a driver, so the update also runs the drivers.
+ * @param fileName The s72 file path and name, the b72 file is written next to it.
+ * @param branching The number of children of each group node.
+ * @param depth The number of group node levels above the leaves.
+ */
+static void WriteTreeScene(const std::string& fileName, uint32_t branching, uint32_t depth){
+
+    std::string meshFileName = std::filesystem::path(fileName).stem().string() + ".b72";
+    std::ofstream meshFile(std::filesystem::path(fileName).parent_path() / meshFileName, std::ios::binary);
+    const float vertices[3][13] = {
+            {-1,-1,0, 0,0,1, 1,0,0,1, 0,0, 0},
+            { 1,-1,0, 0,0,1, 1,0,0,1, 1,0, 0},
+            { 0, 1,0, 0,0,1, 1,0,0,1, 0,1, 0},
+    };
+    for(const auto& vertex : vertices){
+        const uint32_t white = 0xFFFFFFFF;
+        meshFile.write(reinterpret_cast<const char*>(vertex), sizeof(float) * 12);
+        meshFile.write(reinterpret_cast<const char*>(&white), sizeof(white));
+    }
+    meshFile.close();
+
+    auto Attribute = [&meshFileName](const char* name, int offset, const char* format){
+        return std::string("\"") + name + "\":{\"src\":\"" + meshFileName + "\",\"offset\":" + std::to_string(offset) + ",\"stride\":52,\"format\":\"" + format + "\"}";
+    };
+
+    /* The s72 objects, the nodes are reserved first so their children come after them. */
+    std::vector<std::string> objects = {"\"s72-v1\""};
+    objects.emplace_back("{\"type\":\"MESH\",\"name\":\"Triangle\",\"topology\":\"TRIANGLE_LIST\",\"count\":3,\"attributes\":{" +
+                         Attribute("POSITION", 0, "R32G32B32_SFLOAT") + "," + Attribute("NORMAL", 12, "R32G32B32_SFLOAT") + "," +
+                         Attribute("TANGENT", 24, "R32G32B32A32_SFLOAT") + "," + Attribute("TEXCOORD", 40, "R32G32_SFLOAT") + "," +
+                         Attribute("COLOR", 48, "R8G8B8A8_UNORM") + "}}");
+
+    std::vector<size_t> groups;
+    uint32_t leafCount = 0;
+
+    std::function<size_t(uint32_t)> AddNode = [&](uint32_t level) -> size_t {
+        size_t index = objects.size();
+        objects.emplace_back();
+        std::string name = "Node." + std::to_string(index);
+
+        if(level == depth || leafCount >= instanceCount){
+            leafCount++;
+            objects[index] = "{\"type\":\"NODE\",\"name\":\"" + name + "\",\"translation\":[" + std::to_string(leafCount % 64) + "," +
+                             std::to_string(leafCount / 64) + ",0],\"rotation\":[0,0,0,1],\"scale\":[1,1,1],\"mesh\":1}";
+            return index;
+        }
+
+        groups.emplace_back(index);
+        std::string children;
+        for(uint32_t i = 0; i < branching && leafCount < instanceCount; i++){
+            children += (i == 0 ? "" : ",") + std::to_string(AddNode(level + 1));
+        }
+        objects[index] = "{\"type\":\"NODE\",\"name\":\"" + name + "\",\"translation\":[0,0,0],\"rotation\":[0,0,0,1],\"scale\":[1,1,1],\"children\":[" + children + "]}";
+        return index;
+    };
+
+    std::string roots;
+    while(leafCount < instanceCount){
+        roots += (roots.empty() ? "" : ",") + std::to_string(AddNode(0));
+    }
+
+    size_t driverStep = (std::max)(groups.size() / 64, (size_t)1);
+    for(size_t i = 0; i < groups.size(); i += driverStep){
+        objects.emplace_back("{\"type\":\"DRIVER\",\"name\":\"Spin." + std::to_string(i) + "\",\"node\":" + std::to_string(groups[i]) +
+                             ",\"channel\":\"rotation\",\"times\":[0,1,2],\"values\":[0,0,0,1, 0,0,1,0, 0,0,0,1],\"interpolation\":\"SLERP\"}");
+    }
+    objects.emplace_back("{\"type\":\"SCENE\",\"name\":\"Tree\",\"roots\":[" + roots + "]}");
+
+    std::ofstream file(fileName);
+    file << "[";
+    for(size_t i = 0; i < objects.size(); i++){
+        file << (i == 0 ? "\n" : ",\n") << objects[i];
+    }
+    file << "\n]\n";
+}
+
+
+/**
+ * @brief Measure the parser on a s72 file, in bytes per second of the file.
+ * @param bench The benchmark runner.
+ * @param name The name of the scene.
+ * @param fileName The s72 file path and name.
+ */
+static void BenchParse(MicroBench& bench, const std::string& name, const std::string& fileName){
+    auto fileSize = (double)std::filesystem::file_size(fileName);
+    XZJParser parser;
+    bench.Run("parse/" + name, fileSize, [&](uint64_t){
+        std::shared_ptr<ParserNode> root = parser.Parse(fileName);
+        MicroBench::KeepValue(root);
+    });
+}
+
+
+/**
+ * @brief Measure the scene graph update on a s72 file, with the animation on the virtual clock so the drivers run too.
+ * @param bench The benchmark runner.
+ * @param name The name of the scene.
+ * @param fileName The s72 file path and name.
+ */
+static void BenchUpdate(MicroBench& bench, const std::string& name, const std::string& fileName){
+    if(!bench.IsSelected("update/" + name)){
+        return;
+    }
+
+    S72Helper helper;
+    helper.ReadS72(fileName);
+    helper.useVirtualClock = true;
+    helper.StartAnimation();
+
+    bench.Run("update/" + name, 0, [&](uint64_t i){
+        helper.SetAnimationTime((float)(i % 600) / 60.0f);
+        helper.UpdateObjects();
+        MicroBench::KeepValue(helper.currDuration);
+    });
+}
+
+
+/**
+ * @brief Measure the frustum culling on random instances around a camera, in bytes per second of model matrices.
+ * @param bench The benchmark runner.
+ */
+static void BenchCulling(MicroBench& bench){
+
+    auto camera = std::make_shared<S72Object::Camera>();
+    camera->SetCameraData(1.7778f, 1.0f, 0.1f, 100.0f);
+    camera->ComputeViewMatrix();
+    camera->ComputeProjectionMatrix();
+
+    AABB boundingBox;
+    boundingBox.b_min = XZM::vec3(-1, -1, -1);
+    boundingBox.b_max = XZM::vec3(1, 1, 1);
+
+    /* The instances are spread around the camera, so some are visible and some are culled. */
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> component(-1.0f, 1.0f);
+    std::vector<XZM::mat4> models;
+    for(uint32_t i = 0; i < 4096; i++){
+        XZM::quat rotation(component(random), component(random), component(random), component(random));
+        float length = std::sqrt(XZM::DotProduct(rotation, rotation));
+        rotation = rotation * (1.0f / (std::max)(length, 1e-4f));
+        XZM::mat4 rotationMatrix = XZM::QuatToMat4(rotation);
+        models.emplace_back(rotationMatrix * XZM::Translation(XZM::vec3(position(random), position(random), position(random))));
+    }
+
+    bench.Run("culling/is_culled", sizeof(XZM::mat4), [&](uint64_t i){
+        bool isCulled = FrustumCulling::IsCulled(camera, boundingBox, models[i & 4095]);
+        MicroBench::KeepValue(isCulled);
+    });
+}
+
+
+/**
+ * @brief Measure the driver interpolation with 64 keys at random times.
+ * @param bench The benchmark runner.
+ */
+static void BenchDrivers(MicroBench& bench){
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> time(0.0f, 10.0f);
+    std::vector<float> times(1024);
+    for(float& t : times){
+        t = time(random);
+    }
+
+    auto MakeDriver = [](const std::string& channel, const std::string& interpolation){
+        S72Object::Driver driver;
+        driver.channel = channel;
+        driver.interpolation = interpolation;
+        for(uint32_t k = 0; k < 64; k++){
+            float angle = (float)k * 0.1f;
+            driver.timers.emplace_back((float)k * 10.0f / 63.0f);
+            if(channel == "rotation"){
+                driver.values.emplace_back(XZM::quat(0, 0, std::sin(angle), std::cos(angle)));
+            }
+            else{
+                driver.values.emplace_back(XZM::vec3(angle, 2.0f * angle, 0));
+            }
+        }
+        return driver;
+    };
+
+    const std::pair<std::string,std::string> kinds[] = {{"translation","LINEAR"}, {"rotation","LINEAR"}, {"rotation","SLERP"}, {"rotation","STEP"}};
+    for(const auto& kind : kinds){
+        S72Object::Driver driver = MakeDriver(kind.first, kind.second);
+        bench.Run("driver/" + kind.first + "_" + kind.second, 0, [&](uint64_t i){
+            auto value = driver.GetCurrentValue(times[i & 1023]);
+            MicroBench::KeepValue(value);
+        });
+    }
+}
+
+
+/**
+ * @brief Measure the core math operations used by the scene graph update and the culling.
+ * @param bench The benchmark runner.
+ */
+static void BenchMath(MicroBench& bench){
+
+    std::mt19937 random(13);
+    std::uniform_real_distribution<float> component(-1.0f, 1.0f);
+
+    std::vector<XZM::mat4> matrices(256);
+    std::vector<XZM::vec3> vectors(256);
+    std::vector<XZM::quat> quats(256);
+    for(size_t i = 0; i < 256; i++){
+        quats[i] = XZM::quat(component(random), component(random), component(random), component(random));
+        quats[i] = quats[i] * (1.0f / std::sqrt(XZM::DotProduct(quats[i], quats[i])));
+        vectors[i] = XZM::vec3(component(random), component(random), component(random));
+        matrices[i] = XZM::QuatToMat4(quats[i]) * XZM::Translation(vectors[i]);
+    }
+
+    bench.Run("xzm/mat4_mul", sizeof(XZM::mat4) * 2, [&](uint64_t i){
+        XZM::mat4 lhs = matrices[i & 255];
+        XZM::mat4 result = lhs * matrices[(i + 1) & 255];
+        MicroBench::KeepValue(result);
+    });
+    bench.Run("xzm/mat4_vec3", 0, [&](uint64_t i){
+        XZM::mat4 lhs = matrices[i & 255];
+        XZM::vec3 result = lhs * vectors[i & 255];
+        MicroBench::KeepValue(result);
+    });
+    bench.Run("xzm/quat_to_mat4", 0, [&](uint64_t i){
+        XZM::mat4 result = XZM::QuatToMat4(quats[i & 255]);
+        MicroBench::KeepValue(result);
+    });
+    bench.Run("xzm/quat_slerp", 0, [&](uint64_t i){
+        XZM::quat result = XZM::SLerp(quats[i & 255], quats[(i + 1) & 255], 0.3f);
+        MicroBench::KeepValue(result);
+    });
+    bench.Run("xzm/normalize", 0, [&](uint64_t i){
+        XZM::vec3 result = XZM::Normalize(vectors[i & 255]);
+        MicroBench::KeepValue(result);
+    });
+    bench.Run("xzm/look_at", 0, [&](uint64_t i){
+        XZM::mat4 result = XZM::LookAt(vectors[i & 255], vectors[(i + 1) & 255], XZM::vec3(0, 0, 1));
+        MicroBench::KeepValue(result);
+    });
+    bench.Run("xzm/trs_compose", 0, [&](uint64_t i){
+        XZM::mat4 scale = XZM::Scaling(XZM::vec3(1, 1, 1));
+        XZM::mat4 result = scale * XZM::QuatToMat4(quats[i & 255]) * XZM::Translation(vectors[i & 255]);
+        MicroBench::KeepValue(result);
+    });
+}
+
+
+int main(int argc, char** argv) {
+
+    ReadCMDArguments(argc,argv);
+
+    MicroBench bench;
+    bench.SetOptions(minBatchMilliseconds, repetitions, benchFilter);
+
+    /* A wide scene (every instance under one level of groups) and a deep one (a binary tree). */
+    std::filesystem::create_directories(workDirectory);
+    std::vector<std::pair<std::string,std::string>> scenes = {
+            {"wide", workDirectory + "/wide.s72"},
+            {"deep", workDirectory + "/deep.s72"},
+    };
+    WriteTreeScene(scenes[0].second, 64, 1);
+    WriteTreeScene(scenes[1].second, 2, 32);
+    for(const auto& fileName : sceneFileNames){
+        scenes.emplace_back(std::filesystem::path(fileName).stem().string(), fileName);
+    }
+
+    for(const auto& scene : scenes){
+        BenchParse(bench, scene.first, scene.second);
+        BenchUpdate(bench, scene.first, scene.second);
+    }
+    BenchCulling(bench);
+    BenchDrivers(bench);
+    BenchMath(bench);
+
+    bench.Print();
+    if(!csvFileName.empty()){
+        bench.SaveCSV(csvFileName);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -3,6 +3,8 @@
 //
 
 #include "RenderHelper.h"
+#include <thread>
+#include <cstdio>
 
 
 /**
@@ -14,6 +16,25 @@ RenderHelper::RenderHelper() {
 }
 
 
+/**
+ * @brief Set if the material textures are loaded as block compressed textures.
+ * The compressed textures and their mip chains are cached next to the source files.
+ * @param useCompressedTexture True if we want to use the compressed textures.
+ */
+void RenderHelper::SetTextureCompression(bool useCompressedTexture){
+    S72Object::Material::useCompressedTexture = useCompressedTexture;
+}
+
+
+/**
+ * @brief Set the path of the Cubes tool. Without it, stale environment outputs only give a warning.
+ * @param path The Cubes executable path.
+ */
+void RenderHelper::SetIBLTool(const std::string& path){
+    vulkanHelper->SetIBLTool(path);
+}
+
+
 /**
  * @brief Read and parse a s72 file.
  * @param fileName The target file path and name.
@@ -47,6 +68,17 @@ void RenderHelper::SetEventFile(const std::string& eventFileName){
 }
 
 
+/**
+ * @brief Set if the headless events are replayed on a virtual clock.
+ * The clock jumps to each event's time and the animation time comes from it, so the frames only depend on the event file.
+ * @param useVirtualClock True if we want to use the virtual clock.
+ */
+void RenderHelper::SetVirtualClock(bool useVirtualClock){
+    this->useVirtualClock = useVirtualClock;
+    s72Helper->useVirtualClock = useVirtualClock;
+}
+
+
 /**
  * @brief Update the performance test count and mode;
  * @param count
@@ -56,10 +88,63 @@ void RenderHelper::SetPerformanceTest(size_t count){
 
     if(performanceTestCount != 0){
         renderMode = RenderMode::PerformanceTest;
+        frameStats = std::make_shared<FrameStats>();
+        vulkanHelper->SetFrameStats(frameStats);
+    }
+}
+
+
+/**
+ * @brief Set the files the performance test results are written to.
+ * @param jsonFileName The JSON file, nothing is written if empty.
+ * @param csvFileName The CSV file, nothing is written if empty.
+ */
+void RenderHelper::SetStatsOutput(const std::string& jsonFileName, const std::string& csvFileName){
+    statsJSONFileName = jsonFileName;
+    statsCSVFileName = csvFileName;
+}
+
+
+/**
+ * @brief Set the files the trace is written to. The run is traced if either is set:
+ * the CPU zones of each stage, the GPU zones from the timestamp queries, and the counters of each frame.
+ * @param newTraceFileName The Chrome trace JSON file, nothing is written if empty.
+ * @param newCounterFileName The counter CSV file, nothing is written if empty.
+ */
+void RenderHelper::SetTraceOutput(const std::string& newTraceFileName, const std::string& newCounterFileName){
+    traceFileName = newTraceFileName;
+    counterFileName = newCounterFileName;
+
+    if(!traceFileName.empty() || !counterFileName.empty()){
+        traceRecorder = std::make_shared<TraceRecorder>();
+        traceRecorder->SetThreadName("Main");
+        vulkanHelper->SetTraceRecorder(traceRecorder);
     }
 }
 
 
+/**
+ * @brief Set how many frames the simulation can run ahead of the render thread.
+ * With a depth above 0, the window and the performance test modes update the scene and capture a snapshot of it on this thread,
+ * while a render thread draws the snapshots, so the scene update overlaps the fence wait and the recording of the previous frames.
+ * The headless events always run on this thread, since they change the camera and save the frames in order.
+ * @param depth The queue depth, 0 draws the frames on the window thread.
+ */
+void RenderHelper::SetFrameQueueDepth(size_t depth){
+    frameQueueDepth = depth;
+}
+
+
+/**
+ * @brief Set the cameras drawn in every frame of the headless and the performance test modes.
+ * Every listed camera is drawn into its own image in one command buffer, and each saved frame is written once per camera.
+ * @param cameraList "all" for every camera of the scene, a comma separated list of camera names, or empty for the current camera only.
+ */
+void RenderHelper::SetMultiView(const std::string& cameraList){
+    multiViewCameras = cameraList;
+}
+
+
 /**
  * @brief Set the vulkan instance with the data from the command line arguments.
  * @param width new window width.
@@ -67,9 +152,10 @@ void RenderHelper::SetPerformanceTest(size_t count){
  * @param deviceName selected physical device name.
  * @param cameraName selected camera's name.
  * @param cullingMode selected culling mode.
+ * @param useDepthPrepass if we render a depth pre-pass before shading.
  */
 void RenderHelper::SetVulkanData(uint32_t  width, uint32_t  height, const std::string &deviceName,
-                                 const std::string &cameraName, const std::string &cullingMode) {
+                                 const std::string &cameraName, const std::string &cullingMode, bool useDepthPrepass) {
     vulkanHelper->SetWindowSize(width,height);
 
     if(!deviceName.empty()){
@@ -87,81 +173,389 @@ void RenderHelper::SetVulkanData(uint32_t  width, uint32_t  height, const std::s
         vulkanHelper->SetCameraName("User-Camera");
     }
 
+    vulkanHelper->SetDepthPrepass(useDepthPrepass);
+
     /* Both the headless mode and the performance test mode will do the headless rendering. */
     vulkanHelper->SetHeadlessMode(renderMode == RenderMode::Headless || renderMode == RenderMode::PerformanceTest);
+
+    if(!multiViewCameras.empty()){
+        vulkanHelper->SetMultiView(multiViewCameras);
+    }
 }
 
 
 /**
- * @brief Run the vulkan renderer.
+ * @brief Update the scene graph, traced as the "scene_update" zone.
  */
-void RenderHelper::RunVulkan(){
-    /* If in the headless mode.*/
-    if(renderMode == RenderMode::Headless){
-        eventStartTimePoint = std::chrono::system_clock::now();
+void RenderHelper::UpdateScene(){
+    TraceRecorder::Zone zone(traceRecorder.get(), "scene_update");
+    s72Helper->UpdateObjects();
+}
+
+
+/**
+ * @brief Show the frame time and the counters of the last frame in the window title,
+ * so they can be watched while moving through the scene.
+ * @param frameMilliseconds The average frame time since the last update.
+ */
+void RenderHelper::UpdateWindowTitle(double frameMilliseconds){
+    VulkanHelper::FrameCounters counters = vulkanHelper->frameCounters;
+    double latency = 0;
+
+    /* The render thread's counters are copied under the lock. */
+    if(frameQueue != nullptr){
+        std::lock_guard<std::mutex> lock(reportMutex);
+        counters = lastCounters;
+        latency = lastLatency;
+    }
+
+    char title[320];
+    int length = snprintf(title, sizeof(title), "Vulkan | %.2f ms (%.0f fps) | %u/%u instances | %u draws | %u pipelines | %.1f KB uploaded | culling: %s",
+                          frameMilliseconds, 1000.0 / frameMilliseconds, counters.visibleInstances, counters.instances, counters.draws,
+                          counters.pipelineBinds, (double)counters.bytesUploaded / 1024.0, vulkanHelper->cullingMode.c_str());
+    if(frameQueue != nullptr && length > 0 && length < (int)sizeof(title)){
+        snprintf(title + length, sizeof(title) - length, " | latency %.2f ms", latency);
+    }
+    glfwSetWindowTitle(vulkanHelper->window, title);
+}
+
+
+/**
+ * @brief Start the render thread. The frames are drawn from the snapshots pushed to the frame queue.
+ */
+void RenderHelper::StartRenderThread(){
+    frameQueue = std::make_shared<FrameQueue>(frameQueueDepth);
+    renderError = nullptr;
+    vulkanHelper->useRenderThread = true;
+    renderThread = std::thread(&RenderHelper::RunRenderThread, this);
+}
+
+
+/**
+ * @brief Capture the updated scene into a snapshot and push it to the render thread.
+ * Wait while the queue is full, so the simulation runs at most the queue depth ahead.
+ * @return False if the render thread has stopped.
+ */
+bool RenderHelper::PushSnapshot(){
+    auto captureStart = std::chrono::steady_clock::now();
+    std::shared_ptr<FrameSnapshot> snapshot = frameQueue->Acquire();
+    {
+        TraceRecorder::Zone zone(traceRecorder.get(), "snapshot_capture");
+        vulkanHelper->CaptureSnapshot(*snapshot);
+    }
+    auto pushStart = std::chrono::steady_clock::now();
+
+    bool isPushed;
+    {
+        TraceRecorder::Zone zone(traceRecorder.get(), "queue_push");
+        isPushed = frameQueue->Push(snapshot);
+    }
+
+    if(frameStats != nullptr){
+        frameStats->AddSample("cpu_snapshot_capture", std::chrono::duration<double, std::milli>(pushStart - captureStart).count());
+        frameStats->AddSample("cpu_simulation_wait", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pushStart).count());
+    }
+    return isPushed;
+}
+
+
+/**
+ * @brief Close the frame queue, let the render thread draw the snapshots already pushed, and wait for it to stop.
+ * An error thrown on the render thread is thrown again here.
+ */
+void RenderHelper::StopRenderThread(){
+    frameQueue->Close();
+    if(renderThread.joinable()){
+        renderThread.join();
+    }
+    vulkanHelper->useRenderThread = false;
+
+    if(renderError != nullptr){
+        std::rethrow_exception(renderError);
+    }
+}
+
+
+/**
+ * @brief The render thread's loop: pop a snapshot, draw it, and hand it back to be reused, until the queue is closed.
+ * The latency of a frame is the time from its capture to the end of its submit (and present on the window).
+ */
+void RenderHelper::RunRenderThread(){
+    if(traceRecorder != nullptr){
+        traceRecorder->SetThreadName("Render");
+    }
+
+    try{
+        auto lastFrameEnd = std::chrono::steady_clock::now();
         while(true){
-            /* If reach to the end of the event file. */
-            if(eventHelper->EventAllFinished()){
+            auto waitStart = std::chrono::steady_clock::now();
+            std::shared_ptr<FrameSnapshot> snapshot;
+            {
+                TraceRecorder::Zone zone(traceRecorder.get(), "queue_pop");
+                snapshot = frameQueue->Pop();
+            }
+            if(snapshot == nullptr){
                 break;
             }
-            float duration = std::chrono::duration<float, std::chrono::microseconds::period>(std::chrono::system_clock::now() - eventStartTimePoint).count();
-            /* Find a list of matched action. */
-            eventHelper->GetMatchedNode(duration);
-            /* Run those actions. */
-            for(size_t i = eventHelper->startIndex; i < eventHelper->endIndex; i++){
-                if(eventHelper->events[i].eventType == EventType::AVAILABLE){
-                    s72Helper->UpdateObjects();
-                    vulkanHelper->DrawFrame();
-                }
-                else if(eventHelper->events[i].eventType == EventType::PLAY){
-                    s72Helper->StopAnimation();
-                    s72Helper->currDuration = 0;
-                    s72Helper->StartAnimation();
-                    s72Helper->UpdateObjects();
-                    vulkanHelper->DrawFrame();
-                }
-                else if(eventHelper->events[i].eventType == EventType::SAVE){
-                    std::string ppmFileName = std::get<std::string>(eventHelper->events[i].data);
-                    s72Helper->UpdateObjects();
-                    vulkanHelper->DrawFrame();
-                    vulkanHelper->SaveRenderResult(ppmFileName);
-                }
-                else if(eventHelper->events[i].eventType == EventType::MARK){
-                    std::cout << std::get<std::string>(eventHelper->events[i].data) << std::endl;
-                }
+            auto drawStart = std::chrono::steady_clock::now();
+            double queueLatency = std::chrono::duration<double, std::milli>(drawStart - snapshot->captureTime).count();
+            if(traceRecorder != nullptr){
+                traceRecorder->SetCounter("latency_queue_ms", queueLatency);
+            }
+
+            vulkanHelper->DrawSnapshot(snapshot);
+
+            auto drawEnd = std::chrono::steady_clock::now();
+            double latency = std::chrono::duration<double, std::milli>(drawEnd - snapshot->captureTime).count();
+            if(frameStats != nullptr){
+                frameStats->AddSample("cpu_render_wait", std::chrono::duration<double, std::milli>(drawStart - waitStart).count());
+                frameStats->AddSample("cpu_draw_frame", std::chrono::duration<double, std::milli>(drawEnd - drawStart).count());
+                frameStats->AddSample("frame_interval", std::chrono::duration<double, std::milli>(drawEnd - lastFrameEnd).count());
+                frameStats->AddSample("latency_queue", queueLatency);
+                frameStats->AddSample("latency_capture_to_submit", latency);
+            }
+            lastFrameEnd = drawEnd;
+
+            {
+                std::lock_guard<std::mutex> lock(reportMutex);
+                lastCounters = vulkanHelper->frameCounters;
+                lastLatency = latency;
             }
-            /* Update the action list as a sliding window. */
-            eventHelper->startIndex = eventHelper->endIndex;
+            frameQueue->Recycle(snapshot);
+        }
+    }
+    catch(...){
+        /* Stop the simulation thread, it throws the error again. */
+        renderError = std::current_exception();
+        frameQueue->Close();
+    }
+}
+
+
+/**
+ * @brief Wait for the GPU zones of the last frames, then write the Chrome trace and the counter dump.
+ */
+void RenderHelper::SaveTrace(){
+    if(traceRecorder == nullptr){
+        return;
+    }
+
+    vulkanHelper->FinishFrames();
+
+    if(!traceFileName.empty()){
+        traceRecorder->SaveChromeTrace(traceFileName);
+    }
+    if(!counterFileName.empty()){
+        traceRecorder->SaveCounters(counterFileName);
+    }
+}
+
+
+/**
+ * @brief Run a single headless event.
+ * @param event The event to run.
+ */
+void RenderHelper::RunEvent(const EventNode& event){
+    if(event.eventType == EventType::AVAILABLE){
+        UpdateScene();
+        vulkanHelper->DrawFrame();
+    }
+    else if(event.eventType == EventType::PLAY){
+        s72Helper->StopAnimation();
+        s72Helper->currDuration = 0;
+        s72Helper->StartAnimation();
+        playEventTime = event.time;
+        UpdateScene();
+        vulkanHelper->DrawFrame();
+    }
+    else if(event.eventType == EventType::SAVE){
+        std::string ppmFileName = std::get<std::string>(event.data);
+        UpdateScene();
+        vulkanHelper->SaveNextFrame(ppmFileName);
+        vulkanHelper->DrawFrame();
+    }
+    else if(event.eventType == EventType::MARK){
+        std::cout << std::get<std::string>(event.data) << std::endl;
+    }
+    else if(event.eventType == EventType::CAMERA){
+        vulkanHelper->SetCameraName(std::get<std::string>(event.data));
+    }
+    else if(event.eventType == EventType::LOOK){
+        const auto& look = std::get<std::array<float,6>>(event.data);
+        vulkanHelper->currCamera->SetView(XZM::vec3(look[0],look[1],look[2]), XZM::vec3(look[3],look[4],look[5]));
+    }
+    else if(event.eventType == EventType::SET){
+        const auto& parameter = std::get<std::pair<std::string,std::string>>(event.data);
+        if(parameter.first == "culling"){
+            vulkanHelper->SetCullingMode(parameter.second);
+        }
+        else{
+            std::cout << "Unknown parameter in the SET event: " << parameter.first << std::endl;
+        }
+    }
+}
+
+
+/**
+ * @brief Run the headless events when their time is reached on the system clock.
+ * The thread sleeps until shortly before the next event instead of spinning the whole time.
+ */
+void RenderHelper::RunEventsOnSystemClock(){
+    eventStartTimePoint = std::chrono::system_clock::now();
+    while(true){
+        /* If reach to the end of the event file. */
+        if(eventHelper->EventAllFinished()){
+            break;
+        }
+        auto duration = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - eventStartTimePoint).count();
+        /* Run all the events whose time is reached. */
+        for(const EventNode* event = eventHelper->PeekEvent(); event != nullptr && event->time <= duration; event = eventHelper->PeekEvent()){
+            RunEvent(*event);
+            eventHelper->PopEvent();
+        }
+
+        /* Sleep until the next event, and only spin for the last 2 ms since the sleep is not precise. */
+        if(!eventHelper->EventAllFinished()){
+            auto nextEventTime = std::chrono::microseconds((int64_t)eventHelper->PeekEvent()->time);
+            std::this_thread::sleep_until(eventStartTimePoint + nextEventTime - std::chrono::milliseconds(2));
+        }
+    }
+}
+
+
+/**
+ * @brief Run the headless events back to back. A virtual clock jumps to each event's time,
+ * and the animation time is set from it, so the frames are the same on every run and machine.
+ */
+void RenderHelper::RunEventsOnVirtualClock(){
+    for(const EventNode* event = eventHelper->PeekEvent(); event != nullptr; event = eventHelper->PeekEvent()){
+        /* Move the clock to the event, the event times are in microseconds. Subtract them as integers so late events keep their precision. */
+        if(s72Helper->isPlayingAnimation){
+            auto sincePlay = (int64_t)(event->time - playEventTime);
+            s72Helper->SetAnimationTime((double)sincePlay / 1000000.0);
+        }
+        RunEvent(*event);
+        eventHelper->PopEvent();
+    }
+}
+
+
+/**
+ * @brief Run the vulkan renderer.
+ */
+void RenderHelper::RunVulkan(){
+    /* If in the headless mode.*/
+    if(renderMode == RenderMode::Headless){
+        if(useVirtualClock){
+            RunEventsOnVirtualClock();
+        }
+        else{
+            RunEventsOnSystemClock();
         }
     }
     /* If it is the performance test mode. */
     else if(renderMode == RenderMode::PerformanceTest){
-        float totalUpdate = 0;
-        float totalRender = 0;
-        for(size_t i = 0; i < performanceTestCount; i++) {
-            auto beforeUpdate = std::chrono::system_clock::now();
-            s72Helper->UpdateObjects();
-            auto beforeRender = std::chrono::system_clock::now();
-            vulkanHelper->DrawFrame();
-            auto afterRender = std::chrono::system_clock::now();
-            totalUpdate += std::chrono::duration<float, std::chrono::milliseconds::period>(beforeRender - beforeUpdate).count();
-            totalRender += std::chrono::duration<float, std::chrono::milliseconds::period>(afterRender - beforeRender).count();
-            std::cout << "Finish " << i << std::endl;
-        }
-        std::cout << "The average time to update the scene graph is: " << totalUpdate/(float)performanceTestCount << "ms" << std::endl;
-        std::cout << "The average time to draw the scene is: " << totalRender/(float)performanceTestCount << "ms" << std::endl;
+        auto runStart = std::chrono::steady_clock::now();
+        auto lastFrameEnd = runStart;
+        /* With a render thread, this thread only updates the scene, the render thread records the draw stages and the latency. */
+        if(frameQueueDepth > 0){
+            StartRenderThread();
+            for(size_t i = 0; i < performanceTestCount; i++) {
+                auto beforeUpdate = std::chrono::steady_clock::now();
+                UpdateScene();
+                frameStats->AddSample("cpu_update", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - beforeUpdate).count());
+                if(!PushSnapshot()){
+                    break;
+                }
+            }
+            StopRenderThread();
+        }
+        else {
+            for(size_t i = 0; i < performanceTestCount; i++) {
+                auto beforeUpdate = std::chrono::steady_clock::now();
+                UpdateScene();
+                auto beforeRender = std::chrono::steady_clock::now();
+                vulkanHelper->DrawFrame();
+                auto afterRender = std::chrono::steady_clock::now();
+                frameStats->AddSample("cpu_update", std::chrono::duration<double, std::milli>(beforeRender - beforeUpdate).count());
+                frameStats->AddSample("cpu_draw_frame", std::chrono::duration<double, std::milli>(afterRender - beforeRender).count());
+                /* Once the frames in flight are full, the interval also waits for the GPU. */
+                frameStats->AddSample("frame_interval", std::chrono::duration<double, std::milli>(afterRender - lastFrameEnd).count());
+                lastFrameEnd = afterRender;
+            }
+        }
+        /* The run is only over when the GPU is done with the last frames. */
+        vulkanHelper->FinishFrames();
+        double totalTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+
+        frameStats->AddMetadata("scene", S72Helper::s72fileName);
+        frameStats->AddMetadata("frames", std::to_string(performanceTestCount));
+        frameStats->AddMetadata("width", std::to_string(vulkanHelper->windowWidth));
+        frameStats->AddMetadata("height", std::to_string(vulkanHelper->windowHeight));
+        frameStats->AddMetadata("culling", vulkanHelper->cullingMode);
+        frameStats->AddMetadata("depth_prepass", vulkanHelper->useDepthPrepass ? "on" : "off");
+        frameStats->AddMetadata("frame_queue", std::to_string(frameQueueDepth));
+        frameStats->AddMetadata("views", std::to_string(vulkanHelper->viewCount));
+        frameStats->AddMetadata("total_ms", std::to_string(totalTime));
+
+        std::cout << "Depth pre-pass: " << (vulkanHelper->useDepthPrepass ? "on" : "off") << std::endl;
+        std::cout << "The average frame time including the GPU is: " << totalTime/(double)performanceTestCount << "ms" << std::endl;
+        frameStats->Print();
+
+        if(!statsJSONFileName.empty()){
+            frameStats->SaveJSON(statsJSONFileName);
+        }
+        if(!statsCSVFileName.empty()){
+            frameStats->SaveCSV(statsCSVFileName);
+        }
     }
     /* If it is the on window mode. */
     else {
+        /* The window title shows the average frame time of the last half second. */
+        auto titleStart = std::chrono::steady_clock::now();
+        uint32_t titleFrames = 0;
+
+        if(frameQueueDepth > 0){
+            StartRenderThread();
+        }
+
         while (!glfwWindowShouldClose(vulkanHelper->window)) {
             glfwPollEvents();       // Check for inputs
+
+            /* Keep polling the window while the render thread is behind, e.g. when the window is minimized. */
+            if(frameQueue != nullptr && !frameQueue->WaitForSpace(std::chrono::milliseconds(10))){
+                continue;
+            }
+
             /* Conditions for updating the scene graph. */
             if(s72Helper->isPlayingAnimation) {
-                s72Helper->UpdateObjects();
+                UpdateScene();
+            }
+
+            if(frameQueue != nullptr){
+                if(!PushSnapshot()){
+                    break;
+                }
+            }
+            else{
+                vulkanHelper->DrawFrame();
+            }
+
+            titleFrames++;
+            double titleTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - titleStart).count();
+            if(titleTime >= 500.0){
+                UpdateWindowTitle(titleTime / titleFrames);
+                titleStart = std::chrono::steady_clock::now();
+                titleFrames = 0;
             }
-            vulkanHelper->DrawFrame();
+        }
+
+        if(frameQueue != nullptr){
+            StopRenderThread();
         }
     }
+
+    SaveTrace();
 }
 
 
@@ -7,7 +7,11 @@
 
 #include <string>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <exception>
 #include "VulkanHelper.h"
+#include "FrameQueue.h"
 
 /**
  * @brief The render mode we can use.
@@ -36,12 +40,88 @@ private:
     /* A start time for the headless rendering. */
     std::chrono::system_clock::time_point eventStartTimePoint;
 
+    /* Set if the headless events are replayed on a virtual clock instead of the system clock. */
+    bool useVirtualClock = false;
+
+    /* The event time (in microseconds) of the last PLAY event, the virtual animation time counts from it. */
+    uint64_t playEventTime = 0;
+
     /* The iteration count to do the performance test. */
     size_t performanceTestCount = 0;
 
+    /* The stage timings collected by the performance test. */
+    std::shared_ptr<FrameStats> frameStats = nullptr;
+
+    /* The files the performance test results are written to, nothing is written if empty. */
+    std::string statsJSONFileName;
+    std::string statsCSVFileName;
+
+    /* The CPU and GPU zones and the frame counters, nullptr if nothing is traced. */
+    std::shared_ptr<TraceRecorder> traceRecorder = nullptr;
+
+    /* The Chrome trace file and the counter dump file, nothing is written if empty. */
+    std::string traceFileName;
+    std::string counterFileName;
+
+    /* The number of frames the simulation can run ahead of the render thread, 0 draws the frames on the window thread. */
+    size_t frameQueueDepth = 0;
+
+    /* The cameras drawn in every frame, "all" or a comma separated list, empty if only the current camera is drawn. */
+    std::string multiViewCameras;
+
+    /* The frame snapshots passed from the simulation thread to the render thread, nullptr if there is no render thread. */
+    std::shared_ptr<FrameQueue> frameQueue = nullptr;
+
+    /* The thread drawing the frame snapshots. */
+    std::thread renderThread;
+
+    /* The error thrown on the render thread, thrown again on the simulation thread once the render thread stops. */
+    std::exception_ptr renderError = nullptr;
+
+    /* The counters and the latency of the last frame drawn by the render thread, shown in the window title. */
+    std::mutex reportMutex;
+    VulkanHelper::FrameCounters lastCounters;
+    double lastLatency = 0;
+
+    /* Start the render thread and the frame queue. */
+    void StartRenderThread();
+
+    /* Capture the scene into a snapshot and push it to the render thread. */
+    bool PushSnapshot();
+
+    /* Let the render thread draw the pushed snapshots, then stop it. */
+    void StopRenderThread();
+
+    /* The render thread's loop: draw the snapshots until the queue is closed. */
+    void RunRenderThread();
+
+    /* Update the scene graph inside a trace zone. */
+    void UpdateScene();
+
+    /* Show the frame time and the frame counters in the window title. */
+    void UpdateWindowTitle(double frameMilliseconds);
+
+    /* Wait for the last frames and write the trace files. */
+    void SaveTrace();
+
+    /* Run a single headless event. */
+    void RunEvent(const EventNode& event);
+
+    /* Run the headless events when their time is reached on the system clock. */
+    void RunEventsOnSystemClock();
+
+    /* Run the headless events back to back, moving a virtual clock to each event's time. */
+    void RunEventsOnVirtualClock();
+
 public:
     RenderHelper();
 
+    /* Set if the material textures are loaded as block compressed textures. Need to be called before reading the s72 file. */
+    void SetTextureCompression(bool useCompressedTexture);
+
+    /* Set the path of the Cubes tool used to regenerate the stale environment outputs. */
+    void SetIBLTool(const std::string& path);
+
     /* Read a s72 file to the s72 instance. */
     void ReadS72(const std::string& fileName);
 
@@ -51,12 +131,27 @@ public:
     /* Process the event file. */
     void SetEventFile(const std::string& eventFileName);
 
+    /* Set if the headless events are replayed on a virtual clock, so the frames are the same on every run. */
+    void SetVirtualClock(bool useVirtualClock);
+
     /* Set the performance test iteration count to decide if we do the performance test. */
     void SetPerformanceTest(size_t count);
 
+    /* Set the JSON and CSV files the performance test results are written to. */
+    void SetStatsOutput(const std::string& jsonFileName, const std::string& csvFileName);
+
+    /* Set the Chrome trace file and the counter dump file, the run is traced if either is set. */
+    void SetTraceOutput(const std::string& newTraceFileName, const std::string& newCounterFileName);
+
+    /* Set how many frames the simulation can run ahead of a render thread, 0 to draw on the window thread. */
+    void SetFrameQueueDepth(size_t depth);
+
+    /* Set the cameras drawn in every frame of the off-screen rendering, "all" or a comma separated list. */
+    void SetMultiView(const std::string& cameraList);
+
     /* Set the vulkan data from the command line arguments. */
     void SetVulkanData(uint32_t width,uint32_t height, const std::string& deviceName, const std::string& cameraName,
-                        const std::string& cullingMode);
+                        const std::string& cullingMode, bool useDepthPrepass);
 
     /* Initialize the vulkan helper. */
     void InitVulkan();
@@ -5,6 +5,7 @@
 #include "S72Helper.h"
 
 #include <memory>
+#include <filesystem>
 
 
 std::unordered_map<std::string, VkPrimitiveTopology> topologyMap = {
@@ -191,6 +192,23 @@ void S72Object::Camera::ReFocusToCenter() {
 }
 
 
+/**
+ * @brief Place the camera at a position facing a direction. Only work for the movable cameras.
+ * @param position The new camera position.
+ * @param direction The direction the camera is facing, it does not need to be normalized.
+ */
+void S72Object::Camera::SetView(const XZM::vec3& position, const XZM::vec3& direction) {
+
+    if(direction.IsEmpty() || !isMovable) return;
+
+    cameraPos = position;
+    cameraDir = XZM::Normalize(direction);
+
+    ComputeViewMatrix();
+    ComputeProjectionMatrix();
+}
+
+
 /* ================================================= Mesh =========================================================== */
 
 
@@ -310,7 +328,7 @@ void S72Object::Mesh::ProcessMesh(){
  */
 void S72Object::Mesh::SetSrc(const std::string& srcPath){
     /* We want to locate the b72 file next to the s72 file. */
-    std::string b72FileName = S72Helper::s72fileName + "/../" + srcPath;
+    std::string b72FileName = S72Helper::GetFilePath(srcPath);
     std::ifstream input_file(b72FileName, std::ios::binary);
 
     if(!input_file){
@@ -339,7 +357,7 @@ void S72Object::Mesh::SetSrc(const std::string& srcPath){
  */
 void S72Object::Mesh::SetIndicesSrc(const std::string &srcPath){
     /* We want to locate the b72 file next to the s72 file. */
-    std::string b72FileName = S72Helper::s72fileName + "/../" + srcPath;
+    std::string b72FileName = S72Helper::GetFilePath(srcPath);
     std::ifstream input_file(b72FileName, std::ios::binary);
 
     if(!input_file){
@@ -457,15 +475,26 @@ void S72Object::Mesh::ReadBoundingBox(std::stringstream& buffer){
  * @param cullingMode The culling mode we use, can be none or frustum.
  */
 void S72Object::Mesh::UpdateInstanceWithCulling(const std::shared_ptr<S72Object::Camera>& camera, const std::string& cullingMode){
+    UpdateInstanceWithCulling(instances, camera, cullingMode);
+}
+
+
+/**
+ * @brief Update a mesh's visible instances from a given list of instances and a given camera.
+ * @param source The instances to cull, e.g. the ones captured with a frame snapshot.
+ * @param camera The camera we want to render about.
+ * @param cullingMode The culling mode we use, can be none or frustum.
+ */
+void S72Object::Mesh::UpdateInstanceWithCulling(const std::vector<MeshInstance>& source, const std::shared_ptr<S72Object::Camera>& camera, const std::string& cullingMode){
 
     if(cullingMode == "none"){
-        visibleInstances = instances;
+        visibleInstances = source;
         return;
     }
 
     visibleInstances.clear();
     /* Loop through the list and check which are visible. */
-    for(const auto& instance : instances){
+    for(const auto& instance : source){
         if(!FrustumCulling::IsCulled(camera,boundingBox,instance.model)){
             visibleInstances.emplace_back(instance);
         }
@@ -723,7 +752,7 @@ void S72Helper::ReconstructRoot() {
         }
         else if(std::get<std::string>(node->GetObjectValue("type")->data) == "ENVIRONMENT"){
             auto radNode = node->GetObjectValue("radiance");
-            envFileName = S72Helper::s72fileName + "/../" + std::get<std::string>(radNode->GetObjectValue("src")->data);
+            envFileName = S72Helper::GetFilePath(std::get<std::string>(radNode->GetObjectValue("src")->data));
         }
         else if(std::get<std::string>(node->GetObjectValue("type")->data) == "MATERIAL"){
             std::shared_ptr<S72Object::Material> material = nullptr;
@@ -918,10 +947,10 @@ void S72Helper::UpdateObjects(){
         mesh.second->instances.clear();
     }
 
-    if(isPlayingAnimation) {
+    if(isPlayingAnimation && !useVirtualClock) {
         auto currentTimePoint = std::chrono::system_clock::now();
         float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTimePoint - animStartTimePoint).count();
-        currDuration = std::fmodf(time, 120);
+        currDuration = std::fmod(time, 120.0f);
     }
 
     lightIndex = 0;
@@ -970,7 +999,7 @@ void S72Helper::UpdateObject(const std::shared_ptr<ParserNode>& newNode, XZM::ma
     else if(type == "MESH"){
         /* Update the mesh instance with the new transform data. */
         std::string meshName = std::get<std::string>(newNode->GetObjectValue("name")->data);
-        meshes[meshName]->instances.emplace_back(newMat);
+        meshes[meshName]->instances.emplace_back(newMat, meshes[meshName]->materialIndex);
     }
     else if(type == "CAMERA"){
         /* Update the camera with the new transform data. */
@@ -1031,6 +1060,16 @@ void S72Helper::StopAnimation(){
 }
 
 
+/**
+ * @brief Set the animation time directly, it is wrapped the same way as the system clock time.
+ * Only used when the virtual clock is on, so the result does not depend on how fast the frames are drawn.
+ * @param time The time in seconds since the animation starts, a double so it is wrapped before losing precision.
+ */
+void S72Helper::SetAnimationTime(double time){
+    currDuration = (float)std::fmod(time, 120.0);
+}
+
+
 /**
  * @brief Given a Material Parser Node, identify its material type.
  * @param newNode The Material Parser Node.
@@ -1135,3 +1174,14 @@ XZM::vec3 S72Helper::FindScale(const ParserNode & newNode) {
 
     return {x,y,z};
 }
+
+
+/**
+ * @brief Get the path of a file referenced by the s72 file, such as a b72 file or a texture.
+ * The references are relative to the folder of the s72 file.
+ * @param relativePath The path written in the s72 file.
+ * @return The path of the file.
+ */
+std::string S72Helper::GetFilePath(const std::string& relativePath){
+    return (std::filesystem::path(s72fileName).parent_path() / relativePath).string();
+}
@@ -16,7 +16,6 @@
 #include "XZJParser.h"
 #include "XZMath.h"
 #include "FrustumCulling.h"
-#include "VkMaterial.h"
 #include "S72Materials.h"
 
 namespace S72Object {
@@ -80,6 +79,9 @@ namespace S72Object {
 
             /* Let the camera loop toward the world center. */
             void ReFocusToCenter();
+
+            /* Place the camera at a position facing a direction. */
+            void SetView(const XZM::vec3& position, const XZM::vec3& direction);
     };
 
 
@@ -89,8 +91,11 @@ namespace S72Object {
     struct MeshInstance{
         /* The data is the model matrix. */
         alignas(16) XZM::mat4 model;
-        explicit MeshInstance(const XZM::mat4& newModel){
+        /* The index of the instance's material in the material buffer. */
+        alignas(4) uint32_t material = 0;
+        explicit MeshInstance(const XZM::mat4& newModel, uint32_t newMaterial = 0){
             model = newModel;
+            material = newMaterial;
         }
     };
 
@@ -143,6 +148,9 @@ namespace S72Object {
             std::string indicesSrc;
             uint32_t indicesCount = 0;
 
+            /* The index of the mesh's material in the material buffer, copied to each instance. */
+            uint32_t materialIndex = 0;
+
             /* A list of mesh instances, they are represented by its unique model matrix. */
             std::vector<MeshInstance> instances;
 
@@ -169,6 +177,9 @@ namespace S72Object {
 
             /* For a given camera instance, update if the instances are culled. */
             void UpdateInstanceWithCulling(const std::shared_ptr<S72Object::Camera>& camera, const std::string& cullingMode);
+
+            /* Update the visible instances from a given list of instances, e.g. the ones captured with a frame. */
+            void UpdateInstanceWithCulling(const std::vector<MeshInstance>& source, const std::shared_ptr<S72Object::Camera>& camera, const std::string& cullingMode);
     };
 
 
@@ -261,6 +272,9 @@ public:
     /* The current time from the start time point to the current time point. */
     float currDuration = 0;
 
+    /* Set if currDuration is given by SetAnimationTime instead of the system clock, used by the deterministic replay. */
+    bool useVirtualClock = false;
+
     /* A list of Drivers. */
     std::vector<std::shared_ptr<S72Object::Driver>> drivers;
 
@@ -295,6 +309,9 @@ public:
     /* Pause the animation if it is playing. */
     void StopAnimation();
 
+    /* Set the animation time directly when the virtual clock is used. */
+    void SetAnimationTime(double time);
+
     /* Given a material parser node, identify its EMaterial type. */
     static S72Object::EMaterial GetMaterialType(const ParserNode&);
 
@@ -306,6 +323,9 @@ public:
 
     /* Extract the scale data as a vec3 from a ParserNode. */
     static XZM::vec3 FindScale(const ParserNode&);
+
+    /* Get the path of a file referenced by the s72 file, they are next to each other. */
+    static std::string GetFilePath(const std::string& relativePath);
 };
 
 
@@ -2,47 +2,7 @@
 // Created by Xuan Zhai on 2024/3/8.
 //
 #include "S72Materials.h"
-#include "VulkanHelper.h"
-
-
-/**
- * @brief Create the descriptor set layout for the material.
- * @param device The physical device.
- */
-void S72Object::Material_Lambertian::CreateDescriptorSetLayout(const VkDevice& device){
-
-    std::array<VkDescriptorSetLayoutBinding,3> bindings{};
-    /* Set the normal map sampler */
-    bindings[0].binding = 0;
-    bindings[0].descriptorCount = 1;
-    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    bindings[0].pImmutableSamplers = nullptr;
-    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;     // Use the image sampler in the fragment shader stage.
-
-    /* Set the height map sampler */
-    bindings[1].binding = 1;
-    bindings[1].descriptorCount = 1;
-    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    bindings[1].pImmutableSamplers = nullptr;
-    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;     // Use the image sampler in the fragment shader stage.
-
-    /* Set the albedo map sampler */
-    bindings[2].binding = 2;
-    bindings[2].descriptorCount = 1;
-    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    bindings[2].pImmutableSamplers = nullptr;
-    bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;     // Use the image sampler in the fragment shader stage.
-
-    /* Combine all the bindings into a single object */
-    VkDescriptorSetLayoutCreateInfo layoutInfo{};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
-
-    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &MDescriptorSetLayout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor set layout!");
-    }
-}
+#include <algorithm>
 
 
 /**
@@ -67,125 +27,15 @@ void S72Object::Material_Lambertian::ProcessMaterial(const std::shared_ptr<Parse
         float g = std::get<float>(color[1]->data);
         float b = std::get<float>(color[2]->data);
 
-        albedo = std::string() + (char) (r * 255) + (char) (g * 255) + (char) (b * 255) + (char)(255u);
+        albedo = std::make_shared<const std::string>(std::string() + (char) (r * 255) + (char) (g * 255) + (char) (b * 255) + (char)(255u));
         albedoHeight = 1;
         albedoWidth = 1;
         albedoChannel = 4;
-        albedoMipLevels = static_cast<uint32_t>(std::floor(std::log2(max(albedoWidth, albedoHeight)))) + 1;
+        albedoMipLevels = static_cast<uint32_t>(std::floor(std::log2((std::max)(albedoWidth, albedoHeight)))) + 1;
+        albedoKey = GetConstantKey(*albedo);
     }
     else {
-        std::string src = S72Helper::s72fileName + "/../" + std::get<std::string>(newAlbedo->GetObjectValue("src")->data);
-        ReadPNG(src,albedo,albedoWidth,albedoHeight,albedoChannel,albedoMipLevels);
+        std::string src = S72Helper::GetFilePath(std::get<std::string>(newAlbedo->GetObjectValue("src")->data));
+        ReadPNG(src,albedo,albedoWidth,albedoHeight,albedoChannel,albedoMipLevels,albedoFormat,albedoKey);
     }
-}
-
-
-/**
- * @brief Create the descriptor pool for the material.
- * @param device The physical device.
- */
-void S72Object::Material_Lambertian::CreateDescriptorPool(const VkDevice& device){
-    /* Describe which descriptor types our descriptor sets are going to contain */
-    std::array<VkDescriptorPoolSize,3> poolSizes{};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    /* Create the pool info for allocation */
-    VkDescriptorPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &MDescriptorPool) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor pool!");
-    }
-}
-
-
-/**
- * @brief Create the descriptor set for the lambertian material.
- * @param device The physical device.
- * @param uniformBuffers The UBO buffer.
- * @param textureSampler The sampler for the texture.
- * @param cubeMap The lambertian cube map.
- */
-void S72Object::Material_Lambertian::CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler){
-
-    /* Create one descriptor set for each frame in flight */
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, MDescriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = MDescriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
-
-    MDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(device, &allocInfo, MDescriptorSets.data()) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate descriptor sets!");
-    }
-
-    /* Configure each descriptor set */
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        std::array<VkDescriptorImageInfo,1> normalMapInfo{};
-        normalMapInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        normalMapInfo[0].imageView = normalImageView;
-        normalMapInfo[0].sampler = textureSampler;
-
-        std::array<VkDescriptorImageInfo,1> heightMapInfo{};
-        heightMapInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        heightMapInfo[0].imageView = heightImageView;
-        heightMapInfo[0].sampler = textureSampler;
-
-        std::array<VkDescriptorImageInfo,1> albedoInfo{};
-        albedoInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        albedoInfo[0].imageView = albedoImageView;
-        albedoInfo[0].sampler = textureSampler;
-
-        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = MDescriptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[0].descriptorCount = static_cast<uint32_t>(normalMapInfo.size());
-        descriptorWrites[0].pImageInfo = normalMapInfo.data();
-
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = MDescriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = static_cast<uint32_t>(heightMapInfo.size());
-        descriptorWrites[1].pImageInfo = heightMapInfo.data();
-
-        descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[2].dstSet = MDescriptorSets[i];
-        descriptorWrites[2].dstBinding = 2;
-        descriptorWrites[2].dstArrayElement = 0;
-        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[2].descriptorCount = static_cast<uint32_t>(albedoInfo.size());
-        descriptorWrites[2].pImageInfo = albedoInfo.data();
-
-        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-    }
-}
-
-
-/**
- * @brief Deallocate and free the memory of the albedo data.
- * @param device The physical device.
- */
-void S72Object::Material_Lambertian::CleanUp(const VkDevice& device){
-    S72Object::Material::CleanUp(device);
-
-    vkDestroyImageView(device, albedoImageView, nullptr);
-    vkDestroyImage(device, albedoImage, nullptr);
-    vkFreeMemory(device, albedoImageMemory, nullptr);
-}
+}
\ No newline at end of file
@@ -4,6 +4,11 @@
 
 #include "S72Materials.h"
 #include "stb_image.h"
+#include <filesystem>
+
+bool S72Object::Material::useCompressedTexture = false;
+std::unordered_map<std::string, S72Object::TextureData> S72Object::Material::textureCache;
+uint32_t S72Object::Material::textureCacheHits = 0;
 
 
 /**
@@ -19,20 +24,6 @@ bool S72Object::Material::operator < (const Material& newMat) const{
 }
 
 
-/**
- * @brief Default create pool function.
- * @param device The physical device.
- */
-void S72Object::Material::CreateDescriptorPool(const VkDevice& device){}
-
-
-/**
- * @brief Default create layout function.
- * @param device The physical device.
- */
-void S72Object::Material::CreateDescriptorSetLayout(const VkDevice& device) {}
-
-
 /**
  * @brief Read a node and load all the info.
  * @param node The node we want to load.
@@ -50,42 +41,134 @@ void S72Object::Material::ProcessMaterial(const std::shared_ptr<ParserNode>& nod
         auto normalObject = node->GetObjectValue("normalMap");
         auto src = normalObject->GetObjectValue("src");
 
-        ReadPNG( S72Helper::s72fileName + "/../" + std::get<std::string>(src->data),normalMap,normalMapWidth,normalMapHeight,normalMapChannel,normalMipLevels);
+        ReadPNG(S72Helper::GetFilePath(std::get<std::string>(src->data)),normalMap,normalMapWidth,normalMapHeight,normalMapChannel,normalMipLevels,normalMapFormat,normalMapKey);
     }
     else{
-        normalMap = std::string() + (char) (128u) + (char) (128u) + (char) (255u) + (char)(255u);
+        normalMap = std::make_shared<const std::string>(std::string() + (char) (128u) + (char) (128u) + (char) (255u) + (char)(255u));
         normalMapWidth = 1;
         normalMapHeight = 1;
         normalMapChannel = 4;
         normalMipLevels = 1;
+        normalMapKey = GetConstantKey(*normalMap);
     }
 
     if(node != nullptr && node->GetObjectValue("displacementMap") != nullptr){
         auto normalObject = node->GetObjectValue("displacementMap");
         auto src = normalObject->GetObjectValue("src");
 
-        ReadPNG( S72Helper::s72fileName + "/../" + std::get<std::string>(src->data),heightMap,heightMapWidth,heightMapHeight,heightMapChannel,heightMapMipLevels);
+        ReadPNG(S72Helper::GetFilePath(std::get<std::string>(src->data)),heightMap,heightMapWidth,heightMapHeight,heightMapChannel,heightMapMipLevels,heightMapFormat,heightMapKey);
     }
     else{
-        heightMap = std::string() + (char) (0 * 256);
+        heightMap = std::make_shared<const std::string>(std::string() + (char) (0 * 256));
         heightMapWidth = 1;
         heightMapHeight = 1;
         heightMapChannel = 1;
         heightMapMipLevels = 1;
+        heightMapKey = GetConstantKey(*heightMap);
+    }
+}
+
+
+/**
+ * @brief Get the cache key of a constant 1x1 texture, so materials with the same value share one image.
+ * @param src The texel of the texture.
+ * @return The cache key.
+ */
+std::string S72Object::Material::GetConstantKey(const std::string& src){
+    static const char* hex = "0123456789abcdef";
+
+    std::string key = "XZConst:";
+    for(char c : src){
+        key.push_back(hex[((unsigned char)c) >> 4]);
+        key.push_back(hex[((unsigned char)c) & 0xF]);
     }
+    return key;
 }
 
 
 /**
  * @brief Read a PNG from a file path.
+ * Each file is only decoded once, the later reads of the same file share the pixels of the texture cache.
  * @param filename The file path and name.
- * @param src The target container for the image.
+ * @param src The shared pixels of the image.
  * @param width The image width.
  * @param height The image height.
  * @param nChannels The image number of channels.
  * @param mipLevels The image's mip map level.s
+ * @param format The block compressed format of src, or undefined if src is the raw 8-bit image.
+ * @param key The cache key of the texture, the resolved path and the format.
+ */
+void S72Object::Material::ReadPNG(const std::string& filename, TextureSource& src, int& width, int& height, int& nChannels, uint32_t& mipLevels, VkFormat& format, std::string& key){
+
+    /* Different relative paths can point to the same file. */
+    std::error_code error;
+    std::filesystem::path resolved = std::filesystem::weakly_canonical(filename, error);
+    key = (error ? filename : resolved.string()) + (useCompressedTexture ? "#bc" : "#raw");
+
+    auto cached = textureCache.find(key);
+    if(cached != textureCache.end()){
+        src = cached->second.src;
+        width = cached->second.width;
+        height = cached->second.height;
+        nChannels = cached->second.nChannels;
+        mipLevels = cached->second.mipLevels;
+        format = cached->second.format;
+        textureCacheHits++;
+        return;
+    }
+
+    std::string pixels;
+    ReadTextureFile(filename, pixels, width, height, nChannels, mipLevels, format);
+    src = std::make_shared<const std::string>(std::move(pixels));
+
+    TextureData& data = textureCache[key];
+    data.src = src;
+    data.width = width;
+    data.height = height;
+    data.nChannels = nChannels;
+    data.mipLevels = mipLevels;
+    data.format = format;
+}
+
+
+/**
+ * @brief Decode a texture file, or load its block compressed version.
+ * @param filename The file path and name.
+ * @param src The target container for the image.
+ * @param width The image width.
+ * @param height The image height.
+ * @param nChannels The image number of channels.
+ * @param mipLevels The image's mip map levels.
+ * @param format The block compressed format of src, or undefined if src is the raw 8-bit image.
  */
-void S72Object::Material::ReadPNG(const std::string& filename, std::string& src, int& width, int& height, int& nChannels, uint32_t& mipLevels){
+void S72Object::Material::ReadTextureFile(const std::string& filename, std::string& src, int& width, int& height, int& nChannels, uint32_t& mipLevels, VkFormat& format){
+
+    /* Load the block compressed texture and its mip chain from the cache instead of decoding the PNG. */
+    if(useCompressedTexture){
+        CompressedTexture texture;
+        TextureCompressor::LoadOrCreate(filename, texture);
+
+        src = std::move(texture.data);
+        width = static_cast<int>(texture.width);
+        height = static_cast<int>(texture.height);
+        mipLevels = texture.mipLevels;
+
+        if(texture.format == ECompressedFormat::BC1){
+            format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+            nChannels = 4;
+        }
+        else if(texture.format == ECompressedFormat::BC3){
+            format = VK_FORMAT_BC3_UNORM_BLOCK;
+            nChannels = 4;
+        }
+        else{
+            format = VK_FORMAT_BC4_UNORM_BLOCK;
+            nChannels = 1;
+        }
+        return;
+    }
+
+    format = VK_FORMAT_UNDEFINED;
 
     unsigned char* image = stbi_load(filename.c_str(), &width, &height, &nChannels, 0);
 
@@ -115,21 +198,3 @@ void S72Object::Material::ReadPNG(const std::string& filename, std::string& src,
 
     mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
 }
-
-
-/**
- * @brief Deallocate and free the memory of the normal/displacement data, as well as the pool.
- * @param device The physical device.
- */
-void S72Object::Material::CleanUp(const VkDevice& device){
-    vkDestroyImageView(device, normalImageView, nullptr);
-    vkDestroyImage(device, normalImage, nullptr);
-    vkFreeMemory(device, normalImageMemory, nullptr);
-
-    vkDestroyImageView(device, heightImageView, nullptr);
-    vkDestroyImage(device, heightImage, nullptr);
-    vkFreeMemory(device, heightImageMemory, nullptr);
-
-    vkDestroyDescriptorPool(device, MDescriptorPool, nullptr);
-    vkDestroyDescriptorSetLayout(device, MDescriptorSetLayout, nullptr);
-}
@@ -7,8 +7,11 @@
 
 #include <string>
 #include <cmath>
+#include <unordered_map>
+#include <memory>
 #include "S72Helper.h"
 #include "stb_image.h"
+#include "TextureCompressor.h"
 
 namespace S72Object{
 
@@ -21,25 +24,46 @@ namespace S72Object{
         pbr
     };
 
+    /* The pixels of a texture, shared by all the materials that reference the same file instead of copied. */
+    using TextureSource = std::shared_ptr<const std::string>;
+
+
+    /**
+     * @brief A decoded texture shared by all the materials that reference the same file.
+     */
+    struct TextureData{
+        TextureSource src;
+        int width = 0;
+        int height = 0;
+        int nChannels = 0;
+        uint32_t mipLevels = 1;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+    };
+
+
     /**
      * @brief The S72-side material object. Contain all the data in the .72 files,
-     * as well as the descriptor sets.
+     * as well as its textures' indices in the bindless texture array.
      */
     class Material{
         public:
             std::string name;
             EMaterial type = EMaterial::simple;
-            std::string normalMap;
+            TextureSource normalMap;
             int normalMapHeight = 0;
             int normalMapWidth = 0;
             int normalMapChannel = 0;
             uint32_t normalMipLevels;
+            VkFormat normalMapFormat = VK_FORMAT_UNDEFINED;
+            std::string normalMapKey;
 
-            std::string heightMap;
+            TextureSource heightMap;
             int heightMapHeight = 0;
             int heightMapWidth = 0;
             int heightMapChannel = 0;
             uint32_t heightMapMipLevels;
+            VkFormat heightMapFormat = VK_FORMAT_UNDEFINED;
+            std::string heightMapKey;
 
             VkImage normalImage = VK_NULL_HANDLE;
             VkDeviceMemory normalImageMemory = VK_NULL_HANDLE;
@@ -49,48 +73,43 @@ namespace S72Object{
             VkDeviceMemory heightImageMemory = VK_NULL_HANDLE;
             VkImageView heightImageView = VK_NULL_HANDLE;
 
-            VkDescriptorSetLayout MDescriptorSetLayout = VK_NULL_HANDLE;
-            VkDescriptorPool MDescriptorPool = VK_NULL_HANDLE;
-            std::vector<VkDescriptorSet> MDescriptorSets;
+            /* The index of the material in the material buffer. */
+            uint32_t materialIndex = 0;
 
             /* A list of meshes that use this material. */
             std::vector<std::shared_ptr<S72Object::Mesh>> meshes;
 
+            /* If we load the texture files as block compressed textures. */
+            static bool useCompressedTexture;
+
+            /* The decoded texture files, keyed by the resolved path and the format. */
+            static std::unordered_map<std::string, TextureData> textureCache;
+            /* The number of texture reads served by the cache. */
+            static uint32_t textureCacheHits;
+
             /* Overload < operator used for the map container. */
             bool operator < (const Material& newMat) const;
             /* Read a node and load all the info. */
             virtual void ProcessMaterial(const std::shared_ptr<ParserNode>& node);
             /* Read a PNG from a file path. */
-            static void ReadPNG(const std::string& filename, std::string& src, int& width, int& height, int& nChannels, uint32_t& mipLevels);
-            /* Default create layout function. */
-            virtual void CreateDescriptorSetLayout(const VkDevice& device);
-            /* Default create pool function. */
-            virtual void CreateDescriptorPool(const VkDevice& device);
-            /* Deallocate and free the memory of the normal/displacement data, as well as the pool. */
-            virtual void CleanUp(const VkDevice& device);
+            static void ReadPNG(const std::string& filename, TextureSource& src, int& width, int& height, int& nChannels, uint32_t& mipLevels, VkFormat& format, std::string& key);
+            /* Decode a texture file, or load its block compressed version. */
+            static void ReadTextureFile(const std::string& filename, std::string& src, int& width, int& height, int& nChannels, uint32_t& mipLevels, VkFormat& format);
+            /* Get the cache key of a constant 1x1 texture. */
+            static std::string GetConstantKey(const std::string& src);
     };
 
 
     /**
      * @brief Overload material for the Simple Material type.
      */
-    class Material_Simple : public Material{
-    public:
-        void CreateDescriptorSetLayout(const VkDevice& device) override;
-        void CreateDescriptorPool(const VkDevice& device) override;
-        void CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler);
-    };
+    class Material_Simple : public Material{};
 
 
     /**
     * @brief Overload material for the Environment/Mirror Material type.
     */
-    class Material_EnvMirror : public Material{
-    public:
-        void CreateDescriptorSetLayout(const VkDevice& device) override;
-        void CreateDescriptorPool(const VkDevice& device) override;
-        void CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler);
-    };
+    class Material_EnvMirror : public Material{};
 
 
     /**
@@ -99,23 +118,19 @@ namespace S72Object{
     class Material_Lambertian : public Material{
 
         public:
-            std::string albedo;
+            TextureSource albedo;
             int albedoHeight = 0;
             int albedoWidth = 0;
             int albedoChannel = 0;
             uint32_t albedoMipLevels;
+            VkFormat albedoFormat = VK_FORMAT_UNDEFINED;
+            std::string albedoKey;
 
             VkImage albedoImage = VK_NULL_HANDLE;
             VkDeviceMemory albedoImageMemory = VK_NULL_HANDLE;
             VkImageView albedoImageView = VK_NULL_HANDLE;
 
             void ProcessMaterial(const std::shared_ptr<ParserNode>& node) override;
-
-            void CreateDescriptorSetLayout(const VkDevice& device) override;
-            void CreateDescriptorPool(const VkDevice& device) override;
-            void CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler);
-
-            void CleanUp(const VkDevice& device) override;
     };
 
 
@@ -124,21 +139,27 @@ namespace S72Object{
     */
     class Material_PBR : public Material {
         public:
-            std::string albedo;
+            TextureSource albedo;
             int albedoHeight = 0;
             int albedoWidth = 0;
             int albedoChannel = 0;
             uint32_t albedoMipLevels;
+            VkFormat albedoFormat = VK_FORMAT_UNDEFINED;
+            std::string albedoKey;
 
-            std::string roughness;
+            TextureSource roughness;
             int roughnessHeight = 0;
             int roughnessWidth = 0;
             uint32_t roughnessMipLevels;
+            VkFormat roughnessFormat = VK_FORMAT_UNDEFINED;
+            std::string roughnessKey;
 
-            std::string metallic;
+            TextureSource metallic;
             int metallicHeight = 0;
             int metallicWidth = 0;
             uint32_t metallicMipLevels;
+            VkFormat metallicFormat = VK_FORMAT_UNDEFINED;
+            std::string metallicKey;
 
             VkImage albedoImage = VK_NULL_HANDLE;
             VkDeviceMemory albedoImageMemory = VK_NULL_HANDLE;
@@ -153,12 +174,6 @@ namespace S72Object{
             VkImageView metallicImageView = VK_NULL_HANDLE;
 
             void ProcessMaterial(const std::shared_ptr<ParserNode>& node) override;
-
-            void CreateDescriptorSetLayout(const VkDevice& device) override;
-            void CreateDescriptorPool(const VkDevice& device) override;
-            void CreateDescriptorSets(const VkDevice& device, const VkSampler& textureSampler);
-
-            void CleanUp(const VkDevice& device) override;
     };
 }
 
@@ -0,0 +1,456 @@
+//
+// Created by Xuan Zhai on 2024/4/6.
+//
+
+#include "TextureCompressor.h"
+#include "stb_image.h"
+
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/* The magic number and version of the cache file. */
+static const char CACHE_MAGIC[4] = {'X','Z','T','X'};
+static const uint32_t CACHE_VERSION = 1;
+
+
+/**
+ * @brief The header of the cache file.
+ * The source size and time are used to tell if the cache is out of date.
+ */
+struct CacheHeader{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+
+/**
+ * @brief Get the size and the last write time of a file.
+ * @param filename The file path and name.
+ * @param size The size of the file.
+ * @param time The last write time of the file.
+ */
+static void GetSourceStamp(const std::string& filename, uint64_t& size, int64_t& time){
+    size = static_cast<uint64_t>(std::filesystem::file_size(filename));
+    time = static_cast<int64_t>(std::filesystem::last_write_time(filename).time_since_epoch().count());
+}
+
+
+/**
+ * @brief Get the cache file name of a source texture.
+ * @param filename The source texture's path and name.
+ * @return The cache file's path and name.
+ */
+std::string TextureCompressor::GetCacheFileName(const std::string& filename){
+    return filename + ".xztx";
+}
+
+
+/**
+ * @brief Get the size in bytes of a mip level.
+ * @param format The compressed format.
+ * @param width The width of the level.
+ * @param height The height of the level.
+ * @return The number of bytes of all the blocks in that level.
+ */
+uint64_t TextureCompressor::GetLevelSize(ECompressedFormat format, uint32_t width, uint32_t height){
+    uint64_t blockCount = static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4);
+    uint64_t blockSize = (format == ECompressedFormat::BC3) ? 16 : 8;
+    return blockCount * blockSize;
+}
+
+
+/**
+ * @brief Build the mip chain of an 8-bit image on the CPU with a box filter.
+ * @param src The full resolution image.
+ * @param width The image width.
+ * @param height The image height.
+ * @param nChannels The number of channels of the image.
+ * @param mipLevels The number of levels we want.
+ * @return A list of images from the largest level to the smallest level.
+ */
+std::vector<std::string> TextureCompressor::BuildMipChain(const std::string& src, uint32_t width, uint32_t height, int nChannels, uint32_t mipLevels){
+    std::vector<std::string> levels;
+    levels.reserve(mipLevels);
+    levels.emplace_back(src);
+
+    uint32_t srcWidth = width;
+    uint32_t srcHeight = height;
+
+    for(uint32_t level = 1; level < mipLevels; level++){
+        uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+        uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+        const std::string& prev = levels.back();
+        std::string next(static_cast<size_t>(dstWidth) * dstHeight * nChannels, '\0');
+
+        for(uint32_t y = 0; y < dstHeight; y++){
+            uint32_t y0 = std::min(y * 2, srcHeight - 1);
+            uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+            for(uint32_t x = 0; x < dstWidth; x++){
+                uint32_t x0 = std::min(x * 2, srcWidth - 1);
+                uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+                for(int c = 0; c < nChannels; c++){
+                    uint32_t sum = (unsigned char)prev[(y0 * srcWidth + x0) * nChannels + c]
+                                 + (unsigned char)prev[(y0 * srcWidth + x1) * nChannels + c]
+                                 + (unsigned char)prev[(y1 * srcWidth + x0) * nChannels + c]
+                                 + (unsigned char)prev[(y1 * srcWidth + x1) * nChannels + c];
+                    next[(y * dstWidth + x) * nChannels + c] = (char)((sum + 2) / 4);
+                }
+            }
+        }
+
+        levels.emplace_back(std::move(next));
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+    return levels;
+}
+
+
+/**
+ * @brief Encode a 4x4 RGBA block to BC1. Use the principal axis of the colors as the endpoint line.
+ * @param rgba 16 RGBA pixels in the row order.
+ * @param dst 8 bytes of the output block.
+ */
+void TextureCompressor::EncodeBC1Block(const unsigned char* rgba, unsigned char* dst){
+
+    /* Find the mean color. */
+    float mean[3] = {0,0,0};
+    for(int i = 0; i < 16; i++){
+        for(int c = 0; c < 3; c++){
+            mean[c] += rgba[i * 4 + c];
+        }
+    }
+    for(float& m : mean) m /= 16.0f;
+
+    /* Find the covariance matrix. */
+    float cov[6] = {0,0,0,0,0,0};
+    for(int i = 0; i < 16; i++){
+        float r = rgba[i * 4] - mean[0];
+        float g = rgba[i * 4 + 1] - mean[1];
+        float b = rgba[i * 4 + 2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+
+    /* A few power iterations are enough to get the principal axis. */
+    float axis[3] = {1,1,1};
+    for(int iter = 0; iter < 4; iter++){
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float len = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+        if(len < 1e-6f) break;
+        axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+    }
+
+    /* Pick the two pixels at the ends of the axis as the endpoints. */
+    int minIndex = 0, maxIndex = 0;
+    float minDot = 1e30f, maxDot = -1e30f;
+    for(int i = 0; i < 16; i++){
+        float dot = rgba[i * 4] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+        if(dot < minDot){ minDot = dot; minIndex = i; }
+        if(dot > maxDot){ maxDot = dot; maxIndex = i; }
+    }
+
+    auto To565 = [](const unsigned char* p){
+        uint16_t r = (uint16_t)((p[0] * 31 + 127) / 255);
+        uint16_t g = (uint16_t)((p[1] * 63 + 127) / 255);
+        uint16_t b = (uint16_t)((p[2] * 31 + 127) / 255);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    };
+
+    uint16_t color0 = To565(&rgba[maxIndex * 4]);
+    uint16_t color1 = To565(&rgba[minIndex * 4]);
+    /* color0 > color1 selects the 4 colors mode. */
+    if(color0 < color1){
+        std::swap(color0, color1);
+    }
+
+    /* Expand the quantized endpoints to build the palette. */
+    int palette[4][3];
+    auto Expand = [](uint16_t c, int* out){
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        out[0] = (r << 3) | (r >> 2);
+        out[1] = (g << 2) | (g >> 4);
+        out[2] = (b << 3) | (b >> 2);
+    };
+    Expand(color0, palette[0]);
+    Expand(color1, palette[1]);
+    for(int c = 0; c < 3; c++){
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if(color0 != color1){
+        for(int i = 0; i < 16; i++){
+            int best = 0;
+            int bestDist = 1 << 30;
+            for(int p = 0; p < 4; p++){
+                int dr = rgba[i * 4] - palette[p][0];
+                int dg = rgba[i * 4 + 1] - palette[p][1];
+                int db = rgba[i * 4 + 2] - palette[p][2];
+                int dist = dr * dr + dg * dg + db * db;
+                if(dist < bestDist){ bestDist = dist; best = p; }
+            }
+            indices |= (uint32_t)best << (i * 2);
+        }
+    }
+
+    dst[0] = (unsigned char)(color0 & 0xFF);
+    dst[1] = (unsigned char)(color0 >> 8);
+    dst[2] = (unsigned char)(color1 & 0xFF);
+    dst[3] = (unsigned char)(color1 >> 8);
+    for(int i = 0; i < 4; i++){
+        dst[4 + i] = (unsigned char)((indices >> (i * 8)) & 0xFF);
+    }
+}
+
+
+/**
+ * @brief Encode a 4x4 single channel block to BC4. It is also the alpha block of BC3.
+ * @param values 16 values in the row order.
+ * @param dst 8 bytes of the output block.
+ */
+void TextureCompressor::EncodeBC4Block(const unsigned char* values, unsigned char* dst){
+
+    unsigned char a0 = *std::max_element(values, values + 16);
+    unsigned char a1 = *std::min_element(values, values + 16);
+
+    dst[0] = a0;
+    dst[1] = a1;
+    std::memset(dst + 2, 0, 6);
+
+    if(a0 == a1){
+        return;
+    }
+
+    /* a0 > a1 selects the 8 values mode. */
+    int palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+    for(int i = 2; i < 8; i++){
+        palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+    }
+
+    uint64_t indices = 0;
+    for(int i = 0; i < 16; i++){
+        int best = 0;
+        int bestDist = 1 << 30;
+        for(int p = 0; p < 8; p++){
+            int dist = std::abs((int)values[i] - palette[p]);
+            if(dist < bestDist){ bestDist = dist; best = p; }
+        }
+        indices |= (uint64_t)best << (i * 3);
+    }
+
+    for(int i = 0; i < 6; i++){
+        dst[2 + i] = (unsigned char)((indices >> (i * 8)) & 0xFF);
+    }
+}
+
+
+/**
+ * @brief Encode one mip level into blocks. Pixels outside the image are clamped to the edge.
+ * @param level The 8-bit image of the level.
+ * @param width The width of the level.
+ * @param height The height of the level.
+ * @param nChannels The number of channels, 1 or 4.
+ * @param format The target format.
+ * @param dst The container we append the blocks to.
+ */
+void TextureCompressor::EncodeLevel(const std::string& level, uint32_t width, uint32_t height, int nChannels, ECompressedFormat format, std::string& dst){
+
+    unsigned char rgba[64];
+    unsigned char alpha[16];
+    unsigned char block[16];
+
+    for(uint32_t by = 0; by < height; by += 4){
+        for(uint32_t bx = 0; bx < width; bx += 4){
+
+            /* Gather the 4x4 pixels. */
+            for(uint32_t y = 0; y < 4; y++){
+                uint32_t sy = std::min(by + y, height - 1);
+                for(uint32_t x = 0; x < 4; x++){
+                    uint32_t sx = std::min(bx + x, width - 1);
+                    size_t index = (static_cast<size_t>(sy) * width + sx) * nChannels;
+                    size_t i = y * 4 + x;
+                    for(int c = 0; c < 4; c++){
+                        rgba[i * 4 + c] = (unsigned char)level[index + std::min(c, nChannels - 1)];
+                    }
+                    alpha[i] = (nChannels == 1) ? rgba[i * 4] : rgba[i * 4 + 3];
+                }
+            }
+
+            if(format == ECompressedFormat::BC1){
+                EncodeBC1Block(rgba, block);
+                dst.append(reinterpret_cast<char*>(block), 8);
+            }
+            else if(format == ECompressedFormat::BC3){
+                EncodeBC4Block(alpha, block);
+                EncodeBC1Block(rgba, block + 8);
+                dst.append(reinterpret_cast<char*>(block), 16);
+            }
+            else{
+                EncodeBC4Block(alpha, block);
+                dst.append(reinterpret_cast<char*>(block), 8);
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Compress an 8-bit image and generate its mip chain.
+ * Single channel images use BC4. Four channels images use BC1, or BC3 if any pixel is not opaque.
+ * @param src The image data.
+ * @param width The image width.
+ * @param height The image height.
+ * @param nChannels The number of channels, 1 or 4.
+ * @param texture The compressed texture.
+ */
+void TextureCompressor::Compress(const std::string& src, uint32_t width, uint32_t height, int nChannels, CompressedTexture& texture){
+
+    if(nChannels != 1 && nChannels != 4){
+        throw std::runtime_error("Can only compress textures with 1 or 4 channels!");
+    }
+
+    texture.width = width;
+    texture.height = height;
+    texture.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+    texture.format = ECompressedFormat::BC4;
+
+    if(nChannels == 4){
+        texture.format = ECompressedFormat::BC1;
+        for(size_t i = 3; i < src.size(); i += 4){
+            if((unsigned char)src[i] != 255u){
+                texture.format = ECompressedFormat::BC3;
+                break;
+            }
+        }
+    }
+
+    std::vector<std::string> levels = BuildMipChain(src, width, height, nChannels, texture.mipLevels);
+
+    texture.data.clear();
+    texture.levelOffsets.clear();
+    for(uint32_t level = 0; level < texture.mipLevels; level++){
+        texture.levelOffsets.emplace_back(texture.data.size());
+        EncodeLevel(levels[level], std::max(width >> level, 1u), std::max(height >> level, 1u), nChannels, texture.format, texture.data);
+    }
+}
+
+
+/**
+ * @brief Read a cache file. Fail if it is missing, broken, or older than the source.
+ * @param filename The source texture's path and name.
+ * @param texture The compressed texture.
+ * @return True if the cache is valid and read.
+ */
+bool TextureCompressor::ReadCache(const std::string& filename, CompressedTexture& texture){
+
+    std::ifstream input(GetCacheFileName(filename), std::ios::binary);
+    if(!input.is_open()){
+        return false;
+    }
+
+    CacheHeader header{};
+    input.read(reinterpret_cast<char*>(&header), sizeof(CacheHeader));
+    if(!input || std::memcmp(header.magic, CACHE_MAGIC, 4) != 0 || header.version != CACHE_VERSION){
+        return false;
+    }
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    GetSourceStamp(filename, sourceSize, sourceTime);
+    if(header.sourceSize != sourceSize || header.sourceTime != sourceTime){
+        return false;
+    }
+
+    texture.format = static_cast<ECompressedFormat>(header.format);
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.mipLevels = header.mipLevels;
+    texture.levelOffsets.resize(header.mipLevels);
+    input.read(reinterpret_cast<char*>(texture.levelOffsets.data()), static_cast<std::streamsize>(header.mipLevels * sizeof(uint64_t)));
+
+    uint64_t dataSize = 0;
+    for(uint32_t level = 0; level < header.mipLevels; level++){
+        dataSize += GetLevelSize(texture.format, std::max(header.width >> level, 1u), std::max(header.height >> level, 1u));
+    }
+
+    /* The blocks are already in the upload layout, so it is a straight copy. */
+    texture.data.resize(dataSize);
+    input.read(texture.data.data(), static_cast<std::streamsize>(dataSize));
+
+    return static_cast<bool>(input);
+}
+
+
+/**
+ * @brief Write a cache file for a source texture.
+ * @param filename The source texture's path and name.
+ * @param texture The compressed texture.
+ */
+void TextureCompressor::WriteCache(const std::string& filename, const CompressedTexture& texture){
+
+    std::ofstream output(GetCacheFileName(filename), std::ios::binary | std::ios::trunc);
+    if(!output.is_open()){
+        /* The cache is optional. Just compress it again next time. */
+        return;
+    }
+
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.format = static_cast<uint32_t>(texture.format);
+    header.width = texture.width;
+    header.height = texture.height;
+    header.mipLevels = texture.mipLevels;
+    GetSourceStamp(filename, header.sourceSize, header.sourceTime);
+
+    output.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+    output.write(reinterpret_cast<const char*>(texture.levelOffsets.data()), static_cast<std::streamsize>(texture.levelOffsets.size() * sizeof(uint64_t)));
+    output.write(texture.data.data(), static_cast<std::streamsize>(texture.data.size()));
+}
+
+
+/**
+ * @brief Read a texture from its cache, or decode and compress the source and create the cache.
+ * @param filename The source texture's path and name.
+ * @param texture The compressed texture.
+ */
+void TextureCompressor::LoadOrCreate(const std::string& filename, CompressedTexture& texture){
+
+    if(ReadCache(filename, texture)){
+        return;
+    }
+
+    int width, height, nChannels;
+    if(!stbi_info(filename.c_str(), &width, &height, &nChannels)){
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    /* Single channel data stay single channel, everything else is expanded to RGBA. */
+    int desiredChannels = (nChannels == 1) ? 1 : 4;
+    unsigned char* image = stbi_load(filename.c_str(), &width, &height, &nChannels, desiredChannels);
+    if (!image) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    std::string src(reinterpret_cast<char const*>(image), static_cast<size_t>(width) * height * desiredChannels);
+    stbi_image_free(image);
+
+    Compress(src, static_cast<uint32_t>(width), static_cast<uint32_t>(height), desiredChannels, texture);
+    WriteCache(filename, texture);
+}
@@ -0,0 +1,80 @@
+//
+// Created by Xuan Zhai on 2024/4/6.
+//
+
+#ifndef XUANJAMESZHAI_A1_TEXTURECOMPRESSOR_H
+#define XUANJAMESZHAI_A1_TEXTURECOMPRESSOR_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief The block compressed formats we can produce.
+ * BC1 for opaque color, BC3 for color with alpha, BC4 for single channel data.
+ */
+enum class ECompressedFormat : uint32_t{
+    BC1 = 1,
+    BC3 = 3,
+    BC4 = 4
+};
+
+
+/**
+ * @brief A block compressed texture with its full mip chain.
+ * All the mip levels are packed one after another in data, from the largest to the smallest.
+ */
+struct CompressedTexture{
+    ECompressedFormat format = ECompressedFormat::BC1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+    /* The byte offset of each mip level in data. */
+    std::vector<uint64_t> levelOffsets;
+    /* The packed blocks of all the mip levels. */
+    std::string data;
+};
+
+
+/**
+ * @brief Convert the material textures into block compressed formats and cache them next to the source file.
+ * The cache file (.xztx) is a small KTX2-like container: a header, a level index and the packed blocks,
+ * so loading it is a straight copy.
+ */
+class TextureCompressor {
+
+private:
+    /* Build the mip chain of an 8-bit image on the CPU. */
+    static std::vector<std::string> BuildMipChain(const std::string& src, uint32_t width, uint32_t height, int nChannels, uint32_t mipLevels);
+
+    /* Encode a 4x4 RGBA block to BC1. */
+    static void EncodeBC1Block(const unsigned char* rgba, unsigned char* dst);
+
+    /* Encode a 4x4 single channel block to BC4 (Also the alpha part of BC3). */
+    static void EncodeBC4Block(const unsigned char* values, unsigned char* dst);
+
+    /* Encode one mip level into blocks. */
+    static void EncodeLevel(const std::string& level, uint32_t width, uint32_t height, int nChannels, ECompressedFormat format, std::string& dst);
+
+public:
+    /* Get the cache file name of a source texture. */
+    static std::string GetCacheFileName(const std::string& filename);
+
+    /* Get the size in bytes of a mip level. */
+    static uint64_t GetLevelSize(ECompressedFormat format, uint32_t width, uint32_t height);
+
+    /* Compress an 8-bit image with 1 or 4 channels and generate its mip chain. */
+    static void Compress(const std::string& src, uint32_t width, uint32_t height, int nChannels, CompressedTexture& texture);
+
+    /* Read a cache file, fail if it is missing or older than the source. */
+    static bool ReadCache(const std::string& filename, CompressedTexture& texture);
+
+    /* Write a cache file for a source texture. */
+    static void WriteCache(const std::string& filename, const CompressedTexture& texture);
+
+    /* Read a texture from its cache, or compress the source and create the cache. */
+    static void LoadOrCreate(const std::string& filename, CompressedTexture& texture);
+};
+
+
+#endif //XUANJAMESZHAI_A1_TEXTURECOMPRESSOR_H
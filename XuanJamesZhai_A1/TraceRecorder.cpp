@@ -0,0 +1,209 @@
+//
+// Created by Xuan Zhai on 2024/5/2.
+//
+
+#include "TraceRecorder.h"
+#include "JSONHelper.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+
+/**
+ * @brief Get the track of the calling thread, a new track is added the first time a thread records.
+ * The mutex must be locked.
+ * @return The track index.
+ */
+uint32_t TraceRecorder::GetThreadTrack(){
+    std::thread::id id = std::this_thread::get_id();
+    auto iter = threadTracks.find(id);
+    if(iter != threadTracks.end()){
+        return iter->second;
+    }
+
+    auto track = (uint32_t)trackNames.size();
+    trackNames.emplace_back("Thread " + std::to_string(track));
+    threadTracks[id] = track;
+    return track;
+}
+
+
+/**
+ * @brief Add an event, or drop it once the event limit is reached. The mutex must be locked.
+ * @param event The new event.
+ */
+void TraceRecorder::AddEvent(Event&& event){
+    if(events.size() >= maxEvents){
+        if(!isFull){
+            std::cout << "Trace: reached " << maxEvents << " events, the rest of the run is not recorded." << std::endl;
+            isFull = true;
+        }
+        return;
+    }
+    events.emplace_back(std::move(event));
+}
+
+
+/**
+ * @brief Get the time from the start of the run.
+ * @return The time in microseconds.
+ */
+double TraceRecorder::Now() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+
+/**
+ * @brief Name the track of the calling thread, e.g. "Render".
+ * @param name The track name.
+ */
+void TraceRecorder::SetThreadName(const std::string& name){
+    std::lock_guard<std::mutex> lock(mutex);
+    trackNames[GetThreadTrack()] = name;
+}
+
+
+/**
+ * @brief Add a CPU zone of the calling thread.
+ * @param name The zone name.
+ * @param start The time the zone starts.
+ * @param end The time the zone ends.
+ */
+void TraceRecorder::AddCPUZone(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end){
+    Event event;
+    event.name = name;
+    event.phase = 'X';
+    event.start = std::chrono::duration<double, std::micro>(start - origin).count();
+    event.value = std::chrono::duration<double, std::micro>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    event.track = GetThreadTrack();
+    AddEvent(std::move(event));
+}
+
+
+/**
+ * @brief Add a GPU zone on the GPU track.
+ * @param name The zone name.
+ * @param start The start time in microseconds from the start of the run.
+ * @param duration The duration in microseconds.
+ */
+void TraceRecorder::AddGPUZone(const std::string& name, double start, double duration){
+    Event event;
+    event.name = name;
+    event.phase = 'X';
+    event.track = gpuTrack;
+    event.start = start;
+    event.value = duration;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    AddEvent(std::move(event));
+}
+
+
+/**
+ * @brief Set a counter of the current frame, e.g. the number of draws. Setting it again replaces the value.
+ * @param name The counter name.
+ * @param value The counter value.
+ */
+void TraceRecorder::SetCounter(const std::string& name, double value){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& counter : frameCounters){
+        if(counter.first == name){
+            counter.second = value;
+            return;
+        }
+    }
+    frameCounters.emplace_back(name, value);
+}
+
+
+/**
+ * @brief Write the counters of the current frame as counter events and counter rows, then move to the next frame.
+ */
+void TraceRecorder::EndFrame(){
+    double now = Now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& counter : frameCounters){
+        Event event;
+        event.name = counter.first;
+        event.phase = 'C';
+        event.start = now;
+        event.value = counter.second;
+        AddEvent(std::move(event));
+
+        /* The rows have the same limit as the events, a mesh adds a row every frame. */
+        if(counterRows.size() >= maxEvents){
+            if(!isCounterFull){
+                std::cout << "Trace: reached " << maxEvents << " counter rows, the counters of the rest of the run are not recorded." << std::endl;
+                isCounterFull = true;
+            }
+            continue;
+        }
+        counterRows.emplace_back(frameIndex, counter.first, counter.second);
+    }
+    frameCounters.clear();
+    frameIndex++;
+}
+
+
+/**
+ * @brief Write the events as a Chrome trace JSON file. It can be opened by chrome://tracing or ui.perfetto.dev.
+ * @param fileName The JSON file path and name.
+ */
+void TraceRecorder::SaveChromeTrace(const std::string& fileName){
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the trace file: " + fileName);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    /* Name the tracks first, so the GPU track is listed above the threads. */
+    for(uint32_t i = 0; i < trackNames.size(); i++){
+        file << (i == 0 ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i
+             << ", \"args\": {\"name\": \"" << JSONHelper::Escape(trackNames[i]) << "\"}},\n"
+             << "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i << ", \"args\": {\"sort_index\": " << i << "}}";
+    }
+
+    char values[128];
+    for(size_t i = 0; i < events.size(); i++){
+        const Event& event = events[i];
+        if(event.phase == 'X'){
+            snprintf(values, sizeof(values), "\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f", event.track, event.start, event.value);
+            file << ",\n{\"name\": \"" << JSONHelper::Escape(event.name) << "\", " << values << "}";
+        }
+        else{
+            snprintf(values, sizeof(values), "\"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {\"value\": %.6g}", event.start, event.value);
+            file << ",\n{\"name\": \"" << JSONHelper::Escape(event.name) << "\", " << values << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    std::cout << "Trace: wrote " << events.size() << " events to " << fileName << std::endl;
+}
+
+
+/**
+ * @brief Write the counters as a CSV file, one counter of a frame per row.
+ * @param fileName The CSV file path and name.
+ */
+void TraceRecorder::SaveCounters(const std::string& fileName){
+
+    std::ofstream file(fileName);
+    if(!file.is_open()){
+        throw std::runtime_error("Cannot open the counter file: " + fileName);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    file << "frame,counter,value\n";
+    for(const auto& row : counterRows){
+        file << std::get<0>(row) << "," << std::get<1>(row) << "," << std::get<2>(row) << "\n";
+    }
+}
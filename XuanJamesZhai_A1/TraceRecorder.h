@@ -0,0 +1,136 @@
+//
+// Created by Xuan Zhai on 2024/5/2.
+//
+
+#ifndef XUANJAMESZHAI_A1_TRACERECORDER_H
+#define XUANJAMESZHAI_A1_TRACERECORDER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+
+/**
+ * @brief Record the CPU zones, the GPU zones and the per-frame counters of a run,
+ * then write them as a Chrome trace (JSON, opened by chrome://tracing or Perfetto) and as a CSV counter dump.
+ * The zones can be recorded from any thread, each thread gets its own track.
+ */
+class TraceRecorder {
+
+public:
+    /**
+     * @brief A CPU zone that lasts until the end of its scope. Does nothing if the recorder is null.
+     */
+    class Zone{
+    private:
+        TraceRecorder* recorder;
+        const char* name;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        Zone(TraceRecorder* newRecorder, const char* newName) : recorder(newRecorder), name(newName){
+            if(recorder != nullptr){
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Zone(){
+            if(recorder != nullptr){
+                recorder->AddCPUZone(name, start, std::chrono::steady_clock::now());
+            }
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+    };
+
+private:
+    /**
+     * @brief A trace event. A zone if its phase is 'X', a counter if it is 'C'.
+     */
+    struct Event{
+        std::string name;
+        char phase = 'X';
+        /* The track of a zone, the thread index or the GPU track. */
+        uint32_t track = 0;
+        /* The start time in microseconds from the start of the run. */
+        double start = 0;
+        /* The zone's duration in microseconds, or the counter's value. */
+        double value = 0;
+    };
+
+    /* The start of the run, all the event times count from it. */
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    /* The recorded events. */
+    std::vector<Event> events;
+
+    /* Stop recording past this number of events, or of counter rows, so a long windowed run does not use all the memory. */
+    const size_t maxEvents = 1 << 22;
+
+    /* Set once the event limit is reached. */
+    bool isFull = false;
+
+    /* Set once the counter row limit is reached. */
+    bool isCounterFull = false;
+
+    /* The track index of each thread that recorded a zone. */
+    std::map<std::thread::id, uint32_t> threadTracks;
+
+    /* The name of each track, the GPU track is the first one. */
+    std::vector<std::string> trackNames = {"GPU"};
+
+    /* The counters of the current frame, written out when the frame ends. */
+    std::vector<std::pair<std::string,double>> frameCounters;
+
+    /* The counters of every frame: frame index, counter name and value. */
+    std::vector<std::tuple<uint32_t,std::string,double>> counterRows;
+
+    /* The index of the current frame. */
+    uint32_t frameIndex = 0;
+
+    /* The zones can be recorded from several threads. */
+    std::mutex mutex;
+
+    /* Get the track of the calling thread, the mutex must be locked. */
+    uint32_t GetThreadTrack();
+
+    /* Add an event if the limit is not reached, the mutex must be locked. */
+    void AddEvent(Event&& event);
+
+public:
+    /* The track the GPU zones are drawn on. */
+    static const uint32_t gpuTrack = 0;
+
+    /* Get the time from the start of the run, in microseconds. */
+    [[nodiscard]] double Now() const;
+
+    /* Name the track of the calling thread. */
+    void SetThreadName(const std::string& name);
+
+    /* Add a CPU zone of the calling thread. */
+    void AddCPUZone(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+    /* Add a GPU zone, its times are in microseconds from the start of the run. */
+    void AddGPUZone(const std::string& name, double start, double duration);
+
+    /* Set a counter of the current frame. */
+    void SetCounter(const std::string& name, double value);
+
+    /* Write the counters of the current frame and move to the next frame. */
+    void EndFrame();
+
+    /* Write the events as a Chrome trace JSON file. */
+    void SaveChromeTrace(const std::string& fileName);
+
+    /* Write the counters as a CSV file, one counter of a frame per row. */
+    void SaveCounters(const std::string& fileName);
+};
+
+
+#endif //XUANJAMESZHAI_A1_TRACERECORDER_H
@@ -253,9 +253,9 @@ void VkMaterial_PBR::CreateDescriptorSetLayout(const VkDevice& device) {
     bindings[1].pImmutableSamplers = nullptr;
     bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;     // Use the image sampler in the fragment shader stage.
 
-    /* Set the cube map sampler */
+    /* Set the GGX cube map sampler, each roughness level is a mip level */
     bindings[2].binding = 2;
-    bindings[2].descriptorCount = 10;
+    bindings[2].descriptorCount = 1;
     bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     bindings[2].pImmutableSamplers = nullptr;
     bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;     // Use the image sampler in the fragment shader stage.
@@ -287,7 +287,7 @@ void VkMaterial_PBR::CreateDescriptorPool(const VkDevice& device){
     poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 10;
+    poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     /* Create the pool info for allocation */
     VkDescriptorPoolCreateInfo poolInfo{};
@@ -306,10 +306,10 @@ void VkMaterial_PBR::CreateDescriptorPool(const VkDevice& device){
  * @brief Create the descriptor set for the PBR material.
  * @param device The physical device.
  * @param textureSampler The sampler.
- * @param cubeMaps The GGX LUTs.
+ * @param GGXcubeMap The GGX LUTs, one roughness level per mip level.
  * @param brdfLUT The pre-compute BRDF LUTs.
  */
-void VkMaterial_PBR::CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler, VkImageView const &LamCubeMap, const std::vector<VkImageView>& GGXcubeMaps, const VkImageView& brdfLUT){
+void VkMaterial_PBR::CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler, VkImageView const &LamCubeMap, const VkImageView& GGXcubeMap, const VkImageView& brdfLUT){
     /* Create one descriptor set for each frame in flight */
     std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, VKMDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
@@ -331,14 +331,10 @@ void VkMaterial_PBR::CreateDescriptorSets(const VkDevice& device, VkSampler cons
         LamcubeMapInfo[0].imageView = LamCubeMap;
         LamcubeMapInfo[0].sampler = textureSampler;
 
-        std::vector<VkDescriptorImageInfo> GGXcubeMapInfo;
-        for (const auto &cubeMap: GGXcubeMaps) {
-            VkDescriptorImageInfo newInfo;
-            GGXcubeMapInfo.emplace_back(newInfo);
-            GGXcubeMapInfo.back().imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            GGXcubeMapInfo.back().imageView = cubeMap;
-            GGXcubeMapInfo.back().sampler = textureSampler;
-        }
+        std::array<VkDescriptorImageInfo,1> GGXcubeMapInfo{};
+        GGXcubeMapInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        GGXcubeMapInfo[0].imageView = GGXcubeMap;
+        GGXcubeMapInfo[0].sampler = textureSampler;
 
         std::array<VkDescriptorImageInfo,1> brdfInfo{};
         brdfInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
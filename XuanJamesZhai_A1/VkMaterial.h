@@ -37,6 +37,9 @@ public:
 
     std::vector<VkDescriptorSet> VKMDescriptorSets;
 
+    /* All the meshes drawn with this material type, sorted front-to-back every frame. */
+    std::vector<std::shared_ptr<S72Object::Mesh>> meshes;
+
     /* Create the descriptor set layout. */
     virtual void CreateDescriptorSetLayout(const VkDevice& device) = 0;
     /* Create the descriptor pool. */
@@ -89,7 +92,7 @@ class VkMaterial_PBR : public VkMaterial {
 public:
     void CreateDescriptorSetLayout(const VkDevice& device) override;
     void CreateDescriptorPool(const VkDevice& device) override;
-    void CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler, VkImageView const &LamCubeMap, const std::vector<VkImageView>& cubeMaps, const VkImageView& brdfLUT);
+    void CreateDescriptorSets(const VkDevice& device, VkSampler const &textureSampler, VkImageView const &LamCubeMap, const VkImageView& GGXcubeMap, const VkImageView& brdfLUT);
 };
 
 
@@ -9,6 +9,7 @@
 #include <GLFW/glfw3.h>
 
 #include <string>
+#include <vector>
 #include "S72Helper.h"
 
 /**
@@ -27,10 +28,27 @@ public:
     VkBuffer vertexBuffer;
     VkDeviceMemory vertexBufferMemory;
 
-    /* The instance buffer. */
+    /* The instance buffer, one region of the scene's instance count per view and one more for the shadow casters. */
     VkBuffer instanceBuffer;
     VkDeviceMemory instanceBufferMemory;
 
+    /**
+     * @brief The instances a view draws: the buffer region they are in and how many there are.
+     */
+    struct ViewInstances{
+        uint32_t region = 0;
+        uint32_t count = 0;
+    };
+
+    /* The instances of each view in the current frame. */
+    std::vector<ViewInstances> views;
+
+    /* The instances uploaded to each region this frame, so a later view culling the same instances can share the region. */
+    std::vector<std::vector<S72Object::MeshInstance>> regionInstances;
+
+    /* The unculled instances the shadow passes draw in the current frame. */
+    ViewInstances shadowCasters;
+
     /* The index info. */
     bool isUseIndex;
     VkBuffer indexBuffer;
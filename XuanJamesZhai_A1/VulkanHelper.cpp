@@ -6,9 +6,39 @@
 
 #include "stb_image.h"
 #include <utility>
+#include <thread>
 
 
 
+/**
+ * @brief Get the time since a time point in milliseconds, used by the frame stats.
+ * @param start The start time point.
+ * @return The elapsed milliseconds.
+ */
+static double ElapsedMilliseconds(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * @brief Check if two views culled the same instances in the same order. The instances are compared field by field, since they have padding.
+ * @param a The instances of a view.
+ * @param b The instances of another view.
+ * @return True if they are the same.
+ */
+static bool IsSameInstances(const std::vector<S72Object::MeshInstance>& a, const std::vector<S72Object::MeshInstance>& b){
+    if(a.size() != b.size()){
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++){
+        if(a[i].material != b[i].material || memcmp(&a[i].model, &b[i].model, sizeof(XZM::mat4)) != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+
 /**
 * @brief It creates a VkDebugUtilsMessengerEXT object that's used for the validation extension
 */
@@ -80,6 +110,94 @@ static std::vector<char> ReadFile(const std::string& filename) {
 }
 
 
+/**
+ * @brief Convert a float to a half float.
+ * Values out of the half float range are clamped to the largest half instead of infinity.
+ * A copy of the Cubes tool's conversion, the file formats and their conventions are described in Cubes/Cube.h.
+ * @param[in] value The float value.
+ * @return The bits of the half float.
+ */
+static uint16_t FloatToHalf(float value){
+    uint32_t f;
+    memcpy(&f, &value, sizeof(float));
+
+    uint32_t sign = (f >> 16) & 0x8000u;
+    f &= 0x7FFFFFFFu;
+
+    /* Larger than 65504 or NaN. */
+    if(f >= 0x477FF000u){
+        return (uint16_t)(sign | ((f > 0x7F800000u) ? 0x7E00u : 0x7BFFu));
+    }
+    /* Smaller than the smallest normal half, let the float adder do the rounding. */
+    if(f < 0x38800000u){
+        float magic = 0.5f;
+        float denorm;
+        memcpy(&denorm, &f, sizeof(float));
+        denorm += magic;
+        uint32_t bits;
+        memcpy(&bits, &denorm, sizeof(float));
+        return (uint16_t)(sign | (bits - 0x3F000000u));
+    }
+    /* Rebias the exponent and round to the nearest even. */
+    uint32_t mantissaOdd = (f >> 13) & 1u;
+    f += 0xC8000FFFu + mantissaOdd;
+    return (uint16_t)(sign | (f >> 13));
+}
+
+
+/**
+ * @brief Resample a square RGBA float image to a new size.
+ * Use the box filter when shrinking by an integer factor, otherwise use the bilinear filter.
+ * A copy of the Cubes tool's resampling, so the png fallback matches the cube files.
+ * @param[in] src The source image.
+ * @param[in] srcSize The source width and height.
+ * @param[in] dst The target image.
+ * @param[in] dstSize The target width and height.
+ */
+static void ResampleFace(const float* src, uint32_t srcSize, float* dst, uint32_t dstSize){
+
+    if(srcSize >= dstSize && srcSize % dstSize == 0){
+        uint32_t factor = srcSize / dstSize;
+        float weight = 1.0f / static_cast<float>(factor * factor);
+        for(uint32_t y = 0; y < dstSize; y++){
+            for(uint32_t x = 0; x < dstSize; x++){
+                float sum[4] = {0,0,0,0};
+                for(uint32_t sy = y * factor; sy < (y + 1) * factor; sy++){
+                    for(uint32_t sx = x * factor; sx < (x + 1) * factor; sx++){
+                        for(int c = 0; c < 4; c++){
+                            sum[c] += src[(static_cast<size_t>(sy) * srcSize + sx) * 4 + c];
+                        }
+                    }
+                }
+                for(int c = 0; c < 4; c++){
+                    dst[(static_cast<size_t>(y) * dstSize + x) * 4 + c] = sum[c] * weight;
+                }
+            }
+        }
+        return;
+    }
+
+    float ratio = static_cast<float>(srcSize) / static_cast<float>(dstSize);
+    for(uint32_t y = 0; y < dstSize; y++){
+        float fy = (std::max)(((float)y + 0.5f) * ratio - 0.5f, 0.0f);
+        uint32_t y0 = (std::min)(static_cast<uint32_t>(fy), srcSize - 1);
+        uint32_t y1 = (std::min)(y0 + 1, srcSize - 1);
+        float ty = fy - (float)y0;
+        for(uint32_t x = 0; x < dstSize; x++){
+            float fx = (std::max)(((float)x + 0.5f) * ratio - 0.5f, 0.0f);
+            uint32_t x0 = (std::min)(static_cast<uint32_t>(fx), srcSize - 1);
+            uint32_t x1 = (std::min)(x0 + 1, srcSize - 1);
+            float tx = fx - (float)x0;
+            for(int c = 0; c < 4; c++){
+                float top = src[(static_cast<size_t>(y0) * srcSize + x0) * 4 + c] * (1 - tx) + src[(static_cast<size_t>(y0) * srcSize + x1) * 4 + c] * tx;
+                float bottom = src[(static_cast<size_t>(y1) * srcSize + x0) * 4 + c] * (1 - tx) + src[(static_cast<size_t>(y1) * srcSize + x1) * 4 + c] * tx;
+                dst[(static_cast<size_t>(y) * dstSize + x) * 4 + c] = top * (1 - ty) + bottom * ty;
+            }
+        }
+    }
+}
+
+
 /**
  * @brief React with a key event.
  * @param window The glfw window that it's interacting with.
@@ -137,6 +255,8 @@ void GLFW_Key_Callback(GLFWwindow* window, int key, int scancode, int action, in
 */
 void VulkanHelper::FramebufferResizeCallback(GLFWwindow* window, int width, int height) {
     auto app = reinterpret_cast<VulkanHelper*>(glfwGetWindowUserPointer(window));
+    app->framebufferWidth = width;
+    app->framebufferHeight = height;
     app->framebufferResized = true;
 }
 
@@ -161,6 +281,11 @@ void VulkanHelper::InitWindow()
     glfwSetWindowUserPointer(window, this);
     glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);      // Callback for window resize
 
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    framebufferWidth = width;
+    framebufferHeight = height;
+
     glfwSetKeyCallback(window, GLFW_Key_Callback);
 }
 
@@ -277,7 +402,8 @@ VkExtent2D VulkanHelper::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabi
             }
         }
         else {
-            glfwGetFramebufferSize(window, &width, &height);
+            width = framebufferWidth;
+            height = framebufferHeight;
         }
 
         VkExtent2D actualExtent = {
@@ -613,9 +739,21 @@ void VulkanHelper::CreateLogicalDevice()
     VkPhysicalDeviceFeatures2 deviceFeatures{};
     deviceFeatures.features.samplerAnisotropy = VK_TRUE;     // Enable the anisotropy feature
 
+    /* Enable the BC texture compression if the device has it. */
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    supportBCTexture = supportedFeatures.textureCompressionBC == VK_TRUE;
+    deviceFeatures.features.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+    /* Enable the pipeline statistics if the device has it, the performance test counts the shaded fragments with it. */
+    supportPipelineStatistics = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+    deviceFeatures.features.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+
     VkPhysicalDeviceVulkan12Features capacityFeature12{};
     capacityFeature12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
     capacityFeature12.runtimeDescriptorArray = true;
+    capacityFeature12.shaderSampledImageArrayNonUniformIndexing = true;
+    capacityFeature12.descriptorBindingPartiallyBound = true;
 
 
     VkPhysicalDeviceVulkan11Features capacityFeature11{};
@@ -769,7 +907,8 @@ void VulkanHelper::CreateSwapChain()
  */
 void VulkanHelper::CreateHeadlessSwapChain(){
 
-    uint32_t imageCount = MAX_FRAMES_IN_FLIGHT;
+    /* Each view of a frame in flight is drawn into its own image. */
+    uint32_t imageCount = MAX_FRAMES_IN_FLIGHT * viewCount;
 
     swapChainImages.resize(imageCount);
     headlessImageMemory.resize(imageCount);
@@ -937,6 +1076,12 @@ void VulkanHelper::CreateGraphicsPipeline(const VkRenderPass& newRenderPass, con
     depthStencil.depthBoundsTestEnable = VK_FALSE;
     depthStencil.stencilTestEnable = VK_FALSE;
 
+    /* With a depth pre-pass, the depth buffer is already final. Only shade the fragments that match it. */
+    if(useDepthPrepass){
+        depthStencil.depthWriteEnable = VK_FALSE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+
     /* Describe the color blending in the pipeline */
     /* Blending the new color from the shader with the old one in the frame buffer */
     VkPipelineColorBlendAttachmentState colorBlendAttachment{};
@@ -1349,9 +1494,9 @@ std::array<VkVertexInputBindingDescription2EXT,2> VulkanHelper::CreateBindingDes
  * @param[in] newMeshInstance The mesh we are construct from.
  * @return newMeshInstance's attribute description info.
  */
-std::array<VkVertexInputAttributeDescription2EXT, 9> VulkanHelper::CreateAttributeDescription(const S72Object::Mesh& newMeshInstance){
+std::array<VkVertexInputAttributeDescription2EXT, 10> VulkanHelper::CreateAttributeDescription(const S72Object::Mesh& newMeshInstance){
 
-    std::array<VkVertexInputAttributeDescription2EXT, 9> attributeDescriptions{};
+    std::array<VkVertexInputAttributeDescription2EXT, 10> attributeDescriptions{};
 
     /* Attribute for the vertex data */
     attributeDescriptions[0].binding = 0;
@@ -1413,6 +1558,13 @@ std::array<VkVertexInputAttributeDescription2EXT, 9> VulkanHelper::CreateAttribu
     attributeDescriptions[8].offset = offsetof(S72Object::MeshInstance, model) + sizeof(float)*12;
     attributeDescriptions[8].sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
 
+    /* The material index of the instance. */
+    attributeDescriptions[9].binding = 1;
+    attributeDescriptions[9].location = 9;
+    attributeDescriptions[9].format = VK_FORMAT_R32_UINT;
+    attributeDescriptions[9].offset = offsetof(S72Object::MeshInstance, material);
+    attributeDescriptions[9].sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
+
     return attributeDescriptions;
 }
 
@@ -1446,20 +1598,25 @@ void VulkanHelper::CreateIndexBuffer(const S72Object::Mesh& newMesh, VkMesh& vkM
 
 
 /**
- * @brief Create a single dynamic instance buffer for a mesh.
+ * @brief Create a single dynamic instance buffer for a mesh, with one region per view and a last one for the shadow casters.
  * @param[out] vkMesh The container which has the target instance buffer.
  */
 void VulkanHelper::CreateInstanceBuffer(VkMesh& vkMesh){
-    VkDeviceSize bufferSize = s72Instance->instanceCount * sizeof(S72Object::MeshInstance);
+    VkDeviceSize bufferSize = GetInstanceRegionOffset(viewCount + 1);
     CreateBuffer(bufferSize,VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vkMesh.instanceBuffer,vkMesh.instanceBufferMemory);
 }
 
 
 /**
- * @brief Update an instance buffer with the new instance data.
- * @param newMesh The mesh object which has the instance data.
+ * @brief Update a region of an instance buffer with the new instance data.
+ * @param newMesh The mesh object which owns the instance buffer.
+ * @param instances The instances written, the visible ones of a view or the shadow casters.
+ * @param region The region written, a view's region, or viewCount for the shadow casters.
  */
-void VulkanHelper::UpdateInstanceBuffer(const S72Object::Mesh& newMesh){
+void VulkanHelper::UpdateInstanceBuffer(const S72Object::Mesh& newMesh, const std::vector<S72Object::MeshInstance>& instances, uint32_t region){
+    TraceRecorder::Zone zone(traceRecorder.get(), "instance_upload");
+    auto start = std::chrono::steady_clock::now();
+
     // Map dynamic instance buffer memory
     void* mappedData;
     VkDeviceSize bufferSize = s72Instance->instanceCount * sizeof(S72Object::MeshInstance);
@@ -1468,13 +1625,105 @@ void VulkanHelper::UpdateInstanceBuffer(const S72Object::Mesh& newMesh){
         throw std::runtime_error("Cannot find the vkMesh!");
     }
 
-    vkMapMemory(device, VkMeshes[newMesh.name]->instanceBufferMemory, 0, bufferSize, 0, &mappedData);
+    vkMapMemory(device, VkMeshes[newMesh.name]->instanceBufferMemory, GetInstanceRegionOffset(region), bufferSize, 0, &mappedData);
 
-    // Copy visible instance data to the mapped memory
-    memcpy(mappedData, newMesh.visibleInstances.data(), newMesh.visibleInstances.size() * sizeof(S72Object::MeshInstance));
+    // Copy the instance data to the mapped memory
+    memcpy(mappedData, instances.data(), instances.size() * sizeof(S72Object::MeshInstance));
+    frameCounters.bytesUploaded += instances.size() * sizeof(S72Object::MeshInstance);
 
     // Unmap dynamic instance buffer memory
     vkUnmapMemory(device, VkMeshes[newMesh.name]->instanceBufferMemory);
+
+    instanceUploadTime += ElapsedMilliseconds(start);
+}
+
+
+/**
+ * @brief Get the byte offset of an instance buffer region. Each region can hold all the instances of the scene.
+ * @param region The region index.
+ * @return The byte offset.
+ */
+VkDeviceSize VulkanHelper::GetInstanceRegionOffset(uint32_t region) const {
+    return (VkDeviceSize)region * s72Instance->instanceCount * sizeof(S72Object::MeshInstance);
+}
+
+
+/**
+ * @brief Upload the current view's visible instances of every mesh to the view's instance buffer region.
+ * If an earlier view of the frame culled the same instances, its region is shared instead, so the overlapping views are uploaded once.
+ */
+void VulkanHelper::UploadViewInstances(){
+    for(const auto& mesh : s72Instance->meshes){
+        const std::shared_ptr<VkMesh>& vkMesh = VkMeshes[mesh.second->name];
+        const std::vector<S72Object::MeshInstance>& visible = mesh.second->visibleInstances;
+
+        vkMesh->views.resize(viewCount);
+        VkMesh::ViewInstances& view = vkMesh->views[viewIndex];
+        view.region = viewIndex;
+        view.count = (uint32_t)visible.size();
+
+        if(visible.empty()){
+            continue;
+        }
+
+        /* Only the earlier views that uploaded their own region this frame are compared, a shared region is already listed under its owner. */
+        bool isShared = false;
+        for(uint32_t earlier = 0; earlier < viewIndex && !isShared; earlier++){
+            const VkMesh::ViewInstances& earlierView = vkMesh->views[earlier];
+            if(earlierView.count > 0 && earlierView.region == earlier && IsSameInstances(vkMesh->regionInstances[earlier], visible)){
+                view.region = earlier;
+                isShared = true;
+            }
+        }
+        if(isShared){
+            frameCounters.sharedUploads++;
+            continue;
+        }
+
+        UpdateInstanceBuffer(*mesh.second, visible, view.region);
+
+        /* Keep a copy for the later views to compare with. */
+        if(viewIndex + 1 < viewCount){
+            vkMesh->regionInstances.resize(viewCount);
+            vkMesh->regionInstances[viewIndex] = visible;
+        }
+    }
+}
+
+
+/**
+ * @brief Upload the unculled instances of every mesh to the last instance buffer region, for the shadow passes.
+ * The lights see the instances the cameras culled, so the shadows can not use a view's region,
+ * unless that view kept all the instances of the mesh, e.g. without culling. Its region is shared then.
+ */
+void VulkanHelper::UploadShadowCasterInstances(){
+    size_t meshIndex = 0;
+    for(const auto& mesh : s72Instance->meshes){
+        const std::shared_ptr<VkMesh>& vkMesh = VkMeshes[mesh.second->name];
+        /* The instances captured with the frame, or the live ones, same as the culling. */
+        const std::vector<S72Object::MeshInstance>& instances = frameSnapshot != nullptr ? frameSnapshot->meshInstances[meshIndex++] : mesh.second->instances;
+
+        vkMesh->shadowCasters.region = viewCount;
+        vkMesh->shadowCasters.count = (uint32_t)instances.size();
+        if(instances.empty()){
+            continue;
+        }
+
+        /* The culling only removes instances, so a view with as many instances has all of them. */
+        bool isShared = false;
+        for(const auto& view : vkMesh->views){
+            if(view.count == instances.size()){
+                vkMesh->shadowCasters.region = view.region;
+                isShared = true;
+                break;
+            }
+        }
+        if(isShared){
+            continue;
+        }
+
+        UpdateInstanceBuffer(*mesh.second, instances, viewCount);
+    }
 }
 
 
@@ -1486,11 +1735,13 @@ void VulkanHelper::CreateUniformBuffers()
     /* We use a large uniform buffer to store all mesh instance's ubo data */
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    /* Each view has its own camera, so there is one buffer per view of a frame in flight. */
+    size_t bufferCount = MAX_FRAMES_IN_FLIGHT * viewCount;
+    uniformBuffers.resize(bufferCount);
+    uniformBuffersMemory.resize(bufferCount);
+    uniformBuffersMapped.resize(bufferCount);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < bufferCount; i++) {
         CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
 
         vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
@@ -1508,15 +1759,19 @@ void VulkanHelper::UpdateUniformBuffer(uint32_t currentImage)
     UniformBufferObject ubo{};
 
     //ubo = mesh.instances.at(instanceIndex);
-    ubo.view = currCamera->viewMatrix;
-    ubo.proj = currCamera->projMatrix;;
-    ubo.viewPos = currCamera->cameraPos;
+    const std::shared_ptr<S72Object::Camera>& camera = GetDrawCamera();
+    ubo.view = camera->viewMatrix;
+    ubo.proj = camera->projMatrix;
+    ubo.viewPos = camera->cameraPos;
+    ubo.useSH = useSH ? 1 : 0;
+    ubo.sh = shCoefficients;
 
     /* Flip the Y-Dir */
     ubo.proj.data[1][1] *= -1;
 
     /* Copy the data to the current uniform buffer */
     memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+    frameCounters.bytesUploaded += sizeof(ubo);
 }
 
 
@@ -1549,7 +1804,7 @@ void VulkanHelper::UpdateUniformLightBuffers(uint32_t currentImage){
     uboLights.lightSize = 0;
 
     /* Loop through each S72 Light, also increment the light count. */
-    for(const auto& light : s72Instance->lights){
+    for(const auto& light : GetDrawLights()){
         UniformLight uboLight;
         uboLight.pos = light->pos;
         uboLight.dir = light->dir;
@@ -1574,6 +1829,7 @@ void VulkanHelper::UpdateUniformLightBuffers(uint32_t currentImage){
     }
 
     memcpy(uniformLightBuffersMapped[currentImage], &uboLights, sizeof(uboLights));
+    frameCounters.bytesUploaded += sizeof(uboLights);
 }
 
 
@@ -1616,51 +1872,54 @@ void VulkanHelper::CreateGlobalDescriptorSets(){
 
     /* Describe which descriptor types our descriptor sets are going to contain */
     /* The first is used for the uniform buffer. The second is used for the image sampler */
+    /* One set per view of a frame in flight, the views of a frame share the light ubo and the shadow maps. */
+    auto setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * viewCount);
+
     std::vector<VkDescriptorPoolSize> poolSizes{};
     poolSizes.resize(3);
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[0].descriptorCount = setCount;
 
     /* Used for the light ubo. */
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[1].descriptorCount = setCount;
 
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[2].descriptorCount = max(1, shadowMaps->shadowCount) * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[2].descriptorCount = max(1, shadowMaps->shadowCount) * setCount;
 
     /* Create the pool info for allocation */
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = setCount;
 
     if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &globalDescriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create descriptor pool!");
     }
 
-    /* Create one descriptor set for each frame in flight */
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, globalDescriptorSetLayout);
+    /* Create one descriptor set for each view of each frame in flight */
+    std::vector<VkDescriptorSetLayout> layouts(setCount, globalDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = globalDescriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.descriptorSetCount = setCount;
     allocInfo.pSetLayouts = layouts.data();
 
-    globalDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    globalDescriptorSets.resize(setCount);
     if (vkAllocateDescriptorSets(device, &allocInfo, globalDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate descriptor sets!");
     }
 
     /* Configure each descriptor set */
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < setCount; i++) {
         VkDescriptorBufferInfo uboBufferInfo{};
         uboBufferInfo.buffer = uniformBuffers[i];
         uboBufferInfo.offset = 0;
         uboBufferInfo.range = sizeof(UniformBufferObject);
 
         VkDescriptorBufferInfo uboLightBufferInfo{};
-        uboLightBufferInfo.buffer = uniformLightBuffers[i];
+        uboLightBufferInfo.buffer = uniformLightBuffers[i / viewCount];
         uboLightBufferInfo.offset = 0;
         uboLightBufferInfo.range = sizeof(UniformLights);
 
@@ -1792,12 +2051,13 @@ void VulkanHelper::RenderShadowPass(VkCommandBuffer commandBuffer){
         vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
         std::array<VkVertexInputBindingDescription2EXT,2> newBindingDescription{};
-        std::array<VkVertexInputAttributeDescription2EXT, 9> newAttributeDescription{};
+        std::array<VkVertexInputAttributeDescription2EXT, 10> newAttributeDescription{};
         auto vkCmdSetVertexInputExt = (PFN_vkCmdSetVertexInputEXT)vkGetDeviceProcAddr(device, "vkCmdSetVertexInputEXT");
         auto vkCmdSetPrimitiveTopologyEXT = (PFN_vkCmdSetPrimitiveTopologyEXT)( vkGetDeviceProcAddr( device, "vkCmdSetPrimitiveTopologyEXT" ) );
 
         /* Bind the pipeline. */
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMaps->shadowPipeline);
+        frameCounters.pipelineBinds++;
         vkCmdPushConstants(commandBuffer, shadowMaps->shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(UniformShadowObject), &shadowMaps->USOMatrices[i]);
 
         /* Loop through each material. */
@@ -1807,12 +2067,12 @@ void VulkanHelper::RenderShadowPass(VkCommandBuffer commandBuffer){
                 /* Loop through all the meshes with that material. */
                 for(auto& mesh : material->meshes){
 
-                    /* Update the instance buffer with the new instance data. */
-                    UpdateInstanceBuffer(*mesh);
+                    /* The instances are uploaded before the passes, the shadows are cast by all the instances and not the culled ones. */
+                    const VkMesh::ViewInstances& view = VkMeshes[mesh->name]->shadowCasters;
 
                     /* Bind its vertex buffer and set its info. */
                     VkBuffer newVertexBuffers[] = {  VkMeshes[mesh->name]->vertexBuffer , VkMeshes[mesh->name]->instanceBuffer};
-                    VkDeviceSize offsets[] = { 0, 0 };
+                    VkDeviceSize offsets[] = { 0, GetInstanceRegionOffset(view.region) };
                     vkCmdBindVertexBuffers(commandBuffer, 0, 2, newVertexBuffers, offsets);
 
                     newBindingDescription = CreateBindingDescription(*mesh);
@@ -1822,11 +2082,12 @@ void VulkanHelper::RenderShadowPass(VkCommandBuffer commandBuffer){
                     vkCmdSetPrimitiveTopologyEXT(commandBuffer,mesh->topology);
 
                     /* Draw the mesh. */
+                    frameCounters.draws++;
                     if(mesh->isUseIndex){
-                        vkCmdDrawIndexed(commandBuffer,mesh->indicesCount,(uint32_t)mesh->visibleInstances.size(),0,0,0);
+                        vkCmdDrawIndexed(commandBuffer,mesh->indicesCount,view.count,0,0,0);
                     }
                     else{
-                        vkCmdDraw(commandBuffer, mesh->count, (uint32_t)mesh->visibleInstances.size(), 0, 0);
+                        vkCmdDraw(commandBuffer, mesh->count, view.count, 0, 0);
                     }
                 }
             }
@@ -1838,33 +2099,292 @@ void VulkanHelper::RenderShadowPass(VkCommandBuffer commandBuffer){
 }
 
 
+/**
+ * @brief Create the position-only pipeline for the depth pre-pass.
+ * It reuses the shadow map vertex shader with the camera VP matrices, so the depth matches the shading pipelines.
+ */
+void VulkanHelper::CreateDepthPrepassPipeline(){
+    /* The camera VP matrices are passed the same way as the light VP matrices in the shadow pass. */
+    depthPrepassPushConstant.emplace_back();
+    depthPrepassPushConstant.back().stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    depthPrepassPushConstant.back().offset = 0;
+    depthPrepassPushConstant.back().size = sizeof(UniformShadowObject);
+
+    /* Read the file into a char array */
+    auto vertShaderCode = ReadFile(shadowMaps->shadowVertexFileName);
+
+    /* Create modules for shaders to wrap the file*/
+    VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
+
+    /* Only the vertex stage is needed since we only want the depth. */
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStageInfo.module = vertShaderModule;
+    vertShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo};
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    /* The rasterizer must match the shading pipelines, otherwise the equal depth test will fail. */
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    /* Write the nearest depth, the shading pipelines will only test against it. */
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    /* The render pass has a color attachment, but we do not write to it. */
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = 0;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 0;
+    pipelineLayoutInfo.pSetLayouts = nullptr;
+    pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(depthPrepassPushConstant.size());
+    pipelineLayoutInfo.pPushConstantRanges = depthPrepassPushConstant.data();
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &depthPrepassPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pre-pass pipeline layout!");
+    }
+
+    /* Specify the dynamic states in the pipeline */
+    std::vector<VkDynamicState> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_VERTEX_INPUT_EXT,VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY};
+
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    /* Describe the final pipeline */
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = VK_NULL_HANDLE;    // Vertex Input State is nullptr cuz we do it dynamically.
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = depthPrepassPipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+    pipelineInfo.basePipelineIndex = -1; // Optional
+
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, VK_NULL_HANDLE, &depthPrepassPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pre-pass pipeline!");
+    }
+
+    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+}
+
+
+/**
+ * @brief Cull every mesh's instances against the camera and sort them front-to-back.
+ * The meshes of each material type are also ordered by their nearest visible instance,
+ * so the early depth test can reject the hidden fragments as soon as possible.
+ * In the multi-view mode each view is culled against its own camera and keeps the scene order,
+ * so the views seeing the same instances can share their upload.
+ */
+void VulkanHelper::UpdateVisibleInstances(){
+
+    /* The debug camera keeps culling with the user camera so that we can observe the result. */
+    /* A snapshot already holds its culling camera, the live cameras belong to the simulation thread then. */
+    std::shared_ptr<S72Object::Camera> cullingCamera;
+    if(viewCount > 1){
+        cullingCamera = GetDrawCamera();
+    }
+    else if(frameSnapshot != nullptr){
+        cullingCamera = frameSnapshot->cullingCamera;
+    }
+    else if(currCamera->name == "Debug-Camera"){
+        cullingCamera = s72Instance->cameras["User-Camera"];
+    }
+    else{
+        cullingCamera = currCamera;
+    }
+    const std::string& frameCullingMode = frameSnapshot != nullptr ? frameSnapshot->cullingMode : cullingMode;
+
+    const XZM::vec3& eye = GetDrawCamera()->cameraPos;
+    auto DistanceToEye = [&eye](const S72Object::MeshInstance& instance){
+        XZM::vec3 pos = XZM::ExtractTranslationFromMat(instance.model);
+        float dx = pos.data[0] - eye.data[0];
+        float dy = pos.data[1] - eye.data[1];
+        float dz = pos.data[2] - eye.data[2];
+        return dx * dx + dy * dy + dz * dz;
+    };
+
+    /* The nearest visible instance of each mesh, used to sort the meshes. */
+    std::unordered_map<const S72Object::Mesh*, float> nearestDistance;
+
+    size_t meshIndex = 0;
+    for(auto& mesh : s72Instance->meshes){
+        /* Cull the instances captured with the frame, or the live ones. */
+        const std::vector<S72Object::MeshInstance>& instances = frameSnapshot != nullptr ? frameSnapshot->meshInstances[meshIndex++] : mesh.second->instances;
+        mesh.second->UpdateInstanceWithCulling(instances, cullingCamera, frameCullingMode);
+        frameCounters.visibleInstances += (uint32_t)mesh.second->visibleInstances.size();
+        frameCounters.instances += (uint32_t)instances.size();
+
+        if(viewCount > 1){
+            continue;
+        }
+
+        std::vector<S72Object::MeshInstance>& visible = mesh.second->visibleInstances;
+        std::sort(visible.begin(), visible.end(), [&DistanceToEye](const S72Object::MeshInstance& a, const S72Object::MeshInstance& b){
+            return DistanceToEye(a) < DistanceToEye(b);
+        });
+
+        nearestDistance[mesh.second.get()] = visible.empty() ? (std::numeric_limits<float>::max)() : DistanceToEye(visible.front());
+    }
+
+    if(viewCount > 1){
+        return;
+    }
+
+    /* Sort the meshes of each material type, the material itself is only an index in the instance data. */
+    for(const auto& VkMat : VkMaterials){
+        std::stable_sort(VkMat.first->meshes.begin(), VkMat.first->meshes.end(), [&nearestDistance](const std::shared_ptr<S72Object::Mesh>& a, const std::shared_ptr<S72Object::Mesh>& b){
+            return nearestDistance[a.get()] < nearestDistance[b.get()];
+        });
+    }
+}
+
+
+/**
+ * @brief Get the camera the frame is drawn from: the captured camera when drawing a snapshot, otherwise the current camera.
+ * In the multi-view mode it is the camera of the current view.
+ * @return The camera.
+ */
+const std::shared_ptr<S72Object::Camera>& VulkanHelper::GetDrawCamera(){
+    if(viewCount > 1){
+        return frameSnapshot != nullptr ? frameSnapshot->viewCameras[viewIndex] : viewCameras[viewIndex];
+    }
+    return frameSnapshot != nullptr ? frameSnapshot->camera : currCamera;
+}
+
 
 /**
-* @brief Writes the commands we want to execute into a command buffer.
-* @param[in] commandBuffer: The buffer we are writing to
-* @param[in] imageIndex: The index of the current swap chain image we want to write to
-*/
-void VulkanHelper::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
-{ 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0; // Optional
-    beginInfo.pInheritanceInfo = nullptr; // Optional
+ * @brief Get the lights the frame is drawn with: the captured lights when drawing a snapshot, otherwise the scene lights.
+ * @return The lights.
+ */
+const std::vector<std::shared_ptr<S72Object::Light>>& VulkanHelper::GetDrawLights(){
+    return frameSnapshot != nullptr ? frameSnapshot->lights : s72Instance->lights;
+}
 
-    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to begin recording command buffer!");
+
+/**
+ * @brief Render the depth of every visible instance before the shading pipelines run.
+ * Should be called inside the main render pass after the viewport and scissor are set.
+ * @param commandBuffer The command buffer we are recording to.
+ */
+void VulkanHelper::RenderDepthPrepass(VkCommandBuffer commandBuffer){
+
+    std::array<VkVertexInputBindingDescription2EXT,2> newBindingDescription{};
+    std::array<VkVertexInputAttributeDescription2EXT, 10> newAttributeDescription{};
+    auto vkCmdSetVertexInputExt = (PFN_vkCmdSetVertexInputEXT)vkGetDeviceProcAddr(device, "vkCmdSetVertexInputEXT");
+    auto vkCmdSetPrimitiveTopologyEXT = (PFN_vkCmdSetPrimitiveTopologyEXT)( vkGetDeviceProcAddr( device, "vkCmdSetPrimitiveTopologyEXT" ) );
+
+    /* Use the same VP matrices as the camera uniform buffer, including the Y-flip. */
+    UniformShadowObject cameraMatrices{};
+    cameraMatrices.view = GetDrawCamera()->viewMatrix;
+    cameraMatrices.proj = GetDrawCamera()->projMatrix;
+    cameraMatrices.proj.data[1][1] *= -1;
+
+    /* Bind the pipeline. */
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+    frameCounters.pipelineBinds++;
+    vkCmdPushConstants(commandBuffer, depthPrepassPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(UniformShadowObject), &cameraMatrices);
+
+    /* Follow the same order as the shading pass. */
+    for(const auto& VkMat : VkMaterials){
+        for(auto& mesh : VkMat.first->meshes){
+
+            /* If no instance will be drawn, go to the next mesh. */
+            const VkMesh::ViewInstances& view = VkMeshes[mesh->name]->views[viewIndex];
+            if(view.count == 0){
+                continue;
+            }
+
+            /* Bind its vertex buffer and set its info. */
+            VkBuffer newVertexBuffers[] = {  VkMeshes[mesh->name]->vertexBuffer , VkMeshes[mesh->name]->instanceBuffer};
+            VkDeviceSize offsets[] = { 0, GetInstanceRegionOffset(view.region) };
+            vkCmdBindVertexBuffers(commandBuffer, 0, 2, newVertexBuffers, offsets);
+
+            newBindingDescription = CreateBindingDescription(*mesh);
+            newAttributeDescription = CreateAttributeDescription(*mesh);
+
+            vkCmdSetVertexInputExt(commandBuffer,static_cast<uint32_t>(newBindingDescription.size()),newBindingDescription.data(),static_cast<uint32_t>(newAttributeDescription.size()),newAttributeDescription.data());
+            vkCmdSetPrimitiveTopologyEXT(commandBuffer,mesh->topology);
+
+            /* Draw the mesh. */
+            frameCounters.draws++;
+            if(mesh->isUseIndex){
+                vkCmdDrawIndexed(commandBuffer,mesh->indicesCount,view.count,0,0,0);
+            }
+            else{
+                vkCmdDraw(commandBuffer, mesh->count, view.count, 0, 0);
+            }
+        }
     }
+}
 
-    /* Update the VP matrices before creating the shadow maps. */
-    UpdateShadowMaps();
-    /* Render the shadow passes. */
-    RenderShadowPass(commandBuffers[currentFrame]);
+
+
+/**
+ * @brief Record the main render pass of the current view: the depth pre-pass and the shading pass into the view's own image,
+ * then the readback if the frame is saved. The view's instances must already be uploaded.
+ * @param[in] commandBuffer: The command buffer of the current frame.
+ * @param[in] imageIndex: The index of the current swap chain image, the headless images of all the views share it.
+ */
+void VulkanHelper::RecordViewPass(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    uint32_t framebufferIndex = imageIndex * viewCount + viewIndex;
+    uint32_t viewZone = viewCount > 1 ? BeginGPUZone(commandBuffer, "view_" + GetDrawCamera()->name) : UINT32_MAX;
 
     /* Start the render pass and start drawing */
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];     // Bind the frame buffer with the swap chain image
+    renderPassInfo.framebuffer = swapChainFramebuffers[framebufferIndex];     // Bind the frame buffer with the swap chain image
 
     renderPassInfo.renderArea.offset = { 0, 0 };
     renderPassInfo.renderArea.extent = swapChainExtent;
@@ -1898,23 +2418,36 @@ void VulkanHelper::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t i
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
     std::array<VkVertexInputBindingDescription2EXT,2> newBindingDescription{};
-    std::array<VkVertexInputAttributeDescription2EXT, 9> newAttributeDescription{};
+    std::array<VkVertexInputAttributeDescription2EXT, 10> newAttributeDescription{};
     auto vkCmdSetVertexInputExt = (PFN_vkCmdSetVertexInputEXT)vkGetDeviceProcAddr(device, "vkCmdSetVertexInputEXT");
     auto vkCmdSetPrimitiveTopologyEXT = (PFN_vkCmdSetPrimitiveTopologyEXT)( vkGetDeviceProcAddr( device, "vkCmdSetPrimitiveTopologyEXT" ) );
 
     /* Since the uniform buffer is one for every object, we update it globally. */
-    UpdateUniformBuffer(currentFrame);
-    UpdateUniformLightBuffers(currentFrame);
+    UpdateUniformBuffer(currentFrame * viewCount + viewIndex);
 
-    /* Loop through each material. */
-    for(const auto& VkMat : VkMaterials){
+    /* Lay down the depth first so that the expensive fragment shaders only run on visible pixels. */
+    if(useDepthPrepass){
+        uint32_t prepassZone = BeginGPUZone(commandBuffer, "depth_prepass");
+        RenderDepthPrepass(commandBuffer);
+        EndGPUZone(commandBuffer, prepassZone);
+    }
+
+    /* All the pipelines share the layouts of the global and the material sets, so they are bound only once. */
+    if(!VkMaterials.empty()){
+        VkPipelineLayout sharedLayout = VkMaterials.begin()->first->pipelineLayout;
+        std::array<VkDescriptorSet,2> sharedSets = {globalDescriptorSets[currentFrame * viewCount + viewIndex], materialDescriptorSet};
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, sharedLayout, 0, static_cast<uint32_t>(sharedSets.size()), sharedSets.data(), 0,
+                                nullptr);
+    }
+
+    /* Loop through each material type. */
+    for(const auto& VkMat : VkMaterials){
+
+        uint32_t materialZone = BeginGPUZone(commandBuffer, "material_" + VkMat.first->name);
 
         /* Bind the pipeline. */
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, VkMat.first->pipeline);
-
-        /* Bind global descriptor set. */
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, VkMat.first->pipelineLayout, 0, 1, &globalDescriptorSets[currentFrame], 0,
-                                nullptr);
+        frameCounters.pipelineBinds++;
 
         /* Bind the VkMaterial's descriptor set if exists. (Simple does not have a VkMaterial's descriptor set) */
         if(VkMat.first->VKMDescriptorSetLayout != VK_NULL_HANDLE) {
@@ -1923,59 +2456,140 @@ void VulkanHelper::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t i
                                     nullptr);
         }
 
-        /* Loop through all the material types. */
-        for(const auto& material : VkMat.second){
-            /* Bind material's descriptor set. */
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, VkMat.first->pipelineLayout, 1, 1, &material->MDescriptorSets[currentFrame], 0,
-                                    nullptr);
-
-            /* Loop through all the meshes with that material. */
-            for(auto& mesh : material->meshes){
-                /* Update the visible instance list. */
-                if(currCamera->name == "Debug-Camera"){
-                    mesh->UpdateInstanceWithCulling(s72Instance->cameras["User-Camera"], cullingMode);
-                }
-                else{
-                     mesh->UpdateInstanceWithCulling(currCamera, cullingMode);
-                }
-
-                /* If no instance will be drawn, go to the next mesh. */
-                if(mesh->visibleInstances.empty()){
-                    continue;
-                }
-
-                /* Update the instance buffer with the new instance data. */
-                 UpdateInstanceBuffer(*mesh);
+        /* Loop through all the meshes of that material type, each instance carries its own material index. */
+        for(auto& mesh : VkMat.first->meshes){
+            /* If no instance will be drawn, go to the next mesh. */
+            const VkMesh::ViewInstances& view = VkMeshes[mesh->name]->views[viewIndex];
+            if(view.count == 0){
+                continue;
+            }
 
-                /* Bind its vertex buffer and set its info. */
-                VkBuffer newVertexBuffers[] = {  VkMeshes[mesh->name]->vertexBuffer , VkMeshes[mesh->name]->instanceBuffer};
-                VkDeviceSize offsets[] = { 0, 0 };
-                vkCmdBindVertexBuffers(commandBuffer, 0, 2, newVertexBuffers, offsets);
+            /* Bind its vertex buffer and set its info. */
+            VkBuffer newVertexBuffers[] = {  VkMeshes[mesh->name]->vertexBuffer , VkMeshes[mesh->name]->instanceBuffer};
+            VkDeviceSize offsets[] = { 0, GetInstanceRegionOffset(view.region) };
+            vkCmdBindVertexBuffers(commandBuffer, 0, 2, newVertexBuffers, offsets);
 
-                newBindingDescription = CreateBindingDescription(*mesh);
-                newAttributeDescription = CreateAttributeDescription(*mesh);
+            newBindingDescription = CreateBindingDescription(*mesh);
+            newAttributeDescription = CreateAttributeDescription(*mesh);
 
-                vkCmdSetVertexInputExt(commandBuffer,static_cast<uint32_t>(newBindingDescription.size()),newBindingDescription.data(),static_cast<uint32_t>(newAttributeDescription.size()),newAttributeDescription.data());
-                vkCmdSetPrimitiveTopologyEXT(commandBuffer,mesh->topology);
+            vkCmdSetVertexInputExt(commandBuffer,static_cast<uint32_t>(newBindingDescription.size()),newBindingDescription.data(),static_cast<uint32_t>(newAttributeDescription.size()),newAttributeDescription.data());
+            vkCmdSetPrimitiveTopologyEXT(commandBuffer,mesh->topology);
 
-                /* Draw the mesh. */
-                if(mesh->isUseIndex){
-                    vkCmdDrawIndexed(commandBuffer,mesh->indicesCount,(uint32_t)mesh->visibleInstances.size(),0,0,0);
-                }
-                else{
-                   vkCmdDraw(commandBuffer, mesh->count, (uint32_t)mesh->visibleInstances.size(), 0, 0);
-                }
+            /* Draw the mesh. */
+            frameCounters.draws++;
+            if(mesh->isUseIndex){
+                vkCmdDrawIndexed(commandBuffer,mesh->indicesCount,view.count,0,0,0);
+            }
+            else{
+               vkCmdDraw(commandBuffer, mesh->count, view.count, 0, 0);
             }
         }
+
+        EndGPUZone(commandBuffer, materialZone);
     }
 
     /* End the render pass */
     vkCmdEndRenderPass(commandBuffer);
 
+    /* Copy the image out if this frame is saved. */
+    if(useHeadlessRendering && !readbackFileNames[currentFrame * viewCount + viewIndex].empty()){
+        RecordReadback(commandBuffer, framebufferIndex);
+    }
+
+    EndGPUZone(commandBuffer, viewZone);
+}
+
+
+/**
+* @brief Writes the commands we want to execute into a command buffer.
+* @param[in] commandBuffer: The buffer we are writing to
+* @param[in] imageIndex: The index of the current swap chain image we want to write to
+*/
+void VulkanHelper::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{ 
+    auto recordStart = std::chrono::steady_clock::now();
+    instanceUploadTime = 0;
+    frameCounters = FrameCounters();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0; // Optional
+    beginInfo.pInheritanceInfo = nullptr; // Optional
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording command buffer!");
+    }
+
+    /* The queries are reset outside the render pass before the frame writes them again. */
+    if(!timestampQueryPools.empty()){
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPools[currentFrame], 0, maxTimestampQueries);
+    }
+    if(!statisticsQueryPools.empty()){
+        vkCmdResetQueryPool(commandBuffer, statisticsQueryPools[currentFrame], 0, 1);
+    }
+    uint32_t frameZone = BeginGPUZone(commandBuffer, "frame");
+
+    /* Cull every view and upload its instances before any pass is recorded, the passes only bind the uploaded regions. */
+    double cullingTime = 0;
+    for(viewIndex = 0; viewIndex < viewCount; viewIndex++){
+        auto cullingStart = std::chrono::steady_clock::now();
+        {
+            TraceRecorder::Zone zone(traceRecorder.get(), "culling");
+            UpdateVisibleInstances();
+        }
+        cullingTime += ElapsedMilliseconds(cullingStart);
+
+        UploadViewInstances();
+    }
+    viewIndex = 0;
+    if(frameStats != nullptr){
+        frameStats->AddSample("cpu_culling", cullingTime);
+    }
+    if(shadowMaps->shadowCount > 0){
+        UploadShadowCasterInstances();
+    }
+
+    /* Update the VP matrices before creating the shadow maps. */
+    UpdateShadowMaps();
+    /* The views of a frame share the lights and the shadow maps. */
+    UpdateUniformLightBuffers(currentFrame);
+
+    /* Render the shadow passes. */
+    uint32_t shadowZone = BeginGPUZone(commandBuffer, "shadow");
+    {
+        TraceRecorder::Zone zone(traceRecorder.get(), "shadow_pass_record");
+        RenderShadowPass(commandBuffers[currentFrame]);
+    }
+    EndGPUZone(commandBuffer, shadowZone);
+
+    TraceRecorder::Zone mainPassZone(traceRecorder.get(), "main_pass_record");
+
+    /* Count the fragments shaded by the main passes, the depth pre-pass has no fragment shader so it only shows as fewer invocations. */
+    if(!statisticsQueryPools.empty()){
+        vkCmdBeginQuery(commandBuffer, statisticsQueryPools[currentFrame], 0, 0);
+    }
+
+    /* Draw each view into its own image, one render pass after another in the same command buffer. */
+    for(viewIndex = 0; viewIndex < viewCount; viewIndex++){
+        RecordViewPass(commandBuffer, imageIndex);
+    }
+    viewIndex = 0;
+
+    if(!statisticsQueryPools.empty()){
+        vkCmdEndQuery(commandBuffer, statisticsQueryPools[currentFrame], 0);
+    }
+
+    EndGPUZone(commandBuffer, frameZone);
+
     /* Finish recording the command buffer */
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to record command buffer!");
     }
+
+    if(frameStats != nullptr){
+        frameStats->AddSample("cpu_instance_upload", instanceUploadTime);
+        frameStats->AddSample("cpu_record", ElapsedMilliseconds(recordStart));
+    }
 }
 
 
@@ -2081,9 +2695,9 @@ void VulkanHelper::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t wi
  * @param[in] image: The image we are copying to.
  * @param[in] width: The image's width.
  * @param[in] height: The image's height.
- * @param[in] nChannel: The image's number of channels.
+ * @param[in] texelSize: The image's number of bytes per texel.
  */
-void VulkanHelper::CopyBufferToImageCube(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height,uint32_t nChannel){
+void VulkanHelper::CopyBufferToImageCube(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height,uint32_t texelSize){
     VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
 
     std::vector<VkBufferImageCopy> regions;
@@ -2110,7 +2724,7 @@ void VulkanHelper::CopyBufferToImageCube(VkBuffer buffer, VkImage image, uint32_
                 1
         };
 
-        offset += width * height * nChannel * sizeof(float);
+        offset += width * height * texelSize;
         regions.emplace_back(region);
     }
 
@@ -2201,51 +2815,55 @@ void VulkanHelper::TransitionImageLayout(VkImage image, uint32_t layerCount, VkI
 
 /**
  * @brief Convert a RGBE image to a RGB float image.
+ * The exponent is looked up from a table instead of calling ldexp for every channel,
+ * so the inner loop is only multiplies and can be vectorized by the compiler.
  * @param[in] src The source RGBE image.
  * @param[in] dst The target RGB float image.
- * @param[in] texWidth The image width.
- * @param[in] texHeight The image height.
+ * @param[in] numPixel The number of pixels in the image.
  */
-void VulkanHelper::ProcessRGBEImage(const unsigned char* src, float*& dst, int texWidth, int texHeight){
-
-    int numPixel = texWidth * texHeight;
+void VulkanHelper::ProcessRGBEImage(const unsigned char* src, float* dst, size_t numPixel){
 
-    for(int i = 0; i < numPixel*4; i+=4){
-        auto r = static_cast<float>(src[i]);
-        auto g = static_cast<float>(src[i+1]);
-        auto b = static_cast<float>(src[i+2]);
-        auto e = static_cast<int>(src[i+3]);
-
-        /* If it is 0. */
-        if(r == 0 && g == 0 && b == 0 && e == 0){
-            dst[i] = 0;
-            dst[i+1] = 0;
-            dst[i+2] = 0;
-            dst[i+3] = 1;
-            continue;
+    /* (m + 0.5) / 256 * 2^(e - 128) = (m + 0.5) * 2^(e - 136) */
+    static const std::array<float,256> exponentTable = [](){
+        std::array<float,256> table{};
+        for(int e = 0; e < 256; e++){
+            table[e] = std::ldexp(1.0f, e - 136);
         }
+        return table;
+    }();
 
-        r = (r+0.5f)/256;
-        g = (g+0.5f)/256;
-        b = (b+0.5f)/256;
-        e = e - 128;
+    for(size_t i = 0; i < numPixel * 4; i += 4){
+        /* A zero pixel (Including the zero exponent) is black. */
+        float scale = (src[i+3] == 0) ? 0.0f : exponentTable[src[i+3]];
 
-        dst[i] = ldexp(r,e);
-        dst[i+1] = ldexp(g,e);
-        dst[i+2] = ldexp(b,e);
+        dst[i]   = (static_cast<float>(src[i])   + 0.5f) * scale;
+        dst[i+1] = (static_cast<float>(src[i+1]) + 0.5f) * scale;
+        dst[i+2] = (static_cast<float>(src[i+2]) + 0.5f) * scale;
         dst[i+3] = 1;
     }
 }
 
 
 /**
- * @brief Create a VkImage and VkImageView for a RGBE cube map.
+ * @brief Convert a float image to a half float image.
+ * @param[in] src The source float image.
+ * @param[in] dst The target half float image.
+ * @param[in] count The number of floats in the image.
+ */
+void VulkanHelper::ConvertToHalf(const float* src, uint16_t* dst, size_t count){
+    for(size_t i = 0; i < count; i++){
+        dst[i] = FloatToHalf(src[i]);
+    }
+}
+
+
+/**
+ * @brief Read a RGBE cube map file to a float RGBA image. The faces are stacked vertically.
  * @param[in] filename The input file name.
- * @param[out] image The target VkImage.
- * @param[out] imageMemory  The target VkImage Memory.
- * @param[out] imageView  The target VkImageView.
+ * @param[out] dst The float RGBA image.
+ * @param[out] faceSize The width and height of each face.
  */
-void VulkanHelper::CreateCubeTextureImageAndView(const std::string& filename, VkImage& image, VkDeviceMemory& imageMemory, VkImageView& imageView){
+void VulkanHelper::ReadRGBECube(const std::string& filename, std::vector<float>& dst, int& faceSize){
 
     int texWidth, texHeight, texChannels;
     unsigned char* pixelRGBE = stbi_load(filename.c_str(), &texWidth, &texHeight, &texChannels, 4);
@@ -2254,115 +2872,577 @@ void VulkanHelper::CreateCubeTextureImageAndView(const std::string& filename, Vk
         throw std::runtime_error("failed to load texture image!");
     }
 
-    VkDeviceSize imageSize = texWidth * texHeight * texChannels;
+    size_t numPixel = static_cast<size_t>(texWidth) * texHeight;
+    dst.resize(numPixel * 4);
+    ProcessRGBEImage(pixelRGBE, dst.data(), numPixel);
+    stbi_image_free(pixelRGBE);
+
+    faceSize = texWidth;
+}
+
+
+/**
+ * @brief Create a VkImage and VkImageView for a RGBE cube map.
+ * @param[in] filename The input file name.
+ * @param[out] image The target VkImage.
+ * @param[out] imageMemory  The target VkImage Memory.
+ * @param[out] imageView  The target VkImageView.
+ */
+void VulkanHelper::CreateCubeTextureImageAndView(const std::string& filename, VkImage& image, VkDeviceMemory& imageMemory, VkImageView& imageView){
 
-    /* Allocate memory for the float RGB image. */
-    auto* pixelRBG = new float[imageSize];
     /* Convert to a float RGB image. */
-    ProcessRGBEImage(pixelRGBE,pixelRBG,texWidth,texHeight);
+    std::vector<float> pixelRGB;
+    int faceSize;
+    ReadRGBECube(filename, pixelRGB, faceSize);
 
-    /* Get the height for each face. */
-    texHeight /= 6;
+    /* Pack it as half float. */
+    std::vector<uint16_t> pixelHalf(pixelRGB.size());
+    ConvertToHalf(pixelRGB.data(), pixelHalf.data(), pixelRGB.size());
 
-    uint32_t envMipLevels = static_cast<uint32_t>(std::floor(std::log2(max(texWidth, texHeight)))) + 1;
+    uint32_t envMipLevels = static_cast<uint32_t>(std::floor(std::log2(faceSize))) + 1;
+    VkDeviceSize imageSize = pixelHalf.size() * sizeof(uint16_t);
 
     /* Create a buffer to store the image data */
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
 
-    CreateBuffer(imageSize*sizeof(float), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
     /* Copy the image to the buffer */
     void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize*sizeof(float), 0, &data);
-    memcpy(data, pixelRBG, static_cast<size_t>(imageSize)*sizeof(float));
+    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, pixelHalf.data(), static_cast<size_t>(imageSize));
     vkUnmapMemory(device, stagingBufferMemory);
 
-    stbi_image_free(pixelRGBE);
-    delete[] pixelRBG;
-
-    CreateImage(texWidth, texHeight, envMipLevels, 6,VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+    CreateImage(faceSize, faceSize, envMipLevels, 6,IBL_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
 
     /* Copy the staging buffer to the texture image */
     TransitionImageLayout(image, 6, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, envMipLevels, VK_IMAGE_ASPECT_COLOR_BIT);
-    CopyBufferToImageCube(stagingBuffer, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), static_cast<uint32_t>(texChannels));
+    CopyBufferToImageCube(stagingBuffer, image, static_cast<uint32_t>(faceSize), static_cast<uint32_t>(faceSize), 4 * sizeof(uint16_t));
 
     /* Clear the stage buffer */
     vkDestroyBuffer(device, stagingBuffer, nullptr);
     vkFreeMemory(device, stagingBufferMemory, nullptr);
 
-    GenerateMipmaps(image, VK_FORMAT_R32G32B32A32_SFLOAT, texWidth, texHeight, envMipLevels, 6);
+    GenerateMipmaps(image, IBL_FORMAT, faceSize, faceSize, envMipLevels, 6);
 
     /* Create the image view. */
-    imageView = CreateImageView(image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_VIEW_TYPE_CUBE, VK_IMAGE_ASPECT_COLOR_BIT, envMipLevels, 6);
+    imageView = CreateImageView(image, IBL_FORMAT, VK_IMAGE_VIEW_TYPE_CUBE, VK_IMAGE_ASPECT_COLOR_BIT, envMipLevels, 6);
 }
 
 
 /**
- * @brief Create the VkImage and the VkImageView for pre-compute BRDF LUT.
- * @param[in] The LUT file path and name.
+ * @brief Create a VkImage and VkImageView from a half float cube file (.xzcube) written by the Cubes tool.
+ * The file holds the half float texels of every mip level and face in the order of the copy regions,
+ * so it is read straight into the mapped staging buffer, without any decoding or conversion.
+ * @param[in] filename The cube file name.
+ * @param[in] mipChainLimit The mip chain of the file must stop at this many levels or at 1x1, whichever comes first. 0 for any number of levels.
+ * @param[out] image The target VkImage.
+ * @param[out] imageMemory The target VkImage Memory.
+ * @param[out] imageView The target VkImageView.
+ * @return False if the file does not exist.
  */
-void VulkanHelper::CreateBRDFImageAndView(const std::string& filename){
+bool VulkanHelper::CreateCubeFileImageAndView(const std::string& filename, uint32_t mipChainLimit, VkImage& image, VkDeviceMemory& imageMemory, VkImageView& imageView){
 
-    int texWidth;
-    int texHeight;
-    int texChannel;
-    auto src = stbi_load(filename.c_str(),&texWidth,&texHeight,&texChannel,0);
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if(!file.is_open()){
+        return false;
+    }
+    auto fileSize = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    /* The cube file layout is described in Cubes/Cube.h. */
+    char magic[4];
+    uint32_t header[3];
+    file.read(magic, 4);
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if(!file || memcmp(magic, "XZCB", 4) != 0 || header[2] != 4 || header[1] == 0){
+        throw std::runtime_error("failed to read the cube file " + filename + ", regenerate it with the Cubes tool!");
+    }
+
+    uint32_t faceSize = header[0];
+    uint32_t fileMipLevels = header[1];
+    if(faceSize == 0 || (faceSize >> (fileMipLevels - 1)) == 0){
+        throw std::runtime_error("the cube file " + filename + " has " + std::to_string(fileMipLevels) + " levels, more than its " + std::to_string(faceSize) + " face size can hold!");
+    }
 
-    std::string str_src;
-    str_src.reserve(texWidth*texHeight*4);
+    /* A 64 px face only holds 7 levels, so the expected count depends on the face size. */
+    if(mipChainLimit != 0){
+        uint32_t expectedLevels = 1;
+        while(expectedLevels < mipChainLimit && (faceSize >> expectedLevels) != 0){
+            expectedLevels++;
+        }
+        if(fileMipLevels != expectedLevels){
+            throw std::runtime_error("the cube file " + filename + " has " + std::to_string(fileMipLevels) + " levels, expected " + std::to_string(expectedLevels) + ", regenerate it with the Cubes tool!");
+        }
+    }
 
-    for(auto i = 0; i < texWidth; i++){
-        for(auto j = 0; j < texHeight; j++){
-            str_src.push_back((char)src[i*texHeight*3 + j*3    ]);
-            str_src.push_back((char)src[i*texHeight*3 + j*3 + 1]);
-            str_src.push_back((char)src[i*texHeight*3 + j*3 + 2]);
-            str_src.push_back((char)1);
+    std::vector<VkBufferImageCopy> regions;
+    VkDeviceSize imageSize = 0;
+    for(uint32_t i = 0; i < fileMipLevels; i++){
+        uint32_t levelSize = (std::max)(faceSize >> i, 1u);
+        for(uint32_t face = 0; face < 6; face++){
+            VkBufferImageCopy region{};
+            region.bufferOffset = imageSize;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = i;
+            region.imageSubresource.baseArrayLayer = face;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {levelSize, levelSize, 1};
+            regions.emplace_back(region);
+            imageSize += static_cast<VkDeviceSize>(levelSize) * levelSize * 4 * sizeof(uint16_t);
         }
     }
+    if(fileSize < 4 + sizeof(header) + imageSize){
+        throw std::runtime_error("the cube file " + filename + " is truncated!");
+    }
 
-    CreateTextureImage(str_src,10,10,4,1,pbrBRDFImage,pbrBRDFImageMemory);
-    CreateTextureImageView(pbrBRDFImage,pbrBRDFImageView,4,1);
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    /* The only copy on the CPU, from the file to the staging buffer. */
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+    file.read(static_cast<char*>(data), static_cast<std::streamsize>(imageSize));
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    CreateImage(faceSize, faceSize, fileMipLevels, 6, IBL_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+
+    TransitionImageLayout(image, 6, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, fileMipLevels, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    EndSingleTimeCommands(commandBuffer);
+
+    TransitionImageLayout(image, 6, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, fileMipLevels, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    /* Clear the stage buffer */
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+    imageView = CreateImageView(image, IBL_FORMAT, VK_IMAGE_VIEW_TYPE_CUBE, VK_IMAGE_ASPECT_COLOR_BIT, fileMipLevels, 6);
+    return true;
+}
+
+
+/**
+ * @brief Create the VkImage and the VkImageView for the GGX cube maps.
+ * The base level keeps the size of the source faces and the mip chain is cut at GGX_LEVELS or at 1x1.
+ * The mip level i holds the roughness i / mipLevels, the shader maps the roughness to the lod the same way
+ * and blends between two roughness levels with the trilinear filter.
+ * The cube file from the Cubes tool already holds them that way, otherwise the closest roughness png is resampled to the size of each mip level.
+ */
+void VulkanHelper::CreateGGXImageAndView(){
+
+    if(CreateCubeFileImageAndView(s72Instance->envFileName + "_ggx.xzcube", GGX_LEVELS, pbrTextureImage, pbrTextureImageMemory, pbrTextureImageView)){
+        return;
+    }
+
+    /* A small source keeps its size, it just gets fewer roughness levels. */
+    std::vector<float> level;
+    int faceSize;
+    ReadRGBECube(s72Instance->envFileName + "_ggx_0.png", level, faceSize);
+    uint32_t baseSize = static_cast<uint32_t>(faceSize);
+    uint32_t mipLevels = 1;
+    while(mipLevels < GGX_LEVELS && (baseSize >> mipLevels) != 0){
+        mipLevels++;
+    }
+
+    std::vector<uint16_t> pixelHalf;
+    std::vector<float> resampled;
+    std::vector<VkBufferImageCopy> regions;
+
+    for(uint32_t i = 0; i < mipLevels; i++){
+        /* The png j holds the roughness j / GGX_LEVELS, pick the one closest to the roughness of this mip level. */
+        uint32_t pngLevel = (i * GGX_LEVELS + mipLevels / 2) / mipLevels;
+        if(pngLevel != 0){
+            ReadRGBECube(s72Instance->envFileName + "_ggx_" + std::to_string(pngLevel) + ".png", level, faceSize);
+        }
+
+        uint32_t levelSize = baseSize >> i;
+        resampled.resize(static_cast<size_t>(levelSize) * levelSize * 4);
+
+        for(uint32_t face = 0; face < 6; face++){
+            ResampleFace(level.data() + static_cast<size_t>(face) * faceSize * faceSize * 4, static_cast<uint32_t>(faceSize), resampled.data(), levelSize);
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = pixelHalf.size() * sizeof(uint16_t);
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = i;
+            region.imageSubresource.baseArrayLayer = face;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {levelSize, levelSize, 1};
+            regions.emplace_back(region);
+
+            size_t offset = pixelHalf.size();
+            pixelHalf.resize(offset + resampled.size());
+            ConvertToHalf(resampled.data(), pixelHalf.data() + offset, resampled.size());
+        }
+    }
+
+    VkDeviceSize imageSize = pixelHalf.size() * sizeof(uint16_t);
+
+    /* Create a buffer to store the image data */
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, pixelHalf.data(), static_cast<size_t>(imageSize));
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    CreateImage(baseSize, baseSize, mipLevels, 6, IBL_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pbrTextureImage, pbrTextureImageMemory);
+
+    /* Upload all the levels at once, no mipmap generation since each level is a different roughness. */
+    TransitionImageLayout(pbrTextureImage, 6, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, pbrTextureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    EndSingleTimeCommands(commandBuffer);
+
+    TransitionImageLayout(pbrTextureImage, 6, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    /* Clear the stage buffer */
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+    pbrTextureImageView = CreateImageView(pbrTextureImage, IBL_FORMAT, VK_IMAGE_VIEW_TYPE_CUBE, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 6);
+}
+
+
+/**
+ * @brief Read the half float BRDF LUT written by the Cubes tool, its size is read from the file.
+ * @param[in] filename The .xzlut file path and name.
+ * @param[out] texels The RG halfs, NoV on x and roughness on y.
+ * @param[out] texWidth The LUT width.
+ * @param[out] texHeight The LUT height.
+ * @return False if the file does not exist.
+ */
+bool VulkanHelper::ReadBRDFFile(const std::string& filename, std::vector<uint16_t>& texels, uint32_t& texWidth, uint32_t& texHeight){
+
+    if(!std::ifstream(filename).is_open()){
+        return false;
+    }
+
+    /* The LUT layout is described in Cubes/Cube.h. */
+    std::vector<char> file = ReadFile(filename);
+    uint32_t header[3];
+    if(file.size() < 4 + sizeof(header) || memcmp(file.data(), "XZLT", 4) != 0){
+        throw std::runtime_error("failed to read the BRDF LUT, regenerate it with the Cubes tool!");
+    }
+    memcpy(header, file.data() + 4, sizeof(header));
+
+    texWidth = header[0];
+    texHeight = header[1];
+    size_t texelCount = (size_t)texWidth * texHeight * 2;
+    if(header[2] != 2 || file.size() < 4 + sizeof(header) + texelCount * sizeof(uint16_t)){
+        throw std::runtime_error("the BRDF LUT file is truncated or not two channels!");
+    }
+
+    texels.resize(texelCount);
+    memcpy(texels.data(), file.data() + 4 + sizeof(header), texelCount * sizeof(uint16_t));
+    return true;
+}
+
+
+/**
+ * @brief Read the BRDF LUT from the 8-bit png written by the older Cubes tool.
+ * The png has 1 - roughness on x and NoV on y, it is transposed and flipped into the .xzlut layout
+ * so the shader samples both the same way.
+ * @param[in] filename The png file path and name.
+ * @param[out] texels The RG halfs, NoV on x and roughness on y.
+ * @param[out] texWidth The LUT width.
+ * @param[out] texHeight The LUT height.
+ */
+void VulkanHelper::ReadBRDFPNG(const std::string& filename, std::vector<uint16_t>& texels, uint32_t& texWidth, uint32_t& texHeight){
+
+    int pngWidth;
+    int pngHeight;
+    int pngChannel;
+    stbi_uc* src = stbi_load(filename.c_str(), &pngWidth, &pngHeight, &pngChannel, 3);
+    if(src == nullptr){
+        throw std::runtime_error("failed to read the BRDF LUT " + filename + ", generate it with the Cubes tool!");
+    }
+
+    /* The NoV axis was the png's y, the roughness axis its flipped x. */
+    texWidth = static_cast<uint32_t>(pngHeight);
+    texHeight = static_cast<uint32_t>(pngWidth);
+    texels.resize((size_t)texWidth * texHeight * 2);
+    for(uint32_t y = 0; y < texHeight; y++){
+        for(uint32_t x = 0; x < texWidth; x++){
+            const stbi_uc* pixel = src + ((size_t)x * pngWidth + (pngWidth - 1 - y)) * 3;
+            texels[((size_t)y * texWidth + x) * 2] = FloatToHalf(pixel[0] / 255.0f);
+            texels[((size_t)y * texWidth + x) * 2 + 1] = FloatToHalf(pixel[1] / 255.0f);
+        }
+    }
 
     stbi_image_free(src);
 }
 
 
+/**
+ * @brief Create the VkImage and the VkImageView for pre-compute BRDF LUT.
+ * The LUT is a two channel half float image read from the .xzlut file of the Cubes tool,
+ * the environments which only have the older png LUT fall back to it.
+ */
+void VulkanHelper::CreateBRDFImageAndView(){
+
+    std::vector<uint16_t> texels;
+    uint32_t texWidth;
+    uint32_t texHeight;
+    if(!ReadBRDFFile(s72Instance->envFileName + "_ggx_brdf.xzlut", texels, texWidth, texHeight)){
+        ReadBRDFPNG(s72Instance->envFileName + "_ggx_brdf.png", texels, texWidth, texHeight);
+    }
+    VkDeviceSize imageSize = texels.size() * sizeof(uint16_t);
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, texels.data(), static_cast<size_t>(imageSize));
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    CreateImage(texWidth, texHeight, 1, 1, VK_FORMAT_R16G16_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pbrBRDFImage, pbrBRDFImageMemory);
+
+    TransitionImageLayout(pbrBRDFImage, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, VK_IMAGE_ASPECT_COLOR_BIT);
+    CopyBufferToImage(stagingBuffer, pbrBRDFImage, texWidth, texHeight);
+    TransitionImageLayout(pbrBRDFImage, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    /* Clear the stage buffer */
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+    pbrBRDFImageView = CreateImageView(pbrBRDFImage, VK_FORMAT_R16G16_SFLOAT, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1);
+}
+
+
+/**
+ * @brief Read the SH coefficients of the irradiance, written by the Cubes tool in the SH mode.
+ * @param filename The coefficient file, 9 lines of "r g b".
+ * @return True if all the 9 coefficients are read.
+ */
+bool VulkanHelper::ReadSHCoefficients(const std::string& filename){
+    std::ifstream file(filename);
+    if(!file.is_open()){
+        return false;
+    }
+
+    for(auto& coefficient : shCoefficients){
+        if(!(file >> coefficient[0] >> coefficient[1] >> coefficient[2])){
+            std::cerr << "SH: " << filename << " is incomplete, use the Lambertian map instead." << std::endl;
+            return false;
+        }
+        coefficient[3] = 0;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Hash some bytes with the 64 bits FNV-1a, the same hash the Cubes tool writes in its manifest.
+ * @param data The bytes.
+ * @return The hash as 16 hex digits.
+ */
+static std::string HashManifestSource(const std::vector<char>& data){
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(char byte : data){
+        hash ^= static_cast<unsigned char>(byte);
+        hash *= 0x100000001B3ull;
+    }
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+    return buffer;
+}
+
+
+/**
+ * @brief Get the value of a "name=value" field in a manifest key.
+ * @param key The manifest key.
+ * @param name The field name.
+ * @return The value, empty if the field is missing.
+ */
+static std::string GetManifestField(const std::string& key, const std::string& name){
+    std::istringstream stream(key);
+    std::string field;
+    while(stream >> field){
+        if(field.compare(0, name.size() + 1, name + "=") == 0){
+            return field.substr(name.size() + 1);
+        }
+    }
+    return "";
+}
+
+
+/**
+ * @brief Check the manifest (<env>.xzman) the Cubes tool writes next to the environment.
+ * An output is stale if it has no entry, or its entry was made from a source with another hash.
+ * Stale outputs are regenerated with their recorded settings if the Cubes tool is set, otherwise we only warn.
+ */
+void VulkanHelper::CheckEnvironmentManifest(){
+
+    const std::string& envFileName = s72Instance->envFileName;
+    std::string hash = HashManifestSource(ReadFile(envFileName));
+
+    std::map<std::string,std::string> entries;
+    std::ifstream manifest(envFileName + ".xzman");
+    std::string line;
+    while(std::getline(manifest, line)){
+        size_t tab = line.find('\t');
+        if(tab == std::string::npos) continue;
+        entries[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+    manifest.close();
+
+    /* The manifest names the outputs without their directory. */
+    size_t slash = envFileName.find_last_of("/\\");
+    std::string baseName = (slash == std::string::npos) ? envFileName : envFileName.substr(slash + 1);
+
+    /* If an output was made, it is the one we load. */
+    auto isMade = [&](const std::string& suffix){
+        return entries.count(baseName + suffix) != 0 || std::ifstream(envFileName + suffix).is_open();
+    };
+
+    /* The outputs we load and the Cubes mode producing them. The SH irradiance and the cube files are preferred if they were made. */
+    std::vector<std::pair<std::string,std::string>> outputs;
+    if(isMade("_sh.txt")){
+        outputs.emplace_back(baseName + "_sh.txt", "SH");
+    }
+    else if(isMade("_lam.xzcube")){
+        outputs.emplace_back(baseName + "_lam.xzcube", "Lambertian");
+    }
+    else{
+        outputs.emplace_back(baseName + "_lam.png", "Lambertian");
+    }
+    if(isMade("_ggx.xzcube")){
+        outputs.emplace_back(baseName + "_ggx.xzcube", "GGX");
+    }
+    else{
+        for(uint32_t i = 0; i < GGX_LEVELS; i++){
+            outputs.emplace_back(baseName + "_ggx_" + std::to_string(i) + ".png", "GGX");
+        }
+    }
+    if(isMade("_ggx_brdf.xzlut")){
+        outputs.emplace_back(baseName + "_ggx_brdf.xzlut", "GGX");
+    }
+    else{
+        outputs.emplace_back(baseName + "_ggx_brdf.png", "GGX");
+    }
+
+    /* Collect the modes to run again, with the settings of their old outputs. */
+    std::map<std::string,std::string> staleModes;
+    for(const auto& output : outputs){
+        auto entry = entries.find(output.first);
+        if(entry != entries.end()){
+            std::string sourceHash = GetManifestField(entry->second, "hash");
+            /* Outputs like the BRDF LUT do not depend on the source. */
+            if(sourceHash.empty() || sourceHash == hash) continue;
+        }
+
+        std::cerr << "IBL: " << output.first << " is missing from the manifest or made from an older " << baseName << "." << std::endl;
+        if(staleModes.count(output.second) != 0) continue;
+
+        std::string arguments;
+        if(entry != entries.end()){
+            std::string samples = GetManifestField(entry->second, "samples");
+            std::string size = GetManifestField(entry->second, "size");
+            if(!samples.empty()) arguments += " --sample " + samples;
+            if(!size.empty()) arguments += " --output " + size.substr(0, size.find('x'));
+            if(GetManifestField(entry->second, "filtered") == "0") arguments += " --nofilter";
+        }
+        if((output.second == "GGX" && isMade("_ggx.xzcube")) || (output.second == "Lambertian" && isMade("_lam.xzcube"))){
+            arguments += " --xzcube";
+        }
+        staleModes[output.second] = arguments;
+    }
+
+    if(staleModes.empty()) return;
+
+    /* Keep the LUT size too, so the GGX mode can skip the LUT. */
+    auto brdfEntry = entries.find(baseName + "_ggx_brdf.xzlut");
+    if(staleModes.count("GGX") != 0 && brdfEntry != entries.end()){
+        staleModes["GGX"] += " --brdf " + GetManifestField(brdfEntry->second, "size");
+    }
+
+    if(iblToolPath.empty()){
+        std::cerr << "IBL: The environment outputs are stale, run the Cubes tool again or pass --ibl-tool to regenerate them." << std::endl;
+        return;
+    }
+
+    for(const auto& mode : staleModes){
+        std::string command = "\"" + iblToolPath + "\" --src \"" + envFileName + "\" --mode " + mode.first + mode.second;
+        std::cout << "IBL: Regenerate with " << command << std::endl;
+        if(std::system(command.c_str()) != 0){
+            throw std::runtime_error("failed to regenerate the environment outputs with the Cubes tool!");
+        }
+    }
+}
+
+
 /**
  * @brief Create the environment cube maps.
+ * The irradiance uses the SH coefficients if the Cubes tool wrote them, otherwise the Lambertian cube map.
  */
 void VulkanHelper::CreateEnvironments(){
     if(s72Instance == nullptr || s72Instance->envFileName.empty()){
         throw std::runtime_error("failed to get the environment cube map info from s72!");
     }
 
+    /* Make sure the pre-computed outputs belong to the current environment before loading them. */
+    CheckEnvironmentManifest();
+
     /* Create the environment map. */
     CreateCubeTextureImageAndView(s72Instance->envFileName, envTextureImage,envTextureImageMemory,envTextureImageView);
 
-    /* Create the lambertian map. */
-    std::string lamFileName = s72Instance->envFileName + "_lam.png";
-    CreateCubeTextureImageAndView(lamFileName,lamTextureImage,lamTextureImageMemory,lamTextureImageView);
+    /* Create the irradiance, from the SH coefficients or the lambertian map. */
+    useSH = ReadSHCoefficients(s72Instance->envFileName + "_sh.txt");
+    if(!useSH && !CreateCubeFileImageAndView(s72Instance->envFileName + "_lam.xzcube", 0, lamTextureImage, lamTextureImageMemory, lamTextureImageView)){
+        std::string lamFileName = s72Instance->envFileName + "_lam.png";
+        CreateCubeTextureImageAndView(lamFileName,lamTextureImage,lamTextureImageMemory,lamTextureImageView);
+    }
 
     /* Create the ggx map. */
-    pbrTextureImage.resize(GGX_LEVELS);
-    pbrTextureImageMemory.resize(GGX_LEVELS);
-    pbrTextureImageView.resize(GGX_LEVELS);
-    for(int i = 0; i < GGX_LEVELS; i++){
-        std::string ggxFileName = s72Instance->envFileName + "_ggx_" + std::to_string(i) + ".png";
-        CreateCubeTextureImageAndView(ggxFileName,pbrTextureImage[i],pbrTextureImageMemory[i],pbrTextureImageView[i]);
-    }
+    CreateGGXImageAndView();
 
-    std::string brdfFileName = s72Instance->envFileName + "_ggx_brdf.png";
-    CreateBRDFImageAndView(brdfFileName);
+    /* Create the BRDF LUT. */
+    CreateBRDFImageAndView();
 
 }
 
 
 /**
  * @brief Create a list of VkMaterials based on the data from the s72Instance.
+ * The textures of all the materials go into one bindless descriptor set, so a material is only an index in the instance data.
  */
 void VulkanHelper::CreateMaterials(){
 
+    /* Upload the textures of every material and give each material an index in the material buffer. */
+    materialParameters.clear();
+    for(auto& materialTypes : s72Instance->materials){
+        for(const auto& material : materialTypes.second){
+            CreateMaterialImageView(material.second);
+
+            /* Stamp the index on the meshes, the instances copy it when they are rebuilt. */
+            for(auto& mesh : material.second->meshes){
+                mesh->materialIndex = material.second->materialIndex;
+                for(auto& instance : mesh->instances){
+                    instance.material = mesh->materialIndex;
+                }
+            }
+        }
+    }
+
+    CreateMaterialDescriptorSet();
+
+    /* The shaders do not read the irradiance map with SH, but the binding still needs a valid view. */
+    VkImageView irradianceView = useSH ? envTextureImageView : lamTextureImageView;
+
     for(auto& materialTypes : s72Instance->materials){
 
         /* Create the descriptor set layout for each material. */
@@ -2385,7 +3465,7 @@ void VulkanHelper::CreateMaterials(){
             Vk_lam->name = "lambertian";
             Vk_lam->CreateDescriptorSetLayout(device);
             Vk_lam->CreateDescriptorPool(device);
-            Vk_lam->CreateDescriptorSets(device,textureSampler,lamTextureImageView);
+            Vk_lam->CreateDescriptorSets(device,textureSampler,irradianceView);
             newVkMaterial = std::dynamic_pointer_cast<VkMaterial>(Vk_lam);
         }
         else if(materialTypes.first == S72Object::EMaterial::pbr){
@@ -2393,42 +3473,17 @@ void VulkanHelper::CreateMaterials(){
             Vk_pbr->name = "pbr";
             Vk_pbr->CreateDescriptorSetLayout(device);
             Vk_pbr->CreateDescriptorPool(device);
-            Vk_pbr->CreateDescriptorSets(device,textureSampler,lamTextureImageView,pbrTextureImageView,pbrBRDFImageView);
+            Vk_pbr->CreateDescriptorSets(device,textureSampler,irradianceView,pbrTextureImageView,pbrBRDFImageView);
             newVkMaterial = std::dynamic_pointer_cast<VkMaterial>(Vk_pbr);
         }
 
         std::vector<std::shared_ptr<S72Object::Material>> mats;
         mats.reserve(materialTypes.second.size());
 
-        /* For each material for that type, create its descriptor sets. */
+        /* The meshes of all the materials of this type are drawn together. */
         for(const auto& material : materialTypes.second){
-            CreateMaterialImageView(material.second);
-            if(materialTypes.first == S72Object::EMaterial::simple){
-                auto material_sim = std::dynamic_pointer_cast<S72Object::Material_Simple>(material.second);
-                material_sim->CreateDescriptorSetLayout(device);
-                material_sim->CreateDescriptorPool(device);
-                material_sim->CreateDescriptorSets(device,textureSampler);
-            }
-            else if(materialTypes.first == S72Object::EMaterial::environment || materialTypes.first == S72Object::EMaterial::mirror){
-                auto material_env = std::dynamic_pointer_cast<S72Object::Material_EnvMirror>(material.second);
-                material_env->CreateDescriptorSetLayout(device);;
-                material_env->CreateDescriptorPool(device);
-                material_env->CreateDescriptorSets(device,textureSampler);
-            }
-            else if(materialTypes.first == S72Object::EMaterial::lambertian){
-                auto material_lam = std::dynamic_pointer_cast<S72Object::Material_Lambertian>(material.second);
-                material_lam->CreateDescriptorSetLayout(device);
-                material_lam->CreateDescriptorPool(device);
-                material_lam->CreateDescriptorSets(device,textureSampler);
-            }
-            else if(materialTypes.first == S72Object::EMaterial::pbr){
-                auto material_pbr = std::dynamic_pointer_cast<S72Object::Material_PBR>(material.second);
-                material_pbr->CreateDescriptorSetLayout(device);
-                material_pbr->CreateDescriptorPool(device);
-                material_pbr->CreateDescriptorSets(device,textureSampler);
-            }
-
             mats.emplace_back(material.second);
+            newVkMaterial->meshes.insert(newVkMaterial->meshes.end(), material.second->meshes.begin(), material.second->meshes.end());
         }
         VkMaterials.insert(std::make_pair(newVkMaterial,mats));
 
@@ -2439,13 +3494,19 @@ void VulkanHelper::CreateMaterials(){
         /* Form a container of descriptor set layouts for creating the pipeline. */
         std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
         descriptorSetLayouts.emplace_back(globalDescriptorSetLayout);
-        descriptorSetLayouts.emplace_back(VkMaterials[newVkMaterial][0]->MDescriptorSetLayout);
+        descriptorSetLayouts.emplace_back(materialDescriptorSetLayout);
         if(newVkMaterial->VKMDescriptorSetLayout != VK_NULL_HANDLE){
             descriptorSetLayouts.emplace_back(newVkMaterial->VKMDescriptorSetLayout);
         }
 
         CreateGraphicsPipeline(renderPass, vertexShader, fragShader,descriptorSetLayouts,std::vector<VkPushConstantRange>(), newVkMaterial->pipeline,newVkMaterial->pipelineLayout);
     }
+
+    std::cout << "Texture cache: " << S72Object::Material::textureCache.size() << " files decoded, " << S72Object::Material::textureCacheHits << " reads reused, "
+              << materialTextures.size() << " images uploaded, " << materialTextureHits << " images reused." << std::endl;
+
+    /* The decoded files are on the GPU now. */
+    S72Object::Material::textureCache.clear();
 }
 
 
@@ -2524,41 +3585,288 @@ void VulkanHelper::CreateTextureImageView(const VkImage& textureImage, VkImageVi
 }
 
 
-/**
- * @brief Given A S72 Material, Create its VkImage and VkImageView.
- * @param sMaterial The S72 Material.
- */
-void VulkanHelper::CreateMaterialImageView(const std::shared_ptr<S72Object::Material>& sMaterial){
+/**
+ * @brief Given A S72 Material, Create its VkImage and VkImageView, and its entry in the material buffer.
+ * @param sMaterial The S72 Material.
+ */
+void VulkanHelper::CreateMaterialImageView(const std::shared_ptr<S72Object::Material>& sMaterial){
+
+    MaterialParameters parameters{};
+
+    /* Create the texture for the normal. */
+    parameters.normal = CreateMaterialTexture(sMaterial->normalMapKey,*sMaterial->normalMap, sMaterial->normalMapWidth, sMaterial->normalMapHeight, sMaterial->normalMapChannel, sMaterial->normalMipLevels, sMaterial->normalMapFormat, sMaterial->normalImage, sMaterial->normalImageMemory, sMaterial->normalImageView);
+
+    /* Create the texture for the height. */
+    parameters.height = CreateMaterialTexture(sMaterial->heightMapKey,*sMaterial->heightMap,sMaterial->heightMapWidth,sMaterial->heightMapHeight, sMaterial->heightMapChannel,sMaterial->heightMapMipLevels, sMaterial->heightMapFormat, sMaterial->heightImage,sMaterial->heightImageMemory,sMaterial->heightImageView);
+
+    if(sMaterial->type == S72Object::EMaterial::lambertian){
+        auto sMaterial_lam = std::dynamic_pointer_cast<S72Object::Material_Lambertian>(sMaterial);
+        /* Create the texture for the albedo. */
+        parameters.albedo = CreateMaterialTexture(sMaterial_lam->albedoKey,*sMaterial_lam->albedo,sMaterial_lam->albedoWidth,sMaterial_lam->albedoHeight, sMaterial_lam->albedoChannel,sMaterial_lam->albedoMipLevels, sMaterial_lam->albedoFormat, sMaterial_lam->albedoImage,sMaterial_lam->albedoImageMemory,sMaterial_lam->albedoImageView);
+    }
+    else if(sMaterial->type == S72Object::EMaterial::pbr){
+        auto sMaterial_pbr = std::dynamic_pointer_cast<S72Object::Material_PBR>(sMaterial);
+        /* Create the texture for the albedo. */
+        parameters.albedo = CreateMaterialTexture(sMaterial_pbr->albedoKey,*sMaterial_pbr->albedo,sMaterial_pbr->albedoWidth,sMaterial_pbr->albedoHeight,sMaterial_pbr->albedoChannel,sMaterial_pbr->albedoMipLevels, sMaterial_pbr->albedoFormat, sMaterial_pbr->albedoImage,sMaterial_pbr->albedoImageMemory,sMaterial_pbr->albedoImageView);
+
+        /* Create the texture for the roughness. */
+        parameters.roughness = CreateMaterialTexture(sMaterial_pbr->roughnessKey,*sMaterial_pbr->roughness,sMaterial_pbr->roughnessWidth,sMaterial_pbr->roughnessHeight, 1,sMaterial_pbr->roughnessMipLevels, sMaterial_pbr->roughnessFormat, sMaterial_pbr->roughnessImage,sMaterial_pbr->roughnessImageMemory,sMaterial_pbr->roughnessImageView);
+
+        /* Create the texture for the metallic. */
+        parameters.metallic = CreateMaterialTexture(sMaterial_pbr->metallicKey,*sMaterial_pbr->metallic,sMaterial_pbr->metallicWidth,sMaterial_pbr->metallicHeight, 1,sMaterial_pbr->metallicMipLevels, sMaterial_pbr->metallicFormat, sMaterial_pbr->metallicImage,sMaterial_pbr->metallicImageMemory,sMaterial_pbr->metallicImageView);
+    }
+
+    sMaterial->materialIndex = static_cast<uint32_t>(materialParameters.size());
+    materialParameters.emplace_back(parameters);
+}
+
+
+/**
+ * @brief Create a material texture's image and view.
+ * The raw 8-bit textures generate their mipmaps on the GPU, the block compressed ones already have them.
+ * A texture already uploaded with the same key is reused instead, it is owned by the cache and not the material.
+ * @param key The cache key of the texture.
+ * @param src The texture data.
+ * @param texWidth The texture width.
+ * @param texHeight The texture height.
+ * @param nChannels The number of channels of the raw texture.
+ * @param mipLevels The number of mip levels.
+ * @param format The block compressed format, or undefined for a raw texture.
+ * @param textureImage The created image.
+ * @param textureImageMemory The memory bound to the image.
+ * @param textureImageView The created image view.
+ * @return The index of the texture in the bindless texture array.
+ */
+uint32_t VulkanHelper::CreateMaterialTexture(const std::string& key, const std::string& src, int texWidth, int texHeight, int nChannels, uint32_t mipLevels, VkFormat format, VkImage& textureImage, VkDeviceMemory& textureImageMemory, VkImageView& textureImageView){
+
+    /* The same file can be viewed with a different number of channels (e.g. roughness and metallic). */
+    std::string viewKey = key + "#" + std::to_string(nChannels);
+
+    auto cached = materialTextures.find(viewKey);
+    if(cached != materialTextures.end()){
+        textureImage = cached->second.image;
+        textureImageMemory = cached->second.memory;
+        textureImageView = cached->second.view;
+        materialTextureHits++;
+        return cached->second.index;
+    }
+
+    if(format == VK_FORMAT_UNDEFINED){
+        CreateTextureImage(src, texWidth, texHeight, nChannels, mipLevels, textureImage, textureImageMemory);
+        CreateTextureImageView(textureImage, textureImageView, nChannels, mipLevels);
+    }
+    else{
+        CreateCompressedTextureImage(src, texWidth, texHeight, format, mipLevels, textureImage, textureImageMemory);
+        textureImageView = CreateImageView(textureImage, format, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 1);
+    }
+
+    MaterialTexture texture;
+    texture.image = textureImage;
+    texture.memory = textureImageMemory;
+    texture.view = textureImageView;
+    texture.index = static_cast<uint32_t>(materialTextures.size());
+    materialTextures.insert(std::make_pair(viewKey, texture));
+
+    return texture.index;
+}
+
+
+/**
+ * @brief Create the bindless descriptor set with all the material textures and the material buffer.
+ * Binding 0 is the array of all the material textures, binding 1 is the material buffer which maps a material index to its texture indices.
+ * The set is bound once per frame, the shaders pick the textures with the material index of the instance.
+ */
+void VulkanHelper::CreateMaterialDescriptorSet(){
+
+    /* Upload the material buffer. */
+    if(materialParameters.empty()){
+        materialParameters.emplace_back();
+    }
+    VkDeviceSize bufferSize = sizeof(MaterialParameters) * materialParameters.size();
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+    memcpy(data, materialParameters.data(), (size_t)bufferSize);
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialBuffer, materialBufferMemory);
+    CopyBuffer(stagingBuffer, materialBuffer, bufferSize);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+    /* The texture array in the order of their indices. */
+    std::vector<VkDescriptorImageInfo> textureInfo(materialTextures.size());
+    for(const auto& texture : materialTextures){
+        textureInfo[texture.second.index].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        textureInfo[texture.second.index].imageView = texture.second.view;
+        textureInfo[texture.second.index].sampler = textureSampler;
+    }
+    uint32_t textureCount = (std::max)(static_cast<uint32_t>(textureInfo.size()), 1u);
+
+    std::array<VkDescriptorSetLayoutBinding,2> bindings{};
+
+    /* Set the material texture array */
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = textureCount;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].pImmutableSamplers = nullptr;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    /* Set the material buffer */
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].pImmutableSamplers = nullptr;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    /* A scene without any material texture still needs one element, which is never written. */
+    std::array<VkDescriptorBindingFlags,2> bindingFlags = {VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT, 0};
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+    bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &materialDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+
+    std::array<VkDescriptorPoolSize,2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = textureCount;
+
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &materialDescriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    /* The content never changes, so one set is shared by all the frames in flight. */
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = materialDescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &materialDescriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, &materialDescriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+
+    VkDescriptorBufferInfo materialBufferInfo{};
+    materialBufferInfo.buffer = materialBuffer;
+    materialBufferInfo.offset = 0;
+    materialBufferInfo.range = bufferSize;
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites{};
+
+    if(!textureInfo.empty()){
+        descriptorWrites.emplace_back();
+        descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites.back().dstSet = materialDescriptorSet;
+        descriptorWrites.back().dstBinding = 0;
+        descriptorWrites.back().dstArrayElement = 0;
+        descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites.back().descriptorCount = static_cast<uint32_t>(textureInfo.size());
+        descriptorWrites.back().pImageInfo = textureInfo.data();
+    }
+
+    descriptorWrites.emplace_back();
+    descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites.back().dstSet = materialDescriptorSet;
+    descriptorWrites.back().dstBinding = 1;
+    descriptorWrites.back().dstArrayElement = 0;
+    descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites.back().descriptorCount = 1;
+    descriptorWrites.back().pBufferInfo = &materialBufferInfo;
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+
+/**
+ * @brief Create the texture image with a block compressed texture.
+ * All the mip levels are uploaded with one copy, so there is no blit on the GPU.
+ * @param src The packed blocks of all the mip levels, from the largest to the smallest.
+ * @param texWidth The texture width.
+ * @param texHeight The texture height.
+ * @param format The block compressed format.
+ * @param mipLevels The number of mip levels in src.
+ * @param textureImage The created image.
+ * @param textureImageMemory The memory bound to the image.
+ */
+void VulkanHelper::CreateCompressedTextureImage(const std::string& src, int texWidth, int texHeight, VkFormat format, uint32_t mipLevels, VkImage& textureImage, VkDeviceMemory& textureImageMemory){
+
+    if(!supportBCTexture){
+        throw std::runtime_error("The device does not support the BC compressed textures!");
+    }
+
+    VkDeviceSize imageSize = src.size();
+
+    /* Create a buffer to store the image data */
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, src.data(), static_cast<size_t>(imageSize));
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    CreateImage(texWidth, texHeight, mipLevels, 1, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
 
-    /* Create the texture for the normal. */
-    CreateTextureImage(sMaterial->normalMap, sMaterial->normalMapWidth, sMaterial->normalMapHeight, sMaterial->normalMapChannel, sMaterial->normalMipLevels, sMaterial->normalImage, sMaterial->normalImageMemory);
-    CreateTextureImageView(sMaterial->normalImage, sMaterial->normalImageView, sMaterial->normalMapChannel, sMaterial->normalMipLevels);
+    /* One copy region for each mip level. */
+    ECompressedFormat blockFormat = ECompressedFormat::BC1;
+    if(format == VK_FORMAT_BC3_UNORM_BLOCK) blockFormat = ECompressedFormat::BC3;
+    else if(format == VK_FORMAT_BC4_UNORM_BLOCK) blockFormat = ECompressedFormat::BC4;
 
-    /* Create the texture for the height. */
-    CreateTextureImage(sMaterial->heightMap,sMaterial->heightMapWidth,sMaterial->heightMapHeight, sMaterial->heightMapChannel,sMaterial->heightMapMipLevels, sMaterial->heightImage,sMaterial->heightImageMemory);
-    CreateTextureImageView(sMaterial->heightImage,sMaterial->heightImageView, sMaterial->heightMapChannel,sMaterial->heightMapMipLevels);
+    std::vector<VkBufferImageCopy> regions(mipLevels);
+    VkDeviceSize offset = 0;
+    for(uint32_t level = 0; level < mipLevels; level++){
+        uint32_t levelWidth = (std::max)(static_cast<uint32_t>(texWidth) >> level, 1u);
+        uint32_t levelHeight = (std::max)(static_cast<uint32_t>(texHeight) >> level, 1u);
 
-    if(sMaterial->type == S72Object::EMaterial::lambertian){
-        auto sMaterial_lam = std::dynamic_pointer_cast<S72Object::Material_Lambertian>(sMaterial);
-        /* Create the texture for the albedo. */
-        CreateTextureImage(sMaterial_lam->albedo,sMaterial_lam->albedoWidth,sMaterial_lam->albedoHeight, sMaterial_lam->albedoChannel,sMaterial_lam->albedoMipLevels, sMaterial_lam->albedoImage,sMaterial_lam->albedoImageMemory);
-        CreateTextureImageView(sMaterial_lam->albedoImage,sMaterial_lam->albedoImageView, sMaterial_lam->albedoChannel,sMaterial_lam->albedoMipLevels);
+        regions[level].bufferOffset = offset;
+        regions[level].bufferRowLength = 0;
+        regions[level].bufferImageHeight = 0;
+        regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[level].imageSubresource.mipLevel = level;
+        regions[level].imageSubresource.baseArrayLayer = 0;
+        regions[level].imageSubresource.layerCount = 1;
+        regions[level].imageOffset = { 0, 0, 0 };
+        regions[level].imageExtent = { levelWidth, levelHeight, 1 };
 
+        offset += TextureCompressor::GetLevelSize(blockFormat, levelWidth, levelHeight);
     }
-    else if(sMaterial->type == S72Object::EMaterial::pbr){
-        auto sMaterial_pbr = std::dynamic_pointer_cast<S72Object::Material_PBR>(sMaterial);
-        /* Create the texture for the albedo. */
-        CreateTextureImage(sMaterial_pbr->albedo,sMaterial_pbr->albedoWidth,sMaterial_pbr->albedoHeight,sMaterial_pbr->albedoChannel,sMaterial_pbr->albedoMipLevels, sMaterial_pbr->albedoImage,sMaterial_pbr->albedoImageMemory);
-        CreateTextureImageView(sMaterial_pbr->albedoImage,sMaterial_pbr->albedoImageView, sMaterial_pbr->albedoChannel,sMaterial_pbr->albedoMipLevels);
 
-        /* Create the texture for the roughness. */
-        CreateTextureImage(sMaterial_pbr->roughness,sMaterial_pbr->roughnessWidth,sMaterial_pbr->roughnessHeight, 1,sMaterial_pbr->roughnessMipLevels, sMaterial_pbr->roughnessImage,sMaterial_pbr->roughnessImageMemory);
-        CreateTextureImageView(sMaterial_pbr->roughnessImage,sMaterial_pbr->roughnessImageView, 1,sMaterial_pbr->roughnessMipLevels);
+    TransitionImageLayout(textureImage, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels,VK_IMAGE_ASPECT_COLOR_BIT);
 
-        /* Create the texture for the metallic. */
-        CreateTextureImage(sMaterial_pbr->metallic,sMaterial_pbr->metallicWidth,sMaterial_pbr->metallicHeight, 1,sMaterial_pbr->metallicMipLevels, sMaterial_pbr->metallicImage,sMaterial_pbr->metallicImageMemory);
-        CreateTextureImageView(sMaterial_pbr->metallicImage,sMaterial_pbr->metallicImageView, 1,sMaterial_pbr->metallicMipLevels);
-    }
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    EndSingleTimeCommands(commandBuffer);
+
+    TransitionImageLayout(textureImage, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels,VK_IMAGE_ASPECT_COLOR_BIT);
+
+    /* Clear the stage buffer */
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
 }
 
 
@@ -2703,110 +4011,333 @@ void VulkanHelper::CreateDepthResources()
 
 
 /**
- * @brief Copy a VKImage to data through a staging buffer.
- * @param image The image we want to copy.
- * @param imageMemory The memory allocated for the image.
- * @param data The data we copied to.
+ * @brief Create the persistent buffers the saved frames are read back to, one per frame in flight.
+ * Cached memory is preferred since the CPU reads the whole frame back.
  */
-void VulkanHelper::CopyImageToData(const VkImage& image, const VkDeviceMemory& imageMemory, void*& data, uint32_t imageWidth, uint32_t imageHeight){
-
-    VkMemoryRequirements oldMemoryRequirements;
-    vkGetImageMemoryRequirements(device, image, &oldMemoryRequirements);
-
-    /* Allocate staging buffer */
-    VkBufferCreateInfo bufferCreateInfo = {};
-    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size = oldMemoryRequirements.size;
-    bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+void VulkanHelper::CreateReadbackBuffers()
+{
+    VkDeviceSize bufferSize = (VkDeviceSize)windowWidth * windowHeight * 4;
+
+    /* Each view of a frame in flight is read back to its own buffer. */
+    size_t bufferCount = MAX_FRAMES_IN_FLIGHT * viewCount;
+    readbackBuffers.resize(bufferCount);
+    readbackBuffersMemory.resize(bufferCount);
+    readbackBuffersMapped.resize(bufferCount);
+    readbackFileNames.resize(bufferCount);
+
+    for (size_t i = 0; i < bufferCount; i++) {
+        try{
+            CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, readbackBuffers[i], readbackBuffersMemory[i]);
+        }
+        catch(const std::runtime_error&){
+            /* No cached memory type on this device. */
+            if(readbackBuffers[i] != VK_NULL_HANDLE){
+                vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+                readbackBuffers[i] = VK_NULL_HANDLE;
+            }
+            CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffers[i], readbackBuffersMemory[i]);
+        }
 
-    VkBuffer stagingBuffer;
-    vkCreateBuffer(device, &bufferCreateInfo, nullptr, &stagingBuffer);
+        vkMapMemory(device, readbackBuffersMemory[i], 0, bufferSize, 0, &readbackBuffersMapped[i]);
+    }
 
-    /* Allocate memory for staging buffer. */
-    VkMemoryRequirements memoryRequirements;
-    vkGetBufferMemoryRequirements(device, stagingBuffer, &memoryRequirements);
+    frameWriter = std::make_unique<FrameWriter>();
+}
 
-    VkMemoryAllocateInfo allocateInfo = {};
-    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize = memoryRequirements.size;
-    allocateInfo.memoryTypeIndex = FindMemoryType(memoryRequirements.memoryTypeBits,VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 
-    VkDeviceMemory stagingBufferMemory;
-    vkAllocateMemory(device, &allocateInfo, nullptr, &stagingBufferMemory);
-    vkBindBufferMemory(device, stagingBuffer, stagingBufferMemory, 0);
+/**
+ * @brief Record the copy of the rendered image to the readback buffer of the current frame and view.
+ * The copy runs in the frame's own command buffer, so the frame's fence tells when the data is ready.
+ * @param[in] commandBuffer: The command buffer of the current frame, after the render pass.
+ * @param[in] imageIndex: The index of the rendered headless image.
+ */
+void VulkanHelper::RecordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    VkBuffer readbackBuffer = readbackBuffers[currentFrame * viewCount + viewIndex];
+
+    /* The render pass leaves the image in the transfer source layout, wait for the color writes before copying. */
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = swapChainImages[imageIndex];
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
 
-    /* Copy data from image to staging buffer */
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
     VkBufferImageCopy copyRegion = {};
     copyRegion.bufferOffset = 0;
-    copyRegion.bufferRowLength = imageWidth;
-    copyRegion.bufferImageHeight = imageHeight;
-    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    copyRegion.bufferRowLength = windowWidth;
+    copyRegion.bufferImageHeight = windowHeight;
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     copyRegion.imageSubresource.mipLevel = 0;
     copyRegion.imageSubresource.baseArrayLayer = 0;
     copyRegion.imageSubresource.layerCount = 1;
     copyRegion.imageOffset = {0, 0, 0};
     copyRegion.imageExtent = {
-            imageWidth,
-            imageHeight,
+            windowWidth,
+            windowHeight,
             1
     };
 
-    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stagingBuffer, 1, &copyRegion);
+    vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &copyRegion);
 
-    /* Transition image layout back if needed */
-    vkMapMemory(device, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    /* Make the copy visible to the host once the fence is signaled. */
+    VkBufferMemoryBarrier bufferBarrier{};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = readbackBuffer;
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = VK_WHOLE_SIZE;
 
-    EndSingleTimeCommands(commandBuffer);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+}
 
-    vkUnmapMemory(device, stagingBufferMemory);
 
-    /* Clean up */
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
+/**
+ * @brief Hand the read back data of every view of a finished frame to the frame writer.
+ * The caller must have waited for the frame's fence.
+ * @param[in] frameIndex: The index of the frame in flight.
+ */
+void VulkanHelper::CollectReadback(uint32_t frameIndex)
+{
+    for(uint32_t view = 0; view < viewCount; view++){
+        uint32_t index = frameIndex * viewCount + view;
+        if(readbackFileNames[index].empty()){
+            continue;
+        }
+
+        /* Copy out of the mapped buffer so it can be reused by the next frame right away. */
+        size_t bufferSize = (size_t)windowWidth * windowHeight * 4;
+        std::vector<unsigned char> pixels(bufferSize);
+        memcpy(pixels.data(), readbackBuffersMapped[index], bufferSize);
+
+        frameWriter->Push(readbackFileNames[index], windowWidth, windowHeight, std::move(pixels));
+        readbackFileNames[index].clear();
+    }
+}
+
+
+/**
+ * @brief Get the file a view of a saved frame is written to. In the multi-view mode the camera name is added before the extension,
+ * e.g. "frame.png" is saved as "frame.Camera-1.png".
+ * @param fileName The file the frame is saved to, empty if it is not saved.
+ * @param view The view index.
+ * @return The file of the view, empty if the frame is not saved.
+ */
+std::string VulkanHelper::GetViewFileName(const std::string& fileName, uint32_t view) const {
+    if(fileName.empty() || viewCameras.empty()){
+        return fileName;
+    }
+
+    size_t dot = fileName.find_last_of('.');
+    size_t slash = fileName.find_last_of("/\\");
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)){
+        return fileName + "." + viewCameras[view]->name;
+    }
+    return fileName.substr(0, dot) + "." + viewCameras[view]->name + fileName.substr(dot);
+}
+
+
+/**
+ * @brief Create the timestamp query pools, one per frame in flight, used to time the GPU stages.
+ * Nothing is created if the graphics queue does not support timestamps, the GPU stages are then not reported.
+ */
+void VulkanHelper::CreateTimestampQueryPools()
+{
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t graphicsFamily = FindQueueFamilies(physicalDevice).graphicsFamily.value();
+    if(queueFamilies[graphicsFamily].timestampValidBits == 0){
+        std::cout << "The graphics queue does not support timestamps, the GPU stages are not measured." << std::endl;
+        return;
+    }
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = maxTimestampQueries;
+
+    timestampQueryPools.resize(MAX_FRAMES_IN_FLIGHT);
+    timestampLabels.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPools[i]) != VK_SUCCESS){
+            throw std::runtime_error("failed to create the timestamp query pool!");
+        }
+    }
+}
+
+
+/**
+ * @brief Write the timestamp starting a GPU zone in the current frame.
+ * @param[in] commandBuffer: The command buffer of the current frame.
+ * @param[in] label: The zone name, reported as "gpu_<label>". Zones with the same label are added up in a frame.
+ * @return The zone index to end it with, or UINT32_MAX if the zone is not measured.
+ */
+uint32_t VulkanHelper::BeginGPUZone(VkCommandBuffer commandBuffer, const std::string& label)
+{
+    if(timestampQueryPools.empty()){
+        return UINT32_MAX;
+    }
+
+    std::vector<std::string>& labels = timestampLabels[currentFrame];
+    if((labels.size() + 1) * 2 > maxTimestampQueries){
+        return UINT32_MAX;
+    }
+
+    auto zone = (uint32_t)labels.size();
+    labels.emplace_back(label);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPools[currentFrame], zone * 2);
+    return zone;
+}
+
+
+/**
+ * @brief Write the timestamp ending a GPU zone, once all the work recorded before it is done.
+ * @param[in] commandBuffer: The command buffer of the current frame.
+ * @param[in] zone: The index returned by BeginGPUZone.
+ */
+void VulkanHelper::EndGPUZone(VkCommandBuffer commandBuffer, uint32_t zone)
+{
+    if(zone == UINT32_MAX){
+        return;
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPools[currentFrame], zone * 2 + 1);
+}
+
+
+/**
+ * @brief Read the timestamps of a finished frame into the frame stats and the trace.
+ * The GPU clock is not calibrated against the CPU clock, so the trace places the frame's zones from the time it was submitted.
+ * The caller must have waited for the frame's fence.
+ * @param[in] frameIndex: The index of the frame in flight.
+ */
+void VulkanHelper::CollectTimestamps(uint32_t frameIndex)
+{
+    if(timestampQueryPools.empty() || timestampLabels[frameIndex].empty()){
+        return;
+    }
+
+    std::vector<std::string>& labels = timestampLabels[frameIndex];
+    std::vector<uint64_t> timestamps(labels.size() * 2);
+    vkGetQueryPoolResults(device, timestampQueryPools[frameIndex], 0, (uint32_t)timestamps.size(), timestamps.size() * sizeof(uint64_t),
+                          timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+    /* Add up the zones with the same label, keep the order they are written. */
+    std::vector<std::pair<std::string,double>> zoneTimes;
+    for(size_t i = 0; i < labels.size(); i++){
+        double milliseconds = (double)(timestamps[i * 2 + 1] - timestamps[i * 2]) * timestampPeriod / 1000000.0;
+        if(traceRecorder != nullptr){
+            double offset = (double)(timestamps[i * 2] - timestamps[0]) * timestampPeriod / 1000.0;
+            traceRecorder->AddGPUZone("gpu_" + labels[i], submitTimes[frameIndex] + offset, milliseconds * 1000.0);
+        }
+        auto iter = std::find_if(zoneTimes.begin(), zoneTimes.end(), [&](const auto& zone){ return zone.first == labels[i]; });
+        if(iter == zoneTimes.end()){
+            zoneTimes.emplace_back(labels[i], milliseconds);
+        }
+        else{
+            iter->second += milliseconds;
+        }
+    }
+
+    if(frameStats != nullptr){
+        for(const auto& zone : zoneTimes){
+            frameStats->AddSample("gpu_" + zone.first, zone.second);
+        }
+    }
+    labels.clear();
 }
 
 
 /**
- * @brief Save an image to a PPM file.
- * @param image The image we want to save.
- * @param imageMemory The memory allocated for the image.
- * @param filename The target PPM file name.
+ * @brief Create one pipeline statistics query pool per frame in flight, counting the fragment shader invocations.
+ * Comparing the count with and without the depth pre-pass shows how much overdraw it removes.
  */
-void VulkanHelper::SaveImageToPPM(const VkImage& image, const VkDeviceMemory& imageMemory,  const std::string& filename, uint32_t imageWidth, uint32_t imageHeight){
-    /* Map image memory */
-    void *mappedMemory;
-    /* Read pixel data from image */
-    CopyImageToData(image,imageMemory,mappedMemory, imageWidth,imageHeight);
+void VulkanHelper::CreateStatisticsQueryPools()
+{
+    if(!supportPipelineStatistics){
+        std::cout << "The device does not support the pipeline statistics, the shaded fragments are not counted." << std::endl;
+        return;
+    }
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    queryPoolInfo.queryCount = 1;
+    queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    statisticsQueryPools.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &statisticsQueryPools[i]) != VK_SUCCESS){
+            throw std::runtime_error("failed to create the pipeline statistics query pool!");
+        }
+    }
+}
+
+
+/**
+ * @brief Read the fragment shader invocations of a finished frame into the frame stats, as "fragment_invocations".
+ * The caller must have waited for the frame's fence. Nothing is read if the frame has not been drawn yet.
+ * @param[in] frameIndex: The index of the frame in flight.
+ */
+void VulkanHelper::CollectStatistics(uint32_t frameIndex)
+{
+    if(statisticsQueryPools.empty() || frameStats == nullptr){
+        return;
+    }
 
-    /* Write pixel data to PPM file */
-    std::ofstream ppmFile(filename, std::ios::binary);
-    if (!ppmFile.is_open()) {
-        throw std::runtime_error("Failed to open PPM file for writing.");
+    /* Without the wait bit, a query that was never written is reported as not ready instead of blocking. */
+    uint64_t invocations = 0;
+    VkResult result = vkGetQueryPoolResults(device, statisticsQueryPools[frameIndex], 0, 1, sizeof(uint64_t), &invocations, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if(result == VK_SUCCESS){
+        frameStats->AddCounter("fragment_invocations", (double)invocations);
     }
+}
 
-    /* Write PPM header */
-    ppmFile << "P6\n";
-    ppmFile << imageWidth << " " << imageHeight << "\n";
-    ppmFile << "255\n";
 
-    /* Write pixel data */
-    auto *row = reinterpret_cast<unsigned int*>(mappedMemory);
-    uint32_t y = 0;
-    uint32_t x = 0;
+/**
+ * @brief Write the counters of the recorded frame to the trace: the draws, the pipeline binds, the uploaded bytes
+ * and the visible instances, in total and for each mesh.
+ */
+void VulkanHelper::RecordFrameCounters()
+{
+    if(traceRecorder == nullptr){
+        return;
+    }
 
-    for (; y < imageWidth; y++){
-        for (x = 0; x < imageHeight; x++){
-            /* We want to avoid writing the alpha data. */
-            ppmFile.write((char*)row,1);
-            ppmFile.write((char*)row,1);
-            ppmFile.write((char*)row,1);
-            row++;
+    traceRecorder->SetCounter("draws", frameCounters.draws);
+    traceRecorder->SetCounter("pipeline_binds", frameCounters.pipelineBinds);
+    traceRecorder->SetCounter("bytes_uploaded", (double)frameCounters.bytesUploaded);
+    traceRecorder->SetCounter("visible_instances", frameCounters.visibleInstances);
+    traceRecorder->SetCounter("instances", frameCounters.instances);
+    traceRecorder->SetCounter("shared_uploads", frameCounters.sharedUploads);
+    for(const auto& mesh : s72Instance->meshes){
+        /* Summed over the views in the multi-view mode. */
+        uint32_t visible = 0;
+        for(const auto& view : VkMeshes[mesh.second->name]->views){
+            visible += view.count;
         }
+        traceRecorder->SetCounter("visible/" + mesh.first, visible);
     }
-    /* Close file and unmap memory */
-    ppmFile.close();
+    traceRecorder->EndFrame();
 }
 
 
@@ -2859,7 +4390,8 @@ void VulkanHelper::RecreateSwapChain()
         }
     }
     else {
-        glfwGetFramebufferSize(window, &width, &height);
+        width = framebufferWidth;
+        height = framebufferHeight;
     }
 
     while (width == 0 || height == 0) {
@@ -2867,8 +4399,15 @@ void VulkanHelper::RecreateSwapChain()
             // TODO:
         }
         else {
-            glfwGetFramebufferSize(window, &width, &height);
-            glfwWaitEvents();
+            /* Only the window thread can wait for the window events, the render thread waits for the callback to change the size. */
+            if(useRenderThread){
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            else{
+                glfwWaitEvents();
+            }
+            width = framebufferWidth;
+            height = framebufferHeight;
         }
     }
 
@@ -3027,6 +4566,19 @@ void VulkanHelper::InitVulkan()
     CreateGlobalDescriptorSets();
 
     CreateMaterials();
+    if(useDepthPrepass){
+        CreateDepthPrepassPipeline();
+    }
+    if(useHeadlessRendering){
+        CreateReadbackBuffers();
+    }
+    if(frameStats != nullptr || traceRecorder != nullptr){
+        CreateTimestampQueryPools();
+    }
+    if(frameStats != nullptr){
+        CreateStatisticsQueryPools();
+    }
+    submitTimes.resize(MAX_FRAMES_IN_FLIGHT);
     commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
     CreateCommandBuffers(commandPool,commandBuffers);
     CreateSyncObjects();
@@ -3059,7 +4611,7 @@ void VulkanHelper::InitShadowMaps(){
  */
 void VulkanHelper::UpdateShadowMaps(){
     shadowMaps->USOMatrices.clear();
-    for(const auto& light : s72Instance->lights){
+    for(const auto& light : GetDrawLights()){
         /* Only process if it is a spotlight. */
         if(light->type != 2) continue;
         shadowMaps->SetViewAndProjectionMatrix(*light);
@@ -3149,20 +4701,121 @@ void VulkanHelper::SetHeadlessMode(bool isUseHeadless){
 
 
 /**
- * @brief Save the rendered result to a PPM file.
- * @param filename The target PPM's file name.
+ * @brief Select the cameras drawn in every frame. Each camera is drawn into its own image in the same command buffer,
+ * and a saved frame is written once per camera, with the camera name added before the file extension.
+ * Only the off-screen rendering has an image per camera, the window keeps drawing the current camera.
+ * @param cameraList "all" for every camera of the scene, or a comma separated list of camera names.
  */
-void VulkanHelper::SaveRenderResult(const std::string& filename){
+void VulkanHelper::SetMultiView(const std::string& cameraList){
+
+    if(s72Instance == nullptr){
+        throw std::runtime_error("Vulkan initialization error: s72Instance is null");
+    }
+
     if(!useHeadlessRendering){
-        std::cout << "Cannot save a render image in a on window mode" << std::endl;
+        std::cout << "The multi-view mode needs the off-screen rendering, only the current camera is drawn" << std::endl;
+        return;
+    }
+
+    viewCameras.clear();
+    if(cameraList == "all"){
+        for(const auto& camera : s72Instance->cameras){
+            viewCameras.emplace_back(camera.second);
+        }
+    }
+    else{
+        size_t begin = 0;
+        while(begin <= cameraList.size()){
+            size_t end = cameraList.find(',', begin);
+            if(end == std::string::npos){
+                end = cameraList.size();
+            }
+
+            std::string cameraName = cameraList.substr(begin, end - begin);
+            if(!cameraName.empty()){
+                if(!s72Instance->cameras.count(cameraName)){
+                    throw std::runtime_error("Cannot find the multi-view camera: " + cameraName);
+                }
+                viewCameras.emplace_back(s72Instance->cameras[cameraName]);
+            }
+            begin = end + 1;
+        }
+    }
+
+    viewCount = (std::max)((uint32_t)viewCameras.size(), (uint32_t)1);
+    if(viewCameras.size() < 2){
+        /* A single view is drawn the same way as the current camera. */
+        if(!viewCameras.empty()){
+            currCamera = viewCameras.front();
+        }
+        viewCameras.clear();
+    }
+}
+
+
+/**
+ * @brief Select if we render a depth pre-pass before the shading pipelines.
+ * @param isUseDepthPrepass True if we want to use the depth pre-pass.
+ */
+void VulkanHelper::SetDepthPrepass(bool isUseDepthPrepass){
+    this->useDepthPrepass = isUseDepthPrepass;
+}
+
+
+/**
+ * @brief Set the path of the Cubes tool. Stale environment outputs are regenerated with it when the scene is loaded.
+ * @param path The Cubes executable path.
+ */
+void VulkanHelper::SetIBLTool(const std::string& path){
+    this->iblToolPath = path;
+}
+
+
+/**
+ * @brief Set where the stage timings are collected. The GPU stages are timed with timestamp queries.
+ * Need to be called before the initialization, so the query pools are created.
+ * @param stats The frame stats, nullptr to measure nothing.
+ */
+void VulkanHelper::SetFrameStats(const std::shared_ptr<FrameStats>& stats){
+    this->frameStats = stats;
+}
+
+
+/**
+ * @brief Set where the CPU and GPU zones and the frame counters are traced. The GPU zones are timed with timestamp queries.
+ * Need to be called before the initialization, so the query pools are created.
+ * @param recorder The trace recorder, nullptr to trace nothing.
+ */
+void VulkanHelper::SetTraceRecorder(const std::shared_ptr<TraceRecorder>& recorder){
+    this->traceRecorder = recorder;
+}
+
+
+/**
+ * @brief Wait for all the frames in flight to finish and collect their GPU timings.
+ */
+void VulkanHelper::FinishFrames(){
+    vkDeviceWaitIdle(device);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        CollectTimestamps(i);
+        CollectStatistics(i);
     }
+}
+
 
-    size_t imageIndex = headlessImageIndex - 1;
-    if(headlessImageIndex == 0){
-        imageIndex = headlessImageMemory.size()-1;
+/**
+ * @brief Save the next drawn image to a file, PPM, PNG or PFM depending on its extension.
+ * The image is read back when its frame is reused or at clean up, and written on a background thread.
+ * @param filename The target file name.
+ */
+void VulkanHelper::SaveNextFrame(const std::string& filename){
+    if(!useHeadlessRendering){
+        std::cout << "Cannot save a render image in a on window mode" << std::endl;
+        return;
     }
 
-    SaveImageToPPM(swapChainImages[imageIndex], headlessImageMemory[imageIndex], filename,windowWidth,windowHeight);
+    nextSaveFileName = filename;
 }
 
 
@@ -3247,16 +4900,26 @@ void VulkanHelper::ProcessGLFWInputCallBack(char key){
 */
 void VulkanHelper::DrawFrame()
 {
-
+    TraceRecorder::Zone frameZone(traceRecorder.get(), "draw_frame");
 
     /* Wait until the previous frame has finished */
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    auto waitStart = std::chrono::steady_clock::now();
+    {
+        TraceRecorder::Zone zone(traceRecorder.get(), "fence_wait");
+        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    }
+    if(frameStats != nullptr){
+        frameStats->AddSample("cpu_fence_wait", ElapsedMilliseconds(waitStart));
+    }
+    CollectTimestamps(currentFrame);
+    CollectStatistics(currentFrame);
 
     /* Acquire an image from the swap chain, may need to recreate the swap chain if the image is outdated */
     uint32_t imageIndex;
     VkResult result;
 
     if(!useHeadlessRendering) {
+        TraceRecorder::Zone zone(traceRecorder.get(), "acquire");
         result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
                                                 VK_NULL_HANDLE, &imageIndex);
         if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -3267,8 +4930,18 @@ void VulkanHelper::DrawFrame()
         }
     }
     else{
+        /* The image index picks the images of all the views, the view is added when the framebuffer is chosen. */
         imageIndex = headlessImageIndex;
-        headlessImageIndex = (headlessImageIndex + 1) % headlessImageMemory.size();
+        headlessImageIndex = (headlessImageIndex + 1) % (headlessImageMemory.size() / viewCount);
+    }
+
+    /* The frame's previous work is done, its readback buffers can be written out and reused. */
+    if(useHeadlessRendering){
+        CollectReadback(currentFrame);
+        for(uint32_t view = 0; view < viewCount; view++){
+            readbackFileNames[currentFrame * viewCount + view] = GetViewFileName(nextSaveFileName, view);
+        }
+        nextSaveFileName.clear();
     }
 
     /* Reset the fence after wait. Only reset the fence if we are submitting work */
@@ -3308,9 +4981,16 @@ void VulkanHelper::DrawFrame()
     }
 
     /* Submit the command buffer */
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit draw command buffer!");
+    {
+        TraceRecorder::Zone zone(traceRecorder.get(), "submit");
+        if(traceRecorder != nullptr){
+            submitTimes[currentFrame] = traceRecorder->Now();
+        }
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit draw command buffer!");
+        }
     }
+    RecordFrameCounters();
 
     if(useHeadlessRendering){
         /* Update the current frame to the next frame index */
@@ -3332,7 +5012,10 @@ void VulkanHelper::DrawFrame()
 
     /* Use the present info result to present the image! */
     presentInfo.pResults = nullptr; // Optional
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    {
+        TraceRecorder::Zone zone(traceRecorder.get(), "present");
+        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
         framebufferResized = false;
@@ -3347,6 +5030,59 @@ void VulkanHelper::DrawFrame()
 }
 
 
+/**
+ * @brief Capture the scene state the next frame is drawn from: the cameras, the culling mode, the mesh instances and the lights.
+ * Called on the simulation thread after the scene update. The snapshot's vectors are reused, so a captured frame does not allocate.
+ * @param snapshot The snapshot to capture into.
+ */
+void VulkanHelper::CaptureSnapshot(FrameSnapshot& snapshot){
+
+    *snapshot.camera = *currCamera;
+    if(currCamera->name == "Debug-Camera"){
+        *snapshot.cullingCamera = *s72Instance->cameras["User-Camera"];
+    }
+    else{
+        *snapshot.cullingCamera = *currCamera;
+    }
+    snapshot.cullingMode = cullingMode;
+
+    while(snapshot.viewCameras.size() < viewCameras.size()){
+        snapshot.viewCameras.emplace_back(std::make_shared<S72Object::Camera>());
+    }
+    snapshot.viewCameras.resize(viewCameras.size());
+    for(size_t i = 0; i < viewCameras.size(); i++){
+        *snapshot.viewCameras[i] = *viewCameras[i];
+    }
+
+    snapshot.meshInstances.resize(s72Instance->meshes.size());
+    size_t meshIndex = 0;
+    for(const auto& mesh : s72Instance->meshes){
+        snapshot.meshInstances[meshIndex++] = mesh.second->instances;
+    }
+
+    while(snapshot.lights.size() < s72Instance->lights.size()){
+        snapshot.lights.emplace_back(std::make_shared<S72Object::Light>());
+    }
+    snapshot.lights.resize(s72Instance->lights.size());
+    for(size_t i = 0; i < s72Instance->lights.size(); i++){
+        *snapshot.lights[i] = *s72Instance->lights[i];
+    }
+
+    snapshot.captureTime = std::chrono::steady_clock::now();
+}
+
+
+/**
+ * @brief Draw a frame from a captured scene state, on the render thread.
+ * @param snapshot The snapshot captured by CaptureSnapshot.
+ */
+void VulkanHelper::DrawSnapshot(const std::shared_ptr<FrameSnapshot>& snapshot){
+    frameSnapshot = snapshot;
+    DrawFrame();
+    frameSnapshot = nullptr;
+}
+
+
 /**
 * @brief CleanUp used for destroy the instance and related destruction.
 */
@@ -3355,6 +5091,18 @@ void VulkanHelper::CleanUp()
     /* Wait for the logical device to finish operations before exiting mainLoop and destroying the window */
     vkDeviceWaitIdle(device);
 
+    /* Write out the frames still sitting in the readback buffers. */
+    if(useHeadlessRendering){
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            CollectReadback(i);
+        }
+        for (size_t i = 0; i < readbackBuffers.size(); i++) {
+            vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+            vkFreeMemory(device, readbackBuffersMemory[i], nullptr);
+        }
+        frameWriter->Flush();
+    }
+
     if (enableValidationLayers) {
         DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
     }
@@ -3369,13 +5117,23 @@ void VulkanHelper::CleanUp()
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < uniformBuffers.size(); i++) {
         vkDestroyBuffer(device, uniformBuffers[i], nullptr);
         vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+    }
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroyBuffer(device, uniformLightBuffers[i], nullptr);
         vkFreeMemory(device, uniformLightBuffersMemory[i], nullptr);
     }
 
+    for(auto& queryPool : timestampQueryPools){
+        vkDestroyQueryPool(device, queryPool, nullptr);
+    }
+    for(auto& queryPool : statisticsQueryPools){
+        vkDestroyQueryPool(device, queryPool, nullptr);
+    }
+
     vkDestroyDescriptorPool(device, globalDescriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, globalDescriptorSetLayout, nullptr);
 
@@ -3391,11 +5149,9 @@ void VulkanHelper::CleanUp()
     vkDestroyImage(device, lamTextureImage, nullptr);
     vkFreeMemory(device, lamTextureImageMemory, nullptr);
 
-    for(auto i = 0; i < GGX_LEVELS; i++){
-        vkDestroyImageView(device, pbrTextureImageView[i], nullptr);
-        vkDestroyImage(device, pbrTextureImage[i], nullptr);
-        vkFreeMemory(device, pbrTextureImageMemory[i], nullptr);
-    }
+    vkDestroyImageView(device, pbrTextureImageView, nullptr);
+    vkDestroyImage(device, pbrTextureImage, nullptr);
+    vkFreeMemory(device, pbrTextureImageMemory, nullptr);
 
     vkDestroyImageView(device, pbrBRDFImageView, nullptr);
     vkDestroyImage(device, pbrBRDFImage, nullptr);
@@ -3404,14 +5160,29 @@ void VulkanHelper::CleanUp()
     vkDestroySampler(device, textureSampler, nullptr);
 
     for(auto& materialType : VkMaterials){
-        /* Clean the material's data. */
-        for(auto& material : materialType.second){
-            material->CleanUp(device);
-        }
         /* Clean the material types' data. */
         materialType.first->CleanUp(device);
     }
 
+    /* The material textures are shared, so they are freed here instead of in the materials. */
+    for(auto& texture : materialTextures){
+        vkDestroyImageView(device, texture.second.view, nullptr);
+        vkDestroyImage(device, texture.second.image, nullptr);
+        vkFreeMemory(device, texture.second.memory, nullptr);
+    }
+    materialTextures.clear();
+
+    vkDestroyDescriptorPool(device, materialDescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, materialDescriptorSetLayout, nullptr);
+
+    vkDestroyBuffer(device, materialBuffer, nullptr);
+    vkFreeMemory(device, materialBufferMemory, nullptr);
+
+    if(useDepthPrepass){
+        vkDestroyPipeline(device, depthPrepassPipeline, nullptr);
+        vkDestroyPipelineLayout(device, depthPrepassPipelineLayout, nullptr);
+    }
+
     vkDestroyRenderPass(device, renderPass, nullptr);
 
     vkDestroyCommandPool(device, commandPool, nullptr);     // Command buffer will be freed when the pool is freed
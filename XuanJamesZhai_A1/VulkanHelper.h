@@ -26,13 +26,21 @@
 #include <array>
 #include <chrono>
 #include <unordered_map>
+#include <map>
+#include <sstream>
 #include <cmath>
+#include <atomic>
 
 #include "S72Helper.h"
 #include "EventHelper.h"
 #include "VkMaterial.h"
 #include "VkMesh.h"
 #include "VkShadowMaps.h"
+#include "TextureCompressor.h"
+#include "FrameWriter.h"
+#include "FrameStats.h"
+#include "TraceRecorder.h"
+#include "FrameQueue.h"
 
 
 
@@ -52,6 +60,9 @@ const std::unordered_map<S72Object::EMaterial, std::array<std::string,2>> shader
 /* The number of PBR environment maps. */
 const int GGX_LEVELS = 10;
 
+/* The format of the environment cube maps. Half float keeps the HDR range with a quarter of the RGBA32F memory. */
+const VkFormat IBL_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
 /* How many frames should be processed concurrently */
 const int MAX_FRAMES_IN_FLIGHT = 3;
 
@@ -81,6 +92,10 @@ struct UniformBufferObject {
     alignas(64) XZM::mat4 view;
     alignas(64) XZM::mat4 proj;
     alignas(64) XZM::vec3 viewPos;
+    /* 1 if the irradiance comes from the SH coefficients instead of the Lambertian cube map. */
+    alignas(4) uint32_t useSH = 0;
+    /* The 9 SH coefficients of the irradiance, RGB in xyz. */
+    alignas(16) std::array<std::array<float,4>,9> sh{};
 };
 
 
@@ -110,6 +125,24 @@ struct UniformLights {
     alignas(16) std::array<UniformLight,MAX_NUM_LIGHTS> lights;
 };
 
+/* A material texture on the GPU, shared by all the materials that use it. */
+struct MaterialTexture {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    /* The index in the bindless texture array. */
+    uint32_t index = 0;
+};
+
+/* The texture indices of a material, stored in the material storage buffer. */
+struct MaterialParameters {
+    alignas(4) uint32_t normal = 0;
+    alignas(4) uint32_t height = 0;
+    alignas(4) uint32_t albedo = 0;
+    alignas(4) uint32_t roughness = 0;
+    alignas(4) uint32_t metallic = 0;
+};
+
 
 /* ===================================================================================== */
 
@@ -147,6 +180,12 @@ private:
     /* Vulkan logical device handle */
     VkDevice device = VK_NULL_HANDLE;
 
+    /* If the physical device can sample the BC compressed textures. */
+    bool supportBCTexture = false;
+
+    /* If the device can count the shader invocations with the pipeline statistics queries. */
+    bool supportPipelineStatistics = false;
+
     /* Handles for graphics queue */
     VkQueue graphicsQueue = VK_NULL_HANDLE;
 
@@ -191,8 +230,15 @@ private:
     /* keep track of the current frame in flight */
     uint32_t currentFrame = 0;
 
-    /* Used to handle the explicit window resize event */
-    bool framebufferResized = false;
+    /* Used to handle the explicit window resize event. Set by the window callback, read by the thread drawing the frames. */
+    std::atomic<bool> framebufferResized{false};
+
+    /* The frame buffer size given by the window callback, so the render thread does not need to ask the window. */
+    std::atomic<int> framebufferWidth{0};
+    std::atomic<int> framebufferHeight{0};
+
+    /* Set if the frames are drawn on a render thread instead of the thread owning the window. */
+    bool useRenderThread = false;
 
     /* A map of VkMeshes hold all the vertex info in the GPU. */
     std::unordered_map<std::string,std::shared_ptr<VkMesh>> VkMeshes;
@@ -202,6 +248,21 @@ private:
     VkDescriptorPool globalDescriptorPool = VK_NULL_HANDLE;
     std::vector<VkDescriptorSet> globalDescriptorSets;
 
+    /* The material textures, keyed by their resolved path (Or value) and format. */
+    std::unordered_map<std::string,MaterialTexture> materialTextures;
+    /* The number of material textures reused from the cache. */
+    uint32_t materialTextureHits = 0;
+
+    /* The bindless material descriptor set, all the material textures and the material buffer. */
+    VkDescriptorSetLayout materialDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool materialDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet materialDescriptorSet = VK_NULL_HANDLE;
+
+    /* The parameters of every material, indexed by the material index of the instance. */
+    std::vector<MaterialParameters> materialParameters;
+    VkBuffer materialBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory materialBufferMemory = VK_NULL_HANDLE;
+
     /* Buffer that contains camera UBO data */
     std::vector<VkBuffer> uniformBuffers;
     std::vector<VkDeviceMemory> uniformBuffersMemory;
@@ -223,15 +284,24 @@ private:
     VkDeviceMemory envTextureImageMemory = VK_NULL_HANDLE;
     VkImageView envTextureImageView = VK_NULL_HANDLE;
 
+    /* If the irradiance is evaluated from the SH coefficients, the Lambertian map is not loaded then. */
+    bool useSH = false;
+
+    /* The path of the Cubes tool, run to regenerate the stale environment outputs. Empty means only a warning. */
+    std::string iblToolPath;
+
+    /* The 9 SH coefficients of the irradiance from the Cubes tool. */
+    std::array<std::array<float,4>,9> shCoefficients{};
+
     /* Data for the lambertian environment map. */
     VkImage lamTextureImage = VK_NULL_HANDLE;
     VkDeviceMemory lamTextureImageMemory = VK_NULL_HANDLE;
     VkImageView lamTextureImageView = VK_NULL_HANDLE;
 
-    /* Data for the pre-compute PBR environment map. */
-    std::vector<VkImage> pbrTextureImage; 
-    std::vector<VkDeviceMemory> pbrTextureImageMemory;
-    std::vector<VkImageView> pbrTextureImageView;
+    /* Data for the pre-compute PBR environment map. Each roughness level is stored as a mip level of one cube. */
+    VkImage pbrTextureImage = VK_NULL_HANDLE;
+    VkDeviceMemory pbrTextureImageMemory = VK_NULL_HANDLE;
+    VkImageView pbrTextureImageView = VK_NULL_HANDLE;
 
     /* Data for pre-compute BRDF. */
     VkImage pbrBRDFImage;
@@ -259,6 +329,18 @@ private:
     /* The culling mode used for rendering. Can be none or frustum. */
     std::string cullingMode;
 
+    /* The scene state of the frame being drawn, nullptr if the frame is drawn from the live scene. */
+    std::shared_ptr<FrameSnapshot> frameSnapshot = nullptr;
+
+    /* The cameras drawn in every frame by the multi-view mode, empty if only the current camera is drawn. */
+    std::vector<std::shared_ptr<S72Object::Camera>> viewCameras;
+
+    /* The number of views drawn in a frame, each view has its own image, uniform buffer and readback buffer per frame in flight. */
+    uint32_t viewCount = 1;
+
+    /* The view being culled or recorded. */
+    uint32_t viewIndex = 0;
+
     /* Set if we are doing the off-screen rendering. */
     bool useHeadlessRendering = false;
 
@@ -271,9 +353,77 @@ private:
     /* The current rendered image into headless list. */
     uint32_t headlessImageIndex = 0;
 
+    /* The host visible buffers a saved frame is copied to, one per frame in flight. */
+    std::vector<VkBuffer> readbackBuffers;
+    std::vector<VkDeviceMemory> readbackBuffersMemory;
+    std::vector<void*> readbackBuffersMapped;
+
+    /* The file each frame in flight is saved to, empty if the frame is not saved. */
+    std::vector<std::string> readbackFileNames;
+
+    /* The file the next drawn frame is saved to, empty if it is not saved. */
+    std::string nextSaveFileName;
+
+    /* Write the read back frames on a background thread. */
+    std::unique_ptr<FrameWriter> frameWriter = nullptr;
+
+    /* Collect the stage timings of the performance test, nullptr if nothing is measured. */
+    std::shared_ptr<FrameStats> frameStats = nullptr;
+
+    /* One timestamp query pool per frame in flight, only created when the frame stats are collected. */
+    std::vector<VkQueryPool> timestampQueryPools;
+
+    /* The label of each begin/end timestamp pair written in a frame, one list per frame in flight. */
+    std::vector<std::vector<std::string>> timestampLabels;
+
+    /* The number of nanoseconds per timestamp tick. */
+    float timestampPeriod = 1;
+
+    /* The max number of timestamps written in a frame. */
+    const uint32_t maxTimestampQueries = 64;
+
+    /* One pipeline statistics query pool per frame in flight, counting the fragment shader invocations of the main passes. */
+    std::vector<VkQueryPool> statisticsQueryPools;
+
+    /* The CPU time spent uploading the instance buffers in the current frame, in milliseconds. */
+    double instanceUploadTime = 0;
+
+    /* Record the CPU and GPU zones and the frame counters as a trace, nullptr if nothing is traced. */
+    std::shared_ptr<TraceRecorder> traceRecorder = nullptr;
+
+    /* The trace time each frame in flight is submitted at, in microseconds. Its GPU zones are placed from it. */
+    std::vector<double> submitTimes;
+
+    /**
+     * @brief The work counted while recording a frame.
+     */
+    struct FrameCounters{
+        uint32_t draws = 0;
+        uint32_t pipelineBinds = 0;
+        /* The bytes copied into the instance and uniform buffers. */
+        uint64_t bytesUploaded = 0;
+        uint32_t visibleInstances = 0;
+        uint32_t instances = 0;
+        /* The mesh instance uploads skipped because an earlier view culled the same instances. */
+        uint32_t sharedUploads = 0;
+    };
+
+    /* The counters of the last recorded frame. */
+    FrameCounters frameCounters;
+
     /* Refers to the instance of VkShadowMaps */
     std::shared_ptr<VkShadowMaps> shadowMaps = nullptr;
 
+    /* Set if we lay down the depth with a position-only pass before shading. */
+    bool useDepthPrepass = false;
+
+    /* The position-only pipeline used by the depth pre-pass. */
+    VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+    VkPipelineLayout depthPrepassPipelineLayout = VK_NULL_HANDLE;
+
+    /* Push constant range for the camera VP matrices used in the depth pre-pass. */
+    std::vector<VkPushConstantRange> depthPrepassPushConstant;
+
 
     /* A struct of queue that will be submitted to Vulkan */
     struct QueueFamilyIndices {
@@ -398,7 +548,7 @@ private:
     static std::array<VkVertexInputBindingDescription2EXT,2> CreateBindingDescription(const S72Object::Mesh& newMesh);
 
     /* Form an attribute description struct based on the info of a mesh instance. */
-    static std::array<VkVertexInputAttributeDescription2EXT, 9> CreateAttributeDescription(const S72Object::Mesh& newMesh);
+    static std::array<VkVertexInputAttributeDescription2EXT, 10> CreateAttributeDescription(const S72Object::Mesh& newMesh);
 
     /* Create the index buffer to store the index relations. */
     void CreateIndexBuffer(const S72Object::Mesh& newMesh, VkMesh& vkMesh);
@@ -406,8 +556,17 @@ private:
     /* Create a single dynamic instance buffer for a mesh. */
     void CreateInstanceBuffer(VkMesh& vkMesh);
 
-    /* Update an instance buffer with the new instance data. */
-    void UpdateInstanceBuffer(const S72Object::Mesh& newMesh);
+    /* Update a region of an instance buffer with the new instance data. */
+    void UpdateInstanceBuffer(const S72Object::Mesh& newMesh, const std::vector<S72Object::MeshInstance>& instances, uint32_t region);
+
+    /* Get the byte offset of an instance buffer region. */
+    [[nodiscard]] VkDeviceSize GetInstanceRegionOffset(uint32_t region) const;
+
+    /* Upload the current view's visible instances, or share the region of an earlier view with the same instances. */
+    void UploadViewInstances();
+
+    /* Upload the unculled instances for the shadow passes, or share the region of a view that kept all of them. */
+    void UploadShadowCasterInstances();
 
     /* Create the uniform buffer to store the general uniform data. */
     void CreateUniformBuffers();
@@ -433,6 +592,24 @@ private:
     /* Render the shadow passes. */
     void RenderShadowPass(VkCommandBuffer commandBuffer);
 
+    /* Create the position-only pipeline for the depth pre-pass. */
+    void CreateDepthPrepassPipeline();
+
+    /* Cull the instances against the camera and sort them front-to-back. */
+    void UpdateVisibleInstances();
+
+    /* Get the camera the frame is drawn from. */
+    const std::shared_ptr<S72Object::Camera>& GetDrawCamera();
+
+    /* Get the lights the frame is drawn with. */
+    const std::vector<std::shared_ptr<S72Object::Light>>& GetDrawLights();
+
+    /* Render the depth of every visible instance before the shading pipelines run. */
+    void RenderDepthPrepass(VkCommandBuffer commandBuffer);
+
+    /* Record the main render pass of the current view into its own image. */
+    void RecordViewPass(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
     /* Writes the commands we want to execute into a command buffer. */
     void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
@@ -440,19 +617,43 @@ private:
     void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 
     /* Copy a VkBuffer which contains a cube map to a VkImage. */
-    void CopyBufferToImageCube(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height,uint32_t nChannel);
+    void CopyBufferToImageCube(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height,uint32_t texelSize);
 
     /* Transit the image's layout with a new layout using a pipeline barrier. */
     void TransitionImageLayout(VkImage image,uint32_t layerCount, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t newMipLevels, VkImageAspectFlags aspectFlags);
 
     /* Convert a RGBE Image to a float RGB Image. */
-    static void ProcessRGBEImage(const unsigned char* src, float*& dst, int texWidth, int texHeight);
+    static void ProcessRGBEImage(const unsigned char* src, float* dst, size_t numPixel);
+
+    /* Convert a float image to a half float image. */
+    static void ConvertToHalf(const float* src, uint16_t* dst, size_t count);
+
+    /* Read a RGBE cube map file to a float RGBA image. */
+    static void ReadRGBECube(const std::string& filename, std::vector<float>& dst, int& faceSize);
 
     /* Create the VkImage and the VkImageView for a cube map. */
     void CreateCubeTextureImageAndView(const std::string& filename, VkImage& image, VkDeviceMemory& imageMemory, VkImageView& imageView);
 
-    /* Create the VkImage and the VkImageView for pre-compute BRDF LUT. */
-    void CreateBRDFImageAndView(const std::string& filename);
+    /* Create the VkImage and the VkImageView from a half float cube file, false if there is no such file. */
+    bool CreateCubeFileImageAndView(const std::string& filename, uint32_t mipChainLimit, VkImage& image, VkDeviceMemory& imageMemory, VkImageView& imageView);
+
+    /* Create the VkImage and the VkImageView for the GGX cube maps packed into one mip chain. */
+    void CreateGGXImageAndView();
+
+    /* Read the half float BRDF LUT from a .xzlut file, false if there is no such file. */
+    bool ReadBRDFFile(const std::string& filename, std::vector<uint16_t>& texels, uint32_t& texWidth, uint32_t& texHeight);
+
+    /* Read the BRDF LUT from an older 8-bit png and convert it to the layout of the .xzlut file. */
+    void ReadBRDFPNG(const std::string& filename, std::vector<uint16_t>& texels, uint32_t& texWidth, uint32_t& texHeight);
+
+    /* Create the VkImage and the VkImageView for pre-compute BRDF LUT, from the .xzlut file or the older png. */
+    void CreateBRDFImageAndView();
+
+    /* Read the SH coefficients of the irradiance, fail if the file is missing. */
+    bool ReadSHCoefficients(const std::string& filename);
+
+    /* Check the Cubes manifest of the environment and regenerate the outputs made from an older source. */
+    void CheckEnvironmentManifest();
 
     /* Create the three environment cube maps. */
     void CreateEnvironments();
@@ -466,9 +667,18 @@ private:
     /* Create the image view to access and present the texture image. */
     void CreateTextureImageView(const VkImage& textureImage, VkImageView& textureImageView, int nChannels, uint32_t mipLevels);
 
-    /* Given A S72 Material, Create its VkImage and VkImageView. */
+    /* Create the texture image with a block compressed texture and its precomputed mip chain. */
+    void CreateCompressedTextureImage(const std::string& src, int texWidth, int texHeight, VkFormat format, uint32_t mipLevels, VkImage& textureImage, VkDeviceMemory& textureImageMemory);
+
+    /* Create a material texture's image and view, either raw or block compressed, or reuse a cached one. Return its bindless index. */
+    uint32_t CreateMaterialTexture(const std::string& key, const std::string& src, int texWidth, int texHeight, int nChannels, uint32_t mipLevels, VkFormat format, VkImage& textureImage, VkDeviceMemory& textureImageMemory, VkImageView& textureImageView);
+
+    /* Given A S72 Material, Create its VkImage and VkImageView, and its entry in the material buffer. */
     void CreateMaterialImageView(const std::shared_ptr<S72Object::Material>& newMat);
 
+    /* Create the bindless descriptor set with all the material textures and the material buffer. */
+    void CreateMaterialDescriptorSet();
+
     /* Create the texture sampler to access the texture. */
     void CreateTextureSampler();
 
@@ -487,11 +697,38 @@ private:
     /* Create the depth image and the image view. */
     void CreateDepthResources();
 
-    /* Copy a VkImage to a mapped array through a staging buffer. */
-    void CopyImageToData(const VkImage& image, const VkDeviceMemory& imageMemory, void*& data, uint32_t imageWidth, uint32_t imageHeight);
+    /* Create the persistent buffers the saved frames are read back to, one per frame in flight. */
+    void CreateReadbackBuffers();
+
+    /* Record the copy of the rendered image to the frame's readback buffer. */
+    void RecordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+    /* Hand the read back data of a finished frame to the frame writer. */
+    void CollectReadback(uint32_t frameIndex);
+
+    /* Get the file a view of a saved frame is written to. */
+    [[nodiscard]] std::string GetViewFileName(const std::string& fileName, uint32_t view) const;
+
+    /* Create the timestamp query pools used to time the GPU stages. */
+    void CreateTimestampQueryPools();
+
+    /* Write the timestamp starting a GPU zone, return the zone index. */
+    uint32_t BeginGPUZone(VkCommandBuffer commandBuffer, const std::string& label);
+
+    /* Write the timestamp ending a GPU zone. */
+    void EndGPUZone(VkCommandBuffer commandBuffer, uint32_t zone);
+
+    /* Read the timestamps of a finished frame into the frame stats and the trace. */
+    void CollectTimestamps(uint32_t frameIndex);
+
+    /* Create the pipeline statistics query pools used to count the fragment shader invocations. */
+    void CreateStatisticsQueryPools();
 
-    /* Same a VKImage to a PPM file with a given name. */
-    void SaveImageToPPM(const VkImage& image, const VkDeviceMemory& imageMemory, const std::string&, uint32_t imageWidth, uint32_t imageHeight);
+    /* Read the fragment shader invocations of a finished frame into the frame stats. */
+    void CollectStatistics(uint32_t frameIndex);
+
+    /* Write the counters of the recorded frame to the trace. */
+    void RecordFrameCounters();
 
     /* Clean up the swap chain and all the related resources. */
     void CleanUpSwapChain();
@@ -520,6 +757,12 @@ private:
     /* Draw the frame and submit the command buffer. */
     void DrawFrame();
 
+    /* Capture the scene state the next frame is drawn from. */
+    void CaptureSnapshot(FrameSnapshot& snapshot);
+
+    /* Draw a frame from a captured scene state. */
+    void DrawSnapshot(const std::shared_ptr<FrameSnapshot>& snapshot);
+
     /* CleanUp used for destroy the instance and related destruction. */
     void CleanUp();
 
@@ -549,8 +792,26 @@ public:
     /* Set if we use the off-screen rendering. */
     void SetHeadlessMode(bool);
 
-    /* Save the rendered image to a ppm file. Only work if it's the off-screen rendering. */
-    void SaveRenderResult(const std::string& filename);
+    /* Set the cameras drawn in every frame, "all" or a comma separated list. Need to be called after SetHeadlessMode and before the initialization. */
+    void SetMultiView(const std::string& cameraList);
+
+    /* Set if we render a depth pre-pass before the shading pipelines. */
+    void SetDepthPrepass(bool);
+
+    /* Set the path of the Cubes tool used to regenerate the stale environment outputs. */
+    void SetIBLTool(const std::string& path);
+
+    /* Set where the stage timings are collected. Need to be called before the initialization. */
+    void SetFrameStats(const std::shared_ptr<FrameStats>& stats);
+
+    /* Set where the CPU and GPU zones and the frame counters are traced. Need to be called before the initialization. */
+    void SetTraceRecorder(const std::shared_ptr<TraceRecorder>& recorder);
+
+    /* Wait for all the frames in flight and collect their timings. */
+    void FinishFrames();
+
+    /* Save the next drawn image to a file (PPM, PNG or PFM by its extension). Only work if it's the off-screen rendering. */
+    void SaveNextFrame(const std::string& filename);
 
     /* Run the Vulkan application using the WSI. */
     void RunWIN(HINSTANCE new_Instance, HWND new_hwnd);
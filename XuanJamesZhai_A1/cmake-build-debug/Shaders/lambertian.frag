@@ -9,6 +9,7 @@ layout(location = 2) in vec2 fragTexCoord;
 layout(location = 3) in vec3 fragPosition;
 layout(location = 4) in mat3 TBN;
 layout(location = 7) in vec4 fragPositionLightSpace[MAX_LIGHT_COUNT];
+layout(location = 17) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
@@ -16,6 +17,9 @@ layout(set = 0, binding = 0) uniform UniformBufferObject{
     mat4 view;
     mat4 proj;
     vec3 viewPos;
+    /* 1 if the irradiance comes from the SH coefficients. */
+    uint useSH;
+    vec4 sh[9];
 } ubo;
 
 /* Struct of a single light source. */
@@ -46,9 +50,20 @@ layout(std140, set = 0, binding = 1) uniform UniformLightsObject {
 /* A list of shadow maps, one for each light source. */
 layout(set = 0, binding = 2) uniform sampler2D depthMap[];
 
-layout(set = 1, binding = 0) uniform sampler2D normalSampler;
-layout(set = 1, binding = 1) uniform sampler2D heightSampler;
-layout(set = 1, binding = 2) uniform sampler2D albedoSampler;
+/* The texture indices of a material in the bindless texture array. */
+struct MaterialParameters {
+    uint normal;
+    uint height;
+    uint albedo;
+    uint roughness;
+    uint metallic;
+};
+
+/* All the material textures and parameters, indexed by the material of the instance. */
+layout(set = 1, binding = 0) uniform sampler2D materialTextures[];
+layout(std430, set = 1, binding = 1) readonly buffer MaterialBuffer {
+    MaterialParameters materials[];
+};
 layout(set = 2, binding = 0) uniform samplerCube cubeSampler;
 
 
@@ -81,19 +96,19 @@ vec2 ParallaxOcclusionMapping(vec2 texCoords, vec3 viewDir){
     vec2 P = viewDir.xy * 0.1;
     vec2 deltaTexCoords = P / numLayers;
     vec2  currentTexCoords     = texCoords;
-    float currentDepthMapValue = texture(heightSampler, currentTexCoords).r;
+    float currentDepthMapValue = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], currentTexCoords).r;
 
     /* Keep iterating the layers. */
     while(currentLayerDepth < currentDepthMapValue) {
         currentTexCoords -= deltaTexCoords;
-        currentDepthMapValue = texture(heightSampler, currentTexCoords).r;
+        currentDepthMapValue = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], currentTexCoords).r;
         currentLayerDepth += layerDepth;
     }
 
     /* Interpolate with the previous layer. */
     vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
     float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(heightSampler, prevTexCoords).r - currentLayerDepth + layerDepth;
+    float beforeDepth = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], prevTexCoords).r - currentLayerDepth + layerDepth;
 
     float weight = afterDepth / (afterDepth - beforeDepth);
     vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
@@ -108,13 +123,29 @@ vec3 SchlickFresnel(float WoH, vec3 F0) {
 }
 
 
+/* Reference: https://graphics.stanford.edu/papers/envmap/envmap.pdf */
+/* Evaluate the irradiance from the 9 SH coefficients, already convolved with the cosine lobe and divided by pi. */
+vec3 EvaluateSH(vec3 n){
+    vec3 result = ubo.sh[0].xyz * 0.282095
+                + ubo.sh[1].xyz * 0.488603 * n.y
+                + ubo.sh[2].xyz * 0.488603 * n.z
+                + ubo.sh[3].xyz * 0.488603 * n.x
+                + ubo.sh[4].xyz * 1.092548 * n.x * n.y
+                + ubo.sh[5].xyz * 1.092548 * n.y * n.z
+                + ubo.sh[6].xyz * 0.315392 * (3.0 * n.z * n.z - 1.0)
+                + ubo.sh[7].xyz * 1.092548 * n.x * n.z
+                + ubo.sh[8].xyz * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(result, vec3(0.0));
+}
+
+
 /* Reference: https://learnopengl.com/PBR/IBL/Diffuse-irradiance. */
 vec3 GetEnvironmentLight(vec3 viewDir, vec3 normal, vec3 albedo){
     vec3 F0 = vec3(0.04);
     vec3 kS = SchlickFresnel(max(dot(normal, normalize(-viewDir)), 0.0),F0);
     vec3 kD = 1.0 - kS;
 
-    vec3 irradiance = texture(cubeSampler, normal).xyz;
+    vec3 irradiance = ubo.useSH == 1 ? EvaluateSH(normal) : texture(cubeSampler, normal).xyz;
 
     return toneMapACES(irradiance * albedo * kD,1.0);
 }
@@ -282,11 +313,11 @@ void main() {
     texCoord.y = 1-texCoord.y;
     texCoord = ParallaxOcclusionMapping(texCoord,normalize(transpose(TBN) * viewDir));
 
-    vec3 normal = texture(normalSampler, texCoord).rgb;
+    vec3 normal = texture(materialTextures[nonuniformEXT(materials[fragMaterial].normal)], texCoord).rgb;
     normal = normal * 2.0 - 1.0;
     normal = normalize(TBN * normal);
 
-    vec3 albedo = texture(albedoSampler, texCoord).xyz * fragColor.xyz;
+    vec3 albedo = texture(materialTextures[nonuniformEXT(materials[fragMaterial].albedo)], texCoord).xyz * fragColor.xyz;
 
     vec3 color = vec3(0);
     color += GetEnvironmentLight(viewDir, normal, albedo);
@@ -6,6 +6,7 @@ layout(location = 1) in vec3 fragNormal;
 layout(location = 2) in vec2 fragTexCoord;
 layout(location = 3) in vec3 fragPosition;
 layout(location = 4) in mat3 TBN;
+layout(location = 7) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
@@ -16,8 +17,20 @@ layout(set = 0, binding = 0) uniform UniformBufferObject{
     vec3 viewPos;
 } ubo;
 
-layout(set = 1, binding = 0) uniform sampler2D normalSampler;
-layout(set = 1, binding = 1) uniform sampler2D heightSampler;
+/* The texture indices of a material in the bindless texture array. */
+struct MaterialParameters {
+    uint normal;
+    uint height;
+    uint albedo;
+    uint roughness;
+    uint metallic;
+};
+
+/* All the material textures and parameters, indexed by the material of the instance. */
+layout(set = 1, binding = 0) uniform sampler2D materialTextures[];
+layout(std430, set = 1, binding = 1) readonly buffer MaterialBuffer {
+    MaterialParameters materials[];
+};
 layout (set = 2, binding = 0) uniform samplerCube cubeMapTexture;
 
 vec3 toneMapReinhard(vec3 color, float exposure) {
@@ -49,19 +62,19 @@ vec2 ParallaxOcclusionMapping(vec2 texCoords, vec3 viewDir){
     vec2 P = viewDir.xy * 0.1;
     vec2 deltaTexCoords = P / numLayers;
     vec2  currentTexCoords     = texCoords;
-    float currentDepthMapValue = texture(heightSampler, currentTexCoords).r;
+    float currentDepthMapValue = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], currentTexCoords).r;
 
     /* Keep iterating the layers. */
     while(currentLayerDepth < currentDepthMapValue) {
         currentTexCoords -= deltaTexCoords;
-        currentDepthMapValue = texture(heightSampler, currentTexCoords).r;
+        currentDepthMapValue = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], currentTexCoords).r;
         currentLayerDepth += layerDepth;
     }
 
     /* Interpolate with the previous layer. */
     vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
     float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(heightSampler, prevTexCoords).r - currentLayerDepth + layerDepth;
+    float beforeDepth = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], prevTexCoords).r - currentLayerDepth + layerDepth;
 
     float weight = afterDepth / (afterDepth - beforeDepth);
     vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
@@ -76,7 +89,7 @@ void main() {
     texCoord.y = 1-texCoord.y;
     texCoord = ParallaxOcclusionMapping(texCoord,normalize(transpose(TBN) * viewDir));
 
-    vec3 normal = texture(normalSampler, texCoord).rgb;
+    vec3 normal = texture(materialTextures[nonuniformEXT(materials[fragMaterial].normal)], texCoord).rgb;
     normal = normal * 2.0 - 1.0;
     normal = normalize(TBN*normal);
 
@@ -9,6 +9,7 @@ layout(location = 2) in vec2 fragTexCoord;
 layout(location = 3) in vec3 fragPosition;
 layout(location = 4) in mat3 TBN;
 layout(location = 7) in vec4 fragPositionLightSpace[MAX_LIGHT_COUNT];
+layout(location = 17) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
@@ -17,6 +18,9 @@ layout(set = 0, binding = 0) uniform UniformBufferObject{
     mat4 view;
     mat4 proj;
     vec3 viewPos;
+    /* 1 if the irradiance comes from the SH coefficients. */
+    uint useSH;
+    vec4 sh[9];
 } ubo;
 
 struct UniformLightObject {
@@ -44,14 +48,23 @@ layout(std140, set = 0, binding = 1) uniform UniformLightsObject {
 } lightObjects;
 layout(set = 0, binding = 2) uniform sampler2D depthMap[];
 
-layout(set = 1, binding = 0) uniform sampler2D normalSampler;
-layout(set = 1, binding = 1) uniform sampler2D heightSampler;
-layout(set = 1, binding = 2) uniform sampler2D albedoSampler;
-layout(set = 1, binding = 3) uniform sampler2D roughnessSampler;
-layout(set = 1, binding = 4) uniform sampler2D metallicSampler;
+/* The texture indices of a material in the bindless texture array. */
+struct MaterialParameters {
+    uint normal;
+    uint height;
+    uint albedo;
+    uint roughness;
+    uint metallic;
+};
+
+/* All the material textures and parameters, indexed by the material of the instance. */
+layout(set = 1, binding = 0) uniform sampler2D materialTextures[];
+layout(std430, set = 1, binding = 1) readonly buffer MaterialBuffer {
+    MaterialParameters materials[];
+};
 layout(set = 2, binding = 0) uniform samplerCube LamcubeSampler;
 layout(set = 2, binding = 1) uniform sampler2D brdfSampler;
-layout(set = 2, binding = 2) uniform samplerCube cubeSampler[MAX_LIGHT_COUNT];
+layout(set = 2, binding = 2) uniform samplerCube ggxSampler;
 
 /* Reference: https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/ */
 vec3 toneMapACES(vec3 color, float exposure){
@@ -74,19 +87,21 @@ vec3 SchlickFresnel(float WoH, vec3 F0, float roughness) {
 
 /* Reference: https://learnopengl.com/PBR/IBL/Specular-IBL */
 /* Texture sample the Environment LUT. */
+/* The mip level i holds the roughness i / levels, so the neighbour levels are blended by the trilinear filter. */
+/* A small environment has fewer levels, the roughness is spread over the levels it has. */
 vec3 GetEnv(float roughness, vec3 R){
-    int lod = int(roughness*10);
-    if(lod > 9) lod = 9;
-    if(lod < 0) lod = 0;
+    float levels = float(textureQueryLevels(ggxSampler));
+    float lod = clamp(roughness * levels, 0.0, levels - 1.0);
 
-    return toneMapACES(texture(cubeSampler[lod], R).rgb,1.0);
+    return toneMapACES(textureLod(ggxSampler, R, lod).rgb,1.0);
 }
 
 
-/* Texture sample the BRDF LUT. */
+/* Texture sample the BRDF LUT, NoV on x and roughness on y. */
 vec2 GetBRDF(float roughness, float NoV){
-    /* The LUT Generated by the utility is up side down. */
-    vec2 tex = vec2(1-roughness, NoV);
+    /* Stay between the first and the last texel centers, the sampler repeats. */
+    vec2 halfTexel = 0.5 / vec2(textureSize(brdfSampler, 0));
+    vec2 tex = clamp(vec2(NoV, roughness), halfTexel, 1.0 - halfTexel);
     return texture(brdfSampler, tex).rg;
 }
 
@@ -103,19 +118,19 @@ vec2 ParallaxOcclusionMapping(vec2 texCoords, vec3 viewDir){
     vec2 P = viewDir.xy * 0.1;
     vec2 deltaTexCoords = P / numLayers;
     vec2  currentTexCoords     = texCoords;
-    float currentDepthMapValue = texture(heightSampler, currentTexCoords).r;
+    float currentDepthMapValue = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], currentTexCoords).r;
 
     /* Keep iterating the layers. */
     while(currentLayerDepth < currentDepthMapValue) {
         currentTexCoords -= deltaTexCoords;
-        currentDepthMapValue = texture(heightSampler, currentTexCoords).r;
+        currentDepthMapValue = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], currentTexCoords).r;
         currentLayerDepth += layerDepth;
     }
 
     /* Interpolate with the previous layer. */
     vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
     float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(heightSampler, prevTexCoords).r - currentLayerDepth + layerDepth;
+    float beforeDepth = texture(materialTextures[nonuniformEXT(materials[fragMaterial].height)], prevTexCoords).r - currentLayerDepth + layerDepth;
 
     float weight = afterDepth / (afterDepth - beforeDepth);
     vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
@@ -168,6 +183,22 @@ float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
 }
 
 
+/* Reference: https://graphics.stanford.edu/papers/envmap/envmap.pdf */
+/* Evaluate the irradiance from the 9 SH coefficients, already convolved with the cosine lobe and divided by pi. */
+vec3 EvaluateSH(vec3 n){
+    vec3 result = ubo.sh[0].xyz * 0.282095
+                + ubo.sh[1].xyz * 0.488603 * n.y
+                + ubo.sh[2].xyz * 0.488603 * n.z
+                + ubo.sh[3].xyz * 0.488603 * n.x
+                + ubo.sh[4].xyz * 1.092548 * n.x * n.y
+                + ubo.sh[5].xyz * 1.092548 * n.y * n.z
+                + ubo.sh[6].xyz * 0.315392 * (3.0 * n.z * n.z - 1.0)
+                + ubo.sh[7].xyz * 1.092548 * n.x * n.z
+                + ubo.sh[8].xyz * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(result, vec3(0.0));
+}
+
+
 /* Reference: https://learnopengl.com/PBR/IBL/Specular-IBL */
 /* Compute the environment light. */
 vec3 GetEnvironmentLight(vec3 normal, vec3 view, vec3 R, vec3 albedo, float roughness, float metallic, vec3 F0){
@@ -185,7 +216,7 @@ vec3 GetEnvironmentLight(vec3 normal, vec3 view, vec3 R, vec3 albedo, float roug
     vec3 EnvColor = GetEnv( roughness, R );
     vec2 EnvBRDF = GetBRDF( roughness, NoV );
 
-    vec3 irradiance = toneMapACES(texture(LamcubeSampler, normal).rgb,1.0);
+    vec3 irradiance = toneMapACES(ubo.useSH == 1 ? EvaluateSH(normal) : texture(LamcubeSampler, normal).rgb,1.0);
     vec3 diffuse  = irradiance * albedo;
 
     vec3 specular = EnvColor * ( F * EnvBRDF.x + EnvBRDF.y );
@@ -391,15 +422,15 @@ void main() {
     texCoord.y = 1-texCoord.y;
     texCoord = ParallaxOcclusionMapping(texCoord, normalize(transpose(TBN) * viewDir));
 
-    vec3 normal = texture(normalSampler, texCoord).rgb;
+    vec3 normal = texture(materialTextures[nonuniformEXT(materials[fragMaterial].normal)], texCoord).rgb;
     normal = normal * 2.0 - 1.0;
     normal = normalize(TBN * normal);
     vec3 view = normalize(ubo.viewPos-fragPosition);
     vec3 R = reflect(-view, normal);
 
-    vec3 albedo = texture(albedoSampler, texCoord).xyz * fragColor.xyz;
-    float roughness = texture(roughnessSampler, texCoord).r;
-    float metallic = texture(metallicSampler, texCoord).r;
+    vec3 albedo = texture(materialTextures[nonuniformEXT(materials[fragMaterial].albedo)], texCoord).xyz * fragColor.xyz;
+    float roughness = texture(materialTextures[nonuniformEXT(materials[fragMaterial].roughness)], texCoord).r;
+    float metallic = texture(materialTextures[nonuniformEXT(materials[fragMaterial].metallic)], texCoord).r;
     vec3 F0 = vec3(0.04);
     F0 = mix(F0, albedo, metallic);
 
@@ -38,6 +38,7 @@ layout(location = 2) in vec4 inTangent;
 layout(location = 3) in vec2 inTexCoord;
 layout(location = 4) in vec4 inColor;
 layout(location = 5) in mat4 inModel;
+layout(location = 9) in uint inMaterial;
 
 layout(location = 0) out vec4 fragColor;
 layout(location = 1) out vec3 fragNormal;
@@ -45,12 +46,16 @@ layout(location = 2) out vec2 fragTexCoord;
 layout(location = 3) out vec3 fragPosition;
 layout(location = 4) out mat3 TBN;
 layout(location = 7) out vec4 fragPositionLightSpace[MAX_LIGHT_COUNT];
+layout(location = 17) flat out uint fragMaterial;
+
+invariant gl_Position;
 
 void main() {
 
     gl_Position = ubo.proj * ubo.view * inModel * vec4(inPosition, 1.0);
 
     fragColor = inColor;
+    fragMaterial = inMaterial;
     fragNormal = (transpose(inverse(inModel)) * vec4(inNormal,1.0)).xyz;
     fragTexCoord = inTexCoord;
 
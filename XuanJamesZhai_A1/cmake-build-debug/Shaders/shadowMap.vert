@@ -12,6 +12,10 @@ layout(location = 3) in vec2 inTexCoord;
 layout(location = 4) in vec4 inColor;
 layout(location = 5) in mat4 inModel;
 
+// The depth pre-pass draws with this shader and the shading pipelines test EQUAL against its depth,
+// so every vertex shader keeps gl_Position invariant to get bit-identical depth for the same expression.
+invariant gl_Position;
+
 void main() {
     gl_Position = pushConstants.proj * pushConstants.view * inModel * vec4(inPosition, 1.0);
     //gl_Position = vec4(0,0,fract(sin(dot(inPosition.xy ,vec2(12.9898,78.233))) * 43758.5453), 1.0);
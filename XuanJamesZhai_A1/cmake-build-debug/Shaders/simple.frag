@@ -13,8 +13,6 @@ layout(set = 0, binding = 0) uniform UniformBufferObject{
     mat4 proj;
     vec3 viewPos;
 } ubo;
-layout(set = 1, binding = 0) uniform sampler2D normalSampler;
-layout(set = 1, binding = 1) uniform sampler2D heightSampler;
 
 
 void main() {
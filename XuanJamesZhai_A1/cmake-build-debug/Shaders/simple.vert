@@ -18,6 +18,8 @@ layout(location = 1) out vec3 fragNormal;
 layout(location = 2) out vec2 fragTexCoord;
 layout(location = 3) out vec3 fragPosition;
 
+invariant gl_Position;
+
 void main() {
 
     gl_Position = ubo.proj * ubo.view * inModel * vec4(inPosition, 1.0);
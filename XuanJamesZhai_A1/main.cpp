@@ -28,6 +28,36 @@ static std::string eventFileName;
 /* The number of iterations when doing the performance test. */
 static size_t performanceTestCount = 0;
 
+/* The JSON and CSV files the performance test results are written to. */
+static std::string statsJSONFileName;
+static std::string statsCSVFileName;
+
+/* The Chrome trace file and the per-frame counter file, the run is traced if either is set. */
+static std::string traceFileName;
+static std::string counterFileName;
+
+/* The number of frames the simulation can run ahead of the render thread, 0 draws the frames on the window thread. */
+static size_t frameQueueDepth = 0;
+
+/* The cameras drawn in every frame of the off-screen rendering, "all" or a comma separated list. */
+static std::string multiViewCameras;
+
+/* Set if we render a depth pre-pass before the shading pipelines. */
+static bool useDepthPrepass = false;
+
+/* Set if the material textures are loaded as cached block compressed textures. */
+static bool useCompressedTexture = false;
+
+/* The path of the Cubes tool, used to regenerate the stale environment outputs. */
+static std::string iblToolPath;
+
+/* Set if the headless events are replayed on a virtual clock instead of the system clock. */
+static bool useVirtualClock = false;
+
+/* The text event file to convert into the binary format, and the binary file name. */
+static std::string convertEventSrc;
+static std::string convertEventDst;
+
 /* A dynamic allocated instance of the VKHelper. */
 static std::shared_ptr<RenderHelper> renderHelper = std::make_shared<RenderHelper>();
 
@@ -58,6 +88,40 @@ void ReadCMDArguments(int argc, char** argv){
         else if(strcmp(argv[i],"--performance-test") == 0){
             performanceTestCount = strtoul(argv[i+1],nullptr,0);
         }
+        else if(strcmp(argv[i],"--stats-json") == 0){
+            statsJSONFileName = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--stats-csv") == 0){
+            statsCSVFileName = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--trace") == 0){
+            traceFileName = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--counters") == 0){
+            counterFileName = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--frame-queue") == 0){
+            frameQueueDepth = strtoul(argv[i+1],nullptr,0);
+        }
+        else if(strcmp(argv[i],"--multi-view") == 0){
+            multiViewCameras = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--depth-prepass") == 0){
+            useDepthPrepass = true;
+        }
+        else if(strcmp(argv[i],"--compress-textures") == 0){
+            useCompressedTexture = true;
+        }
+        else if(strcmp(argv[i],"--ibl-tool") == 0){
+            iblToolPath = argv[i+1];
+        }
+        else if(strcmp(argv[i],"--virtual-clock") == 0){
+            useVirtualClock = true;
+        }
+        else if(strcmp(argv[i],"--convert-events") == 0){
+            convertEventSrc = argv[i+1];
+            convertEventDst = argv[i+2];
+        }
     }
 }
 
@@ -66,13 +130,26 @@ int main(int argc, char** argv) {
 
     ReadCMDArguments(argc,argv);
 
+    /* Only convert the event file, no rendering. */
+    if(!convertEventSrc.empty()){
+        EventHelper::ConvertToBinary(convertEventSrc, convertEventDst);
+        return EXIT_SUCCESS;
+    }
+
     //try
     //{
+        renderHelper->SetTextureCompression(useCompressedTexture);
+        renderHelper->SetIBLTool(iblToolPath);
         renderHelper->ReadS72(sceneName);
         renderHelper->AttachS72ToVulkan();
         renderHelper->SetEventFile(eventFileName);
+        renderHelper->SetVirtualClock(useVirtualClock);
         renderHelper->SetPerformanceTest(performanceTestCount);
-        renderHelper->SetVulkanData(windowWidth,windowHeight,deviceName,cameraName,cullingMode);
+        renderHelper->SetStatsOutput(statsJSONFileName, statsCSVFileName);
+        renderHelper->SetTraceOutput(traceFileName, counterFileName);
+        renderHelper->SetFrameQueueDepth(frameQueueDepth);
+        renderHelper->SetMultiView(multiViewCameras);
+        renderHelper->SetVulkanData(windowWidth,windowHeight,deviceName,cameraName,cullingMode,useDepthPrepass);
         renderHelper->InitVulkan();
         renderHelper->RunVulkan();
         renderHelper->ClearVulkan();